@@ -28,7 +28,7 @@ inline cv::Algorithm*
 ALGORITHM(VALUE object)
 {
   cv::Algorithm *ptr;
-  Data_Get_Struct(object, cv::Algorithm, ptr);
+  ptr = (cv::Algorithm*)OPENCV_DATA_PTR(object);
   return ptr;
 }
 
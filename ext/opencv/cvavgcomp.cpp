@@ -24,11 +24,13 @@ rb_class()
   return rb_klass;
 }
 
+const rb_data_type_t data_type = OPENCV_STRUCT_TYPE("OpenCV::CvAvgComp", CvAvgComp, RUBY_TYPED_DEFAULT_FREE);
+
 VALUE
 rb_allocate(VALUE klass)
 {
   CvAvgComp *ptr;
-  return Data_Make_Struct(klass, CvAvgComp, 0, -1, ptr);
+  return TypedData_Make_Struct(klass, CvAvgComp, &data_type, ptr);
 }
 
 /*
@@ -29,7 +29,7 @@ __NAMESPACE_END_AVGCOMP
 
 inline CvAvgComp *CVAVGCOMP(VALUE object){
   CvAvgComp *ptr;
-  Data_Get_Struct(object, CvAvgComp, ptr);
+  ptr = (CvAvgComp*)OPENCV_DATA_PTR(object);
   return ptr;
 }
 
@@ -24,11 +24,13 @@ rb_class()
   return rb_klass;
 }
 
+const rb_data_type_t data_type = OPENCV_STRUCT_TYPE("OpenCV::CvBox2D", CvBox2D, RUBY_TYPED_DEFAULT_FREE);
+
 VALUE
 rb_allocate(VALUE klass)
 {
   CvBox2D *ptr;
-  return Data_Make_Struct(klass, CvBox2D, 0, -1, ptr);
+  return TypedData_Make_Struct(klass, CvBox2D, &data_type, ptr);
 }
 
 /*
@@ -41,7 +41,7 @@ __NAMESPACE_END_CVBOX2D
 inline CvBox2D*
 CVBOX2D(VALUE object){
   CvBox2D *ptr;
-  Data_Get_Struct(object, CvBox2D, ptr);
+  ptr = (CvBox2D*)OPENCV_DATA_PTR(object);
   return ptr;
 }
 
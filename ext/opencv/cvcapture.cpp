@@ -8,6 +8,11 @@
 
 ************************************************************/
 #include "cvcapture.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <sys/stat.h>
 /*
  * Document-class: OpenCV::CvCapture
  *
@@ -24,25 +29,471 @@ rb_class()
   return rb_klass;
 }
 
+/*
+ * Stops the threads of the capture and releases it. May wait for the threads.
+ */
+void
+release_capture(sCvCapture* scap)
+{
+  if (scap->prefetch) {
+    stop_prefetch(scap);
+    delete scap->prefetch;
+  }
+  if (scap->opened)
+    delete scap->ptr;
+  if (scap->flipped)
+    cvReleaseImage(&scap->flipped);
+  delete scap->index;
+  delete scap;
+}
+
+/*
+ * A capture with threads (the decoder thread of #prefetch or the workers of an image
+ * sequence) is not released in GC, where waiting for them would stall every Ruby thread.
+ * The threads are told to stop, and a detached thread waits for them and releases the capture.
+ * CvCapture#close stops them and waits instead.
+ */
 void
 cvcapture_free(void *ptr)
-{ 
-  if (ptr) {
-    sCvCapture* scap = (sCvCapture*)ptr;
-    if (scap->opened)
-      cvReleaseCapture(&scap->ptr);
-    delete scap;
+{
+  if (!ptr)
+    return;
+  sCvCapture* scap = (sCvCapture*)ptr;
+  bool threaded = scap->opened && scap->ptr->threaded();
+  if (scap->prefetch) {
+    std::lock_guard<std::mutex> lock(scap->prefetch->mutex);
+    if (scap->prefetch->thread.joinable()) {
+      scap->prefetch->active = false;
+      threaded = true;
+    }
+  }
+  if (threaded) {
+    if (scap->prefetch)
+      scap->prefetch->cond.notify_all();
+    try {
+      std::thread(release_capture, scap).detach();
+      return;
+    }
+    catch (std::system_error&) {
+      // release it here; the threads have been told to stop
+    }
+  }
+  release_capture(scap);
+}
+
+size_t
+cvcapture_memsize(const void *ptr)
+{
+  const sCvCapture* scap = (const sCvCapture*)ptr;
+  size_t size = sizeof(sCvCapture);
+  if (scap->index) {
+    size += sizeof(capture_index_t) + scap->index->msec.capacity() * sizeof(double) +
+      scap->index->keyframes.capacity() * sizeof(long);
+  }
+  if (scap->prefetch) {
+    capture_prefetch_t* prefetch = scap->prefetch;
+    std::lock_guard<std::mutex> lock(prefetch->mutex);
+    size += sizeof(capture_prefetch_t) + prefetch->ring.capacity() * sizeof(capture_frame_t);
+    for (size_t i = 0; i < prefetch->ring.size(); i++) {
+      if (prefetch->ring[i].image)
+	size += prefetch->ring[i].image->imageSize;
+    }
+  }
+  return size;
+}
+
+const rb_data_type_t data_type = {
+  "OpenCV::CvCapture",
+  { 0, cvcapture_free, cvcapture_memsize, },
+  &opencv_data_type, 0, RUBY_TYPED_FREE_IMMEDIATELY | RUBY_TYPED_WB_PROTECTED
+};
+
+sCvCapture*
+capture_struct(VALUE self)
+{
+  sCvCapture *scap;
+  TypedData_Get_Struct(self, sCvCapture, &data_type, scap);
+  if (!scap->opened)
+    rb_raise(rb_eIOError, "Resource is not available!");
+  return scap;
+}
+
+bool
+prefetching(sCvCapture* scap)
+{
+  return scap->prefetch != NULL && scap->prefetch->active;
+}
+
+/*
+ * Calls func(capture) without the GVL, serialized with the other calls for the capture
+ * (including CvCapture#close). While prefetching, the decoder thread is held off during the call,
+ * and the queued frames are discarded if seek is true (the position may have been changed).
+ */
+template <typename F>
+void
+with_capture(VALUE self, F func, bool seek = false)
+{
+  sCvCapture* scap = capture_struct(self);
+  bool closed = false;
+  rb_cvCallWithoutGVL(self, [&] {
+      if (!scap->opened) { // closed by another thread while waiting
+	closed = true;
+	return;
+      }
+      if (!prefetching(scap)) {
+	func(scap->ptr);
+	return;
+      }
+      capture_prefetch_t* prefetch = scap->prefetch;
+      std::lock_guard<std::mutex> capture_lock(prefetch->capture_mutex);
+      if (seek) {
+	std::lock_guard<std::mutex> lock(prefetch->mutex);
+	discard_prefetched(prefetch);
+      }
+      func(scap->ptr);
+      if (seek) {
+	double msec = scap->ptr->get(CV_CAP_PROP_POS_MSEC);
+	double pos = scap->ptr->get(CV_CAP_PROP_POS_FRAMES);
+	std::lock_guard<std::mutex> lock(prefetch->mutex);
+	prefetch->msec = msec;
+	prefetch->pos = pos;
+	prefetch->cond.notify_all();
+      }
+    });
+  if (closed)
+    rb_raise(rb_eIOError, "Resource is not available!");
+}
+
+/*
+ * Copies a frame returned by the backend into dest, flipping it if its origin is bottom-left
+ */
+void
+copy_frame(const IplImage* frame, CvArr* dest)
+{
+  if (frame->origin == IPL_ORIGIN_TL)
+    cvCopy(frame, dest);
+  else
+    cvFlip(frame, dest);
+}
+
+/*
+ * Opens a video file. YUV4MPEG2 and raw MJPEG files are read natively, and Motion JPEG
+ * in AVI too if highgui can not read it (or native is true). Returns NULL if the file
+ * can not be read.
+ */
+rb_cvVideoSource*
+open_video_file(const char* filename, bool native, double fps)
+{
+  int format = rb_cvSniffVideoFile(filename);
+  if (format == RB_CV_VIDEO_Y4M || format == RB_CV_VIDEO_MJPEG)
+    native = true;
+  if (!native) {
+    CvCapture* capture = cvCaptureFromFile(filename);
+    if (capture)
+      return rb_cvCreateHighguiSource(capture);
+    if (format == RB_CV_VIDEO_UNKNOWN)
+      return NULL;
+  }
+  rb_cvByteSource* stream = rb_cvOpenFileSource(filename);
+  return stream ? rb_cvCreateRawVideoSource(stream, fps) : NULL;
+}
+
+/*
+ * Wraps an opened source into a CvCapture
+ */
+VALUE
+wrap_source(rb_cvVideoSource* source, const char* filename)
+{
+  sCvCapture *scap = new sCvCapture();
+  scap->ptr = source;
+  scap->opened = true;
+  if (filename)
+    scap->filename = filename;
+  return TypedData_Wrap_Struct(rb_klass, &data_type, scap);
+}
+
+/*
+ * Paths of the image sequence opened by CvCapture.open: an Array of paths, or the files of
+ * a printf-style pattern or a glob which is not an existing file. Returns nil if device is
+ * not an image sequence, including a string which matches no files (e.g. a URL with '?'),
+ * which is left to highgui. sequence is the sequence: option: false never reads a string as
+ * a sequence, and true raises if it matches no files.
+ */
+VALUE
+sequence_paths(VALUE device, VALUE sequence)
+{
+  if (TYPE(device) == T_ARRAY) {
+    for (long i = 0; i < RARRAY_LEN(device); i++)
+      Check_Type(rb_ary_entry(device, i), T_STRING);
+    return device;
+  }
+  if (TYPE(device) != T_STRING || sequence == Qfalse ||
+      (NIL_P(sequence) && RTEST(rb_funcall(rb_cFile, rb_intern("exist?"), 1, device))))
+    return Qnil;
+  const char* pattern = StringValueCStr(device);
+  VALUE paths = Qnil;
+  std::vector<std::string> expanded;
+  if (rb_cvExpandSequencePattern(pattern, &expanded)) {
+    paths = rb_ary_new2(expanded.size());
+    for (size_t i = 0; i < expanded.size(); i++)
+      rb_ary_push(paths, rb_str_new(expanded[i].data(), expanded[i].size()));
+  }
+  else if (strpbrk(pattern, "*?[{")) {
+    VALUE entries = rb_funcall(rb_funcall(rb_cDir, rb_intern("glob"), 1, device), rb_intern("sort"), 0);
+    paths = rb_ary_new();
+    for (long i = 0; i < RARRAY_LEN(entries); i++) {
+      VALUE entry = rb_ary_entry(entries, i);
+      if (RTEST(rb_funcall(rb_cFile, rb_intern("file?"), 1, entry)))
+	rb_ary_push(paths, entry);
+    }
+  }
+  if (NIL_P(paths) || RARRAY_LEN(paths) == 0) {
+    if (RTEST(sequence))
+      rb_raise(rb_eArgError, "no image files match %s", pattern);
+    return Qnil;
+  }
+  return paths;
+}
+
+/*
+ * Opens an image sequence (see sequence_paths). Returns NULL if there are no images.
+ */
+rb_cvVideoSource*
+open_sequence(VALUE paths, double fps, int threads, int queue_size)
+{
+  std::vector<std::string> path_list;
+  for (long i = 0; i < RARRAY_LEN(paths); i++) {
+    VALUE path = rb_ary_entry(paths, i);
+    path_list.push_back(std::string(RSTRING_PTR(path), RSTRING_LEN(path)));
+  }
+  if (path_list.empty())
+    return NULL;
+  return rb_cvCreateImageSequenceSource(path_list, fps, threads, queue_size);
+}
+
+/*
+ * Reader of an IO into the byte queue of a stream capture, which runs in a Ruby thread
+ * (see open_stream)
+ */
+void
+stream_feeder_mark(void *ptr)
+{
+  rb_gc_mark(((stream_feeder_t*)ptr)->io);
+}
+
+void
+stream_feeder_free(void *ptr)
+{
+  delete (stream_feeder_t*)ptr;
+}
+
+const rb_data_type_t stream_feeder_type = {
+  "OpenCV::CvCapture::StreamFeeder",
+  { stream_feeder_mark, stream_feeder_free, 0, },
+  0, 0, RUBY_TYPED_FREE_IMMEDIATELY
+};
+
+stream_feeder_t*
+stream_feeder(VALUE feeder)
+{
+  stream_feeder_t* sfeeder;
+  TypedData_Get_Struct(feeder, stream_feeder_t, &stream_feeder_type, sfeeder);
+  return sfeeder;
+}
+
+typedef struct {
+  rb_cvByteQueue* queue;
+  const uchar* data;
+  size_t size;
+  size_t pushed;
+} stream_push_t;
+
+void*
+push_stream(void* arg)
+{
+  stream_push_t* push = (stream_push_t*)arg;
+  push->pushed = push->queue->push(push->data, push->size);
+  return NULL;
+}
+
+void
+interrupt_stream(void* arg)
+{
+  ((rb_cvByteQueue*)arg)->interrupt();
+}
+
+void
+close_stream(void* arg)
+{
+  ((rb_cvByteQueue*)arg)->close();
+}
+
+/*
+ * Pushes a chunk read from the IO, waiting while the queue is full.
+ * Returns false if the capture is closed.
+ */
+bool
+push_stream_chunk(rb_cvByteQueue* queue, VALUE chunk)
+{
+  size_t size = RSTRING_LEN(chunk), done = 0;
+  while (done < size) {
+    stream_push_t push = { queue, (const uchar*)RSTRING_PTR(chunk) + done, size - done, 0 };
+#ifdef HAVE_RUBY_THREAD_H
+    rb_thread_call_without_gvl(push_stream, &push, interrupt_stream, queue);
+#else
+    push_stream(&push);
+#endif
+    rb_thread_check_ints();
+    if (queue->closed())
+      return false;
+    done += push.pushed;
+  }
+  RB_GC_GUARD(chunk);
+  return true;
+}
+
+VALUE
+read_stream_chunk(VALUE feeder)
+{
+  stream_feeder_t* sfeeder = stream_feeder(feeder);
+  return rb_funcall(sfeeder->io, sfeeder->read_id, 1, INT2FIX(STREAM_CHUNK_SIZE));
+}
+
+VALUE
+stream_eof(VALUE feeder, VALUE error)
+{
+  return Qnil;
+}
+
+VALUE
+feed_stream_body(VALUE feeder)
+{
+  rb_cvByteQueue* queue = stream_feeder(feeder)->queue.get();
+  while (true) {
+    VALUE chunk = rb_rescue2(read_stream_chunk, feeder, stream_eof, feeder, rb_eEOFError, (VALUE)0);
+    if (NIL_P(chunk))
+      break;
+    if (!push_stream_chunk(queue, StringValue(chunk)))
+      break;
+  }
+  return Qnil;
+}
+
+VALUE
+finish_stream(VALUE feeder)
+{
+  stream_feeder(feeder)->queue->finish();
+  return Qnil;
+}
+
+VALUE
+feed_stream(VALUE feeder, VALUE data, int argc, const VALUE* argv, VALUE blockarg)
+{
+  return rb_ensure(feed_stream_body, feeder, finish_stream, feeder);
+}
+
+/*
+ * Opens a native reader of an IO. A Ruby thread (returned in *thread) reads the IO into
+ * a queue of buffer_size bytes, from which the reader decodes the frames.
+ * An interrupt while waiting for the header closes the queue. If the reader can not be
+ * opened, the thread is killed, since it may be waiting for the IO.
+ */
+rb_cvVideoSource*
+open_stream(VALUE io, double fps, size_t buffer_size, VALUE* thread)
+{
+  stream_feeder_t* sfeeder = new stream_feeder_t();
+  VALUE feeder = TypedData_Wrap_Struct(rb_cObject, &stream_feeder_type, sfeeder);
+  sfeeder->io = io;
+  sfeeder->read_id = rb_respond_to(io, rb_intern("readpartial")) ? rb_intern("readpartial") : rb_intern("read");
+  sfeeder->queue.reset(new rb_cvByteQueue(buffer_size));
+  *thread = rb_block_call(rb_cThread, rb_intern("new"), 1, &feeder, (rb_block_call_func_t)feed_stream, Qnil);
+  rb_cvByteSource* stream = rb_cvCreateQueueSource(sfeeder->queue);
+  rb_cvVideoSource* source = NULL;
+  cv::Exception error(CV_StsError, "Interrupted while reading the stream header", "open_stream", __FILE__, __LINE__);
+  try {
+    rb_cvCallWithoutGVL([&] { source = rb_cvCreateRawVideoSource(stream, fps); }, // waits for the header
+			close_stream, sfeeder->queue.get());
+  }
+  catch (cv::Exception& e) {
+    error = e;
+  }
+  if (!source) {
+    sfeeder->queue->close();
+    rb_funcall(*thread, rb_intern("kill"), 0);
+    *thread = Qnil;
+    throw error;
+  }
+  RB_GC_GUARD(feeder);
+  return source;
+}
+
+/*
+ * Opens video data in a string
+ * @scope class
+ * @overload decode(data, fps: 25)
+ *   @param data [String] YUV4MPEG2, raw MJPEG or Motion JPEG AVI data
+ *   @param fps [Number] Frame rate of raw MJPEG data
+ * @return [CvCapture] Opened CvCapture instance, which can seek like a file
+ */
+VALUE
+rb_decode(int argc, VALUE *argv, VALUE klass)
+{
+  VALUE data, options;
+  rb_scan_args(argc, argv, "11", &data, &options);
+  double fps = 0;
+  if (!NIL_P(options)) {
+    Check_Type(options, T_HASH);
+    fps = IF_DBL(LOOKUP_HASH(options, "fps"), 0);
+  }
+  data = rb_str_new_frozen(StringValue(data));
+  // Small strings may be embedded in the object, which the GC can move
+  bool copy = RSTRING_LEN(data) <= 4096;
+  rb_cvByteSource* stream = rb_cvCreateMemorySource((const uchar*)RSTRING_PTR(data), RSTRING_LEN(data), copy);
+  rb_cvVideoSource* source = NULL;
+  try {
+    source = rb_cvCreateRawVideoSource(stream, fps);
   }
+  catch (cv::Exception& e) {
+    raise_cverror(e);
+  }
+  VALUE object = wrap_source(source, NULL);
+  if (!copy)
+    rb_ivar_set(object, rb_intern("__stream__"), data);
+  return object;
 }
 
 /*
  * Open video file or a capturing device for video capturing
  * @scope class
- * @overload open(dev = nil)
- *   @param dev [String,Integer,Simbol,nil] Video capturing device
+ * @overload open(dev = nil, index: nil, native: false, fps: 25, buffer: 1048576, threads: nil, queue: nil, sequence: nil)
+ *   @param dev [String,Integer,Simbol,IO,nil] Video capturing device
  *     * If dev is a string (i.e "stream.avi"), reads video stream from a file.
  *     * If dev is a number or symbol (included in CvCapture::INTERFACE), reads video stream from a device.
+ *     * If dev is an IO (or any object with #readpartial or #read, such as StringIO), reads
+ *       YUV4MPEG2, raw MJPEG or Motion JPEG AVI data from it. A Ruby thread reads the IO into
+ *       a buffer of <tt>buffer</tt> bytes, and frames are decoded as the data arrives.
+ *       Such captures can not seek backward.
+ *     * If dev is a printf-style pattern (i.e "frames/%04d.jpg") or a glob (i.e "frames/img*.png")
+ *       which is not an existing file and matches image files, or an Array of paths, reads the
+ *       image files as frames. Other strings, such as URLs, are opened as video files or streams.
+ *       The pattern reads the files from the first existing number in 0..1000 to the last
+ *       consecutive one, and the glob reads the files sorted by name. <tt>threads</tt> native
+ *       threads decode up to <tt>queue</tt> frames ahead, and seeks do not decode the frames
+ *       before the new position.
  *     * If dev is a nil, same as CvCapture.open(:any)
+ *   @param index [Boolean, String] Seek with an index of the video file. The index is loaded from
+ *     the sidecar file (<tt>index</tt> if it is a String, see CvCapture#build_index), and is built
+ *     and saved if the sidecar file does not exist or is out of date.
+ *   @param native [Boolean] Read Motion JPEG in AVI without highgui. YUV4MPEG2 (.y4m) and
+ *     raw MJPEG (concatenated JPEG images) files are always read without highgui, so they
+ *     can be read without a video backend such as ffmpeg, and from pipes.
+ *   @param fps [Number] Frame rate of raw MJPEG files and image sequences, which do not store it
+ *   @param threads [Integer] Number of decoder threads of an image sequence (number of CPUs by default)
+ *   @param queue [Integer] Maximum number of frames of an image sequence decoded ahead
+ *     (2 * threads by default)
+ *   @param sequence [Boolean] Whether a String dev is an image sequence: true raises ArgumentError
+ *     if it matches no files, and false always opens it as a video file. By default, it is
+ *     a sequence if it matches files.
  * @return [CvCapture] Opened CvCapture instance
  * @opencv_func cvCaptureFromCAM
  * @opencv_func cvCaptureFromFile
@@ -50,15 +501,46 @@ cvcapture_free(void *ptr)
 VALUE
 rb_open(int argc, VALUE *argv, VALUE self)
 {
-  VALUE device;
-  rb_scan_args(argc, argv, "01", &device);
+  VALUE device, options;
+  rb_scan_args(argc, argv, "02", &device, &options);
+  bool native = false;
+  double fps = 0;
+  long buffer_size = STREAM_BUFFER_SIZE;
+  VALUE threads = Qnil, queue_size = Qnil, sequence_option = Qnil;
+  if (!NIL_P(options)) {
+    Check_Type(options, T_HASH);
+    native = RTEST(LOOKUP_HASH(options, "native"));
+    fps = IF_DBL(LOOKUP_HASH(options, "fps"), 0);
+    buffer_size = NIL_P(LOOKUP_HASH(options, "buffer")) ? STREAM_BUFFER_SIZE : NUM2LONG(LOOKUP_HASH(options, "buffer"));
+    if (buffer_size < 1)
+      rb_raise(rb_eArgError, "buffer should be greater than 0");
+    threads = LOOKUP_HASH(options, "threads");
+    queue_size = LOOKUP_HASH(options, "queue");
+    sequence_option = LOOKUP_HASH(options, "sequence");
+  }
+  VALUE sequence = sequence_paths(device, sequence_option);
+  int _threads = 0, _queue_size = 0;
+  if (!NIL_P(sequence)) {
+    _threads = NIL_P(threads) ? rb_cvDefaultThreadCount() : NUM2INT(threads);
+    if (_threads < 1)
+      rb_raise(rb_eArgError, "threads should be positive");
+    _queue_size = NIL_P(queue_size) ? _threads * 2 : NUM2INT(queue_size);
+    if (_queue_size < 1)
+      rb_raise(rb_eArgError, "queue should be positive");
+  }
   CvCapture *capture = 0;
-  sCvCapture *scap = new sCvCapture();
+  rb_cvVideoSource* source = NULL;
+  VALUE stream_thread = Qnil;
   try {
-    switch (TYPE(device)) {
-    case T_STRING:
-      capture = cvCaptureFromFile(StringValueCStr(device));
+    if (!NIL_P(sequence))
+      source = open_sequence(sequence, fps, _threads, _queue_size);
+    else switch (TYPE(device)) {
+    case T_STRING: {
+      device = rb_str_new_frozen(device); // the string can not be changed by other threads without the GVL
+      const char* filename = StringValueCStr(device);
+      rb_cvCallWithoutGVL([&] { source = open_video_file(filename, native, fps); }); // may wait for a pipe
       break;
+    }
     case T_FIXNUM:
       capture = cvCaptureFromCAM(FIX2INT(device));
       break;
@@ -72,16 +554,31 @@ rb_open(int argc, VALUE *argv, VALUE self)
     case T_NIL:
       capture = cvCaptureFromCAM(CV_CAP_ANY);
       break;
+    default:
+      if (rb_respond_to(device, rb_intern("readpartial")) || rb_respond_to(device, rb_intern("read")))
+	source = open_stream(device, fps, buffer_size, &stream_thread);
+      break;
     }
+    if (capture)
+      source = rb_cvCreateHighguiSource(capture);
   }
   catch (cv::Exception& e) {
     raise_cverror(e);
   }
-  if (!capture)
+  if (!source)
     rb_raise(rb_eStandardError, "Invalid capture format.");
-  scap->ptr = capture;
-  scap->opened = true;
-  return Data_Wrap_Struct(rb_klass, 0, cvcapture_free, scap);
+  VALUE object = wrap_source(source, TYPE(device) == T_STRING ? StringValueCStr(device) : NULL);
+  if (!NIL_P(stream_thread))
+    rb_ivar_set(object, rb_intern("__stream_thread__"), stream_thread);
+  if (!NIL_P(options)) {
+    VALUE index = LOOKUP_HASH(options, "index");
+    if (RTEST(index)) {
+      VALUE path = (index == Qtrue) ? Qnil : index;
+      if (!RTEST(rb_load_index(1, &path, object)))
+	rb_build_index(1, &path, object);
+    }
+  }
+  return object;
 }
 
 /*
@@ -93,10 +590,22 @@ VALUE
 rb_close(VALUE self)
 {
   sCvCapture *scap;
-  Data_Get_Struct(self, sCvCapture, scap);
+  TypedData_Get_Struct(self, sCvCapture, &data_type, scap);
   if (scap->opened) {
-    scap->opened = false;
-    cvReleaseCapture(&scap->ptr);
+    release_borrowed(self);
+    // Waits for the calls of other threads, which may be using the capture without the GVL
+    rb_cvCallWithoutGVL(self, [&] {
+	if (!scap->opened)
+	  return;
+	if (prefetching(scap))
+	  stop_prefetch(scap);
+	scap->opened = false;
+	delete scap->ptr;
+	scap->ptr = NULL;
+      });
+    VALUE stream_thread = rb_attr_get(self, rb_intern("__stream_thread__"));
+    if (!NIL_P(stream_thread)) // may be waiting for the IO
+      rb_funcall(stream_thread, rb_intern("kill"), 0);
     return true;
   } else
     return false;
@@ -112,84 +621,322 @@ VALUE
 rb_grab(VALUE self)
 {
   int grab = 0;
+  sCvCapture* scap = capture_struct(self);
+  release_borrowed(self);
+  if (prefetching(scap)) {
+    capture_frame_t frame;
+    try {
+      grab = take_prefetched(scap, &frame);
+    }
+    catch (cv::Exception& e) {
+      raise_cverror(e);
+    }
+    std::lock_guard<std::mutex> lock(scap->prefetch->mutex);
+    release_frame(&scap->prefetch->grabbed);
+    if (grab)
+      scap->prefetch->grabbed = frame;
+    return grab ? Qtrue : Qfalse;
+  }
+  bool closed = false;
   try {
-    grab = cvGrabFrame(CVCAPTURE(self));
+    rb_cvCallWithoutGVL(self, [&] {
+	if (scap->opened) // else closed by another thread while waiting
+	  grab = scap->ptr->grab();
+	else
+	  closed = true;
+      });
   }
   catch (cv::Exception& e) {
     raise_cverror(e);
   }
+  if (closed)
+    rb_raise(rb_eIOError, "Resource is not available!");
   return grab ? Qtrue : Qfalse;
 }
 
 /*
- * Decodes and returns the grabbed video frame.
- * @overload retrieve
- * @return [IplImage] Grabbed video frame
- * @return [nil] Failed to grabbing a frame
- * @opencv_func cvRetrieveFrame
+ * Reads the options of CvCapture#retrieve and CvCapture#query
+ */
+void
+frame_options(int argc, VALUE *argv, VALUE* into, bool* borrow)
+{
+  VALUE options;
+  rb_scan_args(argc, argv, "01", &options);
+  *into = Qnil;
+  *borrow = false;
+  if (NIL_P(options))
+    return;
+  Check_Type(options, T_HASH);
+  *into = LOOKUP_HASH(options, "into");
+  *borrow = RTEST(LOOKUP_HASH(options, "borrow"));
+  if (!NIL_P(*into)) {
+    if (!rb_obj_is_kind_of(*into, cCvMat::rb_class()))
+      raise_typeerror(*into, cCvMat::rb_class());
+    check_writable(*into);
+    if (*borrow)
+      rb_raise(rb_eArgError, "into and borrow can not be used together");
+  }
+}
+
+/*
+ * Returns whether a frame can be copied into dest
+ */
+bool
+frame_fits(const IplImage* frame, CvArr* dest)
+{
+  CvSize size = cvGetSize(dest);
+  return size.width == frame->width && size.height == frame->height &&
+    cvGetElemType(dest) == CV_MAKETYPE(IPL2CV_DEPTH(frame->depth), frame->nChannels);
+}
+
+void
+raise_unfit_destination(CvSize size, int type)
+{
+  rb_raise(rb_eArgError, "into does not match the size, depth or number of channels of the frame "
+	   "(given %dx%d with %d channel(s))", size.width, size.height, CV_MAT_CN(type));
+}
+
+/*
+ * Makes a header on a frame owned by the capture (or the decoder thread), without copying it
+ * unless it has to be flipped. Does not need the GVL.
+ */
+IplImage*
+borrowed_header(sCvCapture* scap, IplImage* frame)
+{
+  if (frame->origin != IPL_ORIGIN_TL) {
+    // A bottom-left frame can not be viewed top-left without a copy; flip it into a reused buffer
+    IplImage* flipped = scap->flipped;
+    if (flipped && (flipped->width != frame->width || flipped->height != frame->height ||
+		    flipped->depth != frame->depth || flipped->nChannels != frame->nChannels))
+      cvReleaseImage(&scap->flipped);
+    if (!scap->flipped)
+      scap->flipped = cvCreateImage(cvGetSize(frame), frame->depth, frame->nChannels);
+    cvFlip(frame, scap->flipped);
+    frame = scap->flipped;
+  }
+  IplImage* header = cvCreateImageHeader(cvGetSize(frame), frame->depth, frame->nChannels);
+  header->imageData = frame->imageData;
+  header->widthStep = frame->widthStep;
+  header->imageSize = frame->imageSize;
+  return header;
+}
+
+/*
+ * Wraps a header made by borrowed_header() as a frozen IplImage.
+ * The image is invalidated by release_borrowed().
  */
 VALUE
-rb_retrieve(VALUE self)
+borrow_frame(VALUE self, IplImage* header)
 {
-  VALUE image = Qnil;
-  IplImage *frame = NULL;
+  VALUE image = BORROWED_OBJECT(cIplImage::rb_class(), header, self); // the capture owns the data
+  rb_obj_freeze(image);
+  rb_ivar_set(self, rb_intern("__borrowed__"), image);
+  return image;
+}
+
+/*
+ * Detaches the image returned by retrieve(borrow: true) or query(borrow: true) from the frame
+ * it refers to, before the frame is overwritten or released.
+ * The image becomes a 1x1 black image with a pixel of its own, so that using it afterwards
+ * does not read freed memory.
+ */
+void
+release_borrowed(VALUE self)
+{
+  ID id_borrowed = rb_intern("__borrowed__");
+  VALUE image = rb_attr_get(self, id_borrowed);
+  if (NIL_P(image))
+    return;
+  IplImage* header = (IplImage*)OPENCV_DATA_PTR(image);
   try {
-    if (!(frame = cvRetrieveFrame(CVCAPTURE(self)))) {
-      return Qnil;
-    }
-    image = cIplImage::new_object(frame->width, frame->height,
-				  CV_MAKETYPE(IPL2CV_DEPTH(frame->depth), frame->nChannels));
-    if (frame->origin == IPL_ORIGIN_TL) {
-      cvCopy(frame, CVARR(image));
-    }
-    else {
-      cvFlip(frame, CVARR(image));
-    }
+    rb_cvDetachImageData(header);
   }
   catch (cv::Exception& e) {
     raise_cverror(e);
   }
-  return image;
-
+  rb_ivar_set(self, id_borrowed, Qnil);
 }
 
 /*
- * Grabs, decodes and returns the next video frame.
- * @overload query
- * @return [IplImage] Next video frame
- * @return [nil] Failed to read next video frame
- * @opencv_func cvQueryFrame
+ * Common part of CvCapture#retrieve and CvCapture#query
  */
 VALUE
-rb_query(VALUE self)
+read_frame(int argc, VALUE *argv, VALUE self, bool query)
 {
-  VALUE image = Qnil;
+  VALUE into;
+  bool borrow;
+  frame_options(argc, argv, &into, &borrow);
+  CvArr* into_ptr = NIL_P(into) ? NULL : CVARR(into);
+  sCvCapture* scap = capture_struct(self);
+  release_borrowed(self);
+
   IplImage *frame = NULL;
-  try {
-    if (!(frame = cvQueryFrame(CVCAPTURE(self)))) {
-      return Qnil;
+  bool fits = true;
+  CvSize size = cvSize(0, 0);
+  int type = 0;
+  if (prefetching(scap)) {
+    capture_prefetch_t* prefetch = scap->prefetch;
+    if (query) {
+      // The prefetched frame is handed over without a copy, so borrow: makes no difference
+      capture_frame_t prefetched;
+      bool taken = false;
+      try {
+	taken = take_prefetched(scap, &prefetched, into_ptr, &fits);
+      }
+      catch (cv::Exception& e) {
+	raise_cverror(e);
+      }
+      if (!taken)
+	return Qnil;
+      if (into_ptr) {
+	if (!fits)
+	  raise_unfit_destination(cvGetSize(into_ptr), cvGetElemType(into_ptr));
+	return into;
+      }
+      return OPENCV_OBJECT(cIplImage::rb_class(), prefetched.image);
+    }
+    {
+      std::lock_guard<std::mutex> lock(prefetch->mutex);
+      frame = prefetch->grabbed.image;
+      if (!frame)
+	return Qnil;
+      size = cvGetSize(frame);
+      type = CV_MAKETYPE(IPL2CV_DEPTH(frame->depth), frame->nChannels);
     }
-    image = cIplImage::new_object(frame->width, frame->height,
-				  CV_MAKETYPE(IPL2CV_DEPTH(frame->depth), frame->nChannels));
-    if (frame->origin == IPL_ORIGIN_TL) {
+    // Only #grab replaces or releases the grabbed frame, and it runs under the GVL
+    if (borrow) {
+      IplImage* header = NULL;
+      try {
+	header = borrowed_header(scap, frame);
+      }
+      catch (cv::Exception& e) {
+	raise_cverror(e);
+      }
+      return borrow_frame(self, header);
+    }
+    VALUE image = NIL_P(into) ? cIplImage::new_object(size, type) : into;
+    try {
+      if (into_ptr && !frame_fits(frame, into_ptr))
+	raise_unfit_destination(cvGetSize(into_ptr), cvGetElemType(into_ptr));
       cvCopy(frame, CVARR(image));
     }
-    else {
-      cvFlip(frame, CVARR(image));
+    catch (cv::Exception& e) {
+      raise_cverror(e);
     }
+    return image;
+  }
+
+  // The frame is copied (or borrowed) in the serialized call, before another thread can grab
+  bool closed = false;
+  IplImage* result = NULL;
+  try {
+    rb_cvCallWithoutGVL(self, [&] {
+	if (!scap->opened) { // closed by another thread while waiting
+	  closed = true;
+	  return;
+	}
+	frame = query ? scap->ptr->query() : scap->ptr->retrieve();
+	if (!frame)
+	  return;
+	if (into_ptr) {
+	  fits = frame_fits(frame, into_ptr);
+	  if (fits)
+	    copy_frame(frame, into_ptr);
+	}
+	else if (borrow)
+	  result = borrowed_header(scap, frame);
+	else {
+	  result = cvCreateImage(cvGetSize(frame), frame->depth, frame->nChannels);
+	  copy_frame(frame, result);
+	}
+      });
   }
   catch (cv::Exception& e) {
+    if (result)
+      cvReleaseImage(&result);
     raise_cverror(e);
   }
-  return image;
+  if (closed)
+    rb_raise(rb_eIOError, "Resource is not available!");
+  if (!frame)
+    return Qnil;
+  if (into_ptr) {
+    if (!fits)
+      raise_unfit_destination(cvGetSize(into_ptr), cvGetElemType(into_ptr));
+    return into;
+  }
+  if (borrow)
+    return borrow_frame(self, result);
+  return OPENCV_OBJECT(cIplImage::rb_class(), result);
+}
+
+/*
+ * Decodes and returns the grabbed video frame.
+ *
+ * By default, the frame is copied into a new IplImage.
+ * With <tt>into:</tt>, it is copied into the given image instead, which must have the size, depth
+ * and number of channels of the frame. With <tt>borrow: true</tt>, the frame buffer of the capture
+ * is returned without a copy as a frozen IplImage, which is valid only until the next call of
+ * CvCapture#grab, CvCapture#retrieve, CvCapture#query, CvCapture#close or a property setter;
+ * then it becomes a 1x1 black image. Modifying a borrowed image raises FrozenError, and views of it
+ * (e.g. by CvMat#sub_rect) can not be made, since they would outlive the frame: clone it first.
+ *
+ * @overload retrieve(into: nil, borrow: false)
+ *   @param into [IplImage, CvMat] Destination of the frame
+ *   @param borrow [Boolean] Return the frame without a copy
+ * @return [IplImage] Grabbed video frame (<tt>into</tt> if given)
+ * @return [nil] Failed to grabbing a frame
+ * @opencv_func cvRetrieveFrame
+ * @example
+ *   frame = nil
+ *   while capture.grab
+ *     frame = capture.retrieve(into: frame || capture.retrieve)
+ *   end
+ */
+VALUE
+rb_retrieve(int argc, VALUE *argv, VALUE self)
+{
+  return read_frame(argc, argv, self, false);
+}
+
+/*
+ * Grabs, decodes and returns the next video frame.
+ * The options are the same as CvCapture#retrieve.
+ *
+ * @overload query(into: nil, borrow: false)
+ *   @param into [IplImage, CvMat] Destination of the frame
+ *   @param borrow [Boolean] Return the frame without a copy
+ * @return [IplImage] Next video frame (<tt>into</tt> if given)
+ * @return [nil] Failed to read next video frame
+ * @opencv_func cvQueryFrame
+ * @example
+ *   frame = capture.query
+ *   while capture.query(into: frame)
+ *     detect(frame)
+ *   end
+ *
+ *   while frame = capture.query(borrow: true)
+ *     detect(frame) # must not keep frame after the next query
+ *   end
+ */
+VALUE
+rb_query(int argc, VALUE *argv, VALUE self)
+{
+  return read_frame(argc, argv, self, true);
 }
 
 VALUE
 rb_get_capture_property(VALUE self, int id)
 {
   double result = 0;
+  sCvCapture* scap = capture_struct(self);
+  if (prefetching(scap) && (id == CV_CAP_PROP_POS_MSEC || id == CV_CAP_PROP_POS_FRAMES)) {
+    // Position of the frames returned to the caller, not of the decoder thread
+    std::lock_guard<std::mutex> lock(scap->prefetch->mutex);
+    return rb_float_new(id == CV_CAP_PROP_POS_MSEC ? scap->prefetch->msec : scap->prefetch->pos);
+  }
   try {
-    result = cvGetCaptureProperty(CVCAPTURE(self), id);
+    with_capture(self, [&](rb_cvVideoSource* capture) { result = capture->get(id); });
   }
   catch (cv::Exception& e) {
     raise_cverror(e);
@@ -201,8 +948,19 @@ VALUE
 rb_set_capture_property(VALUE self, int id, VALUE value)
 {
   double result = 0;
+  double val = NUM2DBL(value);
+  sCvCapture* scap = capture_struct(self);
+  release_borrowed(self);
   try {
-    result = cvSetCaptureProperty(CVCAPTURE(self), id, NUM2DBL(value));
+    with_capture(self, [&](rb_cvVideoSource* capture) {
+	if (scap->index && (id == CV_CAP_PROP_POS_FRAMES || id == CV_CAP_PROP_POS_MSEC ||
+			    id == CV_CAP_PROP_POS_AVI_RATIO)) {
+	  seek_indexed(capture, scap->index, indexed_frame(scap->index, id, val));
+	  result = 1;
+	}
+	else
+	  result = capture->set(id, val);
+      }, true);
   }
   catch (cv::Exception& e) {
     raise_cverror(e);
@@ -294,9 +1052,10 @@ rb_get_size(VALUE self)
 {
   CvSize size;
   try {
-    CvCapture* self_ptr = CVCAPTURE(self);
-    size = cvSize((int)cvGetCaptureProperty(self_ptr, CV_CAP_PROP_FRAME_WIDTH),
-		  (int)cvGetCaptureProperty(self_ptr, CV_CAP_PROP_FRAME_HEIGHT));
+    with_capture(self, [&](rb_cvVideoSource* self_ptr) {
+	size = cvSize((int)self_ptr->get(CV_CAP_PROP_FRAME_WIDTH),
+		      (int)self_ptr->get(CV_CAP_PROP_FRAME_HEIGHT));
+      });
   }
   catch (cv::Exception& e) {
     raise_cverror(e);
@@ -316,10 +1075,12 @@ rb_set_size(VALUE self, VALUE value)
 {
   double result = 0;
   CvSize size = VALUE_TO_CVSIZE(value);
+  release_borrowed(self);
   try {
-    CvCapture* self_ptr = CVCAPTURE(self);
-    cvSetCaptureProperty(self_ptr, CV_CAP_PROP_FRAME_WIDTH, size.width);
-    result = cvSetCaptureProperty(self_ptr, CV_CAP_PROP_FRAME_HEIGHT, size.height);
+    with_capture(self, [&](rb_cvVideoSource* self_ptr) {
+	self_ptr->set(CV_CAP_PROP_FRAME_WIDTH, size.width);
+	result = self_ptr->set(CV_CAP_PROP_FRAME_HEIGHT, size.height);
+      }, true);
   }
   catch (cv::Exception& e) {
     raise_cverror(e);
@@ -412,13 +1173,20 @@ VALUE
 rb_get_fourcc(VALUE self)
 {
   char str[4];
-  double fourcc = cvGetCaptureProperty(CVCAPTURE(self), CV_CAP_PROP_FOURCC);
+  double fourcc = 0;
+  try {
+    with_capture(self, [&](rb_cvVideoSource* capture) { fourcc = capture->get(CV_CAP_PROP_FOURCC); });
+  }
+  catch (cv::Exception& e) {
+    raise_cverror(e);
+  }
   sprintf(str, "%s", (char*)&fourcc);
   return rb_str_new2(str);
 }
 
 /*
  * Get number of frames in video file.
+ * If the video file is indexed, returns the number of frames found by CvCapture#build_index.
  * @overload frame_count
  * @return [Number] Number of frames
  * @opencv_func cvGetCaptureProperty (propId=CV_CAP_PROP_FRAME_COUNT)
@@ -426,6 +1194,9 @@ rb_get_fourcc(VALUE self)
 VALUE
 rb_get_frame_count(VALUE self)
 {
+  sCvCapture* scap = capture_struct(self);
+  if (scap->index)
+    return rb_float_new(scap->index->msec.size());
   return rb_get_capture_property(self, CV_CAP_PROP_FRAME_COUNT);
 }
 
@@ -535,7 +1306,7 @@ rb_get_convert_rgb(VALUE self)
 {
   int flag = 0;
   try {
-    flag = (int)cvGetCaptureProperty(CVCAPTURE(self), CV_CAP_PROP_CONVERT_RGB);
+    with_capture(self, [&](rb_cvVideoSource* capture) { flag = (int)capture->get(CV_CAP_PROP_CONVERT_RGB); });
   }
   catch (cv::Exception& e) {
     raise_cverror(e);
@@ -556,19 +1327,1113 @@ rb_get_rectification(VALUE self)
 }
 
 void
-init_ruby_class()
+release_frame(capture_frame_t* frame)
 {
-#if 0
-  // For documentation using YARD
-  VALUE opencv = rb_define_module("OpenCV");
-#endif
-
-  if (rb_klass)
-    return;
+  if (frame->image)
+    cvReleaseImage(&frame->image);
+}
 
-  VALUE opencv = rb_module_opencv();
-  
-  rb_klass = rb_define_class_under(opencv, "CvCapture", rb_cData);
+/*
+ * Body of the decoder thread. Decodes frames into the ring until it is full
+ * (or drops the oldest one if prefetch->drop), the end of the stream, or an error.
+ * If prefetch->rate is set, frames are grabbed no faster than the rate, like a device.
+ */
+void
+prefetch_worker(sCvCapture* scap)
+{
+  capture_prefetch_t* prefetch = scap->prefetch;
+  capture_frame_t staging = { NULL, 0, 0, 0 };
+  std::chrono::steady_clock::time_point next_grab = std::chrono::steady_clock::now();
+  std::unique_lock<std::mutex> lock(prefetch->mutex);
+  while (true) {
+    prefetch->cond.wait(lock, [&] {
+	return !prefetch->active ||
+	  (!prefetch->eof && !prefetch->failed && (prefetch->drop || prefetch->count < prefetch->ring.size()));
+      });
+    if (!prefetch->active)
+      break;
+    if (prefetch->rate > 0) {
+      prefetch->cond.wait_until(lock, next_grab, [&] { return !prefetch->active; });
+      if (!prefetch->active)
+	break;
+      std::chrono::duration<double> interval(1.0 / prefetch->rate);
+      next_grab = std::max(next_grab, std::chrono::steady_clock::now()) +
+	std::chrono::duration_cast<std::chrono::steady_clock::duration>(interval);
+    }
+    lock.unlock();
+
+    unsigned long generation = 0;
+    bool decoded = false;
+    bool failed = false;
+    cv::Exception error;
+    double elapsed = 0;
+    {
+      std::lock_guard<std::mutex> capture_lock(prefetch->capture_mutex);
+      {
+	std::lock_guard<std::mutex> generation_lock(prefetch->mutex);
+	generation = prefetch->generation;
+      }
+      try {
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	// The timestamp is the time of the grab, before the decoding
+	IplImage* frame = NULL;
+	double timestamp = 0;
+	if (scap->ptr->grab()) {
+	  timestamp = std::chrono::duration<double>(std::chrono::system_clock::now().time_since_epoch()).count();
+	  frame = scap->ptr->retrieve();
+	}
+	if (frame) {
+	  if (staging.image && (staging.image->width != frame->width || staging.image->height != frame->height ||
+				staging.image->depth != frame->depth || staging.image->nChannels != frame->nChannels))
+	    cvReleaseImage(&staging.image);
+	  if (!staging.image)
+	    staging.image = cvCreateImage(cvSize(frame->width, frame->height), frame->depth, frame->nChannels);
+	  copy_frame(frame, staging.image);
+	  staging.msec = scap->ptr->get(CV_CAP_PROP_POS_MSEC);
+	  staging.pos = scap->ptr->get(CV_CAP_PROP_POS_FRAMES);
+	  staging.timestamp = timestamp;
+	  decoded = true;
+	}
+	elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      }
+      catch (cv::Exception& e) {
+	failed = true;
+	error = e;
+      }
+      catch (std::bad_alloc&) {
+	failed = true;
+	error = cv::Exception(CV_StsNoMem, "Failed to allocate memory", "CvCapture#prefetch", __FILE__, __LINE__);
+      }
+    }
+
+    lock.lock();
+    if (generation != prefetch->generation) {
+      if (decoded)
+	prefetch->discarded++;
+      continue; // the position was changed while decoding
+    }
+    if (failed) {
+      prefetch->failed = true;
+      prefetch->error = error;
+    }
+    else if (!decoded) {
+      prefetch->eof = true;
+    }
+    else {
+      const size_t capacity = prefetch->ring.size();
+      prefetch->decoded++;
+      prefetch->decode_time += elapsed;
+      prefetch->max_decode_time = MAX(prefetch->max_decode_time, elapsed);
+      if (prefetch->count == capacity) {
+	// Replace the oldest frame; its image is reused for the next frame
+	std::swap(staging, prefetch->ring[prefetch->head]);
+	prefetch->head = (prefetch->head + 1) % capacity;
+	prefetch->dropped++;
+	prefetch->skipping++;
+      }
+      else {
+	// The slot keeps the image of a frame already taken (or NULL if handed over to Ruby)
+	std::swap(staging, prefetch->ring[(prefetch->head + prefetch->count) % capacity]);
+	prefetch->count++;
+      }
+      prefetch->max_depth = MAX(prefetch->max_depth, prefetch->count);
+    }
+    prefetch->cond.notify_all();
+  }
+  lock.unlock();
+  release_frame(&staging);
+}
+
+/*
+ * Starts the decoder thread with a ring of depth frames, grabbing rate frames per second
+ * (0 for as fast as possible). Returns false if the thread can not be created.
+ */
+bool
+start_prefetch(sCvCapture* scap, size_t depth, bool drop, double rate)
+{
+  if (!scap->prefetch)
+    scap->prefetch = new capture_prefetch_t();
+  capture_prefetch_t* prefetch = scap->prefetch;
+  capture_frame_t empty = { NULL, 0, 0, 0 };
+  prefetch->ring.assign(depth, empty);
+  prefetch->head = 0;
+  prefetch->count = 0;
+  prefetch->drop = drop;
+  prefetch->rate = rate;
+  prefetch->eof = false;
+  prefetch->failed = false;
+  prefetch->interrupted = false;
+  prefetch->grabbed = empty;
+  prefetch->msec = scap->ptr->get(CV_CAP_PROP_POS_MSEC);
+  prefetch->pos = scap->ptr->get(CV_CAP_PROP_POS_FRAMES);
+  prefetch->timestamp = 0;
+  prefetch->skipped = prefetch->skipping = 0;
+  prefetch->decoded = prefetch->delivered = prefetch->dropped = prefetch->discarded = 0;
+  prefetch->waits = prefetch->max_depth = 0;
+  prefetch->decode_time = prefetch->max_decode_time = 0;
+  prefetch->active = true;
+  try {
+    prefetch->thread = std::thread(prefetch_worker, scap);
+  }
+  catch (std::system_error&) {
+    prefetch->active = false;
+    prefetch->ring.clear();
+    return false;
+  }
+  return true;
+}
+
+/*
+ * Stops and joins the decoder thread, and releases the queued frames
+ */
+void
+stop_prefetch(sCvCapture* scap)
+{
+  capture_prefetch_t* prefetch = scap->prefetch;
+  {
+    std::lock_guard<std::mutex> lock(prefetch->mutex);
+    if (!prefetch->thread.joinable()) // not started, or already stopped
+      return;
+    prefetch->active = false;
+  }
+  prefetch->cond.notify_all();
+  if (prefetch->thread.joinable())
+    prefetch->thread.join();
+  std::lock_guard<std::mutex> lock(prefetch->mutex);
+  for (size_t i = 0; i < prefetch->ring.size(); i++)
+    release_frame(&prefetch->ring[i]);
+  prefetch->ring.clear();
+  prefetch->count = 0;
+  release_frame(&prefetch->grabbed);
+}
+
+/*
+ * Discards the queued frames (and the frame being decoded). prefetch->mutex must be locked.
+ */
+void
+discard_prefetched(capture_prefetch_t* prefetch)
+{
+  prefetch->discarded += prefetch->count;
+  prefetch->head = 0;
+  prefetch->count = 0;
+  prefetch->eof = false;
+  prefetch->failed = false;
+  prefetch->skipping = 0;
+  prefetch->generation++;
+}
+
+/*
+ * Waits until a frame is ready, the stream ends, or the waiting thread is interrupted
+ */
+void*
+wait_prefetched(void* arg)
+{
+  capture_prefetch_t* prefetch = (capture_prefetch_t*)arg;
+  std::unique_lock<std::mutex> lock(prefetch->mutex);
+  auto ready = [&] {
+    return prefetch->count > 0 || prefetch->eof || prefetch->failed || !prefetch->active || prefetch->interrupted;
+  };
+  if (!ready()) {
+    prefetch->waits++;
+    prefetch->cond.wait(lock, ready);
+  }
+  prefetch->interrupted = false;
+  return NULL;
+}
+
+void
+interrupt_prefetched(void* arg)
+{
+  capture_prefetch_t* prefetch = (capture_prefetch_t*)arg;
+  {
+    std::lock_guard<std::mutex> lock(prefetch->mutex);
+    prefetch->interrupted = true;
+  }
+  prefetch->cond.notify_all();
+}
+
+/*
+ * Takes the next decoded frame. Returns false at the end of the stream.
+ * If into is given, the frame is copied into it (if *fits) instead of being handed over,
+ * and if keep is true, only the position of the frame is returned.
+ * An error of the decoder thread is thrown once, and then the stream is treated as ended.
+ */
+bool
+take_prefetched(sCvCapture* scap, capture_frame_t* frame, CvArr* into, bool* fits, bool keep)
+{
+  capture_prefetch_t* prefetch = scap->prefetch;
+  while (true) {
+#ifdef HAVE_RUBY_THREAD_H
+    rb_thread_call_without_gvl(wait_prefetched, prefetch, interrupt_prefetched, prefetch);
+#else
+    wait_prefetched(prefetch);
+#endif
+    {
+      std::lock_guard<std::mutex> lock(prefetch->mutex);
+      if (prefetch->count > 0) {
+	capture_frame_t& slot = prefetch->ring[prefetch->head];
+	*frame = slot;
+	if (into || keep) {
+	  // Copy the frame (or skip it), and leave its image in the ring for reuse
+	  if (into) {
+	    *fits = frame_fits(slot.image, into);
+	    if (*fits)
+	      cvCopy(slot.image, into);
+	  }
+	  frame->image = NULL;
+	}
+	else {
+	  slot.image = NULL;
+	}
+	prefetch->head = (prefetch->head + 1) % prefetch->ring.size();
+	prefetch->count--;
+	prefetch->delivered++;
+	prefetch->msec = frame->msec;
+	prefetch->pos = frame->pos;
+	prefetch->timestamp = frame->timestamp;
+	prefetch->skipped = prefetch->skipping;
+	prefetch->skipping = 0;
+	prefetch->cond.notify_all();
+	return true;
+      }
+      if (prefetch->failed) {
+	prefetch->failed = false;
+	prefetch->eof = true;
+	throw cv::Exception(prefetch->error);
+      }
+      if (prefetch->eof || !prefetch->active)
+	return false;
+    }
+    rb_thread_check_ints();
+  }
+}
+
+/*
+ * State of CvCapture#each_frame
+ */
+typedef struct {
+  VALUE self;
+  int step;
+  double every_ms;
+  long max;
+} each_frame_t;
+
+/*
+ * Maximum number of frames grabbed without checking interrupts
+ */
+const int GRAB_CHUNK = 64;
+
+/*
+ * Grabs the frames to skip and the next frame to yield (the index-th frame, counted from 0,
+ * such that index % step == 0 and its timestamp >= next_ms), and returns a copy of it,
+ * or NULL at the end of the stream (*eof) or after GRAB_CHUNK frames.
+ */
+IplImage*
+grab_next_frame(VALUE self, sCvCapture* scap, const each_frame_t* each, long* index, double next_ms,
+		double* msec, bool* eof)
+{
+  IplImage* image = NULL;
+  *eof = false;
+  if (prefetching(scap)) {
+    for (int n = 0; n < GRAB_CHUNK; n++) {
+      capture_frame_t frame;
+      (*index)++;
+      bool wanted = (*index % each->step == 0);
+      if (!take_prefetched(scap, &frame, NULL, NULL, !wanted)) {
+	*eof = true;
+	return NULL;
+      }
+      if (wanted && each->every_ms > 0 && frame.msec < next_ms) {
+	release_frame(&frame);
+	continue;
+      }
+      if (wanted) {
+	*msec = frame.msec;
+	return frame.image;
+      }
+    }
+    return NULL;
+  }
+
+  bool closed = false;
+  rb_cvCallWithoutGVL(self, [&] {
+      if (!scap->opened) { // closed by another thread while waiting
+	closed = true;
+	return;
+      }
+      rb_cvVideoSource* capture = scap->ptr;
+      for (int n = 0; n < GRAB_CHUNK; n++) {
+	if (!capture->grab()) {
+	  *eof = true;
+	  return;
+	}
+	(*index)++;
+	if (*index % each->step != 0)
+	  continue;
+	*msec = capture->get(CV_CAP_PROP_POS_MSEC);
+	if (each->every_ms > 0 && *msec < next_ms)
+	  continue;
+	IplImage* frame = capture->retrieve();
+	if (!frame) {
+	  *eof = true;
+	  return;
+	}
+	image = cvCreateImage(cvGetSize(frame), frame->depth, frame->nChannels);
+	try {
+	  copy_frame(frame, image);
+	}
+	catch (...) {
+	  cvReleaseImage(&image);
+	  throw;
+	}
+	return;
+      }
+    });
+  if (closed)
+    rb_raise(rb_eIOError, "Resource is not available!");
+  return image;
+}
+
+VALUE
+each_frame_body(VALUE arg)
+{
+  each_frame_t* each = (each_frame_t*)arg;
+  VALUE self = each->self;
+  long index = -1;
+  long yielded = 0;
+  double next_ms = -DBL_MAX;
+  while (each->max < 0 || yielded < each->max) {
+    sCvCapture* scap = capture_struct(self); // may be closed in the block
+    IplImage* image = NULL;
+    double msec = 0;
+    bool eof = false;
+    try {
+      image = grab_next_frame(self, scap, each, &index, next_ms, &msec, &eof);
+    }
+    catch (cv::Exception& e) {
+      raise_cverror(e);
+    }
+    if (eof)
+      break;
+    if (!image) {
+      rb_thread_check_ints();
+      continue;
+    }
+    VALUE frame = OPENCV_OBJECT(cIplImage::rb_class(), image);
+    if (each->every_ms > 0) {
+      // Keep the sampling points on a fixed grid, so that they do not drift
+      if (next_ms == -DBL_MAX)
+	next_ms = msec;
+      while (next_ms <= msec)
+	next_ms += each->every_ms;
+    }
+    yielded++;
+    rb_yield_values(2, frame, rb_float_new(msec));
+  }
+  return self;
+}
+
+/*
+ * Reads the frames from the current position and yields some of them with their timestamps.
+ *
+ * The frames are grabbed in a native loop without the GVL, and only the frames to be yielded
+ * are decoded (retrieved). Each frame is a new IplImage.
+ *
+ * @overload each_frame(step: 1, every_ms: nil, max: nil) { |frame, msec| ... }
+ *   @param step [Integer] Yields every <tt>step</tt>-th frame
+ *   @param every_ms [Number] Yields the first frame at or after each multiple of
+ *     <tt>every_ms</tt> milliseconds from the first frame yielded
+ *   @param max [Integer] Maximum number of frames to yield
+ *   @yieldparam frame [IplImage] Frame
+ *   @yieldparam msec [Float] Timestamp of the frame (see CvCapture#millisecond)
+ * @return [CvCapture] self
+ * @return [Enumerator] If no block is given
+ * @opencv_func cvGrabFrame
+ * @opencv_func cvRetrieveFrame
+ * @example
+ *   # One frame per second
+ *   capture.each_frame(every_ms: 1000) { |frame, msec|
+ *     index(frame, msec)
+ *   }
+ */
+VALUE
+rb_each_frame(int argc, VALUE *argv, VALUE self)
+{
+  RETURN_ENUMERATOR(self, argc, argv);
+  VALUE options;
+  rb_scan_args(argc, argv, "01", &options);
+  each_frame_t each = { self, 1, 0, -1 };
+  if (!NIL_P(options)) {
+    Check_Type(options, T_HASH);
+    each.step = IF_INT(LOOKUP_HASH(options, "step"), 1);
+    each.every_ms = IF_DBL(LOOKUP_HASH(options, "every_ms"), 0);
+    VALUE max = LOOKUP_HASH(options, "max");
+    if (!NIL_P(max) && (each.max = NUM2LONG(max)) < 0)
+      rb_raise(rb_eArgError, "max should not be negative");
+  }
+  if (each.step < 1)
+    rb_raise(rb_eArgError, "step should be greater than 0");
+  if (each.every_ms < 0)
+    rb_raise(rb_eArgError, "every_ms should not be negative");
+  capture_struct(self);
+  release_borrowed(self);
+  return each_frame_body((VALUE)&each);
+}
+
+/*
+ * Skips frames without decoding them. The frames are grabbed in a native loop without the GVL.
+ *
+ * @overload skip(n)
+ *   @param n [Integer] Number of frames to skip
+ * @return [Integer] Number of frames skipped (less than <tt>n</tt> at the end of the stream)
+ * @opencv_func cvGrabFrame
+ */
+VALUE
+rb_skip(VALUE self, VALUE n)
+{
+  long count = NUM2LONG(n);
+  if (count < 0)
+    rb_raise(rb_eArgError, "n should not be negative");
+  release_borrowed(self);
+  long skipped = 0;
+  bool eof = false;
+  while (skipped < count && !eof) {
+    sCvCapture* scap = capture_struct(self);
+    try {
+      if (prefetching(scap)) {
+	capture_frame_t frame;
+	if (take_prefetched(scap, &frame, NULL, NULL, true))
+	  skipped++;
+	else
+	  eof = true;
+	continue;
+      }
+      rb_cvCallWithoutGVL(self, [&] {
+	  if (!scap->opened) // closed by another thread while waiting; capture_struct raises
+	    return;
+	  for (int i = 0; i < GRAB_CHUNK && skipped < count; i++) {
+	    if (!scap->ptr->grab()) {
+	      eof = true;
+	      return;
+	    }
+	    skipped++;
+	  }
+	});
+    }
+    catch (cv::Exception& e) {
+      raise_cverror(e);
+    }
+    rb_thread_check_ints();
+  }
+  return LONG2NUM(skipped);
+}
+
+/*
+ * Returns the sidecar file of the index (path, or the video file name with ".cvindex")
+ */
+VALUE
+index_path(VALUE self, VALUE path)
+{
+  sCvCapture* scap = capture_struct(self);
+  if (scap->filename.empty())
+    rb_raise(rb_eArgError, "index is only available for video files");
+  if (NIL_P(path))
+    return rb_str_plus(rb_str_new_cstr(scap->filename.c_str()), rb_str_new_cstr(".cvindex"));
+  StringValue(path);
+  return path;
+}
+
+/*
+ * Gets the size and the modification time of a file
+ */
+bool
+stat_source(const char* filename, long long* size, long long* mtime)
+{
+  struct stat st;
+  if (stat(filename, &st) != 0)
+    return false;
+  *size = (long long)st.st_size;
+  *mtime = (long long)st.st_mtime;
+  return true;
+}
+
+inline unsigned long
+read_le32(const unsigned char* p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned long)p[3] << 24);
+}
+
+/*
+ * Reads the key frames of the first video stream from the legacy index (idx1) of an AVI file.
+ * Returns the number of frames in the index, or -1 if the file has no idx1.
+ */
+long
+read_avi_keyframes(const char* filename, std::vector<long>* keyframes)
+{
+  const unsigned long AVIIF_KEYFRAME = 0x10;
+  keyframes->clear();
+  FILE* fp = fopen(filename, "rb");
+  if (!fp)
+    return -1;
+  long frames = -1;
+  int video_stream = -1;
+  int streams = 0;
+  unsigned char chunk[16];
+  if (fread(chunk, 1, 12, fp) == 12 && memcmp(chunk, "RIFF", 4) == 0 && memcmp(chunk + 8, "AVI ", 4) == 0) {
+    while (fread(chunk, 1, 8, fp) == 8) {
+      unsigned long size = read_le32(chunk + 4);
+      if (memcmp(chunk, "LIST", 4) == 0) {
+	// Look into the lists except the frame data
+	if (fread(chunk, 1, 4, fp) != 4)
+	  break;
+	if (memcmp(chunk, "movi", 4) == 0 && fseek(fp, size - 4 + (size & 1), SEEK_CUR) != 0)
+	  break;
+	continue;
+      }
+      if (memcmp(chunk, "strh", 4) == 0 && size >= 4) {
+	if (fread(chunk, 1, 4, fp) != 4)
+	  break;
+	if (memcmp(chunk, "vids", 4) == 0 && video_stream < 0)
+	  video_stream = streams;
+	streams++;
+	size -= 4;
+      }
+      else if (memcmp(chunk, "idx1", 4) == 0) {
+	frames = 0;
+	for (unsigned long i = 0; i < size / 16 && fread(chunk, 1, 16, fp) == 16; i++) {
+	  // Chunk id is "##dc" (compressed) or "##db" (uncompressed) for the frames of stream ##
+	  if (chunk[2] != 'd' || (chunk[3] != 'c' && chunk[3] != 'b'))
+	    continue;
+	  if (video_stream >= 0 && (chunk[0] - '0') * 10 + (chunk[1] - '0') != video_stream)
+	    continue;
+	  if (read_le32(chunk + 4) & AVIIF_KEYFRAME)
+	    keyframes->push_back(frames);
+	  frames++;
+	}
+	break;
+      }
+      if (fseek(fp, size + (size & 1), SEEK_CUR) != 0)
+	break;
+    }
+  }
+  fclose(fp);
+  if (frames < 0)
+    keyframes->clear();
+  return frames;
+}
+
+/*
+ * Reads a sidecar file written by write_index.
+ * Returns false if the file is missing, truncated or inconsistent, so that the index is rebuilt.
+ */
+bool
+read_index(const char* path, capture_index_t* index)
+{
+  FILE* fp = fopen(path, "r");
+  if (!fp)
+    return false;
+  // Each count is bounded by the rest of the file (at least 2 bytes per number),
+  // so a corrupted count can not allocate more than the file holds
+  long length = -1;
+  if (fseek(fp, 0, SEEK_END) == 0)
+    length = ftell(fp);
+  rewind(fp);
+  int version = 0;
+  long frames = 0, keyframes = 0;
+  bool ok = length > 0 && (fscanf(fp, "RBCVINDEX %d source %lld %lld frames %ld", &version, &index->source_size,
+				  &index->source_mtime, &frames) == 4) && version == 1 &&
+    frames >= 0 && frames <= (length - ftell(fp)) / 2;
+  try {
+    if (ok) {
+      index->msec.resize(frames);
+      for (long i = 0; ok && i < frames; i++)
+	ok = (fscanf(fp, "%lf", &index->msec[i]) == 1);
+    }
+    ok = ok && fscanf(fp, " keyframes %ld", &keyframes) == 1 && keyframes >= 0 && keyframes <= frames &&
+      keyframes <= (length - ftell(fp)) / 2;
+    if (ok) {
+      index->keyframes.resize(keyframes);
+      for (long i = 0; ok && i < keyframes; i++) {
+	// Key frames are ascending frame numbers (see seek_indexed)
+	ok = (fscanf(fp, "%ld", &index->keyframes[i]) == 1) && index->keyframes[i] >= 0 &&
+	  index->keyframes[i] < frames && (i == 0 || index->keyframes[i - 1] < index->keyframes[i]);
+      }
+    }
+  }
+  catch (std::bad_alloc& e) {
+    ok = false;
+  }
+  fclose(fp);
+  return ok;
+}
+
+/*
+ * Writes an index to a sidecar file.
+ * The index is only a cache, so a failure is a warning: the index is kept in memory.
+ */
+void
+write_index(const char* path, const capture_index_t* index)
+{
+  FILE* fp = fopen(path, "w");
+  if (!fp) {
+    rb_warn("could not write the index %s: %s", path, strerror(errno));
+    return;
+  }
+  fprintf(fp, "RBCVINDEX 1\nsource %lld %lld\nframes %ld\n", index->source_size, index->source_mtime,
+	  (long)index->msec.size());
+  for (size_t i = 0; i < index->msec.size(); i++)
+    fprintf(fp, "%.17g\n", index->msec[i]);
+  fprintf(fp, "keyframes %ld\n", (long)index->keyframes.size());
+  for (size_t i = 0; i < index->keyframes.size(); i++)
+    fprintf(fp, "%ld\n", index->keyframes[i]);
+  bool failed = ferror(fp) != 0;
+  if (fclose(fp) != 0 || failed) {
+    rb_warn("could not write the index %s: %s", path, strerror(errno));
+    remove(path); // a truncated file would be read as stale anyway
+  }
+}
+
+/*
+ * Grabs all frames from the start in one pass to record their timestamps,
+ * and restores the position of the capture
+ */
+void
+build_index(rb_cvVideoSource* capture, capture_index_t* index)
+{
+  long current = (long)capture->get(CV_CAP_PROP_POS_FRAMES);
+  index->msec.clear();
+  capture->set(CV_CAP_PROP_POS_FRAMES, 0);
+  while (capture->grab())
+    index->msec.push_back(capture->get(CV_CAP_PROP_POS_MSEC));
+  capture->set(CV_CAP_PROP_POS_FRAMES, 0);
+  seek_indexed(capture, index, std::min(current, (long)index->msec.size()));
+}
+
+/*
+ * Returns the frame for a value of CV_CAP_PROP_POS_FRAMES, CV_CAP_PROP_POS_MSEC or CV_CAP_PROP_POS_AVI_RATIO
+ */
+long
+indexed_frame(const capture_index_t* index, int id, double value)
+{
+  long frames = (long)index->msec.size();
+  double frame;
+  switch (id) {
+  case CV_CAP_PROP_POS_MSEC:
+    // The first frame at or after value
+    frame = std::lower_bound(index->msec.begin(), index->msec.end(), value) - index->msec.begin();
+    break;
+  case CV_CAP_PROP_POS_AVI_RATIO:
+    frame = cvRound(value * frames);
+    break;
+  default:
+    frame = cvRound(value);
+    break;
+  }
+  return (long)std::max(0.0, std::min(frame, (double)frames));
+}
+
+/*
+ * Moves to the target frame. The backend seeks to the last key frame before the target,
+ * and the frames from there are grabbed without decoding. A seek forward within the same
+ * key frame interval only grabs the frames in between.
+ */
+void
+seek_indexed(rb_cvVideoSource* capture, const capture_index_t* index, long target)
+{
+  long current = (long)capture->get(CV_CAP_PROP_POS_FRAMES);
+  if (current == target)
+    return;
+  long start = target;
+  const std::vector<long>& keyframes = index->keyframes;
+  if (!keyframes.empty()) {
+    std::vector<long>::const_iterator it = std::upper_bound(keyframes.begin(), keyframes.end(), target);
+    start = (it == keyframes.begin()) ? 0 : *(it - 1);
+  }
+  if (current < start || current > target) {
+    capture->set(CV_CAP_PROP_POS_FRAMES, start);
+    current = start;
+  }
+  while (current < target && capture->grab())
+    current++;
+}
+
+/*
+ * Builds an index of the video file in one pass, and saves it to a sidecar file.
+ *
+ * With the index, CvCapture#frames=, CvCapture#millisecond= and CvCapture#avi_ratio=
+ * land on the exact frame: the backend only seeks to key frames (read from the index of
+ * AVI files), and short seeks forward grab the frames in between instead of seeking.
+ *
+ * @overload build_index(path = nil)
+ *   @param path [String, false] Sidecar file (the video file name with ".cvindex" by default).
+ *     If false, the index is not saved. If the file can not be written, a warning is issued
+ *     and the index is only kept in memory.
+ * @return [Integer] Number of frames
+ * @opencv_func cvGrabFrame
+ * @example
+ *   capture = CvCapture.open('movie.avi', index: true) # loads or builds movie.avi.cvindex
+ *   capture.millisecond = 12_000
+ *   frame = capture.query
+ */
+VALUE
+rb_build_index(int argc, VALUE *argv, VALUE self)
+{
+  VALUE path;
+  rb_scan_args(argc, argv, "01", &path);
+  sCvCapture* scap = capture_struct(self);
+  if (path != Qfalse)
+    path = index_path(self, path);
+  else if (scap->filename.empty())
+    index_path(self, Qnil); // raises
+  long long size, mtime;
+  if (!stat_source(scap->filename.c_str(), &size, &mtime))
+    rb_sys_fail(scap->filename.c_str());
+  release_borrowed(self);
+
+  capture_index_t* index = new capture_index_t();
+  index->source_size = size;
+  index->source_mtime = mtime;
+  try {
+    with_capture(self, [&](rb_cvVideoSource* capture) {
+	long frames = read_avi_keyframes(scap->filename.c_str(), &index->keyframes);
+	build_index(capture, index);
+	if (frames != (long)index->msec.size())
+	  index->keyframes.clear(); // the backend does not count frames as the idx1
+	std::swap(scap->index, index);
+      }, true);
+  }
+  catch (cv::Exception& e) {
+    delete index;
+    raise_cverror(e);
+  }
+  delete index;
+  if (path != Qfalse)
+    write_index(StringValueCStr(path), scap->index);
+  return LONG2NUM((long)scap->index->msec.size());
+}
+
+/*
+ * Loads an index saved by CvCapture#build_index.
+ * @overload load_index(path = nil)
+ *   @param path [String] Sidecar file (the video file name with ".cvindex" by default)
+ * @return [Boolean] False if the sidecar file does not exist, is corrupted, or was built for another version
+ *   of the video file
+ */
+VALUE
+rb_load_index(int argc, VALUE *argv, VALUE self)
+{
+  VALUE path;
+  rb_scan_args(argc, argv, "01", &path);
+  sCvCapture* scap = capture_struct(self);
+  path = index_path(self, path);
+  long long size, mtime;
+  if (!stat_source(scap->filename.c_str(), &size, &mtime))
+    return Qfalse;
+  capture_index_t* index = new capture_index_t();
+  if (!read_index(StringValueCStr(path), index) || index->source_size != size || index->source_mtime != mtime) {
+    delete index;
+    return Qfalse;
+  }
+  release_borrowed(self);
+  try {
+    with_capture(self, [&](rb_cvVideoSource* capture) { std::swap(scap->index, index); }, true);
+  }
+  catch (cv::Exception& e) {
+    delete index;
+    raise_cverror(e);
+  }
+  delete index;
+  return Qtrue;
+}
+
+/*
+ * Returns whether the video file is indexed
+ * @overload indexed?
+ * @return [Boolean] True if CvCapture#build_index or CvCapture#load_index succeeded
+ */
+VALUE
+rb_indexed_q(VALUE self)
+{
+  return capture_struct(self)->index ? Qtrue : Qfalse;
+}
+
+/*
+ * Returns the key frames of the indexed video file, which can be read with the least decoding
+ * @overload keyframes
+ * @return [Array<Integer>] Key frames (empty if unknown: any frame is used as a key frame)
+ * @return [nil] If the video file is not indexed
+ */
+VALUE
+rb_keyframes(VALUE self)
+{
+  sCvCapture* scap = capture_struct(self);
+  if (!scap->index)
+    return Qnil;
+  const std::vector<long>& keyframes = scap->index->keyframes;
+  VALUE result = rb_ary_new2(keyframes.size());
+  for (size_t i = 0; i < keyframes.size(); i++)
+    rb_ary_store(result, i, LONG2NUM(keyframes[i]));
+  return result;
+}
+
+/*
+ * Starts decoding frames ahead on a native thread.
+ *
+ * Up to <tt>depth</tt> frames are decoded into a ring buffer while the caller processes the
+ * previous ones, and CvCapture#query hands over the next ready frame without decoding or copying it.
+ * The handed-over image leaves the ring, so the decoder thread allocates a new one for each frame;
+ * with <tt>query(into: image)</tt> the frame is copied instead, and the images of the ring are
+ * reused without any allocation per frame.
+ * CvCapture#grab and CvCapture#retrieve also read from the ring buffer.
+ * Setting the position (CvCapture#frames=, CvCapture#millisecond=, ...) discards the queued frames,
+ * and CvCapture#frames and CvCapture#millisecond return the position of the frames taken.
+ *
+ * @overload prefetch(depth = 4, drop: false, rate: nil)
+ *   @param depth [Integer] Maximum number of frames decoded ahead
+ *   @param drop [Boolean] If true, the oldest frame is dropped when the ring buffer is full
+ *     (for cameras), otherwise the decoder thread waits for the caller.
+ *   @param rate [Number] Grabs no more than <tt>rate</tt> frames per second, which makes a video
+ *     file or an image sequence behave like a camera. By default frames are grabbed as fast as
+ *     the source delivers them.
+ * @return [CvCapture] self
+ * @opencv_func cvQueryFrame
+ * @example
+ *   capture = CvCapture.open('movie.avi').prefetch(8)
+ *   while frame = capture.query
+ *     detect(frame)
+ *   end
+ *   p capture.prefetch_stats
+ */
+VALUE
+rb_prefetch(int argc, VALUE *argv, VALUE self)
+{
+  VALUE depth, options;
+  rb_scan_args(argc, argv, "02", &depth, &options);
+  if (argc == 1 && TYPE(depth) == T_HASH) {
+    options = depth;
+    depth = Qnil;
+  }
+  int depth_value = NIL_P(depth) ? 4 : NUM2INT(depth);
+  if (depth_value < 1)
+    rb_raise(rb_eArgError, "depth should be greater than 0");
+  bool drop = false;
+  double rate = 0;
+  if (!NIL_P(options)) {
+    Check_Type(options, T_HASH);
+    drop = RTEST(LOOKUP_HASH(options, "drop"));
+    rate = prefetch_rate(LOOKUP_HASH(options, "rate"));
+  }
+  return restart_prefetch(self, depth_value, drop, rate);
+}
+
+/*
+ * Reads the rate: option of CvCapture#prefetch and CvCapture#live
+ */
+double
+prefetch_rate(VALUE rate)
+{
+  if (NIL_P(rate))
+    return 0;
+  double value = NUM2DBL(rate);
+  if (!(value > 0))
+    rb_raise(rb_eArgError, "rate should be greater than 0");
+  return value;
+}
+
+/*
+ * (Re)starts the decoder thread (see start_prefetch)
+ */
+VALUE
+restart_prefetch(VALUE self, size_t depth, bool drop, double rate)
+{
+  sCvCapture* scap = capture_struct(self);
+  release_borrowed(self);
+  bool started = false, closed = false;
+  try {
+    rb_cvCallWithoutGVL(self, [&] {
+	if (!scap->opened) { // closed by another thread while waiting
+	  closed = true;
+	  return;
+	}
+	if (prefetching(scap))
+	  stop_prefetch(scap);
+	started = start_prefetch(scap, depth, drop, rate);
+      });
+  }
+  catch (cv::Exception& e) {
+    raise_cverror(e);
+  }
+  if (closed)
+    rb_raise(rb_eIOError, "Resource is not available!");
+  if (!started)
+    rb_raise(rb_eRuntimeError, "failed to create a decoder thread");
+  return self;
+}
+
+/*
+ * Starts grabbing frames continuously on a native thread, keeping only the newest one.
+ *
+ * CvCapture#query (and CvCapture#grab) returns the most recent frame instead of a stale frame
+ * buffered while the caller was busy, or waits for the next one if it was already taken.
+ * CvCapture#timestamp is the time the frame was grabbed, and CvCapture#skipped_frames the number
+ * of frames dropped since the previous one. Same as <tt>prefetch(1, drop: true)</tt>,
+ * and stopped by CvCapture#stop_prefetch.
+ *
+ * @overload live(rate: nil)
+ *   @param rate [Number] Grabs no more than <tt>rate</tt> frames per second, which makes a video
+ *     file or an image sequence behave like a camera (see CvCapture#prefetch)
+ * @return [CvCapture] self
+ * @opencv_func cvQueryFrame
+ * @example
+ *   capture = CvCapture.open(0).live
+ *   while frame = capture.query
+ *     puts "#{capture.skipped_frames} frames skipped" if capture.skipped_frames > 0
+ *     detect(frame, capture.timestamp)
+ *   end
+ */
+VALUE
+rb_live(int argc, VALUE *argv, VALUE self)
+{
+  VALUE options;
+  rb_scan_args(argc, argv, "01", &options);
+  double rate = 0;
+  if (!NIL_P(options)) {
+    Check_Type(options, T_HASH);
+    rate = prefetch_rate(LOOKUP_HASH(options, "rate"));
+  }
+  return restart_prefetch(self, 1, true, rate);
+}
+
+/*
+ * Returns the time the last frame taken was grabbed by the decoder thread
+ * (see CvCapture#prefetch and CvCapture#live)
+ *
+ * @overload timestamp
+ * @return [Time, nil] Time of the frame, or nil if the capture is not prefetching or no frame was taken
+ */
+VALUE
+rb_get_timestamp(VALUE self)
+{
+  sCvCapture* scap = capture_struct(self);
+  if (!prefetching(scap))
+    return Qnil;
+  double timestamp;
+  {
+    std::lock_guard<std::mutex> lock(scap->prefetch->mutex);
+    timestamp = scap->prefetch->timestamp;
+  }
+  if (timestamp == 0)
+    return Qnil;
+  return rb_funcall(rb_cTime, rb_intern("at"), 1, rb_float_new(timestamp));
+}
+
+/*
+ * Returns the number of frames dropped between the last two frames taken,
+ * because the caller was slower than the source (see CvCapture#live)
+ *
+ * @overload skipped_frames
+ * @return [Integer, nil] Number of frames, or nil if the capture is not prefetching
+ */
+VALUE
+rb_get_skipped_frames(VALUE self)
+{
+  sCvCapture* scap = capture_struct(self);
+  if (!prefetching(scap))
+    return Qnil;
+  std::lock_guard<std::mutex> lock(scap->prefetch->mutex);
+  return SIZET2NUM(scap->prefetch->skipped);
+}
+
+/*
+ * Stops decoding frames ahead. The queued frames are discarded,
+ * so the next frame read may not follow the last one taken.
+ *
+ * @overload stop_prefetch
+ * @return [Boolean] False if the capture was not prefetching
+ */
+VALUE
+rb_stop_prefetch(VALUE self)
+{
+  sCvCapture* scap = capture_struct(self);
+  if (!prefetching(scap))
+    return Qfalse;
+  release_borrowed(self);
+  rb_cvCallWithoutGVL(self, [&] {
+      if (scap->opened) // else stopped by CvCapture#close
+	stop_prefetch(scap);
+    });
+  return Qtrue;
+}
+
+/*
+ * Returns whether the capture is decoding frames ahead (see CvCapture#prefetch)
+ *
+ * @overload prefetch?
+ * @return [Boolean]
+ */
+VALUE
+rb_prefetch_q(VALUE self)
+{
+  return prefetching(capture_struct(self)) ? Qtrue : Qfalse;
+}
+
+/*
+ * Returns the statistics of the decoder thread since CvCapture#prefetch
+ *
+ * @overload prefetch_stats
+ * @return [Hash, nil] Statistics, or nil if the capture is not prefetching
+ *   * <tt>:depth</tt> - Number of frames ready in the ring buffer
+ *   * <tt>:capacity</tt> - Size of the ring buffer
+ *   * <tt>:max_depth</tt> - Maximum number of frames that were ready at once
+ *   * <tt>:decoded</tt> - Number of frames decoded
+ *   * <tt>:delivered</tt> - Number of frames taken by CvCapture#query or CvCapture#grab
+ *   * <tt>:dropped</tt> - Number of frames dropped because the ring buffer was full (with <tt>drop: true</tt>)
+ *   * <tt>:discarded</tt> - Number of frames discarded by changing the position
+ *   * <tt>:waits</tt> - Number of times the caller had to wait for a frame
+ *   * <tt>:decode_time</tt> - Average time to decode a frame (seconds)
+ *   * <tt>:max_decode_time</tt> - Maximum time to decode a frame (seconds)
+ */
+VALUE
+rb_prefetch_stats(VALUE self)
+{
+  sCvCapture* scap = capture_struct(self);
+  if (!prefetching(scap))
+    return Qnil;
+  capture_prefetch_t* prefetch = scap->prefetch;
+  size_t values[8];
+  double decode_time, max_decode_time;
+  {
+    std::lock_guard<std::mutex> lock(prefetch->mutex);
+    size_t stats[] = { prefetch->count, prefetch->ring.size(), prefetch->max_depth, prefetch->decoded,
+		       prefetch->delivered, prefetch->dropped, prefetch->discarded, prefetch->waits };
+    memcpy(values, stats, sizeof(values));
+    decode_time = prefetch->decoded > 0 ? prefetch->decode_time / prefetch->decoded : 0.0;
+    max_decode_time = prefetch->max_decode_time;
+  }
+  const char* keys[] = { "depth", "capacity", "max_depth", "decoded", "delivered", "dropped", "discarded", "waits" };
+  VALUE hash = rb_hash_new();
+  for (int i = 0; i < 8; i++)
+    rb_hash_aset(hash, ID2SYM(rb_intern(keys[i])), SIZET2NUM(values[i]));
+  rb_hash_aset(hash, ID2SYM(rb_intern("decode_time")), rb_float_new(decode_time));
+  rb_hash_aset(hash, ID2SYM(rb_intern("max_decode_time")), rb_float_new(max_decode_time));
+  return hash;
+}
+
+void
+init_ruby_class()
+{
+#if 0
+  // For documentation using YARD
+  VALUE opencv = rb_define_module("OpenCV");
+#endif
+
+  if (rb_klass)
+    return;
+
+  VALUE opencv = rb_module_opencv();
+  
+  rb_klass = rb_define_class_under(opencv, "CvCapture", rb_cObject);
+  rb_undef_alloc_func(rb_klass);
   
   VALUE video_interface = rb_hash_new();
   /*
@@ -595,11 +2460,14 @@ init_ruby_class()
   rb_hash_aset(video_interface, ID2SYM(rb_intern("quicktime")), INT2FIX(CV_CAP_QT));
   
   rb_define_singleton_method(rb_klass, "open", RUBY_METHOD_FUNC(rb_open), -1);
+  rb_define_singleton_method(rb_klass, "decode", RUBY_METHOD_FUNC(rb_decode), -1);
   rb_define_method(rb_klass, "close", RUBY_METHOD_FUNC(rb_close), 0);
   
   rb_define_method(rb_klass, "grab", RUBY_METHOD_FUNC(rb_grab), 0);
-  rb_define_method(rb_klass, "retrieve", RUBY_METHOD_FUNC(rb_retrieve), 0);
-  rb_define_method(rb_klass, "query", RUBY_METHOD_FUNC(rb_query), 0);
+  rb_define_method(rb_klass, "retrieve", RUBY_METHOD_FUNC(rb_retrieve), -1);
+  rb_define_method(rb_klass, "query", RUBY_METHOD_FUNC(rb_query), -1);
+  rb_define_method(rb_klass, "each_frame", RUBY_METHOD_FUNC(rb_each_frame), -1);
+  rb_define_method(rb_klass, "skip", RUBY_METHOD_FUNC(rb_skip), 1);
   rb_define_method(rb_klass, "millisecond", RUBY_METHOD_FUNC(rb_get_millisecond), 0);
   rb_define_method(rb_klass, "millisecond=", RUBY_METHOD_FUNC(rb_set_millisecond), 1);
   rb_define_method(rb_klass, "frames", RUBY_METHOD_FUNC(rb_get_frames), 0);
@@ -626,6 +2494,18 @@ init_ruby_class()
   rb_define_method(rb_klass, "exposure", RUBY_METHOD_FUNC(rb_get_exposure), 0);
   rb_define_method(rb_klass, "convert_rgb", RUBY_METHOD_FUNC(rb_get_convert_rgb), 0);
   rb_define_method(rb_klass, "rectification", RUBY_METHOD_FUNC(rb_get_rectification), 0);
+
+  rb_define_method(rb_klass, "build_index", RUBY_METHOD_FUNC(rb_build_index), -1);
+  rb_define_method(rb_klass, "load_index", RUBY_METHOD_FUNC(rb_load_index), -1);
+  rb_define_method(rb_klass, "indexed?", RUBY_METHOD_FUNC(rb_indexed_q), 0);
+  rb_define_method(rb_klass, "keyframes", RUBY_METHOD_FUNC(rb_keyframes), 0);
+  rb_define_method(rb_klass, "prefetch", RUBY_METHOD_FUNC(rb_prefetch), -1);
+  rb_define_method(rb_klass, "stop_prefetch", RUBY_METHOD_FUNC(rb_stop_prefetch), 0);
+  rb_define_method(rb_klass, "prefetch?", RUBY_METHOD_FUNC(rb_prefetch_q), 0);
+  rb_define_method(rb_klass, "prefetch_stats", RUBY_METHOD_FUNC(rb_prefetch_stats), 0);
+  rb_define_method(rb_klass, "live", RUBY_METHOD_FUNC(rb_live), -1);
+  rb_define_method(rb_klass, "timestamp", RUBY_METHOD_FUNC(rb_get_timestamp), 0);
+  rb_define_method(rb_klass, "skipped_frames", RUBY_METHOD_FUNC(rb_get_skipped_frames), 0);
 }
 
 __NAMESPACE_END_CVCAPTURE
@@ -11,15 +11,95 @@
 #define RUBY_OPENCV_CVCAPTURE_H
 
 #include "opencv.h"
+#include "videoio.h"
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
 
 #define __NAMESPACE_BEGIN_CVCAPTURE namespace cCvCapture {
 #define __NAMESPACE_END_CVCAPTURE }
 
 __NAMESPACE_BEGIN_OPENCV
 
+/*
+ * A frame decoded ahead of the caller
+ */
 typedef struct {
-  CvCapture* ptr;
+  IplImage* image; // top-left origin
+  double msec; // CV_CAP_PROP_POS_MSEC of the frame
+  double pos; // CV_CAP_PROP_POS_FRAMES after the frame
+  double timestamp; // seconds since the Epoch when the frame was grabbed
+} capture_frame_t;
+
+/*
+ * State of the background decoder thread (see CvCapture#prefetch)
+ */
+typedef struct {
+  std::mutex capture_mutex; // held while the CvCapture is used
+  std::mutex mutex; // guards the rest
+  std::condition_variable cond;
+  std::thread thread;
+  std::vector<capture_frame_t> ring;
+  size_t head;
+  size_t count;
+  bool drop; // drop the oldest frame instead of waiting when the ring is full
+  double rate; // frames per second grabbed by the decoder thread (0 for as fast as possible)
+  bool active;
+  bool eof;
+  bool failed;
+  bool interrupted;
+  cv::Exception error;
+  unsigned long generation; // incremented when the queued frames are discarded
+  capture_frame_t grabbed; // frame taken by #grab
+  double msec; // position of the last frame taken
+  double pos;
+  double timestamp; // of the last frame taken
+  size_t skipped; // frames dropped just before the last frame taken
+  size_t skipping; // frames dropped since the last frame taken
+
+  // Statistics
+  size_t decoded;
+  size_t delivered;
+  size_t dropped;
+  size_t discarded;
+  size_t waits;
+  size_t max_depth;
+  double decode_time; // seconds
+  double max_decode_time;
+} capture_prefetch_t;
+
+/*
+ * Seek index of a video file (see CvCapture#build_index)
+ */
+typedef struct {
+  std::vector<double> msec; // CV_CAP_PROP_POS_MSEC of each frame
+  std::vector<long> keyframes; // frames the backend can seek to directly (empty if unknown)
+  long long source_size; // size and modification time of the indexed file
+  long long source_mtime;
+} capture_index_t;
+
+/*
+ * Reader of the IO of a stream capture (see CvCapture.open)
+ */
+typedef struct {
+  VALUE io;
+  ID read_id; // readpartial or read
+  std::shared_ptr<rb_cvByteQueue> queue;
+} stream_feeder_t;
+
+#define STREAM_BUFFER_SIZE (1 << 20)
+#define STREAM_CHUNK_SIZE 65536
+
+typedef struct {
+  rb_cvVideoSource* ptr; // highgui or a native reader
   bool opened;
+  capture_prefetch_t* prefetch; // allocated by the first CvCapture#prefetch
+  IplImage* flipped; // buffer for borrowing bottom-left frames
+  capture_index_t* index; // set by CvCapture#build_index or #load_index
+  std::string filename; // empty for devices
 } sCvCapture;
 
 __NAMESPACE_BEGIN_CVCAPTURE
@@ -29,14 +109,19 @@ VALUE rb_class();
 
 void init_ruby_class();
 
+void release_capture(sCvCapture* scap);
 void cvcapture_free(void *ptr);
+size_t cvcapture_memsize(const void *ptr);
 VALUE rb_open(int argc, VALUE *argv, VALUE klass);
+VALUE rb_decode(int argc, VALUE *argv, VALUE klass);
 
 VALUE rb_close(VALUE self);
 
 VALUE rb_grab(VALUE self);
-VALUE rb_retrieve(VALUE self);
-VALUE rb_query(VALUE self);
+VALUE rb_retrieve(int argc, VALUE *argv, VALUE self);
+VALUE rb_query(int argc, VALUE *argv, VALUE self);
+VALUE rb_each_frame(int argc, VALUE *argv, VALUE self);
+VALUE rb_skip(VALUE self, VALUE n);
 
 VALUE rb_get_millisecond(VALUE self);
 VALUE rb_set_millisecond(VALUE self, VALUE value);
@@ -65,13 +150,63 @@ VALUE rb_get_exposure(VALUE self);
 VALUE rb_get_convert_rgb(VALUE self);
 VALUE rb_get_rectification(VALUE self);
 
+VALUE rb_build_index(int argc, VALUE *argv, VALUE self);
+VALUE rb_load_index(int argc, VALUE *argv, VALUE self);
+VALUE rb_indexed_q(VALUE self);
+VALUE rb_keyframes(VALUE self);
+
+VALUE rb_prefetch(int argc, VALUE *argv, VALUE self);
+VALUE rb_stop_prefetch(VALUE self);
+VALUE rb_prefetch_q(VALUE self);
+VALUE rb_prefetch_stats(VALUE self);
+VALUE rb_live(int argc, VALUE *argv, VALUE self);
+VALUE rb_get_timestamp(VALUE self);
+VALUE rb_get_skipped_frames(VALUE self);
+
+sCvCapture* capture_struct(VALUE self);
+rb_cvVideoSource* open_video_file(const char* filename, bool native, double fps);
+VALUE wrap_source(rb_cvVideoSource* source, const char* filename);
+VALUE sequence_paths(VALUE device, VALUE sequence);
+rb_cvVideoSource* open_sequence(VALUE paths, double fps, int threads, int queue_size);
+stream_feeder_t* stream_feeder(VALUE feeder);
+bool push_stream_chunk(rb_cvByteQueue* queue, VALUE chunk);
+rb_cvVideoSource* open_stream(VALUE io, double fps, size_t buffer_size, VALUE* thread);
+bool prefetching(sCvCapture* scap);
+void copy_frame(const IplImage* frame, CvArr* dest);
+void frame_options(int argc, VALUE *argv, VALUE* into, bool* borrow);
+bool frame_fits(const IplImage* frame, CvArr* dest);
+void raise_unfit_destination(CvSize size, int type);
+IplImage* borrowed_header(sCvCapture* scap, IplImage* frame);
+VALUE borrow_frame(VALUE self, IplImage* header);
+void release_borrowed(VALUE self);
+VALUE read_frame(int argc, VALUE *argv, VALUE self, bool query);
+VALUE index_path(VALUE self, VALUE path);
+bool stat_source(const char* filename, long long* size, long long* mtime);
+long read_avi_keyframes(const char* filename, std::vector<long>* keyframes);
+bool read_index(const char* path, capture_index_t* index);
+void write_index(const char* path, const capture_index_t* index);
+void build_index(rb_cvVideoSource* capture, capture_index_t* index);
+long indexed_frame(const capture_index_t* index, int id, double value);
+void seek_indexed(rb_cvVideoSource* capture, const capture_index_t* index, long target);
+void release_frame(capture_frame_t* frame);
+void prefetch_worker(sCvCapture* scap);
+bool start_prefetch(sCvCapture* scap, size_t depth, bool drop, double rate = 0);
+double prefetch_rate(VALUE rate);
+VALUE restart_prefetch(VALUE self, size_t depth, bool drop, double rate);
+void stop_prefetch(sCvCapture* scap);
+void discard_prefetched(capture_prefetch_t* prefetch);
+void* wait_prefetched(void* arg);
+void interrupt_prefetched(void* arg);
+bool take_prefetched(sCvCapture* scap, capture_frame_t* frame, CvArr* into = NULL, bool* fits = NULL,
+		     bool keep = false);
+
 __NAMESPACE_END_CVCAPTURE
 
 
-inline CvCapture*
+inline rb_cvVideoSource*
 CVCAPTURE(VALUE object) {
   sCvCapture *scap;
-  Data_Get_Struct(object, sCvCapture, scap);
+  scap = (sCvCapture*)OPENCV_DATA_PTR(object);
   if (!scap->opened)
     rb_raise(rb_eIOError, "Resource is not available!");
   return scap->ptr;
@@ -33,7 +33,7 @@ rb_class()
 VALUE
 rb_allocate(VALUE klass)
 {
-  return Data_Wrap_Struct(klass, mark_root_object, unregister_object, NULL);
+  return wrap_rooted_object(klass, &refer_object_type, NULL, Qnil);
 }
 
 /*
@@ -46,24 +46,19 @@ rb_allocate(VALUE klass)
 VALUE
 rb_initialize(int argc, VALUE *argv, VALUE self)
 {
-  CvMemStorage *storage;
   VALUE storage_value;
-  if (rb_scan_args(argc, argv, "01", &storage_value) > 0) {
-    storage_value = CHECK_CVMEMSTORAGE(storage_value);
-    storage = CVMEMSTORAGE(storage_value);
-  }
-  else
-    storage = rb_cvCreateMemStorage(0);
+  rb_scan_args(argc, argv, "01", &storage_value);
+  storage_value = CHECK_CVMEMSTORAGE(storage_value);
+  CvMemStorage *storage = CVMEMSTORAGE(storage_value);
   try {
-    DATA_PTR(self) = (CvChain*)cvCreateSeq(CV_SEQ_ELTYPE_CODE, sizeof(CvChain),
+    rooted_object(self)->ptr = (CvChain*)cvCreateSeq(CV_SEQ_ELTYPE_CODE, sizeof(CvChain),
 					   sizeof(int), storage);
   }
   catch (cv::Exception& e) {
     raise_cverror(e);
   }
-  CvSeq* self_ptr = CVSEQ(self);
-  cCvSeq::register_elem_class(self_ptr, rb_cInteger);
-  register_root_object(self_ptr, storage_value);
+  cCvSeq::register_elem_class(self, rb_cInteger);
+  register_root_object(self, storage_value);
 
   return self;
 }
@@ -191,7 +186,7 @@ new_object()
   catch (cv::Exception& e) {
     raise_cverror(e);
   }
-  return cCvSeq::new_sequence(cCvChain::rb_class(), seq, T_FIXNUM, storage);
+  return cCvSeq::new_sequence(cCvChain::rb_class(), seq, rb_cInteger, storage);
 }
 
 void
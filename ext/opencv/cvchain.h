@@ -37,7 +37,7 @@ __NAMESPACE_END_CVCHAIN
 inline CvChain*
 CVCHAIN(VALUE object){
   CvChain *ptr;
-  Data_Get_Struct(object, CvChain, ptr);
+  ptr = (CvChain*)OPENCV_DATA_PTR(object);
   return ptr;
 }
 
@@ -26,11 +26,13 @@ rb_class()
   return rb_klass;
 }
 
+const rb_data_type_t data_type = OPENCV_STRUCT_TYPE("OpenCV::CvCircle32f", CvCircle32f, RUBY_TYPED_DEFAULT_FREE);
+
 VALUE
 rb_allocate(VALUE klass)
 {
   CvCircle32f *ptr;
-  return Data_Make_Struct(klass, CvCircle32f, 0, -1, ptr);
+  return TypedData_Make_Struct(klass, CvCircle32f, &data_type, ptr);
 }
 
 /*
@@ -43,7 +43,7 @@ inline CvCircle32f*
 CVCIRCLE32F(VALUE object)
 {
   CvCircle32f *ptr;
-  Data_Get_Struct(object, CvCircle32f, ptr);
+  ptr = (CvCircle32f*)OPENCV_DATA_PTR(object);
   return ptr;
 }
 
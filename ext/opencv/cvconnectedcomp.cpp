@@ -25,11 +25,13 @@ rb_class()
   return rb_klass;
 }
 
+const rb_data_type_t data_type = OPENCV_STRUCT_TYPE("OpenCV::CvConnectedComp", CvConnectedComp, RUBY_TYPED_DEFAULT_FREE);
+
 VALUE
 rb_allocate(VALUE klass)
 {
   CvConnectedComp *ptr;
-  return Data_Make_Struct(klass, CvConnectedComp, 0, -1, ptr);
+  return TypedData_Make_Struct(klass, CvConnectedComp, &data_type, ptr);
 }
 
 /*
@@ -40,7 +40,7 @@ inline CvConnectedComp*
 CVCONNECTEDCOMP(VALUE object)
 {
   CvConnectedComp *ptr;
-  Data_Get_Struct(object, CvConnectedComp, ptr);
+  ptr = (CvConnectedComp*)OPENCV_DATA_PTR(object);
   return ptr;
 }
 
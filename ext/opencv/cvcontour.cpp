@@ -37,7 +37,7 @@ rb_class()
 VALUE
 rb_allocate(VALUE klass)
 {
-  return Data_Wrap_Struct(klass, mark_root_object, unregister_object, NULL);
+  return wrap_rooted_object(klass, &refer_object_type, NULL, Qnil);
 }
 
 /*
@@ -80,7 +80,7 @@ rb_initialize(int argc, VALUE *argv, VALUE self)
   storage_value = CHECK_CVMEMSTORAGE(storage_value);
 
   try {
-    DATA_PTR(self) = (CvContour*)cCvSeq::create_seq(seq_flags, sizeof(CvContour), storage_value);
+    cCvSeq::create_seq(self, seq_flags, sizeof(CvContour), storage_value);
   }
   catch (cv::Exception& e) {
     raise_cverror(e);
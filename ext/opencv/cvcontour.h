@@ -42,7 +42,7 @@ __NAMESPACE_END_CVCONTOUR
 inline CvContour*
 CVCONTOUR(VALUE object){
   CvContour *ptr;
-  Data_Get_Struct(object, CvContour, ptr);
+  ptr = (CvContour*)OPENCV_DATA_PTR(object);
   return ptr;
 }
 
@@ -32,7 +32,7 @@ __NAMESPACE_END_CVCONTOURTREE
 inline CvContourTree*
 CVCONTOURTREE(VALUE object){
   CvContourTree *ptr;
-  Data_Get_Struct(object, CvContourTree, ptr);
+  ptr = (CvContourTree*)OPENCV_DATA_PTR(object);
   return ptr;
 }
 
@@ -33,7 +33,7 @@ inline CvConvexityDefect*
 CVCONVEXITYDEFECT(VALUE object)
 {
   CvConvexityDefect *ptr;
-  Data_Get_Struct(object, CvConvexityDefect, ptr);
+  ptr = (CvConvexityDefect*)OPENCV_DATA_PTR(object);
   return ptr;
 }
 
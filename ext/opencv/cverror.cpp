@@ -48,6 +48,15 @@ raise(cv::Exception e)
   rb_raise(by_code(e.code), "%s", e.what());
 }
 
+/*
+ * Returns the exception object that raise(e) would raise
+ */
+VALUE
+exception(const cv::Exception& e)
+{
+  return rb_exc_new2(by_code(e.code), e.what());
+}
+
 void
 init_ruby_class()
 {
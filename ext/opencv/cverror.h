@@ -21,6 +21,7 @@ __NAMESPACE_BEGIN_CVERROR
 void init_ruby_class();
 VALUE by_code(int error_code);
 void raise(cv::Exception e);
+VALUE exception(const cv::Exception& e);
 
 __NAMESPACE_END_CVERROR
 __NAMESPACE_END_OPENCV
@@ -40,12 +40,17 @@ rb_release_feature_tree(void *ptr)
   }
 }
 
+const rb_data_type_t data_type = {
+  "OpenCV::CvFeatureTree",
+  { mark_feature_tree, rb_release_feature_tree, memsize_struct<CvFeatureTreeWrap>, },
+  &opencv_data_type, 0, RUBY_TYPED_FREE_IMMEDIATELY
+};
+
 VALUE
 rb_allocate(VALUE klass)
 {
   CvFeatureTreeWrap* ptr;
-  return Data_Make_Struct(klass, CvFeatureTreeWrap, mark_feature_tree,
-			  rb_release_feature_tree, ptr);
+  return TypedData_Make_Struct(klass, CvFeatureTreeWrap, &data_type, ptr);
 }
 
 /*
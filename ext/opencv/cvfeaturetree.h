@@ -35,7 +35,7 @@ inline CvFeatureTree*
 CVFEATURETREE(VALUE object)
 {
   CvFeatureTreeWrap* ptr;
-  Data_Get_Struct(object, CvFeatureTreeWrap, ptr);
+  ptr = (CvFeatureTreeWrap*)OPENCV_DATA_PTR(object);
   return ptr->feature_tree;
 }
 
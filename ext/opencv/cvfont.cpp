@@ -39,11 +39,13 @@ rb_class()
   return rb_klass;
 }
 
+const rb_data_type_t data_type = OPENCV_STRUCT_TYPE("OpenCV::CvFont", CvFont, RUBY_TYPED_DEFAULT_FREE);
+
 VALUE
 rb_allocate(VALUE klass)
 {
   CvFont *ptr;
-  return Data_Make_Struct(klass, CvFont, 0, -1, ptr);
+  return TypedData_Make_Struct(klass, CvFont, &data_type, ptr);
 }
 
 /*
@@ -47,7 +47,7 @@ inline CvFont*
 CVFONT(VALUE object)
 {
   CvFont *ptr;
-  Data_Get_Struct(object, CvFont, ptr);
+  ptr = (CvFont*)OPENCV_DATA_PTR(object);
   return ptr;
 }
 
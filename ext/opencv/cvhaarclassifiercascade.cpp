@@ -39,6 +39,24 @@ cvhaarclassifiercascade_free(void* ptr)
   }
 }
 
+size_t
+cvhaarclassifiercascade_memsize(const void* ptr)
+{
+  const CvHaarClassifierCascade* cascade = (const CvHaarClassifierCascade*)ptr;
+  if (!cascade)
+    return 0;
+  size_t size = sizeof(CvHaarClassifierCascade) + sizeof(CvHaarStageClassifier) * cascade->count;
+  for (int i = 0; i < cascade->count; ++i)
+    size += sizeof(CvHaarClassifier) * cascade->stage_classifier[i].count;
+  return size;
+}
+
+const rb_data_type_t data_type = {
+  "OpenCV::CvHaarClassifierCascade",
+  { 0, cvhaarclassifiercascade_free, cvhaarclassifiercascade_memsize, },
+  &opencv_data_type, 0, RUBY_TYPED_FREE_IMMEDIATELY | RUBY_TYPED_WB_PROTECTED
+};
+
 /*
  * Load trained cascade of haar classifers from file.
  *
@@ -60,7 +78,7 @@ rb_load(VALUE klass, VALUE path)
   }
   if (!CV_IS_HAAR_CLASSIFIER(cascade))
     rb_raise(rb_eArgError, "invalid format haar classifier cascade file.");
-  return Data_Wrap_Struct(klass, 0, cvhaarclassifiercascade_free, cascade);
+  return TypedData_Wrap_Struct(klass, &data_type, cascade);
 }
 
 /*
@@ -112,8 +130,13 @@ rb_detect_objects(int argc, VALUE *argv, VALUE self)
 
   VALUE result = Qnil;
   try {
-    CvSeq *seq = cvHaarDetectObjects(CVARR_WITH_CHECK(image), CVHAARCLASSIFIERCASCADE(self), CVMEMSTORAGE(storage_val),
-			      scale_factor, min_neighbors, flags, min_size, max_size);
+    CvArr* image_ptr = CVARR_WITH_CHECK(image);
+    CvHaarClassifierCascade* cascade = CVHAARCLASSIFIERCASCADE(self);
+    CvMemStorage* storage = CVMEMSTORAGE(storage_val);
+    CvSeq *seq = NULL;
+    rb_cvCallWithoutGVL(self, [&] {
+	seq = cvHaarDetectObjects(image_ptr, cascade, storage, scale_factor, min_neighbors, flags, min_size, max_size);
+      });
     result = cCvSeq::new_sequence(cCvSeq::rb_class(), seq, cCvAvgComp::rb_class(), storage_val);
     if (rb_block_given_p()) {
       for(int i = 0; i < seq->total; ++i)
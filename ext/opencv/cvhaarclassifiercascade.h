@@ -31,7 +31,7 @@ __NAMESPACE_END_CVHAARCLASSIFERCASCADE
 inline CvHaarClassifierCascade*
 CVHAARCLASSIFIERCASCADE(VALUE object) {
   CvHaarClassifierCascade *ptr;
-  Data_Get_Struct(object, CvHaarClassifierCascade, ptr);
+  ptr = (CvHaarClassifierCascade*)OPENCV_DATA_PTR(object);
   return ptr;
 }
 __NAMESPACE_END_OPENCV
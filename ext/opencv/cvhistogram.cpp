@@ -37,11 +37,28 @@ release_hist(void* ptr)
   }
 }
 
+size_t
+memsize_hist(const void* ptr)
+{
+  const CvHistogram* hist = (const CvHistogram*)ptr;
+  if (!hist)
+    return 0;
+  if (CV_IS_SPARSE_HIST(hist))
+    return sizeof(CvHistogram) + memsize_cvarr(hist->bins);
+  return sizeof(CvHistogram) - sizeof(CvMatND) + memsize_cvarr(&hist->mat);
+}
+
+const rb_data_type_t data_type = {
+  "OpenCV::CvHistogram",
+  { 0, release_hist, memsize_hist, },
+  &opencv_data_type, 0, RUBY_TYPED_FREE_IMMEDIATELY | RUBY_TYPED_WB_PROTECTED
+};
+
 VALUE
 rb_allocate(VALUE klass)
 {
   CvHistogram* ptr = NULL;
-  return Data_Wrap_Struct(klass, 0, release_hist, ptr);
+  return TypedData_Wrap_Struct(klass, &data_type, ptr);
 }
 
 float*
@@ -347,7 +364,7 @@ rb_copy_hist(VALUE self)
   catch (cv::Exception& e) {
     raise_cverror(e);
   }
-  return Data_Wrap_Struct(rb_klass, 0, release_hist, hist);
+  return TypedData_Wrap_Struct(rb_klass, &data_type, hist);
 }
 
 /*
@@ -56,7 +56,7 @@ inline CvHistogram*
 CVHISTOGRAM(VALUE object)
 {
   CvHistogram* ptr;
-  Data_Get_Struct(object, CvHistogram, ptr);
+  ptr = (CvHistogram*)OPENCV_DATA_PTR(object);
   return ptr;
 }
 
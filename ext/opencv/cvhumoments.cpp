@@ -25,11 +25,13 @@ rb_class()
   return rb_klass;
 }
 
+const rb_data_type_t data_type = OPENCV_STRUCT_TYPE("OpenCV::CvHuMoments", CvHuMoments, RUBY_TYPED_DEFAULT_FREE);
+
 VALUE
 rb_allocate(VALUE klass)
 {
   CvHuMoments *ptr;
-  return Data_Make_Struct(klass, CvHuMoments, 0, -1, ptr);
+  return TypedData_Make_Struct(klass, CvHuMoments, &data_type, ptr);
 }
 
 /*
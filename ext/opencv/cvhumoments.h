@@ -42,7 +42,7 @@ inline CvHuMoments*
 CVHUMOMENTS(VALUE object)
 {
   CvHuMoments *ptr;
-  Data_Get_Struct(object, CvHuMoments, ptr);
+  ptr = (CvHuMoments*)OPENCV_DATA_PTR(object);
   return ptr;
 }
 
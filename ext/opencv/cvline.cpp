@@ -25,11 +25,13 @@ rb_class()
   return rb_klass;
 }
 
+const rb_data_type_t data_type = OPENCV_STRUCT_TYPE("OpenCV::CvLine", CvLine, RUBY_TYPED_DEFAULT_FREE);
+
 VALUE
 rb_allocate(VALUE klass)
 {
   CvLine *ptr;
-  return Data_Make_Struct(klass, CvLine, 0, -1, ptr);
+  return TypedData_Make_Struct(klass, CvLine, &data_type, ptr);
 }
 
 /*
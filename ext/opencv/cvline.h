@@ -45,7 +45,7 @@ inline CvLine*
 CVLINE(VALUE object)
 {
   CvLine *ptr;
-  Data_Get_Struct(object, CvLine, ptr);
+  ptr = (CvLine*)OPENCV_DATA_PTR(object);
   return ptr;
 }
 
@@ -68,8 +68,12 @@ rb_drawing_option_line_type(VALUE drawing_option)
   return 0;
 }
 
-int*
-hash_to_format_specific_param(VALUE hash)
+/*
+ * Stores the format-specific parameters of hash into params (RHASH_SIZE(hash) * 2 + 1 ints),
+ * terminated by 0
+ */
+void
+store_format_specific_param(VALUE hash, int* params)
 {
   Check_Type(hash, T_HASH);
   const int flags[] = {
@@ -85,8 +89,8 @@ hash_to_format_specific_param(VALUE hash)
   };
   const int flag_size = sizeof(flags) / sizeof(int);
 
-  int* params = (int*)ALLOC_N(int, RHASH_SIZE(hash) * 2);
-  for (int i = 0, n = 0; i < flag_size; i++) {
+  int n = 0;
+  for (int i = 0; i < flag_size; i++) {
     VALUE val = rb_hash_lookup(hash, INT2FIX(flags[i]));
     if (!NIL_P(val)) {
       params[n] = flags[i];
@@ -94,7 +98,21 @@ hash_to_format_specific_param(VALUE hash)
       n += 2;
     }
   }
+  params[n] = 0;
+}
 
+int*
+hash_to_format_specific_param(VALUE hash)
+{
+  Check_Type(hash, T_HASH);
+  const long size = RHASH_SIZE(hash) * 2 + 1;
+  // Converted in a temporary buffer first, so that nothing leaks if a value is not an integer
+  VALUE values_buf;
+  int* values = ALLOCV_N(int, values_buf, size);
+  store_format_specific_param(hash, values);
+  int* params = (int*)ALLOC_N(int, size);
+  memcpy(params, values, sizeof(int) * size);
+  ALLOCV_END(values_buf);
   return params;
 }
 
@@ -143,12 +161,16 @@ rb_initialize(int argc, VALUE *argv, VALUE self)
 
 /*
  * Load an image from the specified file
- * @overload load(filename, iscolor = 1)
+ * @overload load(filename, iscolor = 1, reduce: 1)
  * @param filename [String] Name of file to be loaded
  * @param iscolor [Integer] Flags specifying the color type of a loaded image:
  *   - <b>> 0</b> Return a 3-channel color image.
  *   - <b>= 0</b> Return a grayscale image.
  *   - <b>< 0</b> Return the loaded image as is.
+ * @param reduce [Integer] Loads the image at 1/2, 1/4 or 1/8 of its width and height.
+ *   If the extension is built with <tt>--enable-libjpeg</tt>, JPEG images are scaled down while
+ *   decoding (DCT scaling), which is much faster than loading at full size and resizing;
+ *   otherwise images are loaded at full size and resized with CV_INTER_AREA.
  * @return [CvMat] Loaded image
  * @opencv_func cvLoadImageM
  * @scope class
@@ -157,6 +179,7 @@ VALUE
 rb_load_imageM(int argc, VALUE *argv, VALUE self)
 {
   VALUE filename, iscolor;
+  int reduce = extract_reduce(&argc, argv);
   rb_scan_args(argc, argv, "11", &filename, &iscolor);
   Check_Type(filename, T_STRING);
 
@@ -170,8 +193,9 @@ rb_load_imageM(int argc, VALUE *argv, VALUE self)
   }
 
   CvMat *mat = NULL;
+  const char* filename_ptr = StringValueCStr(filename);
   try {
-    mat = cvLoadImageM(StringValueCStr(filename), _iscolor);
+    rb_cvCallWithoutGVL([&] { mat = rb_cvLoadImageMReduced(filename_ptr, _iscolor, reduce); });
   }
   catch (cv::Exception& e) {
     raise_cverror(e);
@@ -182,6 +206,68 @@ rb_load_imageM(int argc, VALUE *argv, VALUE self)
   return OPENCV_OBJECT(rb_klass, mat);
 }
 
+/*
+ * Loads many image files in parallel with native decoder threads (see ImageLoader).
+ * The images are yielded or returned in the order of the paths. A file that can not be loaded
+ * is yielded (or returned) as an exception in place of its image.
+ *
+ * @overload load_images(source, options = nil)
+ *   @param source [Array<String>, String] Paths of the image files, or a directory
+ *   @param options [Hash] Options (<tt>:glob</tt>, <tt>:iscolor</tt>, <tt>:grayscale</tt>,
+ *     <tt>:reduce</tt>, <tt>:threads</tt>, <tt>:queue</tt>; see ImageLoader.new)
+ *   @return [Array<CvMat, StandardError>] Loaded images
+ * @overload load_images(source, options = nil) { |image, path| ... }
+ *   @yieldparam image [CvMat, StandardError] Loaded image
+ *   @yieldparam path [String] Path of the file
+ *   @return [ImageLoader] Loader
+ * @example
+ *   faces = CvMat.load_images('faces/', glob: '*.png', grayscale: true, threads: 8)
+ * @scope class
+ */
+VALUE
+rb_load_images(int argc, VALUE *argv, VALUE klass)
+{
+  VALUE source, options;
+  rb_scan_args(argc, argv, "11", &source, &options);
+  VALUE loader = cImageLoader::new_loader(source, options, klass);
+  if (rb_block_given_p())
+    return cImageLoader::rb_each(loader);
+  return cImageLoader::rb_images(loader);
+}
+
+/*
+ * Encodes an image into a 1xN CV_8UC1 matrix, which must be released by the caller.
+ */
+CvMat*
+encode_image_buffer(VALUE self, VALUE _ext, VALUE _params)
+{
+  Check_Type(_ext, T_STRING);
+  const char* ext = RSTRING_PTR(_ext);
+  CvMat* buff = NULL;
+  int* params = NULL;
+
+  if (!NIL_P(_params)) {
+    params = hash_to_format_specific_param(_params);
+  }
+
+  try {
+    CvArr* self_ptr = CVARR(self);
+    rb_cvCallWithoutGVL([&] { buff = cvEncodeImage(ext, self_ptr, params); });
+  }
+  catch (cv::Exception& e) {
+    if (params != NULL) {
+      xfree(params);
+      params = NULL;
+    }
+    raise_cverror(e);
+  }
+  if (params != NULL) {
+    xfree(params);
+    params = NULL;
+  }
+  return buff;
+}
+
 /*
  * Encodes an image into a memory buffer.
  *
@@ -210,35 +296,61 @@ rb_encode_imageM(int argc, VALUE *argv, VALUE self)
 {
   VALUE _ext, _params;
   rb_scan_args(argc, argv, "11", &_ext, &_params);
-  Check_Type(_ext, T_STRING);
-  const char* ext = RSTRING_PTR(_ext);
-  CvMat* buff = NULL;
-  int* params = NULL;
+  CvMat* buff = encode_image_buffer(self, _ext, _params);
 
-  if (!NIL_P(_params)) {
-    params = hash_to_format_specific_param(_params);
+  const int size = buff->rows * buff->cols;
+  VALUE array = rb_ary_new2(size);
+  for (int i = 0; i < size; i++) {
+    rb_ary_store(array, i, CHR2FIX(CV_MAT_ELEM(*buff, char, 0, i)));
   }
 
   try {
-    buff = cvEncodeImage(ext, CVARR(self), params);
+    cvReleaseMat(&buff);
   }
   catch (cv::Exception& e) {
-    if (params != NULL) {
-      free(params);
-      params = NULL;
-    }
     raise_cverror(e);
   }
-  if (params != NULL) {
-    free(params);
-    params = NULL;
-  }
 
-  const int size = buff->rows * buff->cols;
-  VALUE array = rb_ary_new2(size);
-  for (int i = 0; i < size; i++) {
-    rb_ary_store(array, i, CHR2FIX(CV_MAT_ELEM(*buff, char, 0, i)));
-  }
+  return array;
+}
+
+/*
+ * Encodes an image into a binary string.
+ *
+ * Unlike CvMat#encode_image, the encoded bytes are returned as a single ASCII-8BIT string
+ * (or written to <tt>dest</tt>) without creating an object for each byte.
+ *
+ * @overload encode_binary(ext, params = nil, dest = nil)
+ *   @param ext [String] File extension that defines the output format ('.jpg', '.png', ...)
+ *   @param params [Hash] Format-specific parameters (see CvMat#encode_image)
+ *   @param dest [String, IO] Destination of the encoded bytes.
+ *     * If <tt>dest</tt> is a string, the bytes are appended to it.
+ *     * If <tt>dest</tt> responds to <tt>write</tt> (IO, socket, StringIO, ...), the bytes are written to it.
+ * @return [String] Encoded image if <tt>dest</tt> is <tt>nil</tt>, otherwise <tt>dest</tt>.
+ * @opencv_func cvEncodeImage
+ * @example
+ *   mat = CvMat.load('image.jpg')
+ *   jpg = mat.encode_binary('.jpg', CV_IMWRITE_JPEG_QUALITY => 80)
+ *   File.open('thumb.jpg', 'wb') { |f| mat.encode_binary('.jpg', nil, f) }
+ */
+VALUE
+rb_encode_binary(int argc, VALUE *argv, VALUE self)
+{
+  VALUE _ext, _params, dest;
+  rb_scan_args(argc, argv, "12", &_ext, &_params, &dest);
+  if (TYPE(dest) == T_STRING)
+    rb_str_modify(dest);
+  else if (!NIL_P(dest) && !rb_respond_to(dest, rb_intern("write")))
+    raise_typeerror(dest, "String or IO");
+
+  CvMat* buff = encode_image_buffer(self, _ext, _params);
+  const char* ptr = (const char*)buff->data.ptr;
+  const long size = (long)buff->rows * buff->cols;
+  VALUE str = Qnil;
+  if (TYPE(dest) == T_STRING)
+    str = rb_str_cat(dest, ptr, size);
+  else
+    str = rb_str_new(ptr, size);
 
   try {
     cvReleaseMat(&buff);
@@ -247,11 +359,21 @@ rb_encode_imageM(int argc, VALUE *argv, VALUE self)
     raise_cverror(e);
   }
 
-  return array;
+  if (NIL_P(dest))
+    return str;
+  if (TYPE(dest) != T_STRING)
+    rb_io_write(dest, str);
+  return dest;
 }
 
+/*
+ * Converts the argument of decode_image into a 1xN CV_8UC1 matrix.
+ * A String is wrapped in <tt>header</tt> without copying its bytes. Unless it is frozen,
+ * the String is locked (<tt>*locked</tt>) so that no thread can modify it while it is decoded
+ * without the GVL. Call finish_decoding() when decoding is finished.
+ */
 CvMat*
-prepare_decoding(int argc, VALUE *argv, int* iscolor, int* need_release)
+prepare_decoding(int argc, VALUE *argv, CvMat* header, int* iscolor, int* need_release, VALUE* locked)
 {
   VALUE _buff, _iscolor;
   rb_scan_args(argc, argv, "11", &_buff, &_iscolor);
@@ -259,9 +381,20 @@ prepare_decoding(int argc, VALUE *argv, int* iscolor, int* need_release)
 
   CvMat* buff = NULL;
   *need_release = 0;
+  *locked = Qnil;
   switch (TYPE(_buff)) {
   case T_STRING:
-    _buff = rb_funcall(_buff, rb_intern("unpack"), 1, rb_str_new("c*", 2));
+    try {
+      buff = cvInitMatHeader(header, 1, RSTRING_LEN(_buff), CV_8UC1, RSTRING_PTR(_buff));
+    }
+    catch (cv::Exception& e) {
+      raise_cverror(e);
+    }
+    if (!OBJ_FROZEN(_buff)) {
+      rb_str_locktmp(_buff);
+      *locked = _buff;
+    }
+    break;
   case T_ARRAY: {
     int cols = RARRAY_LEN(_buff);
     *need_release = 1;
@@ -289,11 +422,25 @@ prepare_decoding(int argc, VALUE *argv, int* iscolor, int* need_release)
   return buff;
 }
 
+/*
+ * Releases the temporary matrix and the String lock acquired by prepare_decoding()
+ */
+void
+finish_decoding(CvMat** buff, int need_release, VALUE locked)
+{
+  if (need_release)
+    rb_cvReleaseMat(buff);
+  if (!NIL_P(locked))
+    rb_str_unlocktmp(locked);
+}
+
 /*
  * Reads an image from a buffer in memory.
- * @overload decode_image(buf, iscolor = 1)
- * @param buf [CvMat, Array, String] Input array of bytes
+ * @overload decode_image(buf, iscolor = 1, reduce: 1)
+ * @param buf [CvMat, Array, String] Input array of bytes.
+ *   The bytes of a String are decoded in place without being copied.
  * @param iscolor [Integer] Flags specifying the color type of a decoded image (the same flags as CvMat#load)
+ * @param reduce [Integer] Decodes the image at 1/2, 1/4 or 1/8 of its width and height (see CvMat.load)
  * @return [CvMat] Loaded matrix
  * @opencv_func cvDecodeImageM
  */
@@ -301,21 +448,282 @@ VALUE
 rb_decode_imageM(int argc, VALUE *argv, VALUE self)
 {
   int iscolor, need_release;
-  CvMat* buff = prepare_decoding(argc, argv, &iscolor, &need_release);
+  VALUE locked;
+  CvMat header;
+  int reduce = extract_reduce(&argc, argv);
+  CvMat* buff = prepare_decoding(argc, argv, &header, &iscolor, &need_release, &locked);
   CvMat* mat_ptr = NULL;
   try {
-    mat_ptr = cvDecodeImageM(buff, iscolor);
-    if (need_release) {
-      cvReleaseMat(&buff);
-    }
+    rb_cvCallWithoutGVL([&] { mat_ptr = rb_cvDecodeImageMReduced(buff, iscolor, reduce); });
   }
   catch (cv::Exception& e) {
+    finish_decoding(&buff, need_release, locked);
     raise_cverror(e);
   }
+  finish_decoding(&buff, need_release, locked);
 
   return OPENCV_OBJECT(rb_klass, mat_ptr);
 }
 
+VALUE
+image_info_to_hash(int result, const rb_cvImageInfo& info)
+{
+  if (result != 1)
+    return Qnil;
+  VALUE hash = rb_hash_new();
+  rb_hash_aset(hash, ID2SYM(rb_intern("width")), INT2NUM(info.width));
+  rb_hash_aset(hash, ID2SYM(rb_intern("height")), INT2NUM(info.height));
+  rb_hash_aset(hash, ID2SYM(rb_intern("channels")), INT2NUM(info.channels));
+  rb_hash_aset(hash, ID2SYM(rb_intern("format")), ID2SYM(rb_intern(info.format)));
+  return hash;
+}
+
+/*
+ * Reads the size, number of channels and format of an image file from its header,
+ * without decoding the pixels.
+ * JPEG, PNG, BMP, PBM/PGM/PPM and TIFF files are supported.
+ *
+ * @overload probe(filename)
+ * @param filename [String] Name of the file
+ * @return [Hash, nil] <tt>{ width: Integer, height: Integer, channels: Integer, format: Symbol }</tt>
+ *   (format is one of <tt>:jpeg</tt>, <tt>:png</tt>, <tt>:bmp</tt>, <tt>:pnm</tt> and <tt>:tiff</tt>),
+ *   or nil if the format is not supported
+ * @scope class
+ */
+VALUE
+rb_probe(VALUE klass, VALUE filename)
+{
+  Check_Type(filename, T_STRING);
+  filename = rb_str_new_frozen(filename); // the string can not be changed by other threads without the GVL
+  const char* filename_ptr = StringValueCStr(filename);
+  rb_cvImageInfo info;
+  int result = 0;
+  try {
+    rb_cvCallWithoutGVL([&] { result = rb_cvProbeImageFile(filename_ptr, &info); });
+  }
+  catch (cv::Exception& e) {
+    raise_cverror(e);
+  }
+  if (result < 0)
+    rb_sys_fail(filename_ptr);
+  RB_GC_GUARD(filename);
+  return image_info_to_hash(result, info);
+}
+
+/*
+ * Same as CvMat.probe, but reads an encoded image in memory
+ *
+ * @overload probe_buffer(buf)
+ * @param buf [CvMat, Array, String] Encoded image (see CvMat.decode_image)
+ * @return [Hash, nil] Properties of the image (see CvMat.probe)
+ * @scope class
+ */
+VALUE
+rb_probe_buffer(VALUE klass, VALUE buf)
+{
+  int iscolor, need_release;
+  VALUE locked;
+  CvMat header;
+  CvMat* buff = prepare_decoding(1, &buf, &header, &iscolor, &need_release, &locked);
+  rb_cvImageInfo info;
+  int result = rb_cvProbeImage(buff->data.ptr, buff->rows * buff->cols, &info);
+  finish_decoding(&buff, need_release, locked);
+  return image_info_to_hash(result, info);
+}
+
+int
+thumbnail_mode(VALUE mode)
+{
+  if (mode == ID2SYM(rb_intern("fit")))
+    return RB_CV_THUMBNAIL_FIT;
+  else if (mode == ID2SYM(rb_intern("fill")))
+    return RB_CV_THUMBNAIL_FILL;
+  else if (mode == ID2SYM(rb_intern("crop")))
+    return RB_CV_THUMBNAIL_CROP;
+  rb_raise(rb_eArgError, "mode should be :fit, :fill or :crop");
+  return 0;
+}
+
+rb_cvThumbnailBox
+thumbnail_box(VALUE box, int default_mode)
+{
+  rb_cvThumbnailBox result;
+  result.mode = default_mode;
+  switch (TYPE(box)) {
+  case T_ARRAY:
+    if (RARRAY_LEN(box) < 2 || RARRAY_LEN(box) > 3)
+      rb_raise(rb_eArgError, "box should be [width, height] or [width, height, mode]");
+    result.width = NUM2INT(rb_ary_entry(box, 0));
+    result.height = NUM2INT(rb_ary_entry(box, 1));
+    if (RARRAY_LEN(box) == 3)
+      result.mode = thumbnail_mode(rb_ary_entry(box, 2));
+    break;
+  case T_HASH: {
+    VALUE mode = LOOKUP_HASH(box, "mode");
+    result.width = NUM2INT(LOOKUP_HASH(box, "width"));
+    result.height = NUM2INT(LOOKUP_HASH(box, "height"));
+    if (!NIL_P(mode))
+      result.mode = thumbnail_mode(mode);
+    break;
+  }
+  default: {
+    CvSize size = VALUE_TO_CVSIZE(box);
+    result.width = size.width;
+    result.height = size.height;
+    break;
+  }
+  }
+  if (result.width <= 0 || result.height <= 0)
+    rb_raise(rb_eArgError, "box size should be positive");
+  return result;
+}
+
+/*
+ * Decodes an image and encodes thumbnails of it for several target boxes in one native call,
+ * without holding the GVL.
+ *
+ * The image is decoded only once (JPEG images at the smallest reduced resolution that still
+ * covers the largest thumbnail, see CvMat.decode_image), and each thumbnail is resized
+ * with CV_INTER_AREA from the smallest larger thumbnail already made. Images are never enlarged.
+ *
+ * A box is <tt>[width, height]</tt>, <tt>[width, height, mode]</tt>, <tt>{ width:, height:, mode: }</tt>
+ * or a CvSize. The modes are:
+ * * <tt>:fit</tt> - Fits inside the box, keeping the aspect ratio.
+ * * <tt>:fill</tt> - Covers the box, keeping the aspect ratio.
+ * * <tt>:crop</tt> - Covers the box, and crops the center to the box size.
+ *
+ * @overload thumbnails(buf, boxes, ext: '.jpg', params: nil, mode: :fit)
+ * @param buf [CvMat, Array, String] Encoded image (see CvMat.decode_image)
+ * @param boxes [Array] Target boxes
+ * @param ext [String] File extension that defines the output format ('.jpg', '.png', ...)
+ * @param params [Hash] Format-specific parameters (see CvMat#encode_image)
+ * @param mode [Symbol] Mode of the boxes that do not specify one
+ * @return [Array<String>] Encoded thumbnails (ASCII-8BIT strings) in the order of <tt>boxes</tt>
+ * @scope class
+ * @opencv_func cvDecodeImageM
+ * @opencv_func cvResize
+ * @opencv_func cvEncodeImage
+ * @example
+ *   small, medium, square = CvMat.thumbnails(File.binread('photo.jpg'),
+ *                                            [[160, 160], [640, 480], [100, 100, :crop]],
+ *                                            params: { CV_IMWRITE_JPEG_QUALITY => 80 })
+ */
+VALUE
+rb_thumbnails(int argc, VALUE *argv, VALUE klass)
+{
+  VALUE buf, boxes, options;
+  rb_scan_args(argc, argv, "21", &buf, &boxes, &options);
+  Check_Type(boxes, T_ARRAY);
+  VALUE ext = rb_str_new2(".jpg");
+  VALUE params = Qnil;
+  int default_mode = RB_CV_THUMBNAIL_FIT;
+  if (!NIL_P(options)) {
+    Check_Type(options, T_HASH);
+    if (!NIL_P(LOOKUP_HASH(options, "ext"))) {
+      ext = LOOKUP_HASH(options, "ext");
+      Check_Type(ext, T_STRING);
+    }
+    params = LOOKUP_HASH(options, "params");
+    if (!NIL_P(params))
+      Check_Type(params, T_HASH);
+    if (!NIL_P(LOOKUP_HASH(options, "mode")))
+      default_mode = thumbnail_mode(LOOKUP_HASH(options, "mode"));
+  }
+
+  const int count = RARRAY_LEN(boxes);
+  VALUE boxes_buf, results_buf;
+  rb_cvThumbnailBox* boxes_ptr = ALLOCV_N(rb_cvThumbnailBox, boxes_buf, count);
+  CvMat** results = ALLOCV_N(CvMat*, results_buf, count);
+  for (int i = 0; i < count; i++)
+    boxes_ptr[i] = thumbnail_box(rb_ary_entry(boxes, i), default_mode);
+
+  // A frozen copy, so that ext can not be modified (or freed) while it is used without the GVL
+  ext = rb_str_new_frozen(ext);
+  const char* ext_ptr = StringValueCStr(ext);
+  // Freed by the GC (or ALLOCV_END) even if prepare_decoding() raises
+  VALUE params_buf = 0;
+  int* params_ptr = NULL;
+  if (!NIL_P(params)) {
+    params_ptr = ALLOCV_N(int, params_buf, RHASH_SIZE(params) * 2 + 1);
+    store_format_specific_param(params, params_ptr);
+  }
+  int iscolor, need_release;
+  VALUE locked;
+  CvMat header;
+  CvMat* buff = prepare_decoding(1, &buf, &header, &iscolor, &need_release, &locked);
+  try {
+    rb_cvCallWithoutGVL([&] { rb_cvEncodeThumbnails(buff, boxes_ptr, count, ext_ptr, params_ptr, results); });
+  }
+  catch (cv::Exception& e) {
+    finish_decoding(&buff, need_release, locked);
+    raise_cverror(e);
+  }
+  finish_decoding(&buff, need_release, locked);
+
+  VALUE thumbnails = rb_ary_new2(count);
+  for (int i = 0; i < count; i++) {
+    rb_ary_store(thumbnails, i, rb_str_new((const char*)results[i]->data.ptr, results[i]->rows * results[i]->cols));
+    cvReleaseMat(&results[i]);
+  }
+  if (params_buf)
+    ALLOCV_END(params_buf);
+  ALLOCV_END(boxes_buf);
+  ALLOCV_END(results_buf);
+  RB_GC_GUARD(ext);
+  RB_GC_GUARD(buf);
+  return thumbnails;
+}
+
+/*
+ * Applies the operations recorded in the block to each image in parallel on native worker threads.
+ * The block is called once with a CvPipeline to record the operations.
+ *
+ * If <tt>encode</tt> is given, the outputs are also encoded by the workers.
+ *
+ * An error of an image does not stop the others; the error is returned in place of its output.
+ *
+ * @overload batch(images, threads: nil, encode: nil, params: nil) { |pipeline| ... }
+ * @overload batch(images, pipeline: pipeline, threads: nil, encode: nil, params: nil)
+ * @param images [Array<CvMat>] Input images
+ * @param pipeline [CvPipeline] Recorded operations (instead of the block)
+ * @param threads [Integer] Number of worker threads (default: number of CPUs)
+ * @param encode [String] File extension that defines the encoded format ('.jpg', '.png', ...)
+ * @param params [Hash] Format-specific parameters of the encoding (see CvMat#encode_image)
+ * @return [Array<CvMat, String, StandardError>] Outputs, encoded outputs (or errors) in the order of <tt>images</tt>
+ * @raise [ArgumentError] If both a block and <tt>pipeline</tt> are given
+ * @example
+ *   thumbnails = CvMat.batch(images, threads: 4) { |p|
+ *     p.resize(CvSize.new(160, 120), CV_INTER_AREA).smooth(:gaussian, 3)
+ *   }
+ *   jpegs = CvMat.batch(images, encode: '.jpg', params: { CV_IMWRITE_JPEG_QUALITY => 80 }) { |p|
+ *     p.resize(CvSize.new(160, 120), CV_INTER_AREA)
+ *   }
+ * @see CvPipeline#batch
+ * @scope class
+ */
+VALUE
+rb_batch(int argc, VALUE *argv, VALUE klass)
+{
+  VALUE images, options;
+  rb_scan_args(argc, argv, "11", &images, &options);
+  VALUE pipeline = Qnil;
+  if (!NIL_P(options)) {
+    Check_Type(options, T_HASH);
+    pipeline = LOOKUP_HASH(options, "pipeline");
+  }
+  if (NIL_P(pipeline)) {
+    pipeline = cCvPipeline::rb_allocate(cCvPipeline::rb_class());
+    if (rb_block_given_p())
+      rb_yield(pipeline);
+  }
+  else {
+    if (rb_block_given_p())
+      rb_raise(rb_eArgError, "both a block and pipeline are given");
+    CVPIPELINE_WITH_CHECK(pipeline);
+  }
+  return cCvPipeline::rb_batch(argc, argv, pipeline);
+}
+
 /*
  * nodoc
  */
@@ -325,9 +733,13 @@ rb_method_missing(int argc, VALUE *argv, VALUE self)
   VALUE name, args, method;
   rb_scan_args(argc, argv, "1*", &name, &args);
   method = rb_funcall(name, rb_intern("to_s"), 0);
-  if (RARRAY_LEN(args) != 0 || !rb_respond_to(rb_module_opencv(), rb_intern(StringValuePtr(method))))
+  // Color conversions like mat.BGR2GRAY(out: dest) take an options Hash
+  long len = RARRAY_LEN(args);
+  if (len > 1 || (len == 1 && TYPE(RARRAY_AREF(args, 0)) != T_HASH) ||
+      !rb_respond_to(rb_module_opencv(), rb_intern(StringValuePtr(method))))
     return rb_call_super(argc, argv);
-  return rb_funcall(rb_module_opencv(), rb_intern(StringValuePtr(method)), 1, self);
+  VALUE call_args[2] = { self, len > 0 ? RARRAY_AREF(args, 0) : Qnil };
+  return rb_funcall2(rb_module_opencv(), rb_intern(StringValuePtr(method)), 1 + len, call_args);
 }
 
 /*
@@ -462,7 +874,7 @@ rb_channel(VALUE self)
 
 /*
  * @overload data
- * @deprecated This method will be removed.
+ * @deprecated This method will be removed. Use CvMat#to_binary instead.
  */
 VALUE
 rb_data(VALUE self)
@@ -471,6 +883,149 @@ rb_data(VALUE self)
   return rb_str_new((char *)image->imageData, image->imageSize);
 }
 
+/*
+ * Copies the elements of a matrix into a contiguous buffer row by row.
+ * <tt>dst</tt> must have room for <tt>rows * cols * CV_ELEM_SIZE(type)</tt> bytes.
+ */
+void
+copy_packed_data(const CvMat* mat, char* dst)
+{
+  size_t row_size = (size_t)mat->cols * CV_ELEM_SIZE(mat->type);
+  if (CV_IS_MAT_CONT(mat->type)) {
+    memcpy(dst, mat->data.ptr, row_size * mat->rows);
+  }
+  else {
+    for (int j = 0; j < mat->rows; ++j) {
+      memcpy(dst + row_size * j, mat->data.ptr + (size_t)mat->step * j, row_size);
+    }
+  }
+}
+
+/*
+ * Returns the elements of the matrix as a binary string.
+ *
+ * Rows are packed without padding. A continuous matrix is copied with a single memcpy;
+ * a non-continuous one (e.g. a view created by CvMat#sub_rect or an IplImage with ROI)
+ * is packed row by row. Use the MemoryView interface (Ruby 3.0 or later)
+ * to access the elements without copying.
+ * @overload to_binary
+ * @return [String] Frozen ASCII-8BIT string of <tt>rows * cols * channel</tt> elements
+ */
+VALUE
+rb_to_binary(VALUE self)
+{
+  CvMat* mat = CVMAT(self);
+  VALUE str = rb_str_new(NULL, (long)mat->rows * mat->cols * CV_ELEM_SIZE(mat->type));
+  copy_packed_data(mat, RSTRING_PTR(str));
+  OBJ_FREEZE(str);
+  return str;
+}
+
+/*
+ * Returns whether the elements of the matrix are stored without gaps between rows
+ * @overload continuous?
+ * @return [Boolean] If the matrix is continuous, returns <tt>true</tt>.
+ */
+VALUE
+rb_continuous_q(VALUE self)
+{
+  return CV_IS_MAT_CONT(CVMAT(self)->type) ? Qtrue : Qfalse;
+}
+
+#ifdef HAVE_RUBY_MEMORY_VIEW_H
+const char*
+memory_view_format(int depth)
+{
+  switch (depth) {
+  case CV_8U:
+    return "C";
+  case CV_8S:
+    return "c";
+  case CV_16U:
+    return "S";
+  case CV_16S:
+    return "s";
+  case CV_32S:
+    return "l";
+  case CV_32F:
+    return "f";
+  case CV_64F:
+    return "d";
+  default:
+    return NULL;
+  }
+}
+
+/*
+ * Exports the elements as a read-only (rows x cols x channels) view.
+ * The view refers to <tt>obj</tt>, so the matrix stays alive while it is in use.
+ */
+bool
+memory_view_get(VALUE obj, rb_memory_view_t* view, int flags)
+{
+  if (OPENCV_DATA_PTR(obj) == NULL || (flags & RUBY_MEMORY_VIEW_WRITABLE))
+    return false;
+  if (RTYPEDDATA_TYPE(obj) == &borrowed_object_type)
+    return false; // the view could outlive a borrowed frame
+
+  CvMat* mat = CVMAT(obj);
+  const char* format = memory_view_format(CV_MAT_DEPTH(mat->type));
+  if (format == NULL)
+    return false;
+  // The elements are laid out in row-major order, with gaps between rows unless continuous
+  int order = flags & (RUBY_MEMORY_VIEW_ANY_CONTIGUOUS & ~RUBY_MEMORY_VIEW_STRIDES);
+  bool strided = (flags & RUBY_MEMORY_VIEW_STRIDES) == RUBY_MEMORY_VIEW_STRIDES;
+  if (order != 0 && !(order & RUBY_MEMORY_VIEW_ROW_MAJOR))
+    return false;
+  if ((order != 0 || !strided) && !CV_IS_MAT_CONT(mat->type))
+    return false;
+
+  ssize_t* shape = ALLOC_N(ssize_t, 6);
+  ssize_t* strides = shape + 3;
+  rb_cvMarkShared(OPENCV_DATA_PTR(obj)); // the data must outlive the view
+  shape[0] = mat->rows;
+  shape[1] = mat->cols;
+  shape[2] = CV_MAT_CN(mat->type);
+  strides[0] = mat->step;
+  strides[1] = CV_ELEM_SIZE(mat->type);
+  strides[2] = CV_ELEM_SIZE1(mat->type);
+
+  view->obj = obj;
+  view->data = mat->data.ptr;
+  view->byte_size = (mat->rows > 0) ? (ssize_t)mat->step * (mat->rows - 1) + shape[1] * strides[1] : 0;
+  view->readonly = true;
+  view->format = format;
+  view->item_size = strides[2];
+  view->item_desc.components = NULL;
+  view->item_desc.length = 0;
+  view->ndim = 3;
+  view->shape = shape;
+  view->strides = strides;
+  view->sub_offsets = NULL;
+  view->private_data = shape;
+  return true;
+}
+
+bool
+memory_view_release(VALUE obj, rb_memory_view_t* view)
+{
+  xfree(view->private_data);
+  return true;
+}
+
+bool
+memory_view_available_p(VALUE obj)
+{
+  return OPENCV_DATA_PTR(obj) != NULL;
+}
+
+const rb_memory_view_entry_t memory_view_entry = {
+  memory_view_get,
+  memory_view_release,
+  memory_view_available_p
+};
+#endif
+
 /*
  * Makes a clone of an object.
  * @overload clone
@@ -515,6 +1070,8 @@ rb_copy(int argc, VALUE *argv, VALUE self)
     CvSize size = cvGetSize(src);
     _dst = new_mat_kind_object(size, self);
   }
+  else
+    check_writable(_dst);
 
   try {
     cvCopy(src, CVARR_WITH_CHECK(_dst), mask);
@@ -673,6 +1230,7 @@ rb_square_q(VALUE self)
 VALUE
 rb_to_CvMat(VALUE self)
 {
+  check_viewable(self);
   // CvMat#to_CvMat aborts when self's class is CvMat.
   if (CLASS_OF(self) == rb_klass)
     return self;
@@ -706,6 +1264,7 @@ rb_to_CvMat(VALUE self)
 VALUE
 rb_sub_rect(VALUE self, VALUE args)
 {
+  check_viewable(self);
   CvRect area;
   CvPoint topleft;
   CvSize size;
@@ -771,6 +1330,7 @@ rb_get_range_index(VALUE index, int* start, int *end) {
 VALUE
 rb_get_rows(int argc, VALUE* argv, VALUE self)
 {
+  check_viewable(self);
   VALUE row_val, delta_val;
   rb_scan_args(argc, argv, "11", &row_val, &delta_val);
 
@@ -802,6 +1362,7 @@ rb_get_rows(int argc, VALUE* argv, VALUE self)
 VALUE
 rb_get_cols(VALUE self, VALUE col)
 {
+  check_viewable(self);
   int start, end;
   rb_get_range_index(col, &start, &end);
   CvMat* submat = RB_CVALLOC(CvMat);
@@ -827,6 +1388,7 @@ rb_get_cols(VALUE self, VALUE col)
 VALUE
 rb_each_row(VALUE self)
 {
+  check_viewable(self);
   int rows = CVMAT(self)->rows;
   CvMat* row = NULL;
   for (int i = 0; i < rows; ++i) {
@@ -854,6 +1416,7 @@ rb_each_row(VALUE self)
 VALUE
 rb_each_col(VALUE self)
 {
+  check_viewable(self);
   int cols = CVMAT(self)->cols;
   CvMat *col = NULL;
   for (int i = 0; i < cols; ++i) {
@@ -882,6 +1445,7 @@ rb_each_col(VALUE self)
 VALUE
 rb_diag(int argc, VALUE *argv, VALUE self)
 {
+  check_viewable(self);
   VALUE val;
   if (rb_scan_args(argc, argv, "01", &val) < 1)
     val = INT2FIX(0);
@@ -1019,6 +1583,7 @@ rb_aref(VALUE self, VALUE args)
 VALUE
 rb_aset(VALUE self, VALUE args)
 {
+  check_writable(self);
   CvScalar scalar = VALUE_TO_CVSCALAR(rb_ary_pop(args));
   int index[CV_MAX_DIM];
   for (int i = 0; i < RARRAY_LEN(args); ++i)
@@ -1043,73 +1608,498 @@ rb_aset(VALUE self, VALUE args)
   return self;
 }
 
+template <typename T>
+inline VALUE
+element_to_num(T value)
+{
+  return INT2FIX(value);
+}
+
+template <>
+inline VALUE
+element_to_num<int>(int value)
+{
+  return INT2NUM(value);
+}
+
+template <>
+inline VALUE
+element_to_num<float>(float value)
+{
+  return DBL2NUM(value);
+}
+
+template <>
+inline VALUE
+element_to_num<double>(double value)
+{
+  return DBL2NUM(value);
+}
+
+template <typename T>
+VALUE
+elements_to_array(const CvMat* mat, CvRect rect, int channel)
+{
+  const int cn = CV_MAT_CN(mat->type);
+  const long row_len = (long)rect.width * cn;
+  const long begin = (channel < 0) ? 0 : channel;
+  const int stride = (channel < 0) ? 1 : cn;
+  VALUE ary = rb_ary_new2((row_len / stride) * rect.height);
+  for (int j = rect.y; j < rect.y + rect.height; ++j) {
+    const T* row = (const T*)(mat->data.ptr + (size_t)mat->step * j) + (size_t)rect.x * cn;
+    for (long i = begin; i < row_len; i += stride) {
+      rb_ary_push(ary, element_to_num<T>(row[i]));
+    }
+  }
+  return ary;
+}
+
 /*
- * Assigns user data to the array header
- * @overload set_data(data)
- * @param data [Array<Integer>] User data
- * @return [CvMat] <tt>self</tt>
- * @opencv_func cvSetData
+ * Returns the elements of <tt>rect</tt> as a flat array in row-major order.
+ * If <tt>channel</tt> is nil, all channels are interleaved, otherwise only the specified channel is returned.
  */
 VALUE
-rb_set_data(VALUE self, VALUE data)
+rect_to_array(const CvMat* mat, CvRect rect, VALUE channel)
 {
-  data = rb_funcall(data, rb_intern("flatten"), 0);
-  const int DATA_LEN = RARRAY_LEN(data);
-  CvMat *self_ptr = CVMAT(self);
-  int depth = CV_MAT_DEPTH(self_ptr->type);
-  void* array = NULL;
+  if (rect.x < 0 || rect.y < 0 || rect.width < 0 || rect.height < 0 ||
+      rect.x + rect.width > mat->cols || rect.y + rect.height > mat->rows)
+    rb_raise(rb_eArgError, "rectangle (%d, %d, %d, %d) is out of the matrix (%dx%d)",
+	     rect.x, rect.y, rect.width, rect.height, mat->cols, mat->rows);
+  int ch = -1;
+  if (!NIL_P(channel)) {
+    ch = NUM2INT(channel);
+    if (ch < 0 || ch >= CV_MAT_CN(mat->type))
+      rb_raise(rb_eArgError, "channel %d is out of range (0...%d)", ch, CV_MAT_CN(mat->type));
+  }
 
-  switch (depth) {
+  switch (CV_MAT_DEPTH(mat->type)) {
   case CV_8U:
-    array = rb_cvAlloc(sizeof(uchar) * DATA_LEN);
-    for (int i = 0; i < DATA_LEN; ++i)
-      ((uchar*)array)[i] = (uchar)(NUM2INT(rb_ary_entry(data, i)));
-    break;
+    return elements_to_array<uchar>(mat, rect, ch);
   case CV_8S:
-    array = rb_cvAlloc(sizeof(char) * DATA_LEN);
-    for (int i = 0; i < DATA_LEN; ++i)
-      ((char*)array)[i] = (char)(NUM2INT(rb_ary_entry(data, i)));
-    break;
+    return elements_to_array<schar>(mat, rect, ch);
   case CV_16U:
-    array = rb_cvAlloc(sizeof(ushort) * DATA_LEN);
-    for (int i = 0; i < DATA_LEN; ++i)
-      ((ushort*)array)[i] = (ushort)(NUM2INT(rb_ary_entry(data, i)));
-    break;
+    return elements_to_array<ushort>(mat, rect, ch);
   case CV_16S:
-    array = rb_cvAlloc(sizeof(short) * DATA_LEN);
-    for (int i = 0; i < DATA_LEN; ++i)
-      ((short*)array)[i] = (short)(NUM2INT(rb_ary_entry(data, i)));
-    break;
+    return elements_to_array<short>(mat, rect, ch);
   case CV_32S:
-    array = rb_cvAlloc(sizeof(int) * DATA_LEN);
-    for (int i = 0; i < DATA_LEN; ++i)
-      ((int*)array)[i] = NUM2INT(rb_ary_entry(data, i));
-    break;
+    return elements_to_array<int>(mat, rect, ch);
   case CV_32F:
-    array = rb_cvAlloc(sizeof(float) * DATA_LEN);
-    for (int i = 0; i < DATA_LEN; ++i)
-      ((float*)array)[i] = (float)NUM2DBL(rb_ary_entry(data, i));
-    break;
+    return elements_to_array<float>(mat, rect, ch);
   case CV_64F:
-    array = rb_cvAlloc(sizeof(double) * DATA_LEN);
-    for (int i = 0; i < DATA_LEN; ++i)
-      ((double*)array)[i] = NUM2DBL(rb_ary_entry(data, i));
-    break;
+    return elements_to_array<double>(mat, rect, ch);
   default:
     rb_raise(rb_eArgError, "Invalid CvMat depth");
     break;
   }
+  return Qnil;
+}
 
-  try {
-    cvSetData(self_ptr, array, self_ptr->step);    
+/*
+ * Returns all elements of the matrix as a flat array.
+ * @overload to_a(channel = nil)
+ * @param channel [Integer] Zero-based index of the channel to read. If <tt>nil</tt>,
+ *   the values of all channels are interleaved (i.e. <tt>[b0, g0, r0, b1, g1, r1, ...]</tt>).
+ * @return [Array<Integer>, Array<Float>] Elements in row-major order.
+ *   Integers for integer depths, Floats for <tt>CV_32F</tt> and <tt>CV_64F</tt>.
+ * @example
+ *   mat = CvMat.new(2, 2, CV_8U, 3).set(CvScalar.new(1, 2, 3))
+ *   mat.to_a    #=> [1, 2, 3, 1, 2, 3, 1, 2, 3, 1, 2, 3]
+ *   mat.to_a(2) #=> [3, 3, 3, 3]
+ */
+VALUE
+rb_to_a(int argc, VALUE *argv, VALUE self)
+{
+  VALUE channel;
+  rb_scan_args(argc, argv, "01", &channel);
+  CvMat* mat = CVMAT(self);
+  return rect_to_array(mat, cvRect(0, 0, mat->cols, mat->rows), channel);
+}
+
+/*
+ * Returns the elements of a row as a flat array.
+ * @overload row_to_a(row, channel = nil)
+ * @param row [Integer] Zero-based index of the row
+ * @param channel [Integer] Zero-based index of the channel to read (see #to_a)
+ * @return [Array<Integer>, Array<Float>] Elements of the row
+ */
+VALUE
+rb_row_to_a(int argc, VALUE *argv, VALUE self)
+{
+  VALUE row, channel;
+  rb_scan_args(argc, argv, "11", &row, &channel);
+  CvMat* mat = CVMAT(self);
+  return rect_to_array(mat, cvRect(0, NUM2INT(row), mat->cols, 1), channel);
+}
+
+/*
+ * Returns the elements of a rectangular region as a flat array.
+ * @overload pixels(rect, channel = nil)
+ * @param rect [CvRect] Region of interest
+ * @param channel [Integer] Zero-based index of the channel to read (see #to_a)
+ * @return [Array<Integer>, Array<Float>] Elements of the region in row-major order
+ */
+VALUE
+rb_pixels(int argc, VALUE *argv, VALUE self)
+{
+  VALUE rect, channel;
+  rb_scan_args(argc, argv, "11", &rect, &channel);
+  return rect_to_array(CVMAT(self), VALUE_TO_CVRECT(rect), channel);
+}
+
+/*
+ * Reads (x, y) coordinates from a flat array or a CV_32S/CV_32F matrix of 2N elements.
+ */
+void
+read_points(VALUE points, std::vector<CvPoint2D32f>& pts)
+{
+  if (TYPE(points) == T_ARRAY) {
+    long len = RARRAY_LEN(points);
+    if (len % 2 != 0)
+      rb_raise(rb_eArgError, "number of coordinates should be even");
+    pts.resize(len / 2);
+    for (long k = 0; k < len / 2; ++k) {
+      pts[k].x = (float)NUM2DBL(rb_ary_entry(points, k * 2));
+      pts[k].y = (float)NUM2DBL(rb_ary_entry(points, k * 2 + 1));
+    }
+    return;
   }
-  catch (cv::Exception& e) {
-    raise_cverror(e);
+
+  CvMat* mat = CVMAT_WITH_CHECK(points);
+  int depth = CV_MAT_DEPTH(mat->type);
+  if (depth != CV_32S && depth != CV_32F)
+    rb_raise(rb_eTypeError, "points should be CV_32S or CV_32F matrix");
+  long row_len = (long)mat->cols * CV_MAT_CN(mat->type);
+  long len = row_len * mat->rows;
+  if (len % 2 != 0)
+    rb_raise(rb_eArgError, "number of coordinates should be even");
+  pts.resize(len / 2);
+  float* dst = (float*)&pts[0];
+  for (int j = 0; j < mat->rows; ++j) {
+    const uchar* row = mat->data.ptr + (size_t)mat->step * j;
+    for (long i = 0; i < row_len; ++i) {
+      *dst++ = (depth == CV_32S) ? (float)((const int*)row)[i] : ((const float*)row)[i];
+    }
   }
+}
 
+void
+check_points(const CvMat* mat, const std::vector<CvPoint2D32f>& pts, bool interpolate)
+{
+  for (size_t k = 0; k < pts.size(); ++k) {
+    float x = interpolate ? pts[k].x : cvRound(pts[k].x);
+    float y = interpolate ? pts[k].y : cvRound(pts[k].y);
+    if (!(x >= 0 && y >= 0 && x <= mat->cols - 1 && y <= mat->rows - 1))
+      rb_raise(rb_eArgError, "point (%g, %g) is out of the matrix (%dx%d)",
+	       pts[k].x, pts[k].y, mat->cols, mat->rows);
+  }
+}
+
+template <typename T>
+void
+gather_bilinear(const CvMat* src, const std::vector<CvPoint2D32f>& pts, CvMat* dst)
+{
+  const int cn = CV_MAT_CN(src->type);
+  float* out = dst->data.fl;
+  for (size_t k = 0; k < pts.size(); ++k) {
+    int x0 = cvFloor(pts[k].x), y0 = cvFloor(pts[k].y);
+    int x1 = MIN(x0 + 1, src->cols - 1), y1 = MIN(y0 + 1, src->rows - 1);
+    float fx = pts[k].x - x0, fy = pts[k].y - y0;
+    const T* r0 = (const T*)(src->data.ptr + (size_t)src->step * y0);
+    const T* r1 = (const T*)(src->data.ptr + (size_t)src->step * y1);
+    for (int c = 0; c < cn; ++c) {
+      float top = r0[x0 * cn + c] + (r0[x1 * cn + c] - (float)r0[x0 * cn + c]) * fx;
+      float bottom = r1[x0 * cn + c] + (r1[x1 * cn + c] - (float)r1[x0 * cn + c]) * fx;
+      *out++ = top + (bottom - top) * fy;
+    }
+  }
+}
+
+/*
+ * Reads the elements at many coordinates at once.
+ * @overload gather(points, interpolate = false)
+ *   @param points [CvMat, Array<Number>] Coordinates to read; a CV_32S or CV_32F matrix which has
+ *     <tt>N x 2</tt> elements (e.g. <tt>N x 2</tt> 1-channel or <tt>N x 1</tt> 2-channel),
+ *     or a flat array <tt>[x0, y0, x1, y1, ...]</tt>
+ *   @param interpolate [Boolean] If <tt>true</tt>, the elements at non-integer coordinates are computed by
+ *     bilinear interpolation. Otherwise the coordinates are rounded to the nearest element.
+ * @return [CvMat] <tt>N x 1</tt> matrix of the elements. Its type is the same as <tt>self</tt>,
+ *   or 32bit floating-point if <tt>interpolate</tt> is <tt>true</tt>.
+ * @example
+ *   values = mat.gather([10, 20, 30, 40]) # Same as [mat[20, 10], mat[40, 30]]
+ */
+VALUE
+rb_gather(int argc, VALUE *argv, VALUE self)
+{
+  VALUE points, interpolate;
+  rb_scan_args(argc, argv, "11", &points, &interpolate);
+  CvMat* src = CVMAT(self);
+  bool bilinear = RTEST(interpolate);
+  std::vector<CvPoint2D32f> pts;
+  read_points(points, pts);
+  check_points(src, pts, bilinear);
+  if (pts.empty())
+    rb_raise(rb_eArgError, "no points are given");
+
+  const int cn = CV_MAT_CN(src->type);
+  VALUE dest = new_object((int)pts.size(), 1, bilinear ? CV_MAKETYPE(CV_32F, cn) : src->type);
+  CvMat* dst = CVMAT(dest);
+  if (bilinear) {
+    switch (CV_MAT_DEPTH(src->type)) {
+    case CV_8U:
+      gather_bilinear<uchar>(src, pts, dst);
+      break;
+    case CV_8S:
+      gather_bilinear<schar>(src, pts, dst);
+      break;
+    case CV_16U:
+      gather_bilinear<ushort>(src, pts, dst);
+      break;
+    case CV_16S:
+      gather_bilinear<short>(src, pts, dst);
+      break;
+    case CV_32S:
+      gather_bilinear<int>(src, pts, dst);
+      break;
+    case CV_32F:
+      gather_bilinear<float>(src, pts, dst);
+      break;
+    case CV_64F:
+      gather_bilinear<double>(src, pts, dst);
+      break;
+    default:
+      rb_raise(rb_eArgError, "Invalid CvMat depth");
+      break;
+    }
+  }
+  else {
+    const size_t elem_size = CV_ELEM_SIZE(src->type);
+    for (size_t k = 0; k < pts.size(); ++k) {
+      const uchar* p = src->data.ptr + (size_t)src->step * cvRound(pts[k].y) + elem_size * cvRound(pts[k].x);
+      memcpy(dst->data.ptr + elem_size * k, p, elem_size);
+    }
+  }
+  return dest;
+}
+
+/*
+ * Changes the elements at many coordinates at once.
+ * @overload scatter!(points, values)
+ *   @param points [CvMat, Array<Number>] Coordinates to change (see #gather).
+ *     Non-integer coordinates are rounded to the nearest element.
+ *   @param values [CvMat, Array<Number>, String] N new elements; a matrix of the same depth and channels
+ *     as <tt>self</tt>, or anything accepted by CvMat#set_data
+ * @return [CvMat] <tt>self</tt>
+ */
+VALUE
+rb_scatter_bang(VALUE self, VALUE points, VALUE values)
+{
+  check_writable(self);
+  CvMat* dst = CVMAT(self);
+  std::vector<CvPoint2D32f> pts;
+  read_points(points, pts);
+  check_points(dst, pts, false);
+  if (pts.empty())
+    return self;
+
+  const size_t elem_size = CV_ELEM_SIZE(dst->type);
+  const uchar* src = NULL;
+  VALUE packed = Qnil;
+  if (rb_obj_is_kind_of(values, rb_klass)) {
+    CvMat* values_ptr = CVMAT(values);
+    if (CV_MAT_TYPE(values_ptr->type) != CV_MAT_TYPE(dst->type))
+      rb_raise(rb_eTypeError, "values should have the same depth and channels as self");
+    if ((size_t)values_ptr->rows * values_ptr->cols != pts.size())
+      rb_raise(rb_eArgError, "number of values (%d) does not match number of points (%ld)",
+	       values_ptr->rows * values_ptr->cols, (long)pts.size());
+    if (CV_IS_MAT_CONT(values_ptr->type)) {
+      src = values_ptr->data.ptr;
+    }
+    else {
+      packed = new_object((int)pts.size(), 1, dst->type);
+      copy_packed_data(values_ptr, (char*)CVMAT(packed)->data.ptr);
+    }
+  }
+  else {
+    packed = new_object((int)pts.size(), 1, dst->type);
+    store_data(CVMAT(packed), values);
+  }
+  if (!NIL_P(packed))
+    src = CVMAT(packed)->data.ptr;
+
+  for (size_t k = 0; k < pts.size(); ++k) {
+    uchar* p = dst->data.ptr + (size_t)dst->step * cvRound(pts[k].y) + elem_size * cvRound(pts[k].x);
+    memcpy(p, src + elem_size * k, elem_size);
+  }
   return self;
 }
 
+/*
+ * Copies packed elements (see #copy_packed_data) from <tt>src</tt> into a matrix,
+ * respecting its row step.
+ */
+void
+store_packed_data(CvMat* mat, const char* src)
+{
+  size_t row_size = (size_t)mat->cols * CV_ELEM_SIZE(mat->type);
+  if (CV_IS_MAT_CONT(mat->type)) {
+    memcpy(mat->data.ptr, src, row_size * mat->rows);
+  }
+  else {
+    for (int j = 0; j < mat->rows; ++j) {
+      memcpy(mat->data.ptr + (size_t)mat->step * j, src + row_size * j, row_size);
+    }
+  }
+}
+
+void
+store_binary_data(CvMat* mat, const char* src, long size)
+{
+  long expected = (long)mat->rows * mat->cols * CV_ELEM_SIZE(mat->type);
+  if (size != expected)
+    rb_raise(rb_eArgError, "data size mismatch (given %ld bytes, expected %ld bytes)", size, expected);
+  store_packed_data(mat, src);
+}
+
+template <typename T>
+inline T
+integer_element(VALUE value)
+{
+  return (T)NUM2INT(value);
+}
+
+template <typename T>
+inline T
+float_element(VALUE value)
+{
+  return (T)NUM2DBL(value);
+}
+
+/*
+ * Stores the numbers of <tt>data</tt> into a matrix whose depth is T.
+ * Elements beyond the length of <tt>data</tt> are left unchanged.
+ */
+template <typename T, T (*CONVERT)(VALUE)>
+void
+store_array_data(CvMat* mat, VALUE data)
+{
+  const long len = RARRAY_LEN(data);
+  const int row_len = mat->cols * CV_MAT_CN(mat->type);
+  long n = 0;
+  for (int j = 0; j < mat->rows && n < len; ++j) {
+    T* row = (T*)(mat->data.ptr + (size_t)mat->step * j);
+    for (int i = 0; i < row_len && n < len; ++i, ++n) {
+      row[i] = CONVERT(rb_ary_entry(data, n));
+    }
+  }
+}
+
+void
+store_data(CvMat* mat, VALUE data)
+{
+  switch (TYPE(data)) {
+  case T_ARRAY:
+    if (RARRAY_LEN(data) > 0 && TYPE(rb_ary_entry(data, 0)) == T_ARRAY)
+      data = rb_funcall(data, rb_intern("flatten"), 0);
+    switch (CV_MAT_DEPTH(mat->type)) {
+    case CV_8U:
+      store_array_data<uchar, integer_element<uchar> >(mat, data);
+      break;
+    case CV_8S:
+      store_array_data<schar, integer_element<schar> >(mat, data);
+      break;
+    case CV_16U:
+      store_array_data<ushort, integer_element<ushort> >(mat, data);
+      break;
+    case CV_16S:
+      store_array_data<short, integer_element<short> >(mat, data);
+      break;
+    case CV_32S:
+      store_array_data<int, integer_element<int> >(mat, data);
+      break;
+    case CV_32F:
+      store_array_data<float, float_element<float> >(mat, data);
+      break;
+    case CV_64F:
+      store_array_data<double, float_element<double> >(mat, data);
+      break;
+    default:
+      rb_raise(rb_eArgError, "Invalid CvMat depth");
+      break;
+    }
+    break;
+  case T_STRING:
+    store_binary_data(mat, RSTRING_PTR(data), RSTRING_LEN(data));
+    break;
+  default:
+#ifdef HAVE_RUBY_MEMORY_VIEW_H
+    if (rb_memory_view_available_p(data)) {
+      rb_memory_view_t view;
+      if (!rb_memory_view_get(data, &view, RUBY_MEMORY_VIEW_SIMPLE))
+	rb_raise(rb_eArgError, "data is not a contiguous buffer");
+      long size = (long)view.byte_size;
+      long expected = (long)mat->rows * mat->cols * CV_ELEM_SIZE(mat->type);
+      if (size == expected)
+	store_packed_data(mat, (const char*)view.data);
+      rb_memory_view_release(data, &view);
+      if (size != expected)
+	rb_raise(rb_eArgError, "data size mismatch (given %ld bytes, expected %ld bytes)", size, expected);
+      break;
+    }
+#endif
+    raise_typeerror(data, "Array or String");
+    break;
+  }
+}
+
+/*
+ * Assigns user data to the matrix
+ * @overload set_data(data)
+ * @param data [Array<Number>, String] User data
+ *   * If <tt>data</tt> is an array, its numbers are stored in row-major order.
+ *     A nested array is flattened.
+ *   * If <tt>data</tt> is a string (or an object that exports a contiguous MemoryView),
+ *     it is regarded as packed binary elements of the same depth as the matrix
+ *     (e.g. made by CvMat#to_binary or Array#pack) and copied into the matrix.
+ *     Its size must be <tt>rows * cols * channel</tt> elements.
+ * @return [CvMat] <tt>self</tt>
+ */
+VALUE
+rb_set_data(VALUE self, VALUE data)
+{
+  check_writable(self);
+  store_data(CVMAT(self), data);
+  return self;
+}
+
+/*
+ * Creates a matrix from packed binary elements
+ * @overload from_binary(data, rows, cols, depth = CV_8U, channels = 3)
+ * @param data [String] Packed elements (see CvMat#set_data)
+ * @param rows [Integer] Number of rows in the matrix
+ * @param cols [Integer] Number of columns in the matrix
+ * @param depth [Integer, Symbol] Depth type in the matrix (see CvMat.new)
+ * @param channels [Integer] Number of channels in the matrix
+ * @return [CvMat] Created matrix
+ * @scope class
+ * @example
+ *   mat = CvMat.from_binary([0.1, 0.2, 0.3, 0.4].pack('f*'), 2, 2, CV_32F, 1)
+ */
+VALUE
+rb_from_binary(int argc, VALUE *argv, VALUE klass)
+{
+  VALUE data, rows, cols, depth, channel;
+  rb_scan_args(argc, argv, "32", &data, &rows, &cols, &depth, &channel);
+  int type = CV_MAKETYPE(CVMETHOD("DEPTH", depth, CV_8U), NIL_P(channel) ? 3 : NUM2INT(channel));
+
+  VALUE mat = Qnil;
+  if (RTEST(rb_class_inherited_p(klass, cIplImage::rb_class())))
+    mat = cIplImage::new_object(NUM2INT(cols), NUM2INT(rows), type);
+  else
+    mat = new_object(NUM2INT(rows), NUM2INT(cols), type);
+  store_data(CVMAT(mat), data);
+  return mat;
+}
+
 /*
  * Returns a matrix which is set every element to a given value.
  * The function copies the scalar value to every selected element of the destination array:
@@ -1141,6 +2131,7 @@ rb_set(int argc, VALUE *argv, VALUE self)
 VALUE
 rb_set_bang(int argc, VALUE *argv, VALUE self)
 {
+  check_writable(self);
   VALUE value, mask;
   rb_scan_args(argc, argv, "11", &value, &mask);
   try {
@@ -1172,7 +2163,9 @@ rb_save_image(int argc, VALUE *argv, VALUE self)
   }
 
   try {
-    cvSaveImage(StringValueCStr(_filename), CVARR(self), params);
+    const char* filename_ptr = StringValueCStr(_filename);
+    CvArr* self_ptr = CVARR(self);
+    rb_cvCallWithoutGVL([&] { cvSaveImage(filename_ptr, self_ptr, params); });
   }
   catch (cv::Exception& e) {
     if (params != NULL) {
@@ -1210,6 +2203,7 @@ rb_set_zero(VALUE self)
 VALUE
 rb_set_zero_bang(VALUE self)
 {
+  check_writable(self);
   try {
     cvSetZero(CVARR(self));
   }
@@ -1244,6 +2238,7 @@ rb_set_identity(int argc, VALUE *argv, VALUE self)
 VALUE
 rb_set_identity_bang(int argc, VALUE *argv, VALUE self)
 {
+  check_writable(self);
   VALUE val;
   CvScalar value;
   if (rb_scan_args(argc, argv, "01",  &val) < 1)
@@ -1286,6 +2281,7 @@ rb_range(VALUE self, VALUE start, VALUE end)
 VALUE
 rb_range_bang(VALUE self, VALUE start, VALUE end)
 {
+  check_writable(self);
   try {
     cvRange(CVARR(self), NUM2DBL(start), NUM2DBL(end));
   }
@@ -1310,6 +2306,7 @@ rb_range_bang(VALUE self, VALUE start, VALUE end)
 VALUE
 rb_reshape(int argc, VALUE *argv, VALUE self)
 {
+  check_viewable(self);
   VALUE cn, rows;
   CvMat *mat = NULL;
   rb_scan_args(argc, argv, "11", &cn, &rows);
@@ -1372,6 +2369,7 @@ rb_flip(int argc, VALUE *argv, VALUE self)
 VALUE
 rb_flip_bang(int argc, VALUE *argv, VALUE self)
 {
+  check_writable(self);
   VALUE format;
   int mode = 1;
   if (rb_scan_args(argc, argv, "01", &format) > 0) {
@@ -1511,6 +2509,7 @@ rb_rand_shuffle(int argc, VALUE *argv, VALUE self)
 VALUE
 rb_rand_shuffle_bang(int argc, VALUE *argv, VALUE self)
 {
+  check_writable(self);
   VALUE seed, iter;
   rb_scan_args(argc, argv, "02", &seed, &iter);
   try {
@@ -1906,6 +2905,7 @@ rb_not(VALUE self)
 VALUE
 rb_not_bang(VALUE self)
 {
+  check_writable(self);
   try {
     cvNot(CVARR(self), CVARR(self));
   }
@@ -2775,6 +3775,7 @@ rb_line(int argc, VALUE *argv, VALUE self)
 VALUE
 rb_line_bang(int argc, VALUE *argv, VALUE self)
 {
+  check_writable(self);
   VALUE p1, p2, drawing_option;
   rb_scan_args(argc, argv, "21", &p1, &p2, &drawing_option);
   drawing_option = DRAWING_OPTION(drawing_option);
@@ -2834,6 +3835,7 @@ rb_rectangle(int argc, VALUE *argv, VALUE self)
 VALUE
 rb_rectangle_bang(int argc, VALUE *argv, VALUE self)
 {
+  check_writable(self);
   VALUE p1, p2, drawing_option;
   rb_scan_args(argc, argv, "21", &p1, &p2, &drawing_option);
   drawing_option = DRAWING_OPTION(drawing_option);
@@ -2893,6 +3895,7 @@ rb_circle(int argc, VALUE *argv, VALUE self)
 VALUE
 rb_circle_bang(int argc, VALUE *argv, VALUE self)
 {
+  check_writable(self);
   VALUE center, radius, drawing_option;
   rb_scan_args(argc, argv, "21", &center, &radius, &drawing_option);
   drawing_option = DRAWING_OPTION(drawing_option);
@@ -2958,6 +3961,7 @@ rb_ellipse(int argc, VALUE *argv, VALUE self)
 VALUE
 rb_ellipse_bang(int argc, VALUE *argv, VALUE self)
 {
+  check_writable(self);
   VALUE center, axis, angle, start_angle, end_angle, drawing_option;
   rb_scan_args(argc, argv, "51", &center, &axis, &angle, &start_angle, &end_angle, &drawing_option);
   drawing_option = DRAWING_OPTION(drawing_option);
@@ -3019,6 +4023,7 @@ rb_ellipse_box(int argc, VALUE *argv, VALUE self)
 VALUE
 rb_ellipse_box_bang(int argc, VALUE *argv, VALUE self)
 {
+  check_writable(self);
   VALUE box, drawing_option;
   rb_scan_args(argc, argv, "11", &box, &drawing_option);
   drawing_option = DRAWING_OPTION(drawing_option);
@@ -3076,6 +4081,7 @@ rb_fill_poly(int argc, VALUE *argv, VALUE self)
 VALUE
 rb_fill_poly_bang(int argc, VALUE *argv, VALUE self)
 {
+  check_writable(self);
   VALUE polygons, drawing_option;
   VALUE points;
   int i, j;
@@ -3087,14 +4093,14 @@ rb_fill_poly_bang(int argc, VALUE *argv, VALUE self)
   Check_Type(polygons, T_ARRAY);
   drawing_option = DRAWING_OPTION(drawing_option);
   num_polygons = RARRAY_LEN(polygons);
-  num_points = RB_ALLOC_N(int, num_polygons);
+  num_points = RB_ALLOC_N(int, num_polygons);
 
-  p = RB_ALLOC_N(CvPoint*, num_polygons);
+  p = RB_ALLOC_N(CvPoint*, num_polygons);
   for (j = 0; j < num_polygons; ++j) {
     points = rb_ary_entry(polygons, j);
     Check_Type(points, T_ARRAY);
     num_points[j] = RARRAY_LEN(points);
-    p[j] = RB_ALLOC_N(CvPoint, num_points[j]);
+    p[j] = RB_ALLOC_N(CvPoint, num_points[j]);
     for (i = 0; i < num_points[j]; ++i) {
       p[j][i] = VALUE_TO_CVPOINT(rb_ary_entry(points, i));
     }
@@ -3152,6 +4158,7 @@ rb_fill_convex_poly(int argc, VALUE *argv, VALUE self)
 VALUE
 rb_fill_convex_poly_bang(int argc, VALUE *argv, VALUE self)
 {
+  check_writable(self);
   VALUE points, drawing_option;
   int i, num_points;
   CvPoint *p;
@@ -3160,7 +4167,7 @@ rb_fill_convex_poly_bang(int argc, VALUE *argv, VALUE self)
   Check_Type(points, T_ARRAY);
   drawing_option = DRAWING_OPTION(drawing_option);
   num_points = RARRAY_LEN(points);
-  p = RB_ALLOC_N(CvPoint, num_points);
+  p = RB_ALLOC_N(CvPoint, num_points);
   for (i = 0; i < num_points; ++i)
     p[i] = VALUE_TO_CVPOINT(rb_ary_entry(points, i));
 
@@ -3225,6 +4232,7 @@ rb_poly_line(int argc, VALUE *argv, VALUE self)
 VALUE
 rb_poly_line_bang(int argc, VALUE *argv, VALUE self)
 {
+  check_writable(self);
   VALUE polygons, drawing_option;
   VALUE points;
   int i, j;
@@ -3236,14 +4244,14 @@ rb_poly_line_bang(int argc, VALUE *argv, VALUE self)
   Check_Type(polygons, T_ARRAY);
   drawing_option = DRAWING_OPTION(drawing_option);
   num_polygons = RARRAY_LEN(polygons);
-  num_points = RB_ALLOC_N(int, num_polygons);
-  p = RB_ALLOC_N(CvPoint*, num_polygons);
+  num_points = RB_ALLOC_N(int, num_polygons);
+  p = RB_ALLOC_N(CvPoint*, num_polygons);
 
   for (j = 0; j < num_polygons; ++j) {
     points = rb_ary_entry(polygons, j);
     Check_Type(points, T_ARRAY);
     num_points[j] = RARRAY_LEN(points);
-    p[j] = RB_ALLOC_N(CvPoint, num_points[j]);
+    p[j] = RB_ALLOC_N(CvPoint, num_points[j]);
     for (i = 0; i < num_points[j]; ++i) {
       p[j][i] = VALUE_TO_CVPOINT(rb_ary_entry(points, i));
     }
@@ -3296,6 +4304,7 @@ rb_put_text(int argc, VALUE* argv, VALUE self)
 VALUE
 rb_put_text_bang(int argc, VALUE* argv, VALUE self)
 {
+  check_writable(self);
   VALUE _text, _point, _font, _color;
   rb_scan_args(argc, argv, "31", &_text, &_point, &_font, &_color);
   CvScalar color = NIL_P(_color) ? CV_RGB(0, 0, 0) : VALUE_TO_CVSCALAR(_color);
@@ -3316,6 +4325,7 @@ rb_put_text_bang(int argc, VALUE* argv, VALUE self)
  * @param xorder [Integer] Order of the derivative x.
  * @param yorder [Integer] Order of the derivative y.
  * @param aperture_size [Integer] Size of the extended Sobel kernel; it must be 1, 3, 5, or 7.
+ * @param out [CvMat] Destination for the result (see #resize).
  * @return [CvMat] Output image.
  * @opencv_func cvSovel
  */
@@ -3323,15 +4333,16 @@ VALUE
 rb_sobel(int argc, VALUE *argv, VALUE self)
 {
   VALUE xorder, yorder, aperture_size, dest;
+  VALUE out = extract_out(&argc, argv);
   if (rb_scan_args(argc, argv, "21", &xorder, &yorder, &aperture_size) < 3)
     aperture_size = INT2FIX(3);
   CvMat* self_ptr = CVMAT(self);
   switch(CV_MAT_DEPTH(self_ptr->type)) {
   case CV_8U:
-    dest = new_mat_kind_object(cvGetSize(self_ptr), self, CV_16S, 1);
+    dest = destination_object(out, cvGetSize(self_ptr), self, CV_16S, 1);
     break;
   case CV_32F:
-    dest = new_mat_kind_object(cvGetSize(self_ptr), self, CV_32F, 1);
+    dest = destination_object(out, cvGetSize(self_ptr), self, CV_32F, 1);
     break;
   default:
     rb_raise(rb_eArgError, "source depth should be CV_8U or CV_32F.");
@@ -3339,7 +4350,9 @@ rb_sobel(int argc, VALUE *argv, VALUE self)
   }
 
   try {
-    cvSobel(self_ptr, CVARR(dest), NUM2INT(xorder), NUM2INT(yorder), NUM2INT(aperture_size));
+    CvArr* dest_ptr = CVARR(dest);
+    int xorder_value = NUM2INT(xorder), yorder_value = NUM2INT(yorder), aperture = NUM2INT(aperture_size);
+    rb_cvCallWithoutGVL([&] { cvSobel(self_ptr, dest_ptr, xorder_value, yorder_value, aperture); });
   }
   catch (cv::Exception& e) {
     raise_cverror(e);
@@ -3353,6 +4366,7 @@ rb_sobel(int argc, VALUE *argv, VALUE self)
  * @overload laplace(aperture_size = 3)
  * @param aperture_size [Integer] Aperture size used to compute the second-derivative filters.
  *     The size must be positive and odd.
+ * @param out [CvMat] Destination for the result (see #resize).
  * @return Output image.
  * @opencv_func cvLaplace
  */
@@ -3360,22 +4374,25 @@ VALUE
 rb_laplace(int argc, VALUE *argv, VALUE self)
 {
   VALUE aperture_size, dest;
+  VALUE out = extract_out(&argc, argv);
   if (rb_scan_args(argc, argv, "01", &aperture_size) < 1)
     aperture_size = INT2FIX(3);
   CvMat* self_ptr = CVMAT(self);
   switch(CV_MAT_DEPTH(self_ptr->type)) {
   case CV_8U:
-    dest = new_mat_kind_object(cvGetSize(self_ptr), self, CV_16S, 1);
+    dest = destination_object(out, cvGetSize(self_ptr), self, CV_16S, 1);
     break;
   case CV_32F:
-    dest = new_mat_kind_object(cvGetSize(self_ptr), self, CV_32F, 1);
+    dest = destination_object(out, cvGetSize(self_ptr), self, CV_32F, 1);
     break;
   default:
     rb_raise(rb_eArgError, "source depth should be CV_8U or CV_32F.");
   }
 
   try {
-    cvLaplace(self_ptr, CVARR(dest), NUM2INT(aperture_size));
+    CvArr* dest_ptr = CVARR(dest);
+    int aperture = NUM2INT(aperture_size);
+    rb_cvCallWithoutGVL([&] { cvLaplace(self_ptr, dest_ptr, aperture); });
   }
   catch (cv::Exception& e) {
     raise_cverror(e);
@@ -3393,6 +4410,7 @@ rb_laplace(int argc, VALUE *argv, VALUE self)
  * @param thresh1 [Number] First threshold for the hysteresis procedure.
  * @param thresh2 [Number] Second threshold for the hysteresis procedure.
  * @param aperture_size [Integer] Aperture size for the sobel operator.
+ * @param out [CvMat] Destination for the result (see #resize).
  * @return [CvMat] Output edge map
  * @opencv_func cvCanny
  */
@@ -3400,13 +4418,16 @@ VALUE
 rb_canny(int argc, VALUE *argv, VALUE self)
 {
   VALUE thresh1, thresh2, aperture_size;
+  VALUE out = extract_out(&argc, argv);
   if (rb_scan_args(argc, argv, "21", &thresh1, &thresh2, &aperture_size) < 3)
     aperture_size = INT2FIX(3);
   CvArr* self_ptr = CVARR(self);
-  VALUE dest = new_mat_kind_object(cvGetSize(self_ptr), self);
+  VALUE dest = destination_object(out, cvGetSize(self_ptr), self);
   
   try {
-    cvCanny(self_ptr, CVARR(dest), NUM2INT(thresh1), NUM2INT(thresh2), NUM2INT(aperture_size));
+    CvArr* dest_ptr = CVARR(dest);
+    int low = NUM2INT(thresh1), high = NUM2INT(thresh2), aperture = NUM2INT(aperture_size);
+    rb_cvCallWithoutGVL([&] { cvCanny(self_ptr, dest_ptr, low, high, aperture); });
   }
   catch (cv::Exception& e) {
     raise_cverror(e);
@@ -3562,7 +4583,7 @@ rb_find_chessboard_corners(int argc, VALUE *argv, VALUE self)
 
   int flag = NIL_P(flag_val) ? CV_CALIB_CB_ADAPTIVE_THRESH : NUM2INT(flag_val);
   CvSize pattern_size = VALUE_TO_CVSIZE(pattern_size_val);
-  CvPoint2D32f* corners = RB_ALLOC_N(CvPoint2D32f, pattern_size.width * pattern_size.height);
+  CvPoint2D32f* corners = RB_ALLOC_N(CvPoint2D32f, pattern_size.width * pattern_size.height);
   int num_found_corners = 0;
   int pattern_was_found = 0;
   try {
@@ -3598,7 +4619,7 @@ rb_find_corner_sub_pix(VALUE self, VALUE corners, VALUE win_size, VALUE zero_zon
 {
   Check_Type(corners, T_ARRAY);
   int count = RARRAY_LEN(corners);
-  CvPoint2D32f* corners_buff = RB_ALLOC_N(CvPoint2D32f, count);
+  CvPoint2D32f* corners_buff = RB_ALLOC_N(CvPoint2D32f, count);
   VALUE* corners_ptr = RARRAY_PTR(corners);
 
   for (int i = 0; i < count; i++) {
@@ -3664,10 +4685,8 @@ rb_good_features_to_track(int argc, VALUE *argv, VALUE self)
 			  GF_K(good_features_to_track_option));
   }
   catch (cv::Exception& e) {
-    if (eigen != NULL)
-      cvReleaseMat(&eigen);
-    if (tmp != NULL)
-      cvReleaseMat(&tmp);
+    rb_cvReleaseMat(&eigen);
+    rb_cvReleaseMat(&tmp);
     if (p32 != NULL)
       cvFree(&p32);
     raise_cverror(e);
@@ -3676,8 +4695,8 @@ rb_good_features_to_track(int argc, VALUE *argv, VALUE self)
   for (int i = 0; i < np; ++i)
     rb_ary_store(corners, i, cCvPoint2D32f::new_object(p32[i]));
   cvFree(&p32);
-  cvReleaseMat(&eigen);
-  cvReleaseMat(&tmp);
+  rb_cvReleaseMat(&eigen);
+  rb_cvReleaseMat(&tmp);
   return corners;
 }
 
@@ -3757,6 +4776,8 @@ rb_quadrangle_sub_pix(int argc, VALUE *argv, VALUE self)
  *       it is similar to the <tt>:nn</tt> method.
  *     * <tt>CV_INTER_CUBIC</tt> - A bicubic interpolation over 4x4 pixel neighborhood
  *     * <tt>CV_INTER_LANCZOS4</tt> - A Lanczos interpolation over 8x8 pixel neighborhood
+ * @param out [CvMat] Destination for the result instead of a newly allocated matrix. It must have
+ *   the size and type of the result and must not share its data with <tt>self</tt>.
  * @return [CvMat] Output image.
  * @opencv_func cvResize
  */
@@ -3764,12 +4785,15 @@ VALUE
 rb_resize(int argc, VALUE *argv, VALUE self)
 {
   VALUE size, interpolation;
+  VALUE out = extract_out(&argc, argv);
   rb_scan_args(argc, argv, "11", &size, &interpolation);
-  VALUE dest = new_mat_kind_object(VALUE_TO_CVSIZE(size), self);
+  VALUE dest = destination_object(out, VALUE_TO_CVSIZE(size), self);
   int method = NIL_P(interpolation) ? CV_INTER_LINEAR : NUM2INT(interpolation);
 
   try {
-    cvResize(CVARR(self), CVARR(dest), method);
+    CvArr* self_ptr = CVARR(self);
+    CvArr* dest_ptr = CVARR(dest);
+    rb_cvCallWithoutGVL([&] { cvResize(self_ptr, dest_ptr, method); });
   }
   catch (cv::Exception& e) {
     raise_cverror(e);
@@ -3784,6 +4808,7 @@ rb_resize(int argc, VALUE *argv, VALUE self)
  * @param map_matrix [CvMat] 2x3 transformation matrix.
  * @param flags [Integer] Combination of interpolation methods (#see resize) and the optional
  *     flag <tt>WARP_INVERSE_MAP</tt> that means that <tt>map_matrix</tt> is the inverse transformation.
+ * @param out [CvMat] Destination for the result (see #resize).
  * @return [CvMat] Output image that has the size <tt>size</tt> and the same type as <tt>self</tt>.
  * @param fillval [Number, CvScalar] Value used in case of a constant border.
  * @opencv_func cvWarpAffine
@@ -3793,14 +4818,17 @@ rb_warp_affine(int argc, VALUE *argv, VALUE self)
 {
   VALUE map_matrix, flags_val, fill_value;
   VALUE dest = Qnil;
+  VALUE out = extract_out(&argc, argv);
   if (rb_scan_args(argc, argv, "12", &map_matrix, &flags_val, &fill_value) < 3)
     fill_value = INT2FIX(0);
   CvArr* self_ptr = CVARR(self);
   int flags = NIL_P(flags_val) ? (CV_INTER_LINEAR | CV_WARP_FILL_OUTLIERS) : NUM2INT(flags_val);
   try {
-    dest = new_mat_kind_object(cvGetSize(self_ptr), self);
-    cvWarpAffine(self_ptr, CVARR(dest), CVMAT_WITH_CHECK(map_matrix),
-		 flags, VALUE_TO_CVSCALAR(fill_value));
+    dest = destination_object(out, cvGetSize(self_ptr), self);
+    CvArr* dest_ptr = CVARR(dest);
+    CvMat* map_matrix_ptr = CVMAT_WITH_CHECK(map_matrix);
+    CvScalar fillval = VALUE_TO_CVSCALAR(fill_value);
+    rb_cvCallWithoutGVL([&] { cvWarpAffine(self_ptr, dest_ptr, map_matrix_ptr, flags, fillval); });
   }
   catch (cv::Exception& e) {
     raise_cverror(e);
@@ -3907,8 +4935,8 @@ rb_get_perspective_transform(VALUE self, VALUE source, VALUE dest)
 
   int count = RARRAY_LEN(source);
 
-  CvPoint2D32f* source_buff = RB_ALLOC_N(CvPoint2D32f, count);
-  CvPoint2D32f* dest_buff = RB_ALLOC_N(CvPoint2D32f, count);
+  CvPoint2D32f* source_buff = RB_ALLOC_N(CvPoint2D32f, count);
+  CvPoint2D32f* dest_buff = RB_ALLOC_N(CvPoint2D32f, count);
 
   for (int i = 0; i < count; i++) {
     source_buff[i] = *(CVPOINT2D32F(RARRAY_PTR(source)[i]));
@@ -3934,6 +4962,7 @@ rb_get_perspective_transform(VALUE self, VALUE source, VALUE dest)
  *   @param flags [Integer] Combination of interpolation methods (<tt>CV_INTER_LINEAR</tt> or <tt>CV_INTER_NEAREST</tt>)
  *     and the optional flag <tt>CV_WARP_INVERSE_MAP</tt>, that sets <tt>map_matrix</tt> as the inverse transformation.
  *   @param fillval [Number, CvScalar] Value used in case of a constant border.
+ * @param out [CvMat] Destination for the result (see #resize).
  * @return [CvMat] Output image.
  * @opencv_func cvWarpPerspective
  */
@@ -3941,15 +4970,18 @@ VALUE
 rb_warp_perspective(int argc, VALUE *argv, VALUE self)
 {
   VALUE map_matrix, flags_val, option, fillval;
+  VALUE out = extract_out(&argc, argv);
   if (rb_scan_args(argc, argv, "13", &map_matrix, &flags_val, &option, &fillval) < 4)
     fillval = INT2FIX(0);
   CvArr* self_ptr = CVARR(self);
   VALUE dest = Qnil;
   int flags = NIL_P(flags_val) ? (CV_INTER_LINEAR | CV_WARP_FILL_OUTLIERS) : NUM2INT(flags_val);
   try {
-    dest = new_mat_kind_object(cvGetSize(self_ptr), self);
-    cvWarpPerspective(self_ptr, CVARR(dest), CVMAT_WITH_CHECK(map_matrix),
-		      flags, VALUE_TO_CVSCALAR(fillval));
+    dest = destination_object(out, cvGetSize(self_ptr), self);
+    CvArr* dest_ptr = CVARR(dest);
+    CvMat* map_matrix_ptr = CVMAT_WITH_CHECK(map_matrix);
+    CvScalar fill_value = VALUE_TO_CVSCALAR(fillval);
+    rb_cvCallWithoutGVL([&] { cvWarpPerspective(self_ptr, dest_ptr, map_matrix_ptr, flags, fill_value); });
   }
   catch (cv::Exception& e) {
     raise_cverror(e);
@@ -3968,6 +5000,7 @@ rb_warp_perspective(int argc, VALUE *argv, VALUE self)
  *   @param flags [Integer] Combination of interpolation methods (<tt>CV_INTER_LINEAR</tt> or <tt>CV_INTER_NEAREST</tt>)
  *     and the optional flag <tt>CV_WARP_INVERSE_MAP</tt>, that sets <tt>map_matrix</tt> as the inverse transformation.
  *   @param fillval [Number, CvScalar] Value used in case of a constant border.
+ * @param out [CvMat] Destination for the result (see #resize).
  * @return [CvMat] Output image.
  * @opencv_func cvRemap
  */
@@ -3975,15 +5008,19 @@ VALUE
 rb_remap(int argc, VALUE *argv, VALUE self)
 {
   VALUE mapx, mapy, flags_val, option, fillval;
+  VALUE out = extract_out(&argc, argv);
   if (rb_scan_args(argc, argv, "23", &mapx, &mapy, &flags_val, &option, &fillval) < 5)
     fillval = INT2FIX(0);
   CvArr* self_ptr = CVARR(self);
   VALUE dest = Qnil;
   int flags = NIL_P(flags_val) ? (CV_INTER_LINEAR | CV_WARP_FILL_OUTLIERS) : NUM2INT(flags_val);
   try {
-    dest = new_mat_kind_object(cvGetSize(self_ptr), self);
-    cvRemap(self_ptr, CVARR(dest), CVARR_WITH_CHECK(mapx), CVARR_WITH_CHECK(mapy),
-	    flags, VALUE_TO_CVSCALAR(fillval));
+    dest = destination_object(out, cvGetSize(self_ptr), self);
+    CvArr* dest_ptr = CVARR(dest);
+    CvArr* mapx_ptr = CVARR_WITH_CHECK(mapx);
+    CvArr* mapy_ptr = CVARR_WITH_CHECK(mapy);
+    CvScalar fill_value = VALUE_TO_CVSCALAR(fillval);
+    rb_cvCallWithoutGVL([&] { cvRemap(self_ptr, dest_ptr, mapx_ptr, mapy_ptr, flags, fill_value); });
   }
   catch (cv::Exception& e) {
     raise_cverror(e);
@@ -4046,11 +5083,14 @@ rb_erode(int argc, VALUE *argv, VALUE self)
 VALUE
 rb_erode_bang(int argc, VALUE *argv, VALUE self)
 {
+  check_writable(self);
   VALUE element, iteration;
   rb_scan_args(argc, argv, "02", &element, &iteration);
   IplConvKernel* kernel = NIL_P(element) ? NULL : IPLCONVKERNEL_WITH_CHECK(element);
   try {
-    cvErode(CVARR(self), CVARR(self), kernel, IF_INT(iteration, 1));
+    CvArr* self_ptr = CVARR(self);
+    int iterations = IF_INT(iteration, 1);
+    rb_cvCallWithoutGVL([&] { cvErode(self_ptr, self_ptr, kernel, iterations); });
   }
   catch (cv::Exception& e) {
     raise_cverror(e);
@@ -4083,11 +5123,14 @@ rb_dilate(int argc, VALUE *argv, VALUE self)
 VALUE
 rb_dilate_bang(int argc, VALUE *argv, VALUE self)
 {
+  check_writable(self);
   VALUE element, iteration;
   rb_scan_args(argc, argv, "02", &element, &iteration);
   IplConvKernel* kernel = NIL_P(element) ? NULL : IPLCONVKERNEL_WITH_CHECK(element);
   try {
-    cvDilate(CVARR(self), CVARR(self), kernel, IF_INT(iteration, 1));
+    CvArr* self_ptr = CVARR(self);
+    int iterations = IF_INT(iteration, 1);
+    rb_cvCallWithoutGVL([&] { cvDilate(self_ptr, self_ptr, kernel, iterations); });
   }
   catch (cv::Exception& e) {
     raise_cverror(e);
@@ -4107,6 +5150,7 @@ rb_dilate_bang(int argc, VALUE *argv, VALUE self)
  *   * <tt>CV_MOP_BLACKHAT</tt> - Black hat
  * @param element [IplConvKernel] Structuring element.
  * @param iteration [Integer] Number of times erosion and dilation are applied.
+ * @param out [CvMat] Destination for the result (see #resize).
  * @return [CvMat] Result array
  * @opencv_func cvMorphologyEx
  */
@@ -4114,43 +5158,62 @@ VALUE
 rb_morphology(int argc, VALUE *argv, VALUE self)
 {
   VALUE element, iteration, operation_val;
+  VALUE out = extract_out(&argc, argv);
   rb_scan_args(argc, argv, "12", &operation_val, &element, &iteration);
 
   int operation = CVMETHOD("MORPHOLOGICAL_OPERATION", operation_val, -1);
   CvArr* self_ptr = CVARR(self);
   CvSize size = cvGetSize(self_ptr);
-  VALUE dest = new_mat_kind_object(size, self);
+  VALUE dest = destination_object(out, size, self);
   IplConvKernel* kernel = NIL_P(element) ? NULL : IPLCONVKERNEL_WITH_CHECK(element);
+  CvArr* dest_ptr = CVARR(dest);
+  int iterations = IF_INT(iteration, 1);
+  CvMat* temp = NULL;
   try {
     if (operation == CV_MOP_GRADIENT) {
-      CvMat* temp = rb_cvCreateMat(size.height, size.width, cvGetElemType(self_ptr));
-      cvMorphologyEx(self_ptr, CVARR(dest), temp, kernel, CV_MOP_GRADIENT, IF_INT(iteration, 1));
-      cvReleaseMat(&temp);
-    }
-    else {
-      cvMorphologyEx(self_ptr, CVARR(dest), 0, kernel, operation, IF_INT(iteration, 1));
+      temp = rb_cvCreateMat(size.height, size.width, cvGetElemType(self_ptr));
     }
+    rb_cvCallWithoutGVL([&] { cvMorphologyEx(self_ptr, dest_ptr, temp, kernel, operation, iterations); });
   }
   catch (cv::Exception& e) {
+    rb_cvReleaseMat(&temp);
     raise_cverror(e);
   }
+  rb_cvReleaseMat(&temp);
 
   return dest;
 }
 
+/*
+ * Calls cvSmooth without the GVL and raises CvError on failure.
+ */
+void
+smooth_without_gvl(CvArr* src, CvArr* dst, int smoothtype, int size1, int size2, double sigma1, double sigma2)
+{
+  try {
+    rb_cvCallWithoutGVL([&] { cvSmooth(src, dst, smoothtype, size1, size2, sigma1, sigma2); });
+  }
+  catch (cv::Exception& e) {
+    raise_cverror(e);
+  }
+}
+
 /*
  * call-seq:
- *   smooth_blur_no_scale([p1 = 3, p2 = 3]) -> cvmat
+ *   smooth_blur_no_scale([p1 = 3, p2 = 3][, out: dest]) -> cvmat
  *
  * Smooths the image by simple blur with no scaling.
  * * 8bit unsigned -> return 16bit unsigned
  * * 32bit floating point -> return 32bit floating point
  * <b>support single-channel image only.</b>
+ *
+ * If <i>out</i> is given, the result is stored into it instead of a new matrix (see #resize).
  */
 VALUE
 rb_smooth_blur_no_scale(int argc, VALUE *argv, VALUE self)
 {
   VALUE p1, p2, dest;
+  VALUE out = extract_out(&argc, argv);
   rb_scan_args(argc, argv, "02", &p1, &p2);
   CvArr* self_ptr = CVARR(self);
   int type = cvGetElemType(self_ptr), dest_type;
@@ -4164,32 +5227,35 @@ rb_smooth_blur_no_scale(int argc, VALUE *argv, VALUE self)
   default:
     rb_raise(rb_eNotImpError, "unsupport format. (support 8bit unsigned/signed or 32bit floating point only)");
   }
-  dest = new_mat_kind_object(cvGetSize(self_ptr), self, dest_type, CV_MAT_CN(type));
-  cvSmooth(self_ptr, CVARR(dest), CV_BLUR_NO_SCALE, IF_INT(p1, 3), IF_INT(p2, 3));
+  dest = destination_object(out, cvGetSize(self_ptr), self, dest_type, CV_MAT_CN(type));
+  smooth_without_gvl(self_ptr, CVARR(dest), CV_BLUR_NO_SCALE, IF_INT(p1, 3), IF_INT(p2, 3));
   return dest;
 }
 
 /*
  * call-seq:
- *   smooth_blur([p1 = 3, p2 = 3]) -> cvmat
+ *   smooth_blur([p1 = 3, p2 = 3][, out: dest]) -> cvmat
  *
  * Smooths the image by simple blur.
  * Summation over a pixel <i>p1</i> x <i>p2</i> neighborhood with subsequent scaling by 1 / (p1*p2).
+ *
+ * If <i>out</i> is given, the result is stored into it instead of a new matrix (see #resize).
  */
 VALUE
 rb_smooth_blur(int argc, VALUE *argv, VALUE self)
 {
   VALUE p1, p2, dest;
+  VALUE out = extract_out(&argc, argv);
   rb_scan_args(argc, argv, "02", &p1, &p2);
   CvArr* self_ptr = CVARR(self);
-  dest = new_mat_kind_object(cvGetSize(self_ptr), self);
-  cvSmooth(self_ptr, CVARR(dest), CV_BLUR, IF_INT(p1, 3), IF_INT(p2, 3));
+  dest = destination_object(out, cvGetSize(self_ptr), self);
+  smooth_without_gvl(self_ptr, CVARR(dest), CV_BLUR, IF_INT(p1, 3), IF_INT(p2, 3));
   return dest;
 }
 
 /*
  * call-seq:
- *   smooth_gaussian([p1 = 3, p2 = 3, p3 = 0.0, p4 = 0.0]) -> cvmat
+ *   smooth_gaussian([p1 = 3, p2 = 3, p3 = 0.0, p4 = 0.0][, out: dest]) -> cvmat
  *
  * Smooths the image by gaussian blur.
  * Convolving image with <i>p1</i> x <i>p2</i> Gaussian kernel.
@@ -4201,51 +5267,60 @@ rb_smooth_blur(int argc, VALUE *argv, VALUE self)
  *
  * <i>p4</i> is in case of non-square Gaussian kernel the parameter.
  * It may be used to specify a different (from p3) sigma in the vertical direction.
+ *
+ * If <i>out</i> is given, the result is stored into it instead of a new matrix (see #resize).
  */
 VALUE
 rb_smooth_gaussian(int argc, VALUE *argv, VALUE self)
 {
   VALUE p1, p2, p3, p4, dest;
+  VALUE out = extract_out(&argc, argv);
   rb_scan_args(argc, argv, "04", &p1, &p2, &p3, &p4);
   CvArr* self_ptr = CVARR(self);
-  dest = new_mat_kind_object(cvGetSize(self_ptr), self);
-  cvSmooth(self_ptr, CVARR(dest), CV_GAUSSIAN, IF_INT(p1, 3), IF_INT(p2, 3), IF_DBL(p3, 0.0), IF_DBL(p4, 0.0));
+  dest = destination_object(out, cvGetSize(self_ptr), self);
+  smooth_without_gvl(self_ptr, CVARR(dest), CV_GAUSSIAN, IF_INT(p1, 3), IF_INT(p2, 3), IF_DBL(p3, 0.0), IF_DBL(p4, 0.0));
   return dest;
 }
 
 /*
  * call-seq:
- *   smooth_median([p1 = 3]) -> cvmat
+ *   smooth_median([p1 = 3][, out: dest]) -> cvmat
  *
  * Smooths the image by median blur.
  * Finding median of <i>p1</i> x <i>p1</i> neighborhood (i.e. the neighborhood is square).
+ *
+ * If <i>out</i> is given, the result is stored into it instead of a new matrix (see #resize).
  */
 VALUE
 rb_smooth_median(int argc, VALUE *argv, VALUE self)
 {
   VALUE p1, dest;
+  VALUE out = extract_out(&argc, argv);
   rb_scan_args(argc, argv, "01", &p1);
   CvArr* self_ptr = CVARR(self);
-  dest = new_mat_kind_object(cvGetSize(self_ptr), self);
-  cvSmooth(self_ptr, CVARR(dest), CV_MEDIAN, IF_INT(p1, 3));
+  dest = destination_object(out, cvGetSize(self_ptr), self);
+  smooth_without_gvl(self_ptr, CVARR(dest), CV_MEDIAN, IF_INT(p1, 3));
   return dest;
 }
 
 /*
  * call-seq:
- *   smooth_bilateral([p1 = 3][p2 = 3]) -> cvmat
+ *   smooth_bilateral([p1 = 3][p2 = 3][, out: dest]) -> cvmat
  *
  * Smooths the image by bilateral filter.
  * Applying bilateral 3x3 filtering with color sigma=<i>p1</i> and space sigma=<i>p2</i>.
+ *
+ * If <i>out</i> is given, the result is stored into it instead of a new matrix (see #resize).
  */
 VALUE
 rb_smooth_bilateral(int argc, VALUE *argv, VALUE self)
 {
   VALUE p1, p2, dest;
+  VALUE out = extract_out(&argc, argv);
   rb_scan_args(argc, argv, "02", &p1, &p2);
   CvArr* self_ptr = CVARR(self);
-  dest = new_mat_kind_object(cvGetSize(self_ptr), self);
-  cvSmooth(self_ptr, CVARR(dest), CV_BILATERAL, IF_INT(p1, 3), IF_INT(p2, 3));
+  dest = destination_object(out, cvGetSize(self_ptr), self);
+  smooth_without_gvl(self_ptr, CVARR(dest), CV_BILATERAL, IF_INT(p1, 3), IF_INT(p2, 3));
   return dest;
 }
 
@@ -4272,6 +5347,7 @@ rb_smooth_bilateral(int argc, VALUE *argv, VALUE self)
  *     Otherwise it must be a positive odd number.
  *   @param sigma1 [Integer] In the case of a Gaussian parameter this parameter may specify
  *     Gaussian sigma (standard deviation). If it is zero, it is calculated from the kernel size.
+ * @param out [CvMat] Destination for the result (see #resize).
  * @return [CvMat] The destination image.
  * @opencv_func cvSmooth
  */
@@ -4279,6 +5355,7 @@ VALUE
 rb_smooth(int argc, VALUE *argv, VALUE self)
 {
   VALUE smoothtype, p1, p2, p3, p4;
+  VALUE options = (argc > 1 && TYPE(argv[argc - 1]) == T_HASH) ? argv[--argc] : Qnil;
   rb_scan_args(argc, argv, "14", &smoothtype, &p1, &p2, &p3, &p4);
   int _smoothtype = CVMETHOD("SMOOTHING_TYPE", smoothtype, -1);
   
@@ -4308,9 +5385,14 @@ rb_smooth(int argc, VALUE *argv, VALUE self)
     smooth_func = rb_smooth_gaussian;
     break;
   }
+  VALUE args[5];
+  for (int i = 0; i < argc; i++)
+    args[i] = argv[i + 1];
+  if (!NIL_P(options))
+    args[argc++] = options;
   VALUE result = Qnil;
   try {
-    result = (*smooth_func)(argc, argv + 1, self);
+    result = (*smooth_func)(argc, args, self);
   }
   catch (cv::Exception& e) {
     raise_cverror(e);
@@ -4320,24 +5402,29 @@ rb_smooth(int argc, VALUE *argv, VALUE self)
 
 /*
  * call-seq:
- *   filter2d(kernel[,anchor]) -> cvmat
+ *   filter2d(kernel[,anchor][, out: dest]) -> cvmat
  *
  * Convolves image with the kernel.
  * Convolution kernel, single-channel floating point matrix (or same depth of self's).
  * If you want to apply different kernels to different channels,
  * split the image using CvMat#split into separate color planes and process them individually.
+ *
+ * If <i>out</i> is given, the result is stored into it instead of a new matrix (see #resize).
  */
 VALUE
 rb_filter2d(int argc, VALUE *argv, VALUE self)
 {
   VALUE _kernel, _anchor;
+  VALUE out = extract_out(&argc, argv);
   rb_scan_args(argc, argv, "11", &_kernel, &_anchor);
   CvMat* kernel = CVMAT_WITH_CHECK(_kernel);
   CvArr* self_ptr = CVARR(self);
   VALUE _dest = Qnil;
   try {
-    _dest = new_mat_kind_object(cvGetSize(self_ptr), self);
-    cvFilter2D(self_ptr, CVARR(_dest), kernel, NIL_P(_anchor) ? cvPoint(-1,-1) : VALUE_TO_CVPOINT(_anchor));
+    _dest = destination_object(out, cvGetSize(self_ptr), self);
+    CvArr* dest_ptr = CVARR(_dest);
+    CvPoint anchor = NIL_P(_anchor) ? cvPoint(-1,-1) : VALUE_TO_CVPOINT(_anchor);
+    rb_cvCallWithoutGVL([&] { cvFilter2D(self_ptr, dest_ptr, kernel, anchor); });
   }
   catch (cv::Exception& e) {
     raise_cverror(e);
@@ -4440,7 +5527,7 @@ rb_integral(int argc, VALUE *argv, VALUE self)
 }
 
 inline VALUE
-rb_threshold_internal(int threshold_type, VALUE threshold, VALUE max_value, VALUE use_otsu, VALUE self)
+rb_threshold_internal(int threshold_type, VALUE threshold, VALUE max_value, VALUE use_otsu, VALUE out, VALUE self)
 {
   CvArr* self_ptr = CVARR(self);
   int otsu = (use_otsu == Qtrue) && ((threshold_type & CV_THRESH_OTSU) == 0);
@@ -4448,8 +5535,10 @@ rb_threshold_internal(int threshold_type, VALUE threshold, VALUE max_value, VALU
   VALUE dest = Qnil;
   double otsu_threshold = 0;
   try {
-    dest = new_mat_kind_object(cvGetSize(self_ptr), self);
-    otsu_threshold = cvThreshold(self_ptr, CVARR(dest), NUM2DBL(threshold), NUM2DBL(max_value), type);
+    dest = destination_object(out, cvGetSize(self_ptr), self);
+    CvArr* dest_ptr = CVARR(dest);
+    double threshold_value = NUM2DBL(threshold), max = NUM2DBL(max_value);
+    rb_cvCallWithoutGVL([&] { otsu_threshold = cvThreshold(self_ptr, dest_ptr, threshold_value, max, type); });
   }
   catch (cv::Exception& e) {
     raise_cverror(e);
@@ -4474,6 +5563,7 @@ rb_threshold_internal(int threshold_type, VALUE threshold, VALUE max_value, VALU
  *     * CV_THRESH_TRUNC
  *     * CV_THRESH_TOZERO
  *     * CV_THRESH_TOZERO_INV
+ *   @param out [CvMat] Destination for the result (see #resize).
  *   @return [CvMat] Output array of the same size and type as <tt>self</tt>.
  * @overload threshold(threshold, max_value, threshold_type, use_otsu)
  *   @param threshold [Number] Threshold value.
@@ -4486,6 +5576,7 @@ rb_threshold_internal(int threshold_type, VALUE threshold, VALUE max_value, VALU
  *     * CV_THRESH_TOZERO
  *     * CV_THRESH_TOZERO_INV
  *   @param use_otsu [Boolean] Determines the optimal threshold value using the Otsu's algorithm
+ *   @param out [CvMat] Destination for the result (see #resize).
  *   @return [Array<CvMat, Number>] Output array and Otsu's threshold.
  * @opencv_func cvThreshold
  * @example
@@ -4503,13 +5594,14 @@ VALUE
 rb_threshold(int argc, VALUE *argv, VALUE self)
 {
   VALUE threshold, max_value, threshold_type, use_otsu;
+  VALUE out = extract_out(&argc, argv);
   rb_scan_args(argc, argv, "31", &threshold, &max_value, &threshold_type, &use_otsu);
   const int INVALID_TYPE = -1;
   int type = CVMETHOD("THRESHOLD_TYPE", threshold_type, INVALID_TYPE);
   if (type == INVALID_TYPE)
     rb_raise(rb_eArgError, "Invalid threshold type.");
   
-  return rb_threshold_internal(type, threshold, max_value, use_otsu, self);
+  return rb_threshold_internal(type, threshold, max_value, use_otsu, out, self);
 }
 
 /*
@@ -4581,7 +5673,7 @@ rb_adaptive_threshold(int argc, VALUE *argv, VALUE self)
 
 /*
  * call-seq:
- *   pyr_down([filter = :gaussian_5x5]) -> cvmat
+ *   pyr_down([filter = :gaussian_5x5][, out: dest]) -> cvmat
  *
  * Return downsamples image.
  *
@@ -4590,10 +5682,13 @@ rb_adaptive_threshold(int argc, VALUE *argv, VALUE self)
  * by rejecting even rows and columns.
  *
  * note: filter - only :gaussian_5x5 is currently supported.
+ *
+ * If <i>out</i> is given, the result is stored into it instead of a new matrix (see #resize).
  */
 VALUE
 rb_pyr_down(int argc, VALUE *argv, VALUE self)
 {
+  VALUE out = extract_out(&argc, argv);
   int filter = CV_GAUSSIAN_5x5;
   if (argc > 0) {
     VALUE filter_type = argv[0];
@@ -4610,8 +5705,9 @@ rb_pyr_down(int argc, VALUE *argv, VALUE self)
   try {
     CvSize original_size = cvGetSize(self_ptr);
     CvSize size = { original_size.width >> 1, original_size.height >> 1 };
-    dest = new_mat_kind_object(size, self);
-    cvPyrDown(self_ptr, CVARR(dest), filter);
+    dest = destination_object(out, size, self);
+    CvArr* dest_ptr = CVARR(dest);
+    rb_cvCallWithoutGVL([&] { cvPyrDown(self_ptr, dest_ptr, filter); });
   }
   catch (cv::Exception& e) {
     raise_cverror(e);
@@ -4621,7 +5717,7 @@ rb_pyr_down(int argc, VALUE *argv, VALUE self)
 
 /*
  * call-seq:
- *   pyr_up([filter = :gaussian_5x5]) -> cvmat
+ *   pyr_up([filter = :gaussian_5x5][, out: dest]) -> cvmat
  *
  * Return upsamples image.
  *
@@ -4631,11 +5727,14 @@ rb_pyr_down(int argc, VALUE *argv, VALUE self)
  * So the destination image is four times larger than the source image.
  *
  * note: filter - only :gaussian_5x5 is currently supported.
+ *
+ * If <i>out</i> is given, the result is stored into it instead of a new matrix (see #resize).
  */
 VALUE
 rb_pyr_up(int argc, VALUE *argv, VALUE self)
 {
   VALUE filter_type;
+  VALUE out = extract_out(&argc, argv);
   rb_scan_args(argc, argv, "01", &filter_type);
   int filter = CV_GAUSSIAN_5x5;
   if (argc > 0) {
@@ -4652,8 +5751,9 @@ rb_pyr_up(int argc, VALUE *argv, VALUE self)
   try {
     CvSize original_size = cvGetSize(self_ptr);
     CvSize size = { original_size.width << 1, original_size.height << 1 };
-    dest = new_mat_kind_object(size, self);
-    cvPyrUp(self_ptr, CVARR(dest), filter);
+    dest = destination_object(out, size, self);
+    CvArr* dest_ptr = CVARR(dest);
+    rb_cvCallWithoutGVL([&] { cvPyrUp(self_ptr, dest_ptr, filter); });
   }
   catch (cv::Exception& e) {
     raise_cverror(e);
@@ -4701,6 +5801,7 @@ rb_flood_fill(int argc, VALUE *argv, VALUE self)
 VALUE
 rb_flood_fill_bang(int argc, VALUE *argv, VALUE self)
 {
+  check_writable(self);
   VALUE seed_point, new_val, lo_diff, up_diff, flood_fill_option;
   rb_scan_args(argc, argv, "23", &seed_point, &new_val, &lo_diff, &up_diff, &flood_fill_option);
   flood_fill_option = FLOOD_FILL_OPTION(flood_fill_option);
@@ -4774,6 +5875,7 @@ rb_find_contours(int argc, VALUE *argv, VALUE self)
 VALUE
 rb_find_contours_bang(int argc, VALUE *argv, VALUE self)
 {
+  check_writable(self);
   VALUE find_contours_option, klass, element_klass, storage;
   rb_scan_args(argc, argv, "01", &find_contours_option);
   CvSeq *contour = NULL;
@@ -4838,6 +5940,7 @@ rb_draw_contours(int argc, VALUE *argv, VALUE self)
 VALUE
 rb_draw_contours_bang(int argc, VALUE *argv, VALUE self)
 {
+  check_writable(self);
   VALUE contour, external_color, hole_color, max_level, options;
   rb_scan_args(argc, argv, "41", &contour, &external_color, &hole_color, &max_level, &options);
   options = DRAWING_OPTION(options);
@@ -4881,9 +5984,10 @@ rb_draw_chessboard_corners(VALUE self, VALUE pattern_size, VALUE corners, VALUE
 VALUE
 rb_draw_chessboard_corners_bang(VALUE self, VALUE pattern_size, VALUE corners, VALUE pattern_was_found)
 {
+  check_writable(self);
   Check_Type(corners, T_ARRAY);
   int count = RARRAY_LEN(corners);
-  CvPoint2D32f* corners_buff = RB_ALLOC_N(CvPoint2D32f, count);
+  CvPoint2D32f* corners_buff = RB_ALLOC_N(CvPoint2D32f, count);
   VALUE* corners_ptr = RARRAY_PTR(corners);
   for (int i = 0; i < count; i++) {
     corners_buff[i] = *(CVPOINT2D32F(corners_ptr[i]));
@@ -5130,7 +6234,7 @@ rb_inpaint(VALUE self, VALUE inpaint_method, VALUE mask, VALUE radius)
 
 /*
  * call-seq:
- *   equalize_hist -> cvmat
+ *   equalize_hist([out: dest]) -> cvmat
  *
  * Equalize histgram of grayscale of image.
  *
@@ -5143,15 +6247,20 @@ rb_inpaint(VALUE self, VALUE inpaint_method, VALUE mask, VALUE radius)
  * The algorithm normalizes brightness and increases contrast of the image.
  *
  * <b>support single-channel 8bit image (grayscale) only.</b>
+ *
+ * If <i>out</i> is given, the result is stored into it instead of a new matrix (see #resize).
  */
 VALUE
-rb_equalize_hist(VALUE self)
+rb_equalize_hist(int argc, VALUE *argv, VALUE self)
 {
+  VALUE out = extract_out(&argc, argv);
+  rb_scan_args(argc, argv, "0");
   VALUE dest = Qnil;
   try {
     CvArr* self_ptr = CVARR(self);
-    dest = new_mat_kind_object(cvGetSize(self_ptr), self);
-    cvEqualizeHist(self_ptr, CVARR(dest));
+    dest = destination_object(out, cvGetSize(self_ptr), self);
+    CvArr* dest_ptr = CVARR(dest);
+    rb_cvCallWithoutGVL([&] { cvEqualizeHist(self_ptr, dest_ptr); });
   }
   catch (cv::Exception& e) {
     raise_cverror(e);
@@ -5226,7 +6335,8 @@ rb_match_template(int argc, VALUE *argv, VALUE self)
     result = cCvMat::new_object(src_size.height - template_size.height + 1,
 				src_size.width - template_size.width + 1,
 				CV_32FC1);
-    cvMatchTemplate(self_ptr, templ_ptr, CVARR(result), method_flag);
+    CvArr* result_ptr = CVARR(result);
+    rb_cvCallWithoutGVL([&] { cvMatchTemplate(self_ptr, templ_ptr, result_ptr, method_flag); });
   }
   catch (cv::Exception& e) {
     raise_cverror(e);
@@ -5367,9 +6477,9 @@ rb_snake_image(int argc, VALUE *argv, VALUE self)
 	(RARRAY_LEN(beta) != length) ||
 	(RARRAY_LEN(gamma) != length))
       rb_raise(rb_eArgError, "alpha, beta, gamma should be same size of points");
-    a = RB_ALLOC_N(float, length);
-    b = RB_ALLOC_N(float, length);
-    c = RB_ALLOC_N(float, length);
+    a = RB_ALLOC_N(float, length);
+    b = RB_ALLOC_N(float, length);
+    c = RB_ALLOC_N(float, length);
     for (i = 0; i < length; ++i) {
       a[i] = (float)NUM2DBL(RARRAY_PTR(alpha)[i]);
       b[i] = (float)NUM2DBL(RARRAY_PTR(beta)[i]);
@@ -5789,6 +6899,106 @@ new_mat_kind_object(CvSize size, VALUE ref_obj, int cvmat_depth, int channel)
   return Qnil;
 }
 
+/*
+ * Checks the reduction factor of reduced-resolution decoding
+ */
+int
+reduce_value(VALUE reduce)
+{
+  int value = IF_INT(reduce, 1);
+  if (value != 1 && value != 2 && value != 4 && value != 8)
+    rb_raise(rb_eArgError, "reduce should be 1, 2, 4 or 8");
+  return value;
+}
+
+/*
+ * Removes the options Hash at the end of argv (if any) and returns its <tt>:reduce</tt> value
+ */
+int
+extract_reduce(int* argc, VALUE* argv)
+{
+  if (*argc > 1 && TYPE(argv[*argc - 1]) == T_HASH) {
+    (*argc)--;
+    return reduce_value(LOOKUP_HASH(argv[*argc], "reduce"));
+  }
+  return 1;
+}
+
+/*
+ * Removes the options Hash at the end of argv (if any) and returns its <tt>:out</tt> value
+ */
+VALUE
+extract_out(int* argc, VALUE* argv)
+{
+  if (*argc > 0 && TYPE(argv[*argc - 1]) == T_HASH) {
+    (*argc)--;
+    return LOOKUP_HASH(argv[*argc], "out");
+  }
+  return Qnil;
+}
+
+/*
+ * Returns the end of the bytes spanned by the elements of mat, which start at mat->data.ptr
+ */
+const uchar*
+data_end(const CvMat* mat)
+{
+  if (mat->rows <= 0 || mat->cols <= 0)
+    return mat->data.ptr;
+  return mat->data.ptr + (size_t)mat->step * (mat->rows - 1) + (size_t)mat->cols * CV_ELEM_SIZE(mat->type);
+}
+
+/*
+ * Checks that dest can receive the result of an operation on src, i.e. it is a CvMat
+ * (or IplImage) of the given size and type whose data does not overlap the data of src
+ */
+void
+check_destination(VALUE dest, VALUE src, CvSize size, int type)
+{
+  const char* depth_names[] = { "cv8u", "cv8s", "cv16u", "cv16s", "cv32s", "cv32f", "cv64f", "" };
+  if (!rb_obj_is_kind_of(dest, rb_klass))
+    raise_typeerror(dest, rb_klass);
+  check_writable(dest);
+  try {
+    CvMat src_stub, dest_stub;
+    CvMat* dest_ptr = cvGetMat(CVARR(dest), &dest_stub);
+    CvMat* src_ptr = cvGetMat(CVARR(src), &src_stub);
+    int dest_type = CV_MAT_TYPE(dest_ptr->type);
+    if (dest_ptr->cols != size.width || dest_ptr->rows != size.height || dest_type != type) {
+      rb_raise(rb_eArgError, "out should be %dx%d with depth %s and %d channel(s) (given %dx%d with depth %s and %d channel(s))",
+	       size.width, size.height, depth_names[CV_MAT_DEPTH(type)], CV_MAT_CN(type),
+	       dest_ptr->cols, dest_ptr->rows, depth_names[CV_MAT_DEPTH(dest_type)], CV_MAT_CN(dest_type));
+    }
+    if (dest_ptr->data.ptr < data_end(src_ptr) && src_ptr->data.ptr < data_end(dest_ptr))
+      rb_raise(rb_eArgError, "out should not share its data with the source");
+  }
+  catch (cv::Exception& e) {
+    raise_cverror(e);
+  }
+}
+
+/*
+ * Returns dest as the destination of an operation on ref_obj after checking it,
+ * or a new matrix of the same kind as ref_obj if dest is nil (see new_mat_kind_object)
+ */
+VALUE
+destination_object(VALUE dest, CvSize size, VALUE ref_obj)
+{
+  if (NIL_P(dest))
+    return new_mat_kind_object(size, ref_obj);
+  check_destination(dest, ref_obj, size, cvGetElemType(CVARR(ref_obj)));
+  return dest;
+}
+
+VALUE
+destination_object(VALUE dest, CvSize size, VALUE ref_obj, int cvmat_depth, int channel)
+{
+  if (NIL_P(dest))
+    return new_mat_kind_object(size, ref_obj, cvmat_depth, channel);
+  check_destination(dest, ref_obj, size, CV_MAKETYPE(cvmat_depth, channel));
+  return dest;
+}
+
 void
 init_ruby_class()
 {
@@ -5850,6 +7060,7 @@ init_ruby_class()
 
   rb_define_private_method(rb_klass, "initialize", RUBY_METHOD_FUNC(rb_initialize), -1);
   rb_define_singleton_method(rb_klass, "load", RUBY_METHOD_FUNC(rb_load_imageM), -1);
+  rb_define_singleton_method(rb_klass, "load_images", RUBY_METHOD_FUNC(rb_load_images), -1);
   // Ruby/OpenCV original functions
   rb_define_method(rb_klass, "method_missing", RUBY_METHOD_FUNC(rb_method_missing), -1);
   rb_define_method(rb_klass, "to_s", RUBY_METHOD_FUNC(rb_to_s), 0);
@@ -5865,6 +7076,11 @@ init_ruby_class()
   rb_define_method(rb_klass, "depth", RUBY_METHOD_FUNC(rb_depth), 0);
   rb_define_method(rb_klass, "channel", RUBY_METHOD_FUNC(rb_channel), 0);
   rb_define_method(rb_klass, "data", RUBY_METHOD_FUNC(rb_data), 0);
+  rb_define_method(rb_klass, "to_binary", RUBY_METHOD_FUNC(rb_to_binary), 0);
+  rb_define_method(rb_klass, "continuous?", RUBY_METHOD_FUNC(rb_continuous_q), 0);
+#ifdef HAVE_RUBY_MEMORY_VIEW_H
+  rb_memory_view_register(rb_klass, &memory_view_entry);
+#endif
 
   rb_define_method(rb_klass, "clone", RUBY_METHOD_FUNC(rb_clone), 0);
   rb_define_method(rb_klass, "copy", RUBY_METHOD_FUNC(rb_copy), -1);
@@ -5894,7 +7110,13 @@ init_ruby_class()
   rb_define_method(rb_klass, "[]", RUBY_METHOD_FUNC(rb_aref), -2);
   rb_define_alias(rb_klass, "at", "[]");
   rb_define_method(rb_klass, "[]=", RUBY_METHOD_FUNC(rb_aset), -2);
+  rb_define_method(rb_klass, "to_a", RUBY_METHOD_FUNC(rb_to_a), -1);
+  rb_define_method(rb_klass, "row_to_a", RUBY_METHOD_FUNC(rb_row_to_a), -1);
+  rb_define_method(rb_klass, "pixels", RUBY_METHOD_FUNC(rb_pixels), -1);
+  rb_define_method(rb_klass, "gather", RUBY_METHOD_FUNC(rb_gather), -1);
+  rb_define_method(rb_klass, "scatter!", RUBY_METHOD_FUNC(rb_scatter_bang), 2);
   rb_define_method(rb_klass, "set_data", RUBY_METHOD_FUNC(rb_set_data), 1);
+  rb_define_singleton_method(rb_klass, "from_binary", RUBY_METHOD_FUNC(rb_from_binary), -1);
   rb_define_method(rb_klass, "set", RUBY_METHOD_FUNC(rb_set), -1);
   rb_define_alias(rb_klass, "fill", "set");
   rb_define_method(rb_klass, "set!", RUBY_METHOD_FUNC(rb_set_bang), -1);
@@ -6049,7 +7271,7 @@ init_ruby_class()
 
   rb_define_method(rb_klass, "inpaint", RUBY_METHOD_FUNC(rb_inpaint), 3);
 
-  rb_define_method(rb_klass, "equalize_hist", RUBY_METHOD_FUNC(rb_equalize_hist), 0);
+  rb_define_method(rb_klass, "equalize_hist", RUBY_METHOD_FUNC(rb_equalize_hist), -1);
   rb_define_method(rb_klass, "apply_color_map", RUBY_METHOD_FUNC(rb_apply_color_map), 1);
   rb_define_method(rb_klass, "match_template", RUBY_METHOD_FUNC(rb_match_template), -1);
   rb_define_method(rb_klass, "match_shapes", RUBY_METHOD_FUNC(rb_match_shapes), -1);
@@ -6077,8 +7299,13 @@ init_ruby_class()
 
   rb_define_method(rb_klass, "encode_image", RUBY_METHOD_FUNC(rb_encode_imageM), -1);
   rb_define_alias(rb_klass, "encode", "encode_image");
+  rb_define_method(rb_klass, "encode_binary", RUBY_METHOD_FUNC(rb_encode_binary), -1);
   rb_define_singleton_method(rb_klass, "decode_image", RUBY_METHOD_FUNC(rb_decode_imageM), -1);
   rb_define_alias(rb_singleton_class(rb_klass), "decode", "decode_image");
+  rb_define_singleton_method(rb_klass, "probe", RUBY_METHOD_FUNC(rb_probe), 1);
+  rb_define_singleton_method(rb_klass, "probe_buffer", RUBY_METHOD_FUNC(rb_probe_buffer), 1);
+  rb_define_singleton_method(rb_klass, "thumbnails", RUBY_METHOD_FUNC(rb_thumbnails), -1);
+  rb_define_singleton_method(rb_klass, "batch", RUBY_METHOD_FUNC(rb_batch), -1);
 }
 
 __NAMESPACE_END_OPENCV
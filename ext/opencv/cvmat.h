@@ -26,8 +26,15 @@ void init_ruby_class();
 VALUE rb_allocate(VALUE klass);
 VALUE rb_initialize(int argc, VALUE *argv, VALUE self);
 VALUE rb_load_imageM(int argc, VALUE *argv, VALUE self);
+VALUE rb_load_images(int argc, VALUE *argv, VALUE klass);
 VALUE rb_encode_imageM(int argc, VALUE *argv, VALUE self);
+VALUE rb_encode_binary(int argc, VALUE *argv, VALUE self);
 VALUE rb_decode_imageM(int argc, VALUE *argv, VALUE self);
+VALUE image_info_to_hash(int result, const rb_cvImageInfo& info);
+VALUE rb_probe(VALUE klass, VALUE filename);
+VALUE rb_probe_buffer(VALUE klass, VALUE buf);
+VALUE rb_thumbnails(int argc, VALUE *argv, VALUE klass);
+VALUE rb_batch(int argc, VALUE *argv, VALUE klass);
 
 VALUE rb_method_missing(int argc, VALUE *argv, VALUE self);
 VALUE rb_to_s(VALUE self);
@@ -40,6 +47,8 @@ VALUE rb_height(VALUE self);
 VALUE rb_depth(VALUE self);
 VALUE rb_channel(VALUE self);
 VALUE rb_data(VALUE self);
+VALUE rb_to_binary(VALUE self);
+VALUE rb_continuous_q(VALUE self);
 
 VALUE rb_clone(VALUE self);
 VALUE rb_copy(int argc, VALUE *argv, VALUE self);
@@ -68,7 +77,13 @@ VALUE rb_dims(VALUE self);
 VALUE rb_dim_size(VALUE self, VALUE index);
 VALUE rb_aref(VALUE self, VALUE args);
 VALUE rb_aset(VALUE self, VALUE args);
+VALUE rb_to_a(int argc, VALUE *argv, VALUE self);
+VALUE rb_row_to_a(int argc, VALUE *argv, VALUE self);
+VALUE rb_pixels(int argc, VALUE *argv, VALUE self);
+VALUE rb_gather(int argc, VALUE *argv, VALUE self);
+VALUE rb_scatter_bang(VALUE self, VALUE points, VALUE values);
 VALUE rb_set_data(VALUE self, VALUE data);
+VALUE rb_from_binary(int argc, VALUE *argv, VALUE klass);
 VALUE rb_set(int argc, VALUE *argv, VALUE self);
 VALUE rb_set_bang(int argc, VALUE *argv, VALUE self);
 VALUE rb_set_zero(VALUE self);
@@ -214,7 +229,7 @@ VALUE rb_hough_circles(int argc, VALUE *argv, VALUE self);
 VALUE rb_dist_transform(int argc, VALUE *argv, VALUE self);
 VALUE rb_inpaint(VALUE self, VALUE inpaint_method, VALUE mask, VALUE radius);
 
-VALUE rb_equalize_hist(VALUE self);
+VALUE rb_equalize_hist(int argc, VALUE *argv, VALUE self);
 
 VALUE rb_apply_color_map(VALUE self, VALUE colormap);
 
@@ -249,8 +264,26 @@ VALUE new_object(int rows, int cols, int type);
 VALUE new_object(CvSize size, int type);
 VALUE new_mat_kind_object(CvSize size, VALUE ref_obj);
 VALUE new_mat_kind_object(CvSize size, VALUE ref_obj, int cvmat_depth, int channel);
-
-CvMat* prepare_decoding(int argc, VALUE *argv, int* iscolor, int* need_release);
+int reduce_value(VALUE reduce);
+int extract_reduce(int* argc, VALUE* argv);
+int thumbnail_mode(VALUE mode);
+rb_cvThumbnailBox thumbnail_box(VALUE box, int default_mode);
+VALUE extract_out(int* argc, VALUE* argv);
+const uchar* data_end(const CvMat* mat);
+void check_destination(VALUE dest, VALUE src, CvSize size, int type);
+VALUE destination_object(VALUE dest, CvSize size, VALUE ref_obj);
+VALUE destination_object(VALUE dest, CvSize size, VALUE ref_obj, int cvmat_depth, int channel);
+
+void store_format_specific_param(VALUE hash, int* params);
+int* hash_to_format_specific_param(VALUE hash);
+CvMat* encode_image_buffer(VALUE self, VALUE _ext, VALUE _params);
+void copy_packed_data(const CvMat* mat, char* dst);
+void store_packed_data(CvMat* mat, const char* src);
+void store_data(CvMat* mat, VALUE data);
+void smooth_without_gvl(CvArr* src, CvArr* dst, int smoothtype, int size1, int size2 = 0,
+			double sigma1 = 0, double sigma2 = 0);
+CvMat* prepare_decoding(int argc, VALUE *argv, CvMat* header, int* iscolor, int* need_release, VALUE* locked);
+void finish_decoding(CvMat** buff, int need_release, VALUE locked);
 
 __NAMESPACE_END_CVMAT
 
@@ -258,7 +291,7 @@ inline CvMat*
 CVMAT(VALUE object)
 {
   CvMat *ptr, stub;
-  Data_Get_Struct(object, CvMat, ptr);
+  ptr = (CvMat*)OPENCV_DATA_PTR(object);
   return cvGetMat(ptr, &stub);
 }
 
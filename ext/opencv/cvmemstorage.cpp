@@ -24,13 +24,6 @@ rb_class()
   return rb_klass;
 }
 
-VALUE
-rb_allocate(VALUE klass)
-{
-  CvMemStorage *storage = rb_cvCreateMemStorage(0);
-  return Data_Wrap_Struct(klass, 0, cvmemstorage_free, storage);
-}
-
 void
 cvmemstorage_free(void *ptr)
 {
@@ -42,11 +35,36 @@ cvmemstorage_free(void *ptr)
   }
 }
 
+size_t
+cvmemstorage_memsize(const void *ptr)
+{
+  const CvMemStorage* storage = (const CvMemStorage*)ptr;
+  if (!storage)
+    return 0;
+  size_t size = sizeof(CvMemStorage);
+  for (CvMemBlock* block = storage->bottom; block; block = block->next)
+    size += storage->block_size;
+  return size;
+}
+
+const rb_data_type_t data_type = {
+  "OpenCV::CvMemStorage",
+  { 0, cvmemstorage_free, cvmemstorage_memsize, },
+  &opencv_data_type, 0, RUBY_TYPED_FREE_IMMEDIATELY | RUBY_TYPED_WB_PROTECTED
+};
+
+VALUE
+rb_allocate(VALUE klass)
+{
+  CvMemStorage *storage = rb_cvCreateMemStorage(0);
+  return TypedData_Wrap_Struct(klass, &data_type, storage);
+}
+
 VALUE
 new_object(int blocksize)
 {
   CvMemStorage *storage = rb_cvCreateMemStorage(blocksize);
-  return Data_Wrap_Struct(rb_klass, 0, cvmemstorage_free, storage);
+  return TypedData_Wrap_Struct(rb_klass, &data_type, storage);
 }
 
 void
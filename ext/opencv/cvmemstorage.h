@@ -32,7 +32,7 @@ inline CvMemStorage*
 CVMEMSTORAGE(VALUE object)
 {
   CvMemStorage *ptr;
-  Data_Get_Struct(object, CvMemStorage, ptr);
+  ptr = (CvMemStorage*)OPENCV_DATA_PTR(object);
   return ptr;
 }
 
@@ -58,7 +58,7 @@ inline CvMoments*
 CVMOMENTS(VALUE object)
 {
   CvMoments *ptr;
-  Data_Get_Struct(object, CvMoments, ptr);
+  ptr = (CvMoments*)OPENCV_DATA_PTR(object);
   return ptr;
 }
 
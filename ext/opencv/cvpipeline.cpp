@@ -0,0 +1,960 @@
+/************************************************************
+
+   cvpipeline.cpp -
+
+   $Author: ser1zw $
+
+   Copyright (C) 2013 ser1zw
+
+************************************************************/
+#include "cvpipeline.h"
+/*
+ * Document-class: OpenCV::CvPipeline
+ *
+ * Sequence of CvMat image processing operations, which is recorded once and then run
+ * natively for each input image. The intermediate images are kept in buffers that are
+ * reused while the size and type of the input do not change, and the GVL is released
+ * during the whole sequence. The result is the same as calling the operations on CvMat
+ * one by one.
+ *
+ * @example
+ *   pipeline = CvPipeline.new.cvt_color(:BGR2GRAY).resize(CvSize.new(320, 240)).
+ *     smooth(CV_GAUSSIAN, 5).threshold(128, 255, CV_THRESH_BINARY)
+ *   binary = pipeline.run(frame)
+ *   pipeline.run(next_frame, out: binary)
+ */
+__NAMESPACE_BEGIN_OPENCV
+__NAMESPACE_BEGIN_CVPIPELINE
+
+VALUE rb_klass;
+ID id_operations;
+
+VALUE
+rb_class()
+{
+  return rb_klass;
+}
+
+/*
+ * Releases the intermediate buffers of scratch with release_mat, the counterpart of the
+ * create_mat they were allocated with (see allocate_scratch())
+ */
+void
+release_scratch(pipeline_scratch_t* scratch, void (*release_mat)(CvMat**))
+{
+  for (size_t i = 0; i < scratch->buffers.size(); i++) {
+    if (scratch->buffers[i])
+      release_mat(&scratch->buffers[i]);
+  }
+  for (size_t i = 0; i < scratch->temps.size(); i++) {
+    if (scratch->temps[i])
+      release_mat(&scratch->temps[i]);
+  }
+  scratch->buffers.clear();
+  scratch->temps.clear();
+  scratch->stages.clear();
+  scratch->type = -1;
+}
+
+void
+cvpipeline_free(void *ptr)
+{
+  if (ptr) {
+    sCvPipeline* pipeline = (sCvPipeline*)ptr;
+    release_scratch(&pipeline->scratch);
+    delete pipeline;
+  }
+}
+
+size_t
+cvpipeline_memsize(const void *ptr)
+{
+  const sCvPipeline* pipeline = (const sCvPipeline*)ptr;
+  size_t size = sizeof(sCvPipeline) + pipeline->ops.capacity() * sizeof(pipeline_op_t);
+  const pipeline_scratch_t* scratch = &pipeline->scratch;
+  for (size_t i = 0; i < scratch->buffers.size(); i++)
+    size += memsize_cvarr(scratch->buffers[i]);
+  for (size_t i = 0; i < scratch->temps.size(); i++)
+    size += scratch->temps[i] ? memsize_cvarr(scratch->temps[i]) : 0;
+  return size;
+}
+
+const rb_data_type_t data_type = {
+  "OpenCV::CvPipeline",
+  { 0, cvpipeline_free, cvpipeline_memsize, },
+  &opencv_data_type, 0, RUBY_TYPED_FREE_IMMEDIATELY | RUBY_TYPED_WB_PROTECTED
+};
+
+VALUE
+rb_allocate(VALUE klass)
+{
+  sCvPipeline* pipeline = new sCvPipeline();
+  pipeline->scratch.type = -1;
+  pipeline->running = 0;
+  VALUE object = TypedData_Wrap_Struct(klass, &data_type, pipeline);
+  rb_ivar_set(object, id_operations, rb_ary_new());
+  return object;
+}
+
+/*
+ * Creates an empty pipeline. If a block is given, the pipeline is yielded to it to record operations.
+ *
+ * @overload new
+ * @overload new { |pipeline| ... }
+ * @return [CvPipeline] New pipeline
+ */
+VALUE
+rb_initialize(VALUE self)
+{
+  if (rb_block_given_p())
+    rb_yield(self);
+  return self;
+}
+
+pipeline_op_t
+new_operation(int op)
+{
+  pipeline_op_t operation;
+  memset(&operation, 0, sizeof(operation));
+  operation.op = op;
+  return operation;
+}
+
+/*
+ * Appends op to the pipeline, and its name and arguments to the operation list
+ */
+VALUE
+push_operation(VALUE self, const pipeline_op_t& op, const char* name, int argc, VALUE* argv)
+{
+  sCvPipeline* pipeline = CVPIPELINE(self);
+  if (pipeline->running)
+    rb_raise(rb_eRuntimeError, "can't modify a running pipeline");
+  VALUE entry = rb_ary_new4(argc, argv);
+  rb_ary_unshift(entry, ID2SYM(rb_intern(name)));
+  rb_ary_push(rb_attr_get(self, id_operations), entry);
+  pipeline->ops.push_back(op);
+  release_scratch(&pipeline->scratch);
+  return self;
+}
+
+/*
+ * Adds a color conversion
+ *
+ * @overload cvt_color(code)
+ *   @param code [Symbol, String] Name of the conversion, same as the color conversion functions
+ *     of OpenCV (e.g. <tt>:BGR2GRAY</tt>)
+ * @return [CvPipeline] <tt>self</tt>
+ * @see OpenCV.BGR2GRAY
+ */
+VALUE
+rb_cvt_color(VALUE self, VALUE code)
+{
+  VALUE name = SYMBOL_P(code) ? rb_sym_to_s(code) : code;
+  Check_Type(name, T_STRING);
+  const cvtcolor_info_t* info = lookup_cvtcolor(StringValueCStr(name));
+  if (info == NULL)
+    rb_raise(rb_eArgError, "unknown color conversion: %s", StringValueCStr(name));
+  pipeline_op_t op = new_operation(PIPELINE_OP_CVT_COLOR);
+  op.iparams[0] = info->code;
+  op.src_cn = info->src_cn;
+  op.dest_cn = info->dest_cn;
+  return push_operation(self, op, "cvt_color", 1, &code);
+}
+
+/*
+ * Adds a resize operation
+ *
+ * @overload resize(size, interpolation = CV_INTER_LINEAR)
+ * @return [CvPipeline] <tt>self</tt>
+ * @see CvMat#resize
+ */
+VALUE
+rb_resize(int argc, VALUE *argv, VALUE self)
+{
+  VALUE size, interpolation;
+  rb_scan_args(argc, argv, "11", &size, &interpolation);
+  pipeline_op_t op = new_operation(PIPELINE_OP_RESIZE);
+  op.size = VALUE_TO_CVSIZE(size);
+  if (op.size.width <= 0 || op.size.height <= 0)
+    rb_raise(rb_eArgError, "size should be positive");
+  op.iparams[0] = NIL_P(interpolation) ? CV_INTER_LINEAR : NUM2INT(interpolation);
+  return push_operation(self, op, "resize", argc, argv);
+}
+
+/*
+ * Adds a smoothing operation
+ *
+ * @overload smooth(smoothtype, size1 = 3, size2 = 3, sigma1 = 0, sigma2 = 0)
+ * @return [CvPipeline] <tt>self</tt>
+ * @see CvMat#smooth
+ */
+VALUE
+rb_smooth(int argc, VALUE *argv, VALUE self)
+{
+  VALUE smoothtype, p1, p2, p3, p4;
+  rb_scan_args(argc, argv, "14", &smoothtype, &p1, &p2, &p3, &p4);
+  pipeline_op_t op = new_operation(PIPELINE_OP_SMOOTH);
+  int type = CVMETHOD("SMOOTHING_TYPE", smoothtype, -1);
+  // Same parameters as CvMat#smooth_* called from CvMat#smooth
+  switch (type) {
+  case CV_BLUR_NO_SCALE:
+  case CV_BLUR:
+  case CV_BILATERAL:
+    op.iparams[1] = IF_INT(p1, 3);
+    op.iparams[2] = IF_INT(p2, 3);
+    break;
+  case CV_MEDIAN:
+    op.iparams[1] = IF_INT(p1, 3);
+    break;
+  default:
+    type = CV_GAUSSIAN;
+    op.iparams[1] = IF_INT(p1, 3);
+    op.iparams[2] = IF_INT(p2, 3);
+    op.dparams[0] = IF_DBL(p3, 0.0);
+    op.dparams[1] = IF_DBL(p4, 0.0);
+    break;
+  }
+  op.iparams[0] = type;
+  return push_operation(self, op, "smooth", argc, argv);
+}
+
+/*
+ * Adds a fixed-level threshold. The Otsu's threshold value is not returned.
+ *
+ * @overload threshold(threshold, max_value, threshold_type, use_otsu = false)
+ * @return [CvPipeline] <tt>self</tt>
+ * @see CvMat#threshold
+ */
+VALUE
+rb_threshold(int argc, VALUE *argv, VALUE self)
+{
+  VALUE threshold, max_value, threshold_type, use_otsu;
+  rb_scan_args(argc, argv, "31", &threshold, &max_value, &threshold_type, &use_otsu);
+  const int INVALID_TYPE = -1;
+  int type = CVMETHOD("THRESHOLD_TYPE", threshold_type, INVALID_TYPE);
+  if (type == INVALID_TYPE)
+    rb_raise(rb_eArgError, "Invalid threshold type.");
+  pipeline_op_t op = new_operation(PIPELINE_OP_THRESHOLD);
+  op.iparams[0] = type | ((use_otsu == Qtrue) ? CV_THRESH_OTSU : 0);
+  op.dparams[0] = NUM2DBL(threshold);
+  op.dparams[1] = NUM2DBL(max_value);
+  return push_operation(self, op, "threshold", argc, argv);
+}
+
+/*
+ * Adds the Canny edge detector
+ *
+ * @overload canny(thresh1, thresh2, aperture_size = 3)
+ * @return [CvPipeline] <tt>self</tt>
+ * @see CvMat#canny
+ */
+VALUE
+rb_canny(int argc, VALUE *argv, VALUE self)
+{
+  VALUE thresh1, thresh2, aperture_size;
+  rb_scan_args(argc, argv, "21", &thresh1, &thresh2, &aperture_size);
+  pipeline_op_t op = new_operation(PIPELINE_OP_CANNY);
+  op.iparams[0] = NUM2INT(thresh1);
+  op.iparams[1] = NUM2INT(thresh2);
+  op.iparams[2] = IF_INT(aperture_size, 3);
+  return push_operation(self, op, "canny", argc, argv);
+}
+
+/*
+ * Adds the Sobel operator
+ *
+ * @overload sobel(xorder, yorder, aperture_size = 3)
+ * @return [CvPipeline] <tt>self</tt>
+ * @see CvMat#sobel
+ */
+VALUE
+rb_sobel(int argc, VALUE *argv, VALUE self)
+{
+  VALUE xorder, yorder, aperture_size;
+  rb_scan_args(argc, argv, "21", &xorder, &yorder, &aperture_size);
+  pipeline_op_t op = new_operation(PIPELINE_OP_SOBEL);
+  op.iparams[0] = NUM2INT(xorder);
+  op.iparams[1] = NUM2INT(yorder);
+  op.iparams[2] = IF_INT(aperture_size, 3);
+  return push_operation(self, op, "sobel", argc, argv);
+}
+
+/*
+ * Adds the Laplacian
+ *
+ * @overload laplace(aperture_size = 3)
+ * @return [CvPipeline] <tt>self</tt>
+ * @see CvMat#laplace
+ */
+VALUE
+rb_laplace(int argc, VALUE *argv, VALUE self)
+{
+  VALUE aperture_size;
+  rb_scan_args(argc, argv, "01", &aperture_size);
+  pipeline_op_t op = new_operation(PIPELINE_OP_LAPLACE);
+  op.iparams[0] = IF_INT(aperture_size, 3);
+  return push_operation(self, op, "laplace", argc, argv);
+}
+
+/*
+ * Adds a histogram equalization
+ *
+ * @overload equalize_hist
+ * @return [CvPipeline] <tt>self</tt>
+ * @see CvMat#equalize_hist
+ */
+VALUE
+rb_equalize_hist(VALUE self)
+{
+  return push_operation(self, new_operation(PIPELINE_OP_EQUALIZE_HIST), "equalize_hist", 0, NULL);
+}
+
+/*
+ * Adds a downsampling step of Gaussian pyramid decomposition
+ *
+ * @overload pyr_down
+ * @return [CvPipeline] <tt>self</tt>
+ * @see CvMat#pyr_down
+ */
+VALUE
+rb_pyr_down(VALUE self)
+{
+  return push_operation(self, new_operation(PIPELINE_OP_PYR_DOWN), "pyr_down", 0, NULL);
+}
+
+/*
+ * Adds an up-sampling step of Gaussian pyramid decomposition
+ *
+ * @overload pyr_up
+ * @return [CvPipeline] <tt>self</tt>
+ * @see CvMat#pyr_up
+ */
+VALUE
+rb_pyr_up(VALUE self)
+{
+  return push_operation(self, new_operation(PIPELINE_OP_PYR_UP), "pyr_up", 0, NULL);
+}
+
+/*
+ * Adds a convolution with the kernel
+ *
+ * @overload filter2d(kernel, anchor = nil)
+ * @return [CvPipeline] <tt>self</tt>
+ * @see CvMat#filter2d
+ */
+VALUE
+rb_filter2d(int argc, VALUE *argv, VALUE self)
+{
+  VALUE kernel, anchor;
+  rb_scan_args(argc, argv, "11", &kernel, &anchor);
+  pipeline_op_t op = new_operation(PIPELINE_OP_FILTER2D);
+  CVMAT_WITH_CHECK(kernel);
+  op.arr = CVARR(kernel);
+  op.point = NIL_P(anchor) ? cvPoint(-1, -1) : VALUE_TO_CVPOINT(anchor);
+  return push_operation(self, op, "filter2d", argc, argv);
+}
+
+/*
+ * Adds an affine transformation
+ *
+ * @overload warp_affine(map_matrix, flags = CV_INTER_LINEAR | CV_WARP_FILL_OUTLIERS, fillval = 0)
+ * @return [CvPipeline] <tt>self</tt>
+ * @see CvMat#warp_affine
+ */
+VALUE
+rb_warp_affine(int argc, VALUE *argv, VALUE self)
+{
+  VALUE map_matrix, flags, fillval;
+  rb_scan_args(argc, argv, "12", &map_matrix, &flags, &fillval);
+  pipeline_op_t op = new_operation(PIPELINE_OP_WARP_AFFINE);
+  CVMAT_WITH_CHECK(map_matrix);
+  op.arr = CVARR(map_matrix);
+  op.iparams[0] = NIL_P(flags) ? (CV_INTER_LINEAR | CV_WARP_FILL_OUTLIERS) : NUM2INT(flags);
+  op.scalar = NIL_P(fillval) ? cvScalarAll(0) : VALUE_TO_CVSCALAR(fillval);
+  return push_operation(self, op, "warp_affine", argc, argv);
+}
+
+pipeline_op_t
+new_morphology_operation(int op_type, VALUE element, VALUE iteration)
+{
+  pipeline_op_t op = new_operation(op_type);
+  op.element = NIL_P(element) ? NULL : IPLCONVKERNEL_WITH_CHECK(element);
+  op.iparams[1] = IF_INT(iteration, 1);
+  return op;
+}
+
+/*
+ * Adds an erosion
+ *
+ * @overload erode(element = nil, iteration = 1)
+ * @return [CvPipeline] <tt>self</tt>
+ * @see CvMat#erode
+ */
+VALUE
+rb_erode(int argc, VALUE *argv, VALUE self)
+{
+  VALUE element, iteration;
+  rb_scan_args(argc, argv, "02", &element, &iteration);
+  return push_operation(self, new_morphology_operation(PIPELINE_OP_ERODE, element, iteration),
+			"erode", argc, argv);
+}
+
+/*
+ * Adds a dilation
+ *
+ * @overload dilate(element = nil, iteration = 1)
+ * @return [CvPipeline] <tt>self</tt>
+ * @see CvMat#dilate
+ */
+VALUE
+rb_dilate(int argc, VALUE *argv, VALUE self)
+{
+  VALUE element, iteration;
+  rb_scan_args(argc, argv, "02", &element, &iteration);
+  return push_operation(self, new_morphology_operation(PIPELINE_OP_DILATE, element, iteration),
+			"dilate", argc, argv);
+}
+
+/*
+ * Adds a morphological transformation
+ *
+ * @overload morphology(operation, element = nil, iteration = 1)
+ * @return [CvPipeline] <tt>self</tt>
+ * @see CvMat#morphology
+ */
+VALUE
+rb_morphology(int argc, VALUE *argv, VALUE self)
+{
+  VALUE operation, element, iteration;
+  rb_scan_args(argc, argv, "12", &operation, &element, &iteration);
+  pipeline_op_t op = new_morphology_operation(PIPELINE_OP_MORPHOLOGY, element, iteration);
+  op.iparams[0] = CVMETHOD("MORPHOLOGICAL_OPERATION", operation, -1);
+  return push_operation(self, op, "morphology", argc, argv);
+}
+
+/*
+ * Computes the size and type of the output of each operation for the input of size and type.
+ * Raises the same errors as the corresponding CvMat methods for unsupported inputs.
+ */
+void
+plan_pipeline(const std::vector<pipeline_op_t>& ops, CvSize size, int type,
+	      std::vector<pipeline_stage_t>& stages)
+{
+  stages.resize(ops.size());
+  for (size_t i = 0; i < ops.size(); i++) {
+    const pipeline_op_t& op = ops[i];
+    int depth = CV_MAT_DEPTH(type), cn = CV_MAT_CN(type);
+    switch (op.op) {
+    case PIPELINE_OP_CVT_COLOR:
+      if (cn != op.src_cn)
+	rb_raise(rb_eArgError, "operation %d (cvt_color) should have %d-channel input", (int)i, op.src_cn);
+      type = CV_MAKETYPE(depth, op.dest_cn);
+      break;
+    case PIPELINE_OP_RESIZE:
+      size = op.size;
+      break;
+    case PIPELINE_OP_SMOOTH:
+      if (op.iparams[0] == CV_BLUR_NO_SCALE) {
+	if (depth == CV_8U)
+	  type = CV_MAKETYPE(CV_16U, cn);
+	else if (depth != CV_32F)
+	  rb_raise(rb_eNotImpError, "unsupport format. (support 8bit unsigned/signed or 32bit floating point only)");
+      }
+      break;
+    case PIPELINE_OP_SOBEL:
+    case PIPELINE_OP_LAPLACE:
+      if (depth == CV_8U)
+	type = CV_16SC1;
+      else if (depth == CV_32F)
+	type = CV_32FC1;
+      else
+	rb_raise(rb_eArgError, "source depth should be CV_8U or CV_32F.");
+      break;
+    case PIPELINE_OP_PYR_DOWN:
+      size = cvSize(size.width >> 1, size.height >> 1);
+      break;
+    case PIPELINE_OP_PYR_UP:
+      size = cvSize(size.width << 1, size.height << 1);
+      break;
+    default:
+      break;
+    }
+    stages[i].size = size;
+    stages[i].type = type;
+  }
+}
+
+/*
+ * Plans ops for the input of size and type, and allocates the intermediate buffers
+ * unless scratch is already prepared for them
+ */
+void
+prepare_scratch(const std::vector<pipeline_op_t>& ops, CvSize size, int type,
+		pipeline_scratch_t* scratch)
+{
+  if (scratch->type == type && scratch->size.width == size.width && scratch->size.height == size.height)
+    return;
+
+  release_scratch(scratch);
+  plan_pipeline(ops, size, type, scratch->stages);
+  allocate_scratch(ops, size, type, scratch, rb_cvCreateMat);
+}
+
+/*
+ * Allocates the intermediate buffers for the stages planned in scratch with create_mat.
+ * With cvCreateMat, this can be called without the GVL.
+ */
+void
+allocate_scratch(const std::vector<pipeline_op_t>& ops, CvSize size, int type,
+		 pipeline_scratch_t* scratch, CvMat* (*create_mat)(int, int, int))
+{
+  const std::vector<pipeline_stage_t>& stages = scratch->stages;
+  scratch->buffers.resize(ops.size(), NULL);
+  scratch->temps.resize(ops.size(), NULL);
+  CvSize in_size = size;
+  int in_type = type;
+  for (size_t i = 0; i < ops.size(); i++) {
+    if (i + 1 < ops.size())
+      scratch->buffers[i] = create_mat(stages[i].size.height, stages[i].size.width, stages[i].type);
+    if (ops[i].op == PIPELINE_OP_MORPHOLOGY && ops[i].iparams[0] == CV_MOP_GRADIENT)
+      scratch->temps[i] = create_mat(in_size.height, in_size.width, in_type);
+    in_size = stages[i].size;
+    in_type = stages[i].type;
+  }
+  scratch->size = size;
+  scratch->type = type;
+}
+
+void
+execute_operation(const pipeline_op_t& op, CvArr* src, CvArr* dest, CvMat* temp)
+{
+  CvMat stub;
+  switch (op.op) {
+  case PIPELINE_OP_CVT_COLOR:
+    cvCvtColor(src, dest, op.iparams[0]);
+    break;
+  case PIPELINE_OP_RESIZE:
+    cvResize(src, dest, op.iparams[0]);
+    break;
+  case PIPELINE_OP_SMOOTH:
+    cvSmooth(src, dest, op.iparams[0], op.iparams[1], op.iparams[2], op.dparams[0], op.dparams[1]);
+    break;
+  case PIPELINE_OP_THRESHOLD:
+    cvThreshold(src, dest, op.dparams[0], op.dparams[1], op.iparams[0]);
+    break;
+  case PIPELINE_OP_CANNY:
+    cvCanny(src, dest, op.iparams[0], op.iparams[1], op.iparams[2]);
+    break;
+  case PIPELINE_OP_SOBEL:
+    cvSobel(src, dest, op.iparams[0], op.iparams[1], op.iparams[2]);
+    break;
+  case PIPELINE_OP_LAPLACE:
+    cvLaplace(src, dest, op.iparams[0]);
+    break;
+  case PIPELINE_OP_EQUALIZE_HIST:
+    cvEqualizeHist(src, dest);
+    break;
+  case PIPELINE_OP_PYR_DOWN:
+    cvPyrDown(src, dest, CV_GAUSSIAN_5x5);
+    break;
+  case PIPELINE_OP_PYR_UP:
+    cvPyrUp(src, dest, CV_GAUSSIAN_5x5);
+    break;
+  case PIPELINE_OP_FILTER2D:
+    cvFilter2D(src, dest, cvGetMat(op.arr, &stub), op.point);
+    break;
+  case PIPELINE_OP_WARP_AFFINE:
+    cvWarpAffine(src, dest, cvGetMat(op.arr, &stub), op.iparams[0], op.scalar);
+    break;
+  case PIPELINE_OP_ERODE:
+    cvErode(src, dest, op.element, op.iparams[1]);
+    break;
+  case PIPELINE_OP_DILATE:
+    cvDilate(src, dest, op.element, op.iparams[1]);
+    break;
+  case PIPELINE_OP_MORPHOLOGY:
+    cvMorphologyEx(src, dest, temp, op.element, op.iparams[0], op.iparams[1]);
+    break;
+  }
+}
+
+/*
+ * Runs ops from src to dest through the buffers of scratch, which must be prepared for src.
+ * Does not call any Ruby API, so it can be called without the GVL.
+ */
+void
+execute_pipeline(const std::vector<pipeline_op_t>& ops, CvArr* src, CvArr* dest,
+		 pipeline_scratch_t* scratch)
+{
+  if (ops.empty()) {
+    cvCopy(src, dest);
+    return;
+  }
+  CvArr* in = src;
+  for (size_t i = 0; i < ops.size(); i++) {
+    CvArr* out = (i + 1 < ops.size()) ? (CvArr*)scratch->buffers[i] : dest;
+    execute_operation(ops[i], in, out, scratch->temps[i]);
+    in = out;
+  }
+}
+
+typedef struct {
+  VALUE self;
+  VALUE src;
+  VALUE out;
+  pipeline_scratch_t* scratch;
+} run_args_t;
+
+VALUE
+run_pipeline(VALUE arg)
+{
+  run_args_t* args = (run_args_t*)arg;
+  const std::vector<pipeline_op_t>& ops = CVPIPELINE(args->self)->ops;
+  CvArr* src = CVARR(args->src);
+  CvSize size = cvSize(0, 0);
+  int type = 0;
+  try {
+    size = cvGetSize(src);
+    type = cvGetElemType(src);
+  }
+  catch (cv::Exception& e) {
+    raise_cverror(e);
+  }
+  prepare_scratch(ops, size, type, args->scratch);
+  pipeline_stage_t output = { size, type };
+  if (!args->scratch->stages.empty())
+    output = args->scratch->stages.back();
+
+  VALUE dest = cCvMat::destination_object(args->out, output.size, args->src,
+					  CV_MAT_DEPTH(output.type), CV_MAT_CN(output.type));
+  CvArr* dest_ptr = CVARR(dest);
+  pipeline_scratch_t* scratch = args->scratch;
+  try {
+    rb_cvCallWithoutGVL([&] { execute_pipeline(ops, src, dest_ptr, scratch); });
+  }
+  catch (cv::Exception& e) {
+    raise_cverror(e);
+  }
+  return dest;
+}
+
+VALUE
+finish_run(VALUE arg)
+{
+  run_args_t* args = (run_args_t*)arg;
+  sCvPipeline* pipeline = CVPIPELINE(args->self);
+  pipeline->running--;
+  if (args->scratch != &pipeline->scratch) {
+    release_scratch(args->scratch);
+    delete args->scratch;
+  }
+  return Qnil;
+}
+
+/*
+ * Runs the pipeline for an image
+ *
+ * The buffers for the intermediate images are allocated at the first run, and reused while
+ * the size and type of the input do not change. A pipeline can be run from several threads;
+ * a run overlapping a running one uses its own buffers.
+ *
+ * @overload run(mat, out: nil)
+ *   @param mat [CvMat] Input image
+ *   @param out [CvMat] Destination for the result (see CvMat#resize)
+ * @return [CvMat] Output image of the same kind as <tt>mat</tt>
+ */
+VALUE
+rb_run(int argc, VALUE *argv, VALUE self)
+{
+  VALUE out = cCvMat::extract_out(&argc, argv);
+  VALUE src;
+  rb_scan_args(argc, argv, "1", &src);
+  CVMAT_WITH_CHECK(src);
+  sCvPipeline* pipeline = CVPIPELINE(self);
+
+  run_args_t args = { self, src, out, &pipeline->scratch };
+  if (pipeline->running) {
+    args.scratch = new pipeline_scratch_t();
+    args.scratch->type = -1;
+  }
+  pipeline->running++;
+  return rb_ensure(run_pipeline, (VALUE)&args, finish_run, (VALUE)&args);
+}
+
+VALUE
+plan_batch_item(VALUE arg)
+{
+  pipeline_batch_t* batch = (pipeline_batch_t*)arg;
+  pipeline_batch_item_t* item = &batch->items[batch->index];
+  VALUE image = rb_ary_entry(batch->images, batch->index);
+  CVMAT_WITH_CHECK(image);
+  item->src = CVARR(image);
+  try {
+    item->size = cvGetSize(item->src);
+    item->type = cvGetElemType(item->src);
+  }
+  catch (cv::Exception& e) {
+    raise_cverror(e);
+  }
+  plan_pipeline(CVPIPELINE(batch->self)->ops, item->size, item->type, item->stages);
+  pipeline_stage_t output = { item->size, item->type };
+  if (!item->stages.empty())
+    output = item->stages.back();
+  VALUE dest = cCvMat::destination_object(Qnil, output.size, image, CV_MAT_DEPTH(output.type), CV_MAT_CN(output.type));
+  rb_ary_store(batch->results, batch->index, dest);
+  item->dest = CVARR(dest);
+  item->planned = true;
+  return Qnil;
+}
+
+/*
+ * Processes an image of a batch in a worker thread, reusing the buffers of the worker
+ * while the size and type of the images do not change, and encodes the output if ext is given
+ */
+void
+execute_batch_item(const std::vector<pipeline_op_t>& ops, pipeline_batch_item_t* item,
+		   pipeline_scratch_t* scratch, const char* ext, const int* params)
+{
+  if (!item->planned)
+    return;
+  try {
+    if (scratch->type != item->type || scratch->size.width != item->size.width ||
+	scratch->size.height != item->size.height) {
+      release_scratch(scratch, cvReleaseMat);
+      scratch->stages = item->stages;
+      allocate_scratch(ops, item->size, item->type, scratch, cvCreateMat);
+    }
+    execute_pipeline(ops, item->src, item->dest, scratch);
+    if (ext)
+      item->encoded = cvEncodeImage(ext, item->dest, params);
+  }
+  catch (cv::Exception& e) {
+    item->failed = true;
+    item->error = e;
+  }
+  catch (std::bad_alloc&) {
+    item->failed = true;
+    item->error = cv::Exception(CV_StsNoMem, "Failed to allocate memory", "CvPipeline#batch", __FILE__, __LINE__);
+  }
+}
+
+VALUE
+run_batch(VALUE arg)
+{
+  pipeline_batch_t* batch = (pipeline_batch_t*)arg;
+  long n = RARRAY_LEN(batch->images);
+  batch->items.resize(n);
+  for (long i = 0; i < n; i++) {
+    batch->items[i].encoded = NULL;
+    batch->items[i].planned = false;
+    batch->items[i].failed = false;
+    batch->index = i;
+    int state = 0;
+    rb_protect(plan_batch_item, arg, &state);
+    if (state) {
+      VALUE error = rb_errinfo();
+      if (!rb_obj_is_kind_of(error, rb_eStandardError))
+	rb_jump_tag(state);
+      rb_set_errinfo(Qnil);
+      rb_ary_store(batch->results, i, error);
+    }
+  }
+
+  const std::vector<pipeline_op_t>& ops = CVPIPELINE(batch->self)->ops;
+  std::vector<pipeline_batch_item_t>& items = batch->items;
+  std::vector<pipeline_scratch_t>& scratches = batch->scratches;
+  int threads = batch->threads;
+  const char* ext = batch->ext.empty() ? NULL : batch->ext.c_str();
+  const int* params = batch->params.empty() ? NULL : &batch->params[0];
+  scratches.resize(threads);
+  for (int i = 0; i < threads; i++)
+    scratches[i].type = -1;
+  // An interrupt stops the workers between images and is raised by rb_thread_check_ints();
+  // if it does not raise (e.g. a trap handler), the rest of the images is processed
+  size_t done = 0;
+  while (done < items.size()) {
+    rb_thread_check_ints();
+    std::atomic<bool> interrupted(false);
+    size_t offset = done;
+    try {
+      rb_cvCallWithoutGVL([&] {
+	  done += rb_cvParallelFor(items.size() - offset, threads, [&](size_t i, int worker) {
+	      execute_batch_item(ops, &items[offset + i], &scratches[worker], ext, params);
+	    }, &interrupted);
+	}, rb_cvSetInterruptFlag, &interrupted);
+    }
+    catch (cv::Exception& e) {
+      raise_cverror(e);
+    }
+  }
+
+  for (long i = 0; i < n; i++) {
+    if (items[i].failed)
+      rb_ary_store(batch->results, i, cCvError::exception(items[i].error));
+    else if (items[i].encoded) {
+      CvMat* encoded = items[i].encoded;
+      rb_ary_store(batch->results, i, rb_str_new((const char*)encoded->data.ptr, encoded->rows * encoded->cols));
+      items[i].encoded = NULL;
+      cvReleaseMat(&encoded);
+    }
+  }
+  return batch->results;
+}
+
+VALUE
+finish_batch(VALUE arg)
+{
+  pipeline_batch_t* batch = (pipeline_batch_t*)arg;
+  CVPIPELINE(batch->self)->running--;
+  for (size_t i = 0; i < batch->scratches.size(); i++)
+    release_scratch(&batch->scratches[i], cvReleaseMat);
+  for (size_t i = 0; i < batch->items.size(); i++) { // not returned because of an interrupt
+    if (batch->items[i].encoded)
+      cvReleaseMat(&batch->items[i].encoded);
+  }
+  delete batch;
+  return Qnil;
+}
+
+/*
+ * Runs the pipeline for each image in parallel on native worker threads
+ *
+ * The images are planned and their outputs are allocated first, then processed by a pool of
+ * worker threads without the GVL. Each worker reuses its intermediate buffers while the size
+ * and type of the images do not change.
+ *
+ * If <tt>encode</tt> is given, the workers also encode the outputs (as CvMat#encode_binary),
+ * and the encoded bytes are returned instead of the output images.
+ *
+ * An error of an image does not stop the others; the error (<tt>CvError</tt>, <tt>TypeError</tt>,
+ * <tt>ArgumentError</tt>, ...) is returned in place of its output. An interrupt (<tt>Thread#raise</tt>,
+ * <tt>Timeout</tt>, Ctrl-C, ...) stops the workers after their current images.
+ *
+ * @overload batch(images, threads: nil, encode: nil, params: nil)
+ *   @param images [Array<CvMat>] Input images
+ *   @param threads [Integer] Number of worker threads (default: number of CPUs)
+ *   @param encode [String] File extension that defines the encoded format ('.jpg', '.png', ...)
+ *   @param params [Hash] Format-specific parameters of the encoding (see CvMat#encode_image)
+ * @return [Array<CvMat, String, StandardError>] Outputs, encoded outputs (or errors) in the order of <tt>images</tt>
+ * @example
+ *   pipeline = CvPipeline.new.resize(CvSize.new(320, 240)).smooth(:gaussian, 3)
+ *   thumbnails = pipeline.batch(images, threads: 4)
+ *   jpegs = pipeline.batch(images, encode: '.jpg', params: { CV_IMWRITE_JPEG_QUALITY => 80 })
+ */
+VALUE
+rb_batch(int argc, VALUE *argv, VALUE self)
+{
+  VALUE images, options;
+  rb_scan_args(argc, argv, "11", &images, &options);
+  Check_Type(images, T_ARRAY);
+  int threads = rb_cvDefaultThreadCount();
+  VALUE ext = Qnil, params = Qnil;
+  if (!NIL_P(options)) {
+    Check_Type(options, T_HASH);
+    VALUE threads_val = LOOKUP_HASH(options, "threads");
+    if (!NIL_P(threads_val))
+      threads = NUM2INT(threads_val);
+    ext = LOOKUP_HASH(options, "encode");
+    params = LOOKUP_HASH(options, "params");
+  }
+  if (threads < 1)
+    rb_raise(rb_eArgError, "threads should be positive");
+  if (!NIL_P(ext))
+    Check_Type(ext, T_STRING);
+  std::vector<int> format_params;
+  if (!NIL_P(ext) && !NIL_P(params)) {
+    int* params_ptr = cCvMat::hash_to_format_specific_param(params);
+    for (int i = 0; params_ptr[i]; i += 2)
+      format_params.insert(format_params.end(), params_ptr + i, params_ptr + i + 2);
+    format_params.push_back(0);
+    xfree(params_ptr);
+  }
+
+  sCvPipeline* pipeline = CVPIPELINE(self);
+  VALUE sources = rb_ary_dup(images);
+  VALUE results = rb_ary_new2(RARRAY_LEN(sources));
+  pipeline_batch_t* batch = new pipeline_batch_t();
+  batch->self = self;
+  batch->images = sources;
+  batch->results = results;
+  batch->threads = threads;
+  if (!NIL_P(ext))
+    batch->ext.assign(RSTRING_PTR(ext), RSTRING_LEN(ext));
+  batch->params.swap(format_params);
+  batch->index = 0;
+  pipeline->running++;
+  rb_ensure(run_batch, (VALUE)batch, finish_batch, (VALUE)batch);
+  RB_GC_GUARD(sources);
+  return results;
+}
+
+/*
+ * Returns the recorded operations
+ *
+ * @overload operations
+ * @return [Array<Array>] Names and arguments of the operations (e.g. <tt>[[:resize, size], [:smooth, CV_GAUSSIAN, 5]]</tt>)
+ */
+VALUE
+rb_operations(VALUE self)
+{
+  return rb_ary_dup(rb_attr_get(self, id_operations));
+}
+
+/*
+ * Returns the number of the recorded operations
+ *
+ * @overload size
+ * @return [Integer] Number of the operations
+ */
+VALUE
+rb_size(VALUE self)
+{
+  return SIZET2NUM(CVPIPELINE(self)->ops.size());
+}
+
+void
+init_ruby_class()
+{
+#if 0
+  // For documentation using YARD
+  VALUE opencv = rb_define_module("OpenCV");
+#endif
+
+  if (rb_klass)
+    return;
+  /*
+   * opencv = rb_define_module("OpenCV");
+   *
+   * note: this comment is used by rdoc.
+   */
+  VALUE opencv = rb_module_opencv();
+  id_operations = rb_intern("__operations__");
+  rb_klass = rb_define_class_under(opencv, "CvPipeline", rb_cObject);
+  rb_define_alloc_func(rb_klass, rb_allocate);
+  rb_define_method(rb_klass, "initialize", RUBY_METHOD_FUNC(rb_initialize), 0);
+
+  rb_define_method(rb_klass, "cvt_color", RUBY_METHOD_FUNC(rb_cvt_color), 1);
+  rb_define_method(rb_klass, "resize", RUBY_METHOD_FUNC(rb_resize), -1);
+  rb_define_method(rb_klass, "smooth", RUBY_METHOD_FUNC(rb_smooth), -1);
+  rb_define_method(rb_klass, "threshold", RUBY_METHOD_FUNC(rb_threshold), -1);
+  rb_define_method(rb_klass, "canny", RUBY_METHOD_FUNC(rb_canny), -1);
+  rb_define_method(rb_klass, "sobel", RUBY_METHOD_FUNC(rb_sobel), -1);
+  rb_define_method(rb_klass, "laplace", RUBY_METHOD_FUNC(rb_laplace), -1);
+  rb_define_method(rb_klass, "equalize_hist", RUBY_METHOD_FUNC(rb_equalize_hist), 0);
+  rb_define_method(rb_klass, "pyr_down", RUBY_METHOD_FUNC(rb_pyr_down), 0);
+  rb_define_method(rb_klass, "pyr_up", RUBY_METHOD_FUNC(rb_pyr_up), 0);
+  rb_define_method(rb_klass, "filter2d", RUBY_METHOD_FUNC(rb_filter2d), -1);
+  rb_define_method(rb_klass, "warp_affine", RUBY_METHOD_FUNC(rb_warp_affine), -1);
+  rb_define_method(rb_klass, "erode", RUBY_METHOD_FUNC(rb_erode), -1);
+  rb_define_method(rb_klass, "dilate", RUBY_METHOD_FUNC(rb_dilate), -1);
+  rb_define_method(rb_klass, "morphology", RUBY_METHOD_FUNC(rb_morphology), -1);
+
+  rb_define_method(rb_klass, "run", RUBY_METHOD_FUNC(rb_run), -1);
+  rb_define_alias(rb_klass, "call", "run");
+  rb_define_method(rb_klass, "batch", RUBY_METHOD_FUNC(rb_batch), -1);
+  rb_define_method(rb_klass, "operations", RUBY_METHOD_FUNC(rb_operations), 0);
+  rb_define_method(rb_klass, "size", RUBY_METHOD_FUNC(rb_size), 0);
+}
+
+__NAMESPACE_END_CVPIPELINE
+__NAMESPACE_END_OPENCV
@@ -0,0 +1,181 @@
+/************************************************************
+
+   cvpipeline.h -
+
+   $Author: ser1zw $
+
+   Copyright (C) 2013 ser1zw
+
+************************************************************/
+#ifndef RUBY_OPENCV_CVPIPELINE_H
+#define RUBY_OPENCV_CVPIPELINE_H
+
+#include "opencv.h"
+#include <string>
+#include <vector>
+
+#define __NAMESPACE_BEGIN_CVPIPELINE namespace cCvPipeline {
+#define __NAMESPACE_END_CVPIPELINE }
+
+__NAMESPACE_BEGIN_OPENCV
+
+enum {
+  PIPELINE_OP_CVT_COLOR,
+  PIPELINE_OP_RESIZE,
+  PIPELINE_OP_SMOOTH,
+  PIPELINE_OP_THRESHOLD,
+  PIPELINE_OP_CANNY,
+  PIPELINE_OP_SOBEL,
+  PIPELINE_OP_LAPLACE,
+  PIPELINE_OP_EQUALIZE_HIST,
+  PIPELINE_OP_PYR_DOWN,
+  PIPELINE_OP_PYR_UP,
+  PIPELINE_OP_FILTER2D,
+  PIPELINE_OP_WARP_AFFINE,
+  PIPELINE_OP_ERODE,
+  PIPELINE_OP_DILATE,
+  PIPELINE_OP_MORPHOLOGY
+};
+
+/*
+ * A recorded operation. Array parameters (kernel, map matrix, structuring element)
+ * are kept alive by the operation list of the pipeline object.
+ */
+typedef struct {
+  int op;
+  int iparams[4];
+  double dparams[2];
+  CvSize size;
+  CvPoint point;
+  CvScalar scalar;
+  CvArr* arr;
+  IplConvKernel* element;
+  int src_cn; // required input channels (cvt_color)
+  int dest_cn;
+} pipeline_op_t;
+
+typedef struct {
+  CvSize size;
+  int type;
+} pipeline_stage_t;
+
+/*
+ * Intermediate buffers for the input size and type the pipeline was planned for
+ */
+typedef struct {
+  CvSize size;
+  int type; // -1 if not planned yet
+  std::vector<pipeline_stage_t> stages;
+  std::vector<CvMat*> buffers; // output of each operation but the last
+  std::vector<CvMat*> temps; // temporary image of each operation (or NULL)
+} pipeline_scratch_t;
+
+typedef struct {
+  std::vector<pipeline_op_t> ops;
+  pipeline_scratch_t scratch;
+  int running;
+} sCvPipeline;
+
+/*
+ * An image of CvPipeline#batch. Planned with the GVL and processed by a worker thread.
+ */
+typedef struct {
+  CvArr* src;
+  CvArr* dest;
+  CvSize size;
+  int type;
+  std::vector<pipeline_stage_t> stages;
+  CvMat* encoded; // output encoded by the worker (or NULL)
+  bool planned; // false if the image was rejected before processing
+  bool failed;
+  cv::Exception error;
+} pipeline_batch_item_t;
+
+typedef struct {
+  VALUE self;
+  VALUE images;
+  VALUE results;
+  int threads;
+  std::string ext; // encodes the outputs if not empty
+  std::vector<int> params; // format-specific parameters of the encoding (0-terminated, or empty)
+  size_t index; // image being planned
+  std::vector<pipeline_batch_item_t> items;
+  std::vector<pipeline_scratch_t> scratches; // per worker
+} pipeline_batch_t;
+
+__NAMESPACE_BEGIN_CVPIPELINE
+
+extern const rb_data_type_t data_type;
+
+VALUE rb_class();
+
+void init_ruby_class();
+
+void cvpipeline_free(void *ptr);
+size_t cvpipeline_memsize(const void *ptr);
+VALUE rb_allocate(VALUE klass);
+VALUE rb_initialize(VALUE self);
+
+VALUE rb_cvt_color(VALUE self, VALUE code);
+VALUE rb_resize(int argc, VALUE *argv, VALUE self);
+VALUE rb_smooth(int argc, VALUE *argv, VALUE self);
+VALUE rb_threshold(int argc, VALUE *argv, VALUE self);
+VALUE rb_canny(int argc, VALUE *argv, VALUE self);
+VALUE rb_sobel(int argc, VALUE *argv, VALUE self);
+VALUE rb_laplace(int argc, VALUE *argv, VALUE self);
+VALUE rb_equalize_hist(VALUE self);
+VALUE rb_pyr_down(VALUE self);
+VALUE rb_pyr_up(VALUE self);
+VALUE rb_filter2d(int argc, VALUE *argv, VALUE self);
+VALUE rb_warp_affine(int argc, VALUE *argv, VALUE self);
+VALUE rb_erode(int argc, VALUE *argv, VALUE self);
+VALUE rb_dilate(int argc, VALUE *argv, VALUE self);
+VALUE rb_morphology(int argc, VALUE *argv, VALUE self);
+
+VALUE rb_run(int argc, VALUE *argv, VALUE self);
+VALUE run_pipeline(VALUE arg);
+VALUE finish_run(VALUE arg);
+VALUE rb_batch(int argc, VALUE *argv, VALUE self);
+VALUE plan_batch_item(VALUE arg);
+VALUE run_batch(VALUE arg);
+VALUE finish_batch(VALUE arg);
+void execute_batch_item(const std::vector<pipeline_op_t>& ops, pipeline_batch_item_t* item,
+			pipeline_scratch_t* scratch, const char* ext = NULL, const int* params = NULL);
+VALUE rb_operations(VALUE self);
+VALUE rb_size(VALUE self);
+
+pipeline_op_t new_operation(int op);
+pipeline_op_t new_morphology_operation(int op_type, VALUE element, VALUE iteration);
+VALUE push_operation(VALUE self, const pipeline_op_t& op, const char* name, int argc, VALUE* argv);
+void plan_pipeline(const std::vector<pipeline_op_t>& ops, CvSize size, int type,
+		   std::vector<pipeline_stage_t>& stages);
+void prepare_scratch(const std::vector<pipeline_op_t>& ops, CvSize size, int type,
+		     pipeline_scratch_t* scratch);
+void allocate_scratch(const std::vector<pipeline_op_t>& ops, CvSize size, int type,
+		      pipeline_scratch_t* scratch, CvMat* (*create_mat)(int, int, int));
+void release_scratch(pipeline_scratch_t* scratch, void (*release_mat)(CvMat**) = rb_cvReleaseMat);
+void execute_operation(const pipeline_op_t& op, CvArr* src, CvArr* dest, CvMat* temp);
+void execute_pipeline(const std::vector<pipeline_op_t>& ops, CvArr* src, CvArr* dest,
+		      pipeline_scratch_t* scratch);
+
+__NAMESPACE_END_CVPIPELINE
+
+inline sCvPipeline*
+CVPIPELINE(VALUE object)
+{
+  sCvPipeline* pipeline;
+  TypedData_Get_Struct(object, sCvPipeline, &cCvPipeline::data_type, pipeline);
+  return pipeline;
+}
+
+inline sCvPipeline*
+CVPIPELINE_WITH_CHECK(VALUE object)
+{
+  if (!rb_obj_is_kind_of(object, cCvPipeline::rb_class()))
+    raise_typeerror(object, cCvPipeline::rb_class());
+  return CVPIPELINE(object);
+}
+
+__NAMESPACE_END_OPENCV
+
+#endif // RUBY_OPENCV_CVPIPELINE_H
@@ -56,11 +56,13 @@ rb_compatible_q(VALUE klass, VALUE object)
   return (rb_respond_to(object, rb_intern("x")) && rb_respond_to(object, rb_intern("y"))) ? Qtrue : Qfalse;
 }
 
+const rb_data_type_t data_type = OPENCV_STRUCT_TYPE("OpenCV::CvPoint", CvPoint, RUBY_TYPED_DEFAULT_FREE);
+
 VALUE
 rb_allocate(VALUE klass)
 {
   CvPoint *ptr;
-  return Data_Make_Struct(klass, CvPoint, 0, -1, ptr);
+  return TypedData_Make_Struct(klass, CvPoint, &data_type, ptr);
 }
 
 /*
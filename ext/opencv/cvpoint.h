@@ -42,7 +42,7 @@ __NAMESPACE_END_CVPOINT
 inline CvPoint*
 CVPOINT(VALUE object){
   CvPoint *ptr;
-  Data_Get_Struct(object, CvPoint, ptr);
+  ptr = (CvPoint*)OPENCV_DATA_PTR(object);
   return ptr;
 }
 
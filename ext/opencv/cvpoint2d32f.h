@@ -42,7 +42,7 @@ inline CvPoint2D32f*
 CVPOINT2D32F(VALUE object)
 {
   CvPoint2D32f *ptr;
-  Data_Get_Struct(object, CvPoint2D32f, ptr);
+  ptr = (CvPoint2D32f*)OPENCV_DATA_PTR(object);
   return ptr;
 }
 
@@ -62,11 +62,13 @@ rb_compatible_q(VALUE klass, VALUE object)
 	  rb_respond_to(object, rb_intern("z"))) ? Qtrue : Qfalse;
 }
 
+const rb_data_type_t data_type = OPENCV_STRUCT_TYPE("OpenCV::CvPoint3D32f", CvPoint3D32f, RUBY_TYPED_DEFAULT_FREE);
+
 VALUE
 rb_allocate(VALUE klass)
 {
   CvPoint3D32f *ptr;
-  return Data_Make_Struct(klass, CvPoint3D32f, 0, -1, ptr);
+  return TypedData_Make_Struct(klass, CvPoint3D32f, &data_type, ptr);
 }
 
 /*
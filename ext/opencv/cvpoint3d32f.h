@@ -44,7 +44,7 @@ inline CvPoint3D32f*
 CVPOINT3D32F(VALUE object)
 {
   CvPoint3D32f *ptr;
-  Data_Get_Struct(object, CvPoint3D32f, ptr);
+  ptr = (CvPoint3D32f*)OPENCV_DATA_PTR(object);
   return ptr;
 }
 
@@ -80,11 +80,13 @@ rb_max_rect(VALUE klass, VALUE rect1, VALUE rect2)
   return cCvRect::new_object(cvMaxRect(CVRECT(rect1), CVRECT(rect2)));
 }
 
+const rb_data_type_t data_type = OPENCV_STRUCT_TYPE("OpenCV::CvRect", CvRect, RUBY_TYPED_DEFAULT_FREE);
+
 VALUE
 rb_allocate(VALUE klass)
 {
   CvRect *ptr;
-  return Data_Make_Struct(klass, CvRect, 0, -1, ptr);
+  return TypedData_Make_Struct(klass, CvRect, &data_type, ptr);
 }
 
 /*
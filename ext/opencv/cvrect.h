@@ -55,7 +55,7 @@ inline CvRect*
 CVRECT(VALUE object)
 {
   CvRect *ptr;
-  Data_Get_Struct(object, CvRect, ptr);
+  ptr = (CvRect*)OPENCV_DATA_PTR(object);
   return ptr;
 }
 
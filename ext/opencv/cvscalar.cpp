@@ -42,11 +42,13 @@ rb_class()
   return rb_klass;
 }
 
+const rb_data_type_t data_type = OPENCV_STRUCT_TYPE("OpenCV::CvScalar", CvScalar, RUBY_TYPED_DEFAULT_FREE);
+
 VALUE
 rb_allocate(VALUE klass)
 {
   CvScalar *ptr;
-  return Data_Make_Struct(klass, CvScalar, 0, -1, ptr);
+  return TypedData_Make_Struct(klass, CvScalar, &data_type, ptr);
 }
 
 /*
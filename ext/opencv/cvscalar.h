@@ -43,7 +43,7 @@ inline CvScalar*
 CVSCALAR(VALUE object)
 {
   CvScalar *ptr;
-  Data_Get_Struct(object, CvScalar, ptr);
+  ptr = (CvScalar*)OPENCV_DATA_PTR(object);
   return ptr;
 }
 
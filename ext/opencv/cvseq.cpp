@@ -18,8 +18,6 @@ VALUE rb_allocate(VALUE klass);
 void cvseq_free(void *ptr);
 
 VALUE rb_klass;
-// contain sequence-block class
-st_table *seqblock_klass_table = st_init_numtable();
 
 VALUE
 rb_class()
@@ -59,43 +57,42 @@ eltype2class(int eltype, VALUE* ret) {
 }
 
 VALUE
-seqblock_class(void *ptr)
+seqblock_class(VALUE object)
 {
-  VALUE klass = Qnil;
-  if (st_lookup(seqblock_klass_table, (st_data_t)ptr, (st_data_t*)&klass)) {
+  VALUE klass = rooted_object(object)->elem_class;
+  if (!NIL_P(klass)) {
     return klass;
   }
 
-  int eltype = CV_SEQ_ELTYPE((CvSeq*)ptr);
+  int eltype = CV_SEQ_ELTYPE(CVSEQ(object));
   eltype2class(eltype, &klass);
 
   return klass;
 }
 
+/*
+ * Register the class of the elements, which is kept by the sequence object itself.
+ */
 void
-register_elem_class(CvSeq *seq, VALUE klass)
+register_elem_class(VALUE object, VALUE klass)
 {
-  st_insert(seqblock_klass_table, (st_data_t)seq, (st_data_t)klass);
+  RB_OBJ_WRITE(object, &rooted_object(object)->elem_class, klass);
 }
 
-void
-unregister_elem_class(void *ptr)
-{
-  if (ptr) {
-    st_delete(seqblock_klass_table, (st_data_t*)&ptr, NULL);
-    unregister_object(ptr);
-  }
-}
+const rb_data_type_t data_type = {
+  "OpenCV::CvSeq",
+  { mark_rooted_object, RUBY_TYPED_DEFAULT_FREE, memsize_rooted_object, compact_rooted_object, },
+  &rooted_object_type, 0, RUBY_TYPED_FREE_IMMEDIATELY | RUBY_TYPED_WB_PROTECTED
+};
 
 VALUE
 rb_allocate(VALUE klass)
 {
-  CvSeq *ptr = ALLOC(CvSeq);
-  return Data_Wrap_Struct(klass, mark_root_object, unregister_elem_class, ptr);
+  return wrap_rooted_object(klass, &data_type, NULL, Qnil);
 }
 
 CvSeq*
-create_seq(int seq_flags, size_t header_size, VALUE storage_value)
+create_seq(VALUE self, int seq_flags, size_t header_size, VALUE storage_value)
 {
   VALUE klass = Qnil;
   int eltype = seq_flags & CV_SEQ_ELTYPE_MASK;
@@ -114,9 +111,10 @@ create_seq(int seq_flags, size_t header_size, VALUE storage_value)
   catch (cv::Exception& e) {
     raise_cverror(e);
   }
-  register_elem_class(seq, klass);
-  register_root_object(seq, storage_value);
-  
+  rooted_object(self)->ptr = seq;
+  register_elem_class(self, klass);
+  register_root_object(self, storage_value);
+
   return seq;
 }
 
@@ -182,7 +180,7 @@ rb_initialize(int argc, VALUE *argv, VALUE self)
   Check_Type(seq_flags_value, T_FIXNUM);
   seq_flags = FIX2INT(seq_flags_value);
 
-  DATA_PTR(self) = create_seq(seq_flags, sizeof(CvSeq), storage_value);
+  create_seq(self, seq_flags, sizeof(CvSeq), storage_value);
 
   return self;
 }
@@ -231,7 +229,7 @@ rb_aref(VALUE self, VALUE index)
 
   VALUE result = Qnil;
   try {
-    VALUE klass = seqblock_class(seq);
+    VALUE klass = seqblock_class(self);
     if (RTEST(rb_class_inherited_p(klass, rb_cInteger))) {
       result = INT2NUM(*CV_GET_SEQ_ELEM(int, seq, idx));
     }
@@ -281,7 +279,7 @@ rb_h_prev(VALUE self)
 {
   CvSeq *seq = CVSEQ(self);
   if (seq->h_prev)
-    return new_sequence(CLASS_OF(self), seq->h_prev, seqblock_class(seq), lookup_root_object(seq));
+    return new_sequence(CLASS_OF(self), seq->h_prev, seqblock_class(self), lookup_root_object(self));
   else
     return Qnil;
 }
@@ -298,7 +296,7 @@ rb_h_next(VALUE self)
 {
   CvSeq *seq = CVSEQ(self);
   if (seq->h_next)
-    return new_sequence(CLASS_OF(self), seq->h_next, seqblock_class(seq), lookup_root_object(seq));
+    return new_sequence(CLASS_OF(self), seq->h_next, seqblock_class(self), lookup_root_object(self));
   else
     return Qnil;
 }
@@ -315,7 +313,7 @@ rb_v_prev(VALUE self)
 {
   CvSeq *seq = CVSEQ(self);
   if (seq->v_prev)
-    return new_sequence(CLASS_OF(self), seq->v_prev, seqblock_class(seq), lookup_root_object(seq));
+    return new_sequence(CLASS_OF(self), seq->v_prev, seqblock_class(self), lookup_root_object(self));
   else
     return Qnil;
 }
@@ -332,7 +330,7 @@ rb_v_next(VALUE self)
 {
   CvSeq *seq = CVSEQ(self);
   if (seq->v_next)
-    return new_sequence(CLASS_OF(self), seq->v_next, seqblock_class(seq), lookup_root_object(seq));
+    return new_sequence(CLASS_OF(self), seq->v_next, seqblock_class(self), lookup_root_object(self));
   else
     return Qnil;
 }
@@ -341,7 +339,7 @@ VALUE
 rb_seq_push(VALUE self, VALUE args, int flag)
 {
   CvSeq *seq = CVSEQ(self);
-  VALUE klass = seqblock_class(seq);
+  VALUE klass = seqblock_class(self);
   volatile void *elem = NULL;
   int len = RARRAY_LEN(args);
   for (int i = 0; i < len; i++) {
@@ -356,7 +354,7 @@ rb_seq_push(VALUE self, VALUE args, int flag)
 	elem = &double_elem;
       }
       else {
-	elem = (void*)DATA_PTR(object);
+	elem = OPENCV_DATA_PTR(object);
       }
       try {
 	if (flag == CV_FRONT)
@@ -369,7 +367,7 @@ rb_seq_push(VALUE self, VALUE args, int flag)
       }
     }
     else if ((rb_obj_is_kind_of(object, rb_klass) == Qtrue) &&
-	     RTEST(rb_class_inherited_p(seqblock_class(CVSEQ(object)), klass))) { // object is CvSeq
+	     RTEST(rb_class_inherited_p(seqblock_class(object), klass))) { // object is CvSeq
       void *buffer = NULL;
       try {
 	buffer = cvCvtSeqToArray(CVSEQ(object), rb_cvAlloc(CVSEQ(object)->total * CVSEQ(object)->elem_size));
@@ -419,7 +417,7 @@ rb_pop(VALUE self)
     return Qnil;
   
   VALUE object = Qnil;
-  VALUE klass = seqblock_class(seq);
+  VALUE klass = seqblock_class(self);
   try {
     if (klass == rb_cInteger) {
       int n = 0;
@@ -428,7 +426,7 @@ rb_pop(VALUE self)
     }
     else {
       object = GENERIC_OBJECT(klass, malloc(seq->elem_size));
-      cvSeqPop(seq, DATA_PTR(object));
+      cvSeqPop(seq, OPENCV_DATA_PTR(object));
     }
   }
   catch (cv::Exception& e) {
@@ -489,14 +487,14 @@ rb_shift(VALUE self)
 
   VALUE object = Qnil;
   try {
-    if (seqblock_class(seq) == rb_cInteger) {
+    if (seqblock_class(self) == rb_cInteger) {
       int n = 0;
       cvSeqPopFront(seq, &n);
       object = INT2NUM(n);
     }
     else {
-      object = GENERIC_OBJECT(seqblock_class(seq), malloc(seq->elem_size));
-      cvSeqPopFront(seq, DATA_PTR(object));
+      object = GENERIC_OBJECT(seqblock_class(self), malloc(seq->elem_size));
+      cvSeqPopFront(seq, OPENCV_DATA_PTR(object));
     }
   }
   catch (cv::Exception& e) {
@@ -523,7 +521,7 @@ rb_each(VALUE self)
 {
   CvSeq *seq = CVSEQ(self);
   if (seq->total > 0) {
-    VALUE klass = seqblock_class(seq);
+    VALUE klass = seqblock_class(self);
     try {
       if (klass == rb_cInteger)
 	for (int i = 0; i < seq->total; ++i)
@@ -566,7 +564,7 @@ rb_insert(VALUE self, VALUE index, VALUE object)
 {
   Check_Type(index, T_FIXNUM);
   CvSeq *seq = CVSEQ(self);
-  VALUE klass = seqblock_class(seq);
+  VALUE klass = seqblock_class(self);
   if (!rb_obj_is_kind_of(object, klass))
     rb_raise(rb_eTypeError, "arguments should be %s.", rb_class2name(klass));
   try {
@@ -575,7 +573,7 @@ rb_insert(VALUE self, VALUE index, VALUE object)
       cvSeqInsert(seq, NUM2INT(index), &n);
     }
     else
-      cvSeqInsert(seq, NUM2INT(index), DATA_PTR(object));
+      cvSeqInsert(seq, NUM2INT(index), OPENCV_DATA_PTR(object));
   }
   catch (cv::Exception& e) {
     raise_cverror(e);
@@ -604,10 +602,10 @@ rb_remove(VALUE self, VALUE index)
 VALUE
 new_sequence(VALUE klass, CvSeq *seq, VALUE element_klass, VALUE storage)
 {
-  register_root_object(seq, storage);
+  VALUE object = wrap_rooted_object(klass, &data_type, seq, storage);
   if (!NIL_P(element_klass))
-    register_elem_class(seq, element_klass);
-  return Data_Wrap_Struct(klass, mark_root_object, unregister_elem_class, seq);
+    register_elem_class(object, element_klass);
+  return object;
 }
 
 void
@@ -21,10 +21,9 @@ __NAMESPACE_BEGIN_CVSEQ
 VALUE rb_class();
 void init_ruby_class();
 
-VALUE seqblock_class(void *ptr);
-void register_elem_class(CvSeq *seq, VALUE klass);
-void unregister_elem_class(void *ptr);
-CvSeq* create_seq(int seq_flags, size_t header_size, VALUE storage_value);
+VALUE seqblock_class(VALUE object);
+void register_elem_class(VALUE object, VALUE klass);
+CvSeq* create_seq(VALUE self, int seq_flags, size_t header_size, VALUE storage_value);
 
 VALUE rb_allocate(VALUE klass);
 
@@ -58,7 +57,7 @@ inline CvSeq*
 CVSEQ(VALUE object)
 {
   CvSeq *ptr;
-  Data_Get_Struct(object, CvSeq, ptr);
+  ptr = (CvSeq*)OPENCV_DATA_PTR(object);
   return ptr;
 }
 
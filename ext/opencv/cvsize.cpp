@@ -56,11 +56,13 @@ rb_compatible_q(VALUE klass, VALUE object)
   return (rb_respond_to(object, rb_intern("width")) && rb_respond_to(object, rb_intern("height"))) ? Qtrue : Qfalse;
 }
 
+const rb_data_type_t data_type = OPENCV_STRUCT_TYPE("OpenCV::CvSize", CvSize, RUBY_TYPED_DEFAULT_FREE);
+
 VALUE
 rb_allocate(VALUE klass)
 {
   CvSize *ptr;
-  return Data_Make_Struct(klass, CvSize, 0, -1, ptr);
+  return TypedData_Make_Struct(klass, CvSize, &data_type, ptr);
 }
 
 /*
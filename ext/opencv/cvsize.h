@@ -43,7 +43,7 @@ inline CvSize*
 CVSIZE(VALUE object)
 {
   CvSize *ptr;
-  Data_Get_Struct(object, CvSize, ptr);
+  ptr = (CvSize*)OPENCV_DATA_PTR(object);
   return ptr;
 }
 
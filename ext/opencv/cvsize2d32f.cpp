@@ -56,11 +56,13 @@ rb_compatible_q(VALUE klass, VALUE object)
   return (rb_respond_to(object, rb_intern("width")) && rb_respond_to(object, rb_intern("height"))) ? Qtrue : Qfalse;
 }
 
+const rb_data_type_t data_type = OPENCV_STRUCT_TYPE("OpenCV::CvSize2D32f", CvSize2D32f, RUBY_TYPED_DEFAULT_FREE);
+
 VALUE
 rb_allocate(VALUE klass)
 {
   CvSize2D32f *ptr;
-  return Data_Make_Struct(klass, CvSize2D32f, 0, -1, ptr);
+  return TypedData_Make_Struct(klass, CvSize2D32f, &data_type, ptr);
 }
 
 /*
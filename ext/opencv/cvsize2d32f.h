@@ -42,7 +42,7 @@ inline CvSize2D32f*
 CVSIZE2D32F(VALUE object)
 {
   CvSize2D32f *ptr;
-  Data_Get_Struct(object, CvSize2D32f, ptr);
+  ptr = (CvSize2D32f*)OPENCV_DATA_PTR(object);
   return ptr;
 }
 
@@ -28,11 +28,13 @@ rb_class()
   return rb_klass;
 }
 
+const rb_data_type_t data_type = OPENCV_STRUCT_TYPE("OpenCV::CvSlice", CvSlice, RUBY_TYPED_DEFAULT_FREE);
+
 VALUE
 rb_allocate(VALUE klass)
 {
   CvSlice *ptr;
-  return Data_Make_Struct(klass, CvSlice, 0, -1, ptr);
+  return TypedData_Make_Struct(klass, CvSlice, &data_type, ptr);
 }
 
 /*
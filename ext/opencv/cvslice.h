@@ -35,7 +35,7 @@ inline CvSlice*
 CVSLICE(VALUE object)
 {
   CvSlice *ptr;
-  Data_Get_Struct(object, CvSlice, ptr);
+  ptr = (CvSlice*)OPENCV_DATA_PTR(object);
   return ptr;
 }
 
@@ -30,11 +30,13 @@ rb_class()
   return rb_klass;
 }
 
+const rb_data_type_t data_type = OPENCV_STRUCT_TYPE("OpenCV::CvSURFParams", CvSURFParams, RUBY_TYPED_DEFAULT_FREE);
+
 VALUE
 rb_allocate(VALUE klass)
 {
   CvSURFParams *ptr;
-  return Data_Make_Struct(klass, CvSURFParams, 0, -1, ptr);
+  return TypedData_Make_Struct(klass, CvSURFParams, &data_type, ptr);
 }
 
 /*
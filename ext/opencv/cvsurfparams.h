@@ -41,7 +41,7 @@ inline CvSURFParams*
 CVSURFPARAMS(VALUE object)
 {
   CvSURFParams* ptr;
-  Data_Get_Struct(object, CvSURFParams, ptr);
+  ptr = (CvSURFParams*)OPENCV_DATA_PTR(object);
   return ptr;
 }
 
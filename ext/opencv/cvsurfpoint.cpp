@@ -35,11 +35,13 @@ rb_class()
   return rb_klass;
 }
 
+const rb_data_type_t data_type = OPENCV_STRUCT_TYPE("OpenCV::CvSURFPoint", CvSURFPoint, RUBY_TYPED_DEFAULT_FREE);
+
 VALUE
 rb_allocate(VALUE klass)
 {
   CvSURFPoint *ptr;
-  return Data_Make_Struct(klass, CvSURFPoint, 0, -1, ptr);
+  return TypedData_Make_Struct(klass, CvSURFPoint, &data_type, ptr);
 }
 
 /* 
@@ -43,7 +43,7 @@ inline CvSURFPoint*
 CVSURFPOINT(VALUE object)
 {
   CvSURFPoint* ptr;
-  Data_Get_Struct(object, CvSURFPoint, ptr);
+  ptr = (CvSURFPoint*)OPENCV_DATA_PTR(object);
   return ptr;
 }
 
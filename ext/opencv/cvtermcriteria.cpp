@@ -29,11 +29,13 @@ rb_class()
   return rb_klass;
 }
 
+const rb_data_type_t data_type = OPENCV_STRUCT_TYPE("OpenCV::CvTermCriteria", CvTermCriteria, RUBY_TYPED_DEFAULT_FREE);
+
 VALUE
 rb_allocate(VALUE klass)
 {
   CvTermCriteria *ptr;
-  return Data_Make_Struct(klass, CvTermCriteria, 0, -1, ptr);
+  return TypedData_Make_Struct(klass, CvTermCriteria, &data_type, ptr);
 }
 
 /*
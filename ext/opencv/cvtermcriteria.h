@@ -39,7 +39,7 @@ inline CvTermCriteria*
 CVTERMCRITERIA(VALUE object)
 {
   CvTermCriteria *ptr;
-  Data_Get_Struct(object, CvTermCriteria, ptr);
+  ptr = (CvTermCriteria*)OPENCV_DATA_PTR(object);
   return ptr;
 }
 
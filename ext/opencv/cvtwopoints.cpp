@@ -31,11 +31,13 @@ rb_class()
   return rb_klass;
 }
 
+const rb_data_type_t data_type = OPENCV_STRUCT_TYPE("OpenCV::CvTwoPoints", CvTwoPoints, RUBY_TYPED_DEFAULT_FREE);
+
 VALUE
 rb_allocate(VALUE klass)
 {
   CvTwoPoints *ptr;
-  return Data_Make_Struct(klass, CvTwoPoints, 0, -1, ptr);
+  return TypedData_Make_Struct(klass, CvTwoPoints, &data_type, ptr);
 }
 
 /*
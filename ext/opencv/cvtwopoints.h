@@ -42,7 +42,7 @@ __NAMESPACE_END_CVTWOPOINTS
 inline CvTwoPoints*
 CVTWOPOINTS(VALUE object) {
   CvTwoPoints *ptr;
-  Data_Get_Struct(object, CvTwoPoints, ptr);
+  ptr = (CvTwoPoints*)OPENCV_DATA_PTR(object);
   return ptr;
 }
 
@@ -8,6 +8,9 @@
 
 ************************************************************/
 #include "cvutils.h"
+#include <map>
+#include <set>
+#include <vector>
 
 void
 raise_typeerror(VALUE object, VALUE expected_class)
@@ -51,6 +54,277 @@ rbFastMalloc(size_t size)
   return adata;
 }
 
+/*
+ * Size-class pool for the data buffers of CvMat and IplImage
+ *
+ * Pooled buffers are allocated with rbFastMalloc(), so OpenCV can still release them with
+ * cvFree(). The pool records every buffer it has handed out with its size class, which lets
+ * rb_cvReleasePooledData() recognize them and give them back to the pool instead; a buffer
+ * that leaves the pool in another way has to be dropped with rb_cvPoolForget() first.
+ * All pool operations require the GVL.
+ */
+#define BUFFER_POOL_MIN_SIZE 4096
+
+typedef struct {
+  size_t limit;
+  size_t cached_bytes;
+  size_t cached_buffers;
+  size_t hits;
+  size_t misses;
+  size_t returned;
+  size_t discarded;
+  std::map<size_t, std::vector<void*> > free_lists;
+  std::map<void*, size_t> capacities; // capacity of every buffer allocated by the pool
+} buffer_pool_t;
+
+buffer_pool_t buffer_pool;
+
+/*
+ * Rounds size up to one of 4 classes per power of two, so a reused buffer wastes at most 25%
+ */
+size_t
+buffer_pool_size_class(size_t size)
+{
+  size_t high = BUFFER_POOL_MIN_SIZE;
+  while ((high << 1) <= size)
+    high <<= 1;
+  size_t step = high >> 2;
+  return (size + step - 1) / step * step;
+}
+
+void
+free_pooled_buffer(void* ptr)
+{
+  buffer_pool.capacities.erase(ptr);
+  xfree(((uchar**)ptr)[-1]);
+}
+
+/*
+ * Allocates a memory buffer for the data of CvMat or IplImage from the buffer pool
+ * Falls back to rbFastMalloc() when the pool is disabled or size is too small to be pooled
+ */
+void*
+rb_cvPoolAlloc(size_t size)
+{
+  if (buffer_pool.limit == 0 || size < BUFFER_POOL_MIN_SIZE)
+    return rbFastMalloc(size);
+
+  size_t capacity = buffer_pool_size_class(size);
+  std::map<size_t, std::vector<void*> >::iterator it = buffer_pool.free_lists.find(capacity);
+  if (it != buffer_pool.free_lists.end() && !it->second.empty()) {
+    void* ptr = it->second.back();
+    it->second.pop_back();
+    buffer_pool.cached_bytes -= capacity;
+    buffer_pool.cached_buffers--;
+    buffer_pool.hits++;
+    return ptr;
+  }
+  buffer_pool.misses++;
+
+  void* ptr = rbFastMalloc(capacity);
+  try {
+    buffer_pool.capacities[ptr] = capacity;
+  }
+  catch (std::bad_alloc& e) {
+    // hand out an untracked buffer, which is released with cvFree()
+  }
+  return ptr;
+}
+
+/*
+ * Gives a buffer back to the buffer pool, or frees it if the pool is full
+ * Returns false if ptr was not allocated from the pool; the caller has to release it.
+ */
+bool
+rb_cvPoolFree(void* ptr, size_t size)
+{
+  std::map<void*, size_t>::iterator found = buffer_pool.capacities.find(ptr);
+  if (found == buffer_pool.capacities.end() || found->second < size)
+    return false;
+
+  size_t capacity = found->second;
+  if (buffer_pool.cached_bytes + capacity <= buffer_pool.limit) {
+    try {
+      buffer_pool.free_lists[capacity].push_back(ptr);
+      buffer_pool.cached_bytes += capacity;
+      buffer_pool.cached_buffers++;
+      buffer_pool.returned++;
+      return true;
+    }
+    catch (std::bad_alloc& e) {
+      // fall through and free the buffer
+    }
+  }
+  free_pooled_buffer(ptr);
+  buffer_pool.discarded++;
+  return true;
+}
+
+/*
+ * Stops tracking a buffer allocated from the pool, whose new owner releases it with cvFree()
+ */
+void
+rb_cvPoolForget(void* ptr)
+{
+  buffer_pool.capacities.erase(ptr);
+}
+
+/*
+ * Gives the data of CvMat or IplImage back to the buffer pool, if it is a pooled buffer
+ * owned only by arr. Called before the header is released with cvRelease().
+ */
+void
+rb_cvReleasePooledData(void* arr)
+{
+  if (CV_IS_MAT_HDR(arr)) {
+    CvMat* mat = (CvMat*)arr;
+    if (mat->refcount && *mat->refcount == 1 &&
+	rb_cvPoolFree(mat->refcount, (size_t)mat->step * mat->rows)) {
+      mat->refcount = NULL;
+      mat->data.ptr = NULL;
+    }
+  }
+  else if (CV_IS_IMAGE_HDR(arr)) {
+    IplImage* img = (IplImage*)arr;
+    if (img->imageDataOrigin && rb_cvPoolFree(img->imageDataOrigin, (size_t)img->imageSize)) {
+      img->imageData = img->imageDataOrigin = NULL;
+    }
+  }
+}
+
+/*
+ * Releases a matrix created by rb_cvCreateMat(), giving its data back to the buffer pool
+ */
+void
+rb_cvReleaseMat(CvMat** mat)
+{
+  if (*mat) {
+    rb_cvReleasePooledData(*mat);
+    cvReleaseMat(mat);
+  }
+}
+
+/*
+ * Releases an image created by rb_cvCreateImage(), giving its data back to the buffer pool
+ */
+void
+rb_cvReleaseImage(IplImage** image)
+{
+  if (*image) {
+    rb_cvReleasePooledData(*image);
+    cvReleaseImage(image);
+  }
+}
+
+/*
+ * Detaches an image header from its data, which is not released: the image becomes
+ * a 1x1 black image on a pixel of its own, so Ruby objects still referring to the header stay usable
+ * and never share memory. The pixel is owned by the header (imageDataOrigin) and released with it.
+ */
+void
+rb_cvDetachImageData(IplImage* image)
+{
+  int pixel_size = ((image->depth & 255) >> 3) * image->nChannels;
+  char* pixel = (char*)cvAlloc(pixel_size);
+  memset(pixel, 0, pixel_size);
+  image->width = image->height = 1;
+  image->widthStep = image->imageSize = pixel_size;
+  image->imageData = image->imageDataOrigin = pixel;
+}
+
+/*
+ * Arrays whose data other objects refer to: the roots of views (see wrap_rooted_object) and
+ * the exporters of memory views. An array is forgotten when it is released. Requires the GVL.
+ */
+std::set<const void*> shared_arrays;
+
+void
+rb_cvMarkShared(const void* arr)
+{
+  shared_arrays.insert(arr);
+}
+
+void
+rb_cvForgetShared(const void* arr)
+{
+  shared_arrays.erase(arr);
+}
+
+/*
+ * Moves the data of an image to a new header, and detaches the image (see rb_cvDetachImageData())
+ * Returns NULL if the image does not own its whole data (a view, a borrowed frame or an image with ROI),
+ * or if other objects refer to its data (see rb_cvMarkShared()).
+ */
+IplImage*
+rb_cvTakeImageData(IplImage* image)
+{
+  if (image->roi || !image->imageDataOrigin || image->imageData != image->imageDataOrigin ||
+      shared_arrays.count(image) > 0)
+    return NULL;
+  IplImage* taken = cvCreateImageHeader(cvSize(image->width, image->height), image->depth, image->nChannels);
+  taken->origin = image->origin;
+  taken->widthStep = image->widthStep;
+  taken->imageSize = image->imageSize;
+  taken->imageData = taken->imageDataOrigin = image->imageDataOrigin;
+  rb_cvPoolForget(image->imageDataOrigin);
+  rb_cvDetachImageData(image);
+  return taken;
+}
+
+/*
+ * Frees the cached buffers until the pool holds at most limit bytes
+ */
+void
+trim_buffer_pool(size_t limit)
+{
+  std::map<size_t, std::vector<void*> >::iterator it = buffer_pool.free_lists.begin();
+  while (buffer_pool.cached_bytes > limit && it != buffer_pool.free_lists.end()) {
+    while (buffer_pool.cached_bytes > limit && !it->second.empty()) {
+      free_pooled_buffer(it->second.back());
+      it->second.pop_back();
+      buffer_pool.cached_bytes -= it->first;
+      buffer_pool.cached_buffers--;
+    }
+    if (it->second.empty())
+      buffer_pool.free_lists.erase(it++);
+    else
+      ++it;
+  }
+}
+
+/*
+ * Sets the maximum bytes of buffers cached by the pool (0 disables the pool)
+ */
+void
+rb_cvSetBufferPoolLimit(size_t limit)
+{
+  buffer_pool.limit = limit;
+  trim_buffer_pool(limit);
+}
+
+/*
+ * Frees all buffers cached by the pool
+ */
+void
+rb_cvClearBufferPool()
+{
+  trim_buffer_pool(0);
+}
+
+rb_cvBufferPoolStats
+rb_cvGetBufferPoolStats()
+{
+  rb_cvBufferPoolStats stats;
+  stats.limit = buffer_pool.limit;
+  stats.cached_bytes = buffer_pool.cached_bytes;
+  stats.cached_buffers = buffer_pool.cached_buffers;
+  stats.hits = buffer_pool.hits;
+  stats.misses = buffer_pool.misses;
+  stats.returned = buffer_pool.returned;
+  stats.discarded = buffer_pool.discarded;
+  return stats;
+}
+
 /*
  * Allocates a memory buffer
  * When memory allocation is failed, run GC and retry it
@@ -76,7 +350,7 @@ rb_cvCreateMat(int rows, int cols, int type)
       size_t step = mat->step;
       size_t total_size = step * mat->rows + sizeof(int) + CV_MALLOC_ALIGN;
 
-      mat->refcount = (int*)rbFastMalloc(total_size);
+      mat->refcount = (int*)rb_cvPoolAlloc(total_size);
       mat->data.ptr = (uchar*)cvAlignPtr(mat->refcount + 1, CV_MALLOC_ALIGN);
       *mat->refcount = 1;
     }
@@ -105,7 +379,7 @@ rb_cvCreateImage(CvSize size, int depth, int channels)
     ptr = cvCreateImageHeader(size, depth, channels);
     if (ptr) {
       // see OpenCV's cvCreateData()
-      ptr->imageData = ptr->imageDataOrigin = (char*)rbFastMalloc((size_t)ptr->imageSize);
+      ptr->imageData = ptr->imageDataOrigin = (char*)rb_cvPoolAlloc((size_t)ptr->imageSize);
     }
     else {
       rb_raise(rb_eRuntimeError, "Failed to create image header");
@@ -190,3 +464,142 @@ rb_get_option_table(VALUE klass, const char* table_name, VALUE option)
     return rb_funcall(table, rb_intern("merge"), 1, option);
 }
 
+typedef struct {
+  void (*func)(void*);
+  void* data;
+  bool done;
+  bool failed;
+  cv::Exception error;
+} without_gvl_t;
+
+void*
+call_without_gvl(void* ptr)
+{
+  without_gvl_t* arg = (without_gvl_t*)ptr;
+  arg->done = true;
+  try {
+    arg->func(arg->data);
+  }
+  catch (cv::Exception& e) {
+    arg->error = e;
+    arg->failed = true;
+  }
+  catch (std::bad_alloc& e) {
+    arg->error = cv::Exception(CV_StsNoMem, "Failed to allocate memory", "rb_cvCallWithoutGVL", __FILE__, __LINE__);
+    arg->failed = true;
+  }
+  catch (std::exception& e) {
+    arg->error = cv::Exception(CV_StsError, e.what(), "rb_cvCallWithoutGVL", __FILE__, __LINE__);
+    arg->failed = true;
+  }
+  return NULL;
+}
+
+/*
+ * Runs func(data) without the GVL, so that other Ruby threads can run
+ * while OpenCV is processing.
+ * func must not touch any Ruby objects or call Ruby's API (including xmalloc);
+ * arguments should be unpacked and results should be wrapped by the caller.
+ * A cv::Exception thrown by func is rethrown after the GVL is reacquired,
+ * so that the caller can clean up and raise it with raise_cverror().
+ *
+ * ubf(ubf_data) is called from another thread when the calling thread is interrupted
+ * (Thread#raise, Thread#kill, Timeout, Ctrl-C, ...), or before func if an interrupt is
+ * already pending. It should make func return early,
+ * for example by setting a flag that func checks or by closing what func waits for.
+ * A single OpenCV function cannot be cancelled, so most callers pass no ubf: their func
+ * always finishes, and the interrupt is raised at the next interrupt check after the caller
+ * has cleaned up. Interrupts are never raised from inside this function, so that the
+ * cleanup code of the caller is not skipped.
+ */
+void
+rb_cvCallWithoutGVL(void (*func)(void*), void* data, rb_cvUnblockFunction ubf, void* ubf_data)
+{
+  without_gvl_t arg;
+  arg.func = func;
+  arg.data = data;
+  arg.done = false;
+  arg.failed = false;
+#if defined(HAVE_RB_NOGVL) || defined(HAVE_RUBY_THREAD_H)
+#if defined(HAVE_RB_NOGVL)
+  rb_nogvl(call_without_gvl, &arg, ubf, ubf_data, RB_NOGVL_INTR_FAIL);
+#else
+  rb_thread_call_without_gvl(call_without_gvl, &arg, ubf, ubf_data);
+#endif
+  // rb_nogvl() does not call func when an interrupt is already pending.
+  // Run it with the GVL, unblocked first as the interrupt would have; the interrupt is raised later.
+  if (!arg.done) {
+    if (ubf)
+      ubf(ubf_data);
+    call_without_gvl(&arg);
+  }
+#else
+  // No way to release the GVL: nothing can interrupt func, so it runs as is
+  call_without_gvl(&arg);
+#endif
+  if (arg.failed)
+    throw arg.error;
+}
+
+/*
+ * Returns the Mutex that serializes the calls for owner.
+ * The Mutexes are kept in an ObjectSpace::WeakMap instead of the owners, so that frozen
+ * owners work too. A Mutex may be collected while nobody holds it, which is harmless.
+ */
+VALUE
+without_gvl_lock(VALUE owner)
+{
+  static VALUE locks = Qnil;
+  if (NIL_P(locks)) {
+    rb_global_variable(&locks);
+    VALUE object_space = rb_const_get(rb_cObject, rb_intern("ObjectSpace"));
+    locks = rb_class_new_instance(0, NULL, rb_const_get(object_space, rb_intern("WeakMap")));
+  }
+  VALUE lock = rb_funcall(locks, rb_intern("[]"), 1, owner);
+  if (NIL_P(lock)) {
+    lock = rb_mutex_new();
+    rb_funcall(locks, rb_intern("[]="), 2, owner, lock);
+  }
+  return lock;
+}
+
+/*
+ * Same as rb_cvCallWithoutGVL(func, data, ubf, ubf_data), but calls for the same owner are serialized.
+ * Used for objects whose OpenCV state is not thread-safe (capture devices, cascades, ...),
+ * which were implicitly serialized by the GVL before.
+ */
+void
+rb_cvCallWithoutGVL(VALUE owner, void (*func)(void*), void* data, rb_cvUnblockFunction ubf, void* ubf_data)
+{
+  VALUE lock = without_gvl_lock(owner);
+  rb_mutex_lock(lock);
+  try {
+    rb_cvCallWithoutGVL(func, data, ubf, ubf_data);
+  }
+  catch (cv::Exception& e) {
+    rb_mutex_unlock(lock);
+    throw;
+  }
+  rb_mutex_unlock(lock);
+  RB_GC_GUARD(lock);
+}
+
+/*
+ * Returns the default number of worker threads for parallel operations
+ */
+int
+rb_cvDefaultThreadCount()
+{
+  unsigned int n = std::thread::hardware_concurrency();
+  return n > 0 ? (int)n : 1;
+}
+
+/*
+ * Unblocking function which sets the std::atomic<bool> flag pointed by data,
+ * to stop an rb_cvParallelFor() loop given the same flag
+ */
+void
+rb_cvSetInterruptFlag(void* data)
+{
+  ((std::atomic<bool>*)data)->store(true);
+}
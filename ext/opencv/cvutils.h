@@ -7,24 +7,130 @@
     Copyright (C) 2011 ser1zw
 
 ************************************************************/
+#ifndef RUBY_OPENCV_CVUTILS_H
+#define RUBY_OPENCV_CVUTILS_H
 
 #include <ruby.h>
+#ifdef HAVE_RUBY_THREAD_H
+#include <ruby/thread.h>
+#endif
 #include "opencv2/core/core_c.h"
 #include "opencv2/core/core.hpp"
 #include "opencv2/core/internal.hpp"
 #include "opencv2/imgproc/imgproc_c.h"
 #include "opencv2/imgproc/imgproc.hpp"
+#include <atomic>
+#include <system_error>
+#include <thread>
+#include <vector>
 
 #define raise_cverror(e) cCvError::raise(e)
 
+typedef struct {
+  size_t limit;
+  size_t cached_bytes;
+  size_t cached_buffers;
+  size_t hits;
+  size_t misses;
+  size_t returned;
+  size_t discarded;
+} rb_cvBufferPoolStats;
+
 void raise_typeerror(VALUE object, VALUE expected_class);
 void raise_typeerror(VALUE object, const char* expected_class_name);
 void raise_compatible_typeerror(VALUE object, VALUE expected_class);
 void raise_compatible_typeerror(VALUE object, const char* expected_class_name);
+
+void* rb_cvPoolAlloc(size_t size);
+bool rb_cvPoolFree(void* ptr, size_t size);
+void rb_cvPoolForget(void* ptr);
+void rb_cvReleasePooledData(void* arr);
+void rb_cvReleaseMat(CvMat** mat);
+void rb_cvReleaseImage(IplImage** image);
+void rb_cvMarkShared(const void* arr);
+void rb_cvForgetShared(const void* arr);
+void rb_cvDetachImageData(IplImage* image);
+IplImage* rb_cvTakeImageData(IplImage* image);
+void rb_cvSetBufferPoolLimit(size_t limit);
+void rb_cvClearBufferPool();
+rb_cvBufferPoolStats rb_cvGetBufferPoolStats();
 void* rb_cvAlloc(size_t size);
 CvMat* rb_cvCreateMat(int height, int width, int type);
 IplImage* rb_cvCreateImage(CvSize size, int depth, int channels);
 IplConvKernel* rb_cvCreateStructuringElementEx(int cols, int rows, int anchorX, int anchorY, int shape, int *values);
 CvMemStorage* rb_cvCreateMemStorage(int block_size);
 VALUE rb_get_option_table(VALUE klass, const char* table_name, VALUE option);
+typedef void (*rb_cvUnblockFunction)(void*);
+void rb_cvCallWithoutGVL(void (*func)(void*), void* data, rb_cvUnblockFunction ubf = NULL, void* ubf_data = NULL);
+void rb_cvCallWithoutGVL(VALUE owner, void (*func)(void*), void* data,
+			 rb_cvUnblockFunction ubf = NULL, void* ubf_data = NULL);
+int rb_cvDefaultThreadCount();
+void rb_cvSetInterruptFlag(void* data);
+
+template <typename F>
+void
+rb_cvCallFunctor(void* data)
+{
+  (*(F*)data)();
+}
+
+/*
+ * Runs func() without the GVL (see rb_cvCallWithoutGVL(void (*)(void*), void*, rb_cvUnblockFunction, void*))
+ */
+template <typename F>
+void
+rb_cvCallWithoutGVL(F func, rb_cvUnblockFunction ubf = NULL, void* ubf_data = NULL)
+{
+  rb_cvCallWithoutGVL(rb_cvCallFunctor<F>, &func, ubf, ubf_data);
+}
+
+/*
+ * Runs func() without the GVL, serialized with the other calls for owner
+ */
+template <typename F>
+void
+rb_cvCallWithoutGVL(VALUE owner, F func, rb_cvUnblockFunction ubf = NULL, void* ubf_data = NULL)
+{
+  rb_cvCallWithoutGVL(owner, rb_cvCallFunctor<F>, &func, ubf, ubf_data);
+}
+
+/*
+ * Calls func(index, worker) for each index in [0, count) on up to threads native threads
+ * (the calling thread is worker 0). Indices are handed out in order, one at a time.
+ * func must catch its own exceptions. Should be called without the GVL.
+ *
+ * The workers stop taking indices once *interrupted is set (e.g. by rb_cvSetInterruptFlag()
+ * as the unblocking function). Returns n such that the indices in [0, n) have been processed.
+ */
+template <typename F>
+size_t
+rb_cvParallelFor(size_t count, int threads, F func, const std::atomic<bool>* interrupted = NULL)
+{
+  std::atomic<size_t> next(0);
+  auto worker = [&](int id) {
+    while (!(interrupted && interrupted->load())) {
+      size_t i = next++;
+      if (i >= count)
+	break;
+      func(i, id);
+    }
+  };
+  if ((size_t)threads > count)
+    threads = (int)count;
+  std::vector<std::thread> pool;
+  for (int id = 1; id < threads; id++) {
+    try {
+      pool.push_back(std::thread(worker, id));
+    }
+    catch (std::system_error&) {
+      break; // run with the threads created so far
+    }
+  }
+  worker(0);
+  for (size_t i = 0; i < pool.size(); i++)
+    pool[i].join();
+  size_t processed = next;
+  return processed < count ? processed : count;
+}
 
+#endif // RUBY_OPENCV_CVUTILS_H
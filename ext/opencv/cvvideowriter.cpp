@@ -8,6 +8,7 @@
 
 ************************************************************/
 #include "cvvideowriter.h"
+#include <chrono>
 /*
  * Document-class: OpenCV::CvVideoWriter
  *
@@ -26,20 +27,158 @@ rb_class()
   return rb_klass;
 }
 
+/*
+ * Stops the encoder thread and releases the writer. May wait for the thread.
+ */
+void
+release_writer(sCvVideoWriter* swriter)
+{
+  if (swriter->async) {
+    stop_async(swriter);
+    delete swriter->async;
+  }
+  delete swriter->ptr;
+  delete swriter;
+}
+
+/*
+ * A writer is not flushed in GC, where encoding the queued frames would stall every Ruby thread.
+ * The frames which were not closed or flushed are discarded, and a detached thread
+ * waits for the frame being written and releases the writer. CvVideoWriter#close writes them all.
+ */
+void
+cvvideowriter_free(void *ptr)
+{
+  if (!ptr)
+    return;
+  sCvVideoWriter* swriter = (sCvVideoWriter*)ptr;
+  video_writer_async_t* async = swriter->async;
+  bool threaded = false;
+  if (async) {
+    std::lock_guard<std::mutex> lock(async->mutex);
+    if (async->thread.joinable()) {
+      async->discard = true;
+      async->active = false;
+      threaded = true;
+    }
+  }
+  if (threaded) {
+    async->cond.notify_all();
+    try {
+      std::thread(release_writer, swriter).detach();
+      return;
+    }
+    catch (std::system_error&) {
+      // release it here; the encoder only finishes the frame being written
+    }
+  }
+  release_writer(swriter);
+}
+
+size_t
+cvvideowriter_memsize(const void *ptr)
+{
+  const sCvVideoWriter* swriter = (const sCvVideoWriter*)ptr;
+  size_t size = sizeof(sCvVideoWriter);
+  if (swriter->async) {
+    video_writer_async_t* async = swriter->async;
+    std::lock_guard<std::mutex> lock(async->mutex);
+    size += sizeof(video_writer_async_t);
+    for (size_t i = 0; i < async->queue.size(); i++)
+      size += async->queue[i]->imageSize;
+    for (size_t i = 0; i < async->spare.size(); i++)
+      size += async->spare[i]->imageSize;
+  }
+  return size;
+}
+
+const rb_data_type_t data_type = {
+  "OpenCV::CvVideoWriter",
+  { 0, cvvideowriter_free, cvvideowriter_memsize, },
+  &opencv_data_type, 0, RUBY_TYPED_FREE_IMMEDIATELY | RUBY_TYPED_WB_PROTECTED
+};
+
+VALUE
+rb_allocate(VALUE klass)
+{
+  return TypedData_Wrap_Struct(klass, &data_type, new sCvVideoWriter());
+}
+
+sCvVideoWriter*
+writer_struct(VALUE self)
+{
+  sCvVideoWriter* swriter;
+  TypedData_Get_Struct(self, sCvVideoWriter, &data_type, swriter);
+  return swriter;
+}
+
+bool
+writing_async(sCvVideoWriter* swriter)
+{
+  return swriter->async != NULL && swriter->async->active;
+}
+
+/*
+ * Creates the writer of a file. YUV4MPEG2 (.y4m) and raw MJPEG (.mjpeg, .mjpg) files are
+ * written natively, and Motion JPEG in AVI too if highgui can not write it (or native is true).
+ * The format is given by the file name, unless format is set. Returns NULL if highgui can
+ * not create the writer.
+ */
+rb_cvVideoSink*
+create_sink(const char* filename, int format, int fourcc, double fps, CvSize size, bool is_color,
+	    bool native, int quality)
+{
+  if (format != RB_CV_VIDEO_UNKNOWN)
+    native = true;
+  else {
+    format = rb_cvVideoFormatFromFilename(filename);
+    if (format == RB_CV_VIDEO_AVI_MJPEG && fourcc != CV_FOURCC('M', 'J', 'P', 'G'))
+      format = RB_CV_VIDEO_UNKNOWN; // other codecs are left to highgui
+  }
+  if (format == RB_CV_VIDEO_Y4M || format == RB_CV_VIDEO_MJPEG)
+    native = true;
+  if (native && format == RB_CV_VIDEO_UNKNOWN)
+    CV_Error(CV_StsUnsupportedFormat, "Only .y4m, .mjpeg and Motion JPEG .avi files can be written natively");
+  if (!native) {
+    CvVideoWriter* writer = cvCreateVideoWriter(filename, fourcc, fps, size, is_color);
+    if (writer)
+      return rb_cvCreateHighguiSink(writer);
+    if (format == RB_CV_VIDEO_UNKNOWN)
+      return NULL;
+  }
+  rb_cvVideoSink* sink = rb_cvCreateRawVideoSink(filename, format, fps, size, is_color, quality);
+  if (!sink)
+    CV_Error(CV_StsError, "Could not open the video file");
+  return sink;
+}
+
 /*
  * call-seq:
- *   CvVideoWriter.new(filname, fourcc, fps, size[, is_color]) -> cvvideowriter
- *   CvVideoWriter.new(filname, fourcc, fps, size[, is_color]){|vw| ... } -> nil
+ *   CvVideoWriter.new(filname, fourcc, fps, size[, is_color][, options]) -> cvvideowriter
+ *   CvVideoWriter.new(filname, fourcc, fps, size[, is_color][, options]){|vw| ... } -> nil
  *
  * Open new video writer. If block given, writer is closed automatically when end of block.
  * 
  * note: if <i>fourcc</i> is nil, popup codec select dialog (Windows only).
+ *
+ * YUV4MPEG2 (.y4m) and raw MJPEG (.mjpeg, .mjpg; concatenated JPEG images) files are written
+ * without highgui, whatever the <i>fourcc</i> is, so they can be written without a video backend
+ * such as ffmpeg, and to pipes. Motion JPEG ("MJPG") .avi files are written without highgui
+ * if highgui can not write them. <i>options</i> may have:
+ * * :native - write Motion JPEG .avi files without highgui (default false)
+ * * :format - "y4m", "mjpeg" or "avi" (Motion JPEG) to write natively whatever the file name is
+ *   (e.g. "/dev/stdout")
+ * * :quality - JPEG quality (0-100) of the frames of the MJPEG formats (default 95)
  */
 VALUE
 rb_initialize(int argc, VALUE *argv, VALUE self)
 {
-  VALUE filename, fourcc, fps, size, is_color_val;
-  rb_scan_args(argc, argv, "41", &filename, &fourcc, &fps, &size, &is_color_val);
+  VALUE filename, fourcc, fps, size, is_color_val, options;
+  rb_scan_args(argc, argv, "42", &filename, &fourcc, &fps, &size, &is_color_val, &options);
+  if (argc == 5 && TYPE(is_color_val) == T_HASH) {
+    options = is_color_val;
+    is_color_val = Qnil;
+  }
   char codec[4] = {' ', ' ', ' ', ' '};
   int codec_number;
   Check_Type(filename, T_STRING);
@@ -63,9 +202,28 @@ rb_initialize(int argc, VALUE *argv, VALUE self)
     is_color = 1;
   else
     is_color = (is_color_val == Qtrue) ? 1 : 0;
+  bool native = false;
+  int format = RB_CV_VIDEO_UNKNOWN;
+  int quality = 95;
+  if (!NIL_P(options)) {
+    Check_Type(options, T_HASH);
+    native = RTEST(LOOKUP_HASH(options, "native"));
+    VALUE format_name = LOOKUP_HASH(options, "format");
+    if (!NIL_P(format_name)) {
+      VALUE ext = rb_str_plus(rb_str_new2("."), rb_String(format_name));
+      format = rb_cvVideoFormatFromFilename(StringValueCStr(ext));
+      if (format == RB_CV_VIDEO_UNKNOWN)
+	rb_raise(rb_eArgError, "format should be \"y4m\", \"mjpeg\" or \"avi\"");
+    }
+    quality = IF_INT(LOOKUP_HASH(options, "quality"), 95);
+    if (quality < 0 || quality > 100)
+      rb_raise(rb_eArgError, "quality should be 0-100");
+  }
+  double fps_value = NUM2DBL(fps);
+  CvSize frame_size = VALUE_TO_CVSIZE(size);
   try {
-    DATA_PTR(self) = cvCreateVideoWriter(StringValueCStr(filename), codec_number,
-					 NUM2DBL(fps), VALUE_TO_CVSIZE(size), is_color);
+    writer_struct(self)->ptr = create_sink(StringValueCStr(filename), format, codec_number, fps_value,
+					   frame_size, is_color, native, quality);
   }
   catch (cv::Exception& e) {
     raise_cverror(e);
@@ -81,33 +239,124 @@ rb_initialize(int argc, VALUE *argv, VALUE self)
 
 /*
  * call-seq:
- *   write(frame)
+ *   write(frame[, own: false])
  *
  * Write image as frame of video stream.
  * <i>frame</i> should be IplImage
+ *
+ * In the async mode (see CvVideoWriter#async), the frame is queued and written by the encoder thread.
+ * The frame is copied, unless <i>own</i> is true: then the writer takes the data of <i>frame</i>
+ * without a copy, and <i>frame</i> becomes a 1x1 image. The frame is still copied if its data
+ * is shared: a view, an image with views (e.g. by IplImage#sub_rect) or an exported memory view.
+ * An error of a queued frame is raised by a later call of write, flush or close.
  */
 VALUE
-rb_write(VALUE self, VALUE frame)
+rb_write(int argc, VALUE *argv, VALUE self)
 {
+  VALUE frame, options;
+  rb_scan_args(argc, argv, "11", &frame, &options);
+  IplImage* image = IPLIMAGE_WITH_CHECK(frame);
+  sCvVideoWriter* swriter = writer_struct(self);
+  if (!swriter->ptr)
+    rb_raise(rb_eIOError, "closed video writer");
+  if (!writing_async(swriter)) {
+    try {
+      swriter->ptr->write(image);
+    }
+    catch (cv::Exception& e) {
+      raise_cverror(e);
+    }
+    return self;
+  }
+
+  bool own = false;
+  if (!NIL_P(options)) {
+    Check_Type(options, T_HASH);
+    own = RTEST(LOOKUP_HASH(options, "own"));
+  }
+  video_writer_async_t* async = swriter->async;
+  IplImage* queued = NULL;
   try {
-    cvWriteFrame(CVVIDEOWRITER(self), IPLIMAGE_WITH_CHECK(frame));
+    wait_written(swriter, false);
+    {
+      std::lock_guard<std::mutex> lock(async->mutex);
+      if (async->queue.size() >= async->capacity) {
+	async->dropped++; // with drop: true
+	return self;
+      }
+    }
+    if (own && !OBJ_FROZEN(frame))
+      queued = rb_cvTakeImageData(image);
+    if (!queued) {
+      CvSize size = cvGetSize(image);
+      {
+	// Reuse a written frame of the same size for the copy
+	std::lock_guard<std::mutex> lock(async->mutex);
+	for (size_t i = 0; i < async->spare.size(); i++) {
+	  IplImage* spare = async->spare[i];
+	  if (spare->width == size.width && spare->height == size.height &&
+	      spare->depth == image->depth && spare->nChannels == image->nChannels) {
+	    queued = spare;
+	    async->spare.erase(async->spare.begin() + i);
+	    break;
+	  }
+	}
+      }
+      rb_cvCallWithoutGVL([&] {
+	  if (!queued)
+	    queued = cvCreateImage(size, image->depth, image->nChannels);
+	  cvCopy(image, queued);
+	  queued->origin = image->origin;
+	});
+    }
   }
   catch (cv::Exception& e) {
+    if (queued)
+      cvReleaseImage(&queued);
     raise_cverror(e);
   }
+  bool closed = false;
+  {
+    // Closed by another thread while waiting or copying: the encoder thread has been stopped
+    std::lock_guard<std::mutex> lock(async->mutex);
+    if (async->active) {
+      async->queue.push_back(queued);
+      async->max_depth = MAX(async->max_depth, async->queue.size());
+    }
+    else
+      closed = true;
+  }
+  if (closed) {
+    cvReleaseImage(&queued);
+    rb_raise(rb_eIOError, "closed video writer");
+  }
+  async->cond.notify_all();
   return self;
 }
 
 /*
  * Close vidoe writer.
+ * In the async mode, waits until the queued frames are written.
  */
 VALUE
 rb_close(VALUE self)
 {
-  CvVideoWriter *writer = CVVIDEOWRITER(self);
+  sCvVideoWriter* swriter = writer_struct(self);
   try {
-    if (writer)
-      cvReleaseVideoWriter(&writer);
+    if (writing_async(swriter))
+      wait_written(swriter, true);
+  }
+  catch (cv::Exception& e) {
+    rb_cvCallWithoutGVL([&] { stop_async(swriter); });
+    delete swriter->ptr;
+    swriter->ptr = NULL;
+    raise_cverror(e);
+  }
+  try {
+    if (writing_async(swriter))
+      rb_cvCallWithoutGVL([&] { stop_async(swriter); });
+    delete swriter->ptr;
+    swriter->ptr = NULL;
   }
   catch (cv::Exception& e) {
     raise_cverror(e);
@@ -115,6 +364,306 @@ rb_close(VALUE self)
   return Qnil;
 }
 
+/*
+ * Body of the encoder thread. Writes the queued frames in order, until the writer is
+ * stopped and the queue is empty.
+ */
+void
+encoder_worker(sCvVideoWriter* swriter)
+{
+  video_writer_async_t* async = swriter->async;
+  std::unique_lock<std::mutex> lock(async->mutex);
+  while (true) {
+    async->cond.wait(lock, [&] { return !async->queue.empty() || !async->active; });
+    if (async->discard) {
+      for (size_t i = 0; i < async->queue.size(); i++)
+	cvReleaseImage(&async->queue[i]);
+      async->queue.clear();
+    }
+    if (async->queue.empty())
+      break;
+    IplImage* image = async->queue.front();
+    async->queue.pop_front();
+    async->writing = true;
+    lock.unlock();
+    async->cond.notify_all(); // the queue has room
+
+    bool failed = false;
+    cv::Exception error;
+    double elapsed = 0;
+    try {
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      swriter->ptr->write(image);
+      elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    catch (cv::Exception& e) {
+      failed = true;
+      error = e;
+    }
+
+    lock.lock();
+    async->writing = false;
+    if (failed) {
+      if (!async->failed) {
+	async->failed = true;
+	async->error = error;
+      }
+    }
+    else {
+      async->written++;
+      async->encode_time += elapsed;
+      async->max_encode_time = MAX(async->max_encode_time, elapsed);
+    }
+    if (async->spare.size() < async->capacity)
+      async->spare.push_back(image);
+    else
+      cvReleaseImage(&image);
+    async->cond.notify_all();
+  }
+}
+
+/*
+ * Starts the encoder thread. Returns false if the thread could not be created.
+ */
+bool
+start_async(sCvVideoWriter* swriter, size_t capacity, bool drop)
+{
+  if (!swriter->async)
+    swriter->async = new video_writer_async_t();
+  video_writer_async_t* async = swriter->async;
+  async->capacity = capacity;
+  async->drop = drop;
+  async->writing = false;
+  async->discard = false;
+  async->failed = false;
+  async->interrupted = false;
+  async->written = async->dropped = async->waits = async->max_depth = 0;
+  async->encode_time = async->max_encode_time = 0;
+  async->active = true;
+  try {
+    async->thread = std::thread(encoder_worker, swriter);
+  }
+  catch (std::system_error&) {
+    async->active = false;
+    return false;
+  }
+  return true;
+}
+
+/*
+ * Stops the encoder thread after the queued frames are written (or discarded, see cvvideowriter_free),
+ * and joins it
+ */
+void
+stop_async(sCvVideoWriter* swriter)
+{
+  video_writer_async_t* async = swriter->async;
+  {
+    std::lock_guard<std::mutex> lock(async->mutex);
+    if (!async->thread.joinable())
+      return;
+    async->active = false;
+  }
+  async->cond.notify_all();
+  async->thread.join();
+  std::lock_guard<std::mutex> lock(async->mutex);
+  for (size_t i = 0; i < async->spare.size(); i++)
+    cvReleaseImage(&async->spare[i]);
+  async->spare.clear();
+}
+
+/*
+ * Waits until the queue has room (or all frames are written if flush), an error,
+ * or the waiting thread is interrupted
+ */
+void*
+wait_async(void* arg)
+{
+  video_writer_wait_t* wait = (video_writer_wait_t*)arg;
+  video_writer_async_t* async = wait->async;
+  std::unique_lock<std::mutex> lock(async->mutex);
+  auto ready = [&] {
+    bool done = wait->flush ? (async->queue.empty() && !async->writing) :
+      (async->drop || async->queue.size() < async->capacity);
+    return done || async->failed || !async->active || async->interrupted;
+  };
+  if (!ready()) {
+    async->waits++;
+    async->cond.wait(lock, ready);
+  }
+  async->interrupted = false;
+  return NULL;
+}
+
+void
+interrupt_async(void* arg)
+{
+  video_writer_async_t* async = ((video_writer_wait_t*)arg)->async;
+  {
+    std::lock_guard<std::mutex> lock(async->mutex);
+    async->interrupted = true;
+  }
+  async->cond.notify_all();
+}
+
+/*
+ * Waits for the encoder thread (see wait_async) with the GVL released, and throws
+ * the error of a frame written since the last call once.
+ */
+void
+wait_written(sCvVideoWriter* swriter, bool flush)
+{
+  video_writer_async_t* async = swriter->async;
+  video_writer_wait_t wait = { async, flush };
+  while (true) {
+#ifdef HAVE_RUBY_THREAD_H
+    rb_thread_call_without_gvl(wait_async, &wait, interrupt_async, &wait);
+#else
+    wait_async(&wait);
+#endif
+    {
+      std::lock_guard<std::mutex> lock(async->mutex);
+      if (async->failed) {
+	async->failed = false;
+	throw cv::Exception(async->error);
+      }
+      if (!async->active)
+	return;
+      if (flush ? (async->queue.empty() && !async->writing) : (async->drop || async->queue.size() < async->capacity))
+	return;
+    }
+    rb_thread_check_ints();
+  }
+}
+
+/*
+ * call-seq:
+ *   async(depth = 4[, drop: false]) -> self
+ *
+ * Writes the frames on a native encoder thread, so that CvVideoWriter#write returns
+ * without waiting for the encoder. Up to <i>depth</i> frames are queued. When the queue
+ * is full, write waits for the encoder, or drops the frame if <i>drop</i> is true.
+ *
+ * Use CvVideoWriter#flush to wait until the queued frames are written. CvVideoWriter#close
+ * also waits for them. The queued frames of a writer garbage collected without close are
+ * discarded.
+ *
+ *   CvVideoWriter.new('out.avi', 'MJPG', 30, CvSize.new(1920, 1080)) { |writer|
+ *     writer.async(8)
+ *     while frame = capture.query
+ *       writer.write(frame, own: true)
+ *     end
+ *   }
+ */
+VALUE
+rb_async(int argc, VALUE *argv, VALUE self)
+{
+  VALUE depth, options;
+  rb_scan_args(argc, argv, "02", &depth, &options);
+  if (argc == 1 && TYPE(depth) == T_HASH) {
+    options = depth;
+    depth = Qnil;
+  }
+  int depth_value = NIL_P(depth) ? 4 : NUM2INT(depth);
+  if (depth_value < 1)
+    rb_raise(rb_eArgError, "depth should be greater than 0");
+  bool drop = false;
+  if (!NIL_P(options)) {
+    Check_Type(options, T_HASH);
+    drop = RTEST(LOOKUP_HASH(options, "drop"));
+  }
+
+  sCvVideoWriter* swriter = writer_struct(self);
+  if (!swriter->ptr)
+    rb_raise(rb_eIOError, "closed video writer");
+  if (writing_async(swriter)) {
+    try {
+      wait_written(swriter, true);
+    }
+    catch (cv::Exception& e) {
+      raise_cverror(e);
+    }
+    rb_cvCallWithoutGVL([&] { stop_async(swriter); });
+  }
+  if (!start_async(swriter, depth_value, drop))
+    rb_raise(rb_eRuntimeError, "failed to create an encoder thread");
+  return self;
+}
+
+/*
+ * call-seq:
+ *   async? -> true or false
+ *
+ * Returns whether the frames are written on the encoder thread (see CvVideoWriter#async)
+ */
+VALUE
+rb_async_q(VALUE self)
+{
+  return writing_async(writer_struct(self)) ? Qtrue : Qfalse;
+}
+
+/*
+ * call-seq:
+ *   flush -> self
+ *
+ * Waits until the queued frames are written (in the async mode).
+ * Raises the error of a queued frame if any.
+ */
+VALUE
+rb_flush(VALUE self)
+{
+  sCvVideoWriter* swriter = writer_struct(self);
+  if (writing_async(swriter)) {
+    try {
+      wait_written(swriter, true);
+    }
+    catch (cv::Exception& e) {
+      raise_cverror(e);
+    }
+  }
+  return self;
+}
+
+/*
+ * call-seq:
+ *   async_stats -> hash or nil
+ *
+ * Returns the statistics of the encoder thread since CvVideoWriter#async, or nil if not in the async mode
+ * * <tt>:depth</tt> - Number of frames in the queue
+ * * <tt>:capacity</tt> - Size of the queue
+ * * <tt>:max_depth</tt> - Maximum number of frames queued at once
+ * * <tt>:written</tt> - Number of frames written
+ * * <tt>:dropped</tt> - Number of frames dropped because the queue was full (with <tt>drop: true</tt>)
+ * * <tt>:waits</tt> - Number of times the caller had to wait for the encoder
+ * * <tt>:encode_time</tt> - Average time to write a frame (seconds)
+ * * <tt>:max_encode_time</tt> - Maximum time to write a frame (seconds)
+ */
+VALUE
+rb_async_stats(VALUE self)
+{
+  sCvVideoWriter* swriter = writer_struct(self);
+  if (!writing_async(swriter))
+    return Qnil;
+  video_writer_async_t* async = swriter->async;
+  size_t values[6];
+  double encode_time, max_encode_time;
+  {
+    std::lock_guard<std::mutex> lock(async->mutex);
+    size_t stats[] = { async->queue.size(), async->capacity, async->max_depth, async->written,
+		       async->dropped, async->waits };
+    memcpy(values, stats, sizeof(values));
+    encode_time = async->written > 0 ? async->encode_time / async->written : 0.0;
+    max_encode_time = async->max_encode_time;
+  }
+  const char* keys[] = { "depth", "capacity", "max_depth", "written", "dropped", "waits" };
+  VALUE hash = rb_hash_new();
+  for (int i = 0; i < 6; i++)
+    rb_hash_aset(hash, ID2SYM(rb_intern(keys[i])), SIZET2NUM(values[i]));
+  rb_hash_aset(hash, ID2SYM(rb_intern("encode_time")), rb_float_new(encode_time));
+  rb_hash_aset(hash, ID2SYM(rb_intern("max_encode_time")), rb_float_new(max_encode_time));
+  return hash;
+}
+
 void
 init_ruby_class()
 {
@@ -132,9 +681,14 @@ init_ruby_class()
    */
   VALUE opencv = rb_module_opencv();
   rb_klass = rb_define_class_under(opencv, "CvVideoWriter", rb_cObject);
+  rb_define_alloc_func(rb_klass, rb_allocate);
   rb_define_method(rb_klass, "initialize", RUBY_METHOD_FUNC(rb_initialize), -1);
-  rb_define_method(rb_klass, "write", RUBY_METHOD_FUNC(rb_write), 1);
+  rb_define_method(rb_klass, "write", RUBY_METHOD_FUNC(rb_write), -1);
   rb_define_method(rb_klass, "close", RUBY_METHOD_FUNC(rb_close), 0);
+  rb_define_method(rb_klass, "async", RUBY_METHOD_FUNC(rb_async), -1);
+  rb_define_method(rb_klass, "async?", RUBY_METHOD_FUNC(rb_async_q), 0);
+  rb_define_method(rb_klass, "flush", RUBY_METHOD_FUNC(rb_flush), 0);
+  rb_define_method(rb_klass, "async_stats", RUBY_METHOD_FUNC(rb_async_stats), 0);
 }
 
 __NAMESPACE_END_CVVIDEOWRITER
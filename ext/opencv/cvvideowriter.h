@@ -11,31 +11,97 @@
 #define RUBY_OPENCV_CVVIDEOWRITER_H
 
 #include "opencv.h"
+#include "videoio.h"
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 #define __NAMESPACE_BEGIN_CVVIDEOWRITER namespace cCvVideoWriter {
 #define __NAMESPACE_END_CVVIDEOWRITER }
 
 __NAMESPACE_BEGIN_OPENCV
+
+/*
+ * State of the background encoder thread (see CvVideoWriter#async)
+ */
+typedef struct {
+  std::mutex mutex;
+  std::condition_variable cond;
+  std::thread thread;
+  std::deque<IplImage*> queue; // frames waiting to be written
+  std::vector<IplImage*> spare; // written frames reused for the next copies
+  size_t capacity;
+  bool drop; // drop the frames written while the queue is full instead of waiting
+  bool active;
+  bool discard; // release the queued frames without writing them (the writer was garbage collected)
+  bool writing; // the encoder thread is writing a frame
+  bool failed;
+  bool interrupted;
+  cv::Exception error;
+
+  // Statistics
+  size_t written;
+  size_t dropped;
+  size_t waits;
+  size_t max_depth;
+  double encode_time; // seconds
+  double max_encode_time;
+} video_writer_async_t;
+
+typedef struct {
+  video_writer_async_t* async;
+  bool flush; // wait until all frames are written, instead of until the queue has room
+} video_writer_wait_t;
+
+typedef struct {
+  rb_cvVideoSink* ptr; // highgui or a native writer, NULL if closed
+  video_writer_async_t* async; // allocated by the first CvVideoWriter#async
+} sCvVideoWriter;
+
 __NAMESPACE_BEGIN_CVVIDEOWRITER
 
 VALUE rb_class();
 
 void init_ruby_class();
 
+void release_writer(sCvVideoWriter* swriter);
+void cvvideowriter_free(void *ptr);
+size_t cvvideowriter_memsize(const void *ptr);
+VALUE rb_allocate(VALUE klass);
+
 VALUE rb_initialize(int argc, VALUE *argv, VALUE self);
-VALUE rb_write(VALUE self, VALUE frame);
+VALUE rb_write(int argc, VALUE *argv, VALUE self);
 VALUE rb_close(VALUE self);
 
+VALUE rb_async(int argc, VALUE *argv, VALUE self);
+VALUE rb_async_q(VALUE self);
+VALUE rb_flush(VALUE self);
+VALUE rb_async_stats(VALUE self);
+
+sCvVideoWriter* writer_struct(VALUE self);
+rb_cvVideoSink* create_sink(const char* filename, int format, int fourcc, double fps, CvSize size,
+			   bool is_color, bool native, int quality);
+bool writing_async(sCvVideoWriter* swriter);
+void encoder_worker(sCvVideoWriter* swriter);
+bool start_async(sCvVideoWriter* swriter, size_t capacity, bool drop);
+void stop_async(sCvVideoWriter* swriter);
+void* wait_async(void* arg);
+void interrupt_async(void* arg);
+void wait_written(sCvVideoWriter* swriter, bool flush);
+void check_async_error(video_writer_async_t* async);
+
 __NAMESPACE_END_CVVIDEOWRITER
 
-inline CvVideoWriter*
+inline rb_cvVideoSink*
 CVVIDEOWRITER(VALUE object)
 {
   // CvVideoWriter is 
   // CvVideoWriter *ptr;
   // Data_Get_Struct(object, CvVideoWriter, ptr);
   // return ptr;
-  return (CvVideoWriter*)DATA_PTR(object);
+  return ((sCvVideoWriter*)DATA_PTR(object))->ptr;
 }
 
 __NAMESPACE_END_OPENCV
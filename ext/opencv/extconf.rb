@@ -63,6 +63,20 @@ puts ">> Check the required headers..."
 opencv_headers.each { |header| raise "#{header} not found." unless have_header(header) }
 opencv_headers_opt.each { |header| warn "#{header} not found." unless have_header(header) }
 have_header("stdarg.h")
+have_header("ruby/memory_view.h")
+have_header("ruby/thread.h") and have_func("rb_nogvl", "ruby/thread.h")
+
+# Optional: libjpeg for decoding JPEG images at reduced resolution (DCT scaling).
+# Disabled by default because it has to be the libjpeg OpenCV is linked with; OpenCV may bundle
+# its own, which would clash with another one. Enable with --enable-libjpeg.
+# Without it, JPEG images are decoded at full size and shrunk with cvResize.
+if enable_config("libjpeg", false)
+  if have_header("jpeglib.h", "stdio.h") and have_library("jpeg", "jpeg_start_decompress", ["stdio.h", "jpeglib.h"])
+    warn "jpeg_mem_src not found; libjpeg is not used." unless have_func("jpeg_mem_src", ["stdio.h", "jpeglib.h"])
+  else
+    warn "libjpeg not found; libjpeg is not used."
+  end
+end
 
 if $warnflags
   $warnflags.slice!('-Wdeclaration-after-statement')
@@ -33,10 +33,16 @@ release_facerecognizer(void *data_ptr)
   ptr_guard_map.erase(data_ptr);
 }
 
+const rb_data_type_t data_type = {
+  "OpenCV::FaceRecognizer",
+  { 0, release_facerecognizer, 0, },
+  &opencv_data_type, 0, RUBY_TYPED_FREE_IMMEDIATELY | RUBY_TYPED_WB_PROTECTED
+};
+
 VALUE
 allocate_facerecognizer(VALUE klass)
 {
-  return Data_Wrap_Struct(klass, 0, release_facerecognizer, NULL);
+  return TypedData_Wrap_Struct(klass, &data_type, NULL);
 }
 
 
@@ -74,7 +80,7 @@ rb_train(VALUE self, VALUE src, VALUE labels)
 
   cv::FaceRecognizer *self_ptr = FACERECOGNIZER(self);
   try {
-    self_ptr->train(images, local_labels);
+    rb_cvCallWithoutGVL(self, [&] { self_ptr->train(images, local_labels); });
   }
   catch (cv::Exception& e) {
     raise_cverror(e);
@@ -111,7 +117,7 @@ rb_update(VALUE self, VALUE src, VALUE labels)
 
   cv::FaceRecognizer *self_ptr = FACERECOGNIZER(self);
   try {
-    self_ptr->update(images, local_labels);
+    rb_cvCallWithoutGVL(self, [&] { self_ptr->update(images, local_labels); });
   }
   catch (cv::Exception& e) {
     raise_cverror(e);
@@ -134,7 +140,7 @@ rb_predict(VALUE self, VALUE src)
   int label;
   double confidence;
   try {
-    self_ptr->predict(mat, label, confidence);
+    rb_cvCallWithoutGVL(self, [&] { self_ptr->predict(mat, label, confidence); });
   }
   catch (cv::Exception& e) {
     raise_cverror(e);
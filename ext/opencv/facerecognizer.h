@@ -36,7 +36,7 @@ inline cv::FaceRecognizer*
 FACERECOGNIZER(VALUE object)
 {
   cv::FaceRecognizer *ptr;
-  Data_Get_Struct(object, cv::FaceRecognizer, ptr);
+  ptr = (cv::FaceRecognizer*)OPENCV_DATA_PTR(object);
   return ptr;
 }
 
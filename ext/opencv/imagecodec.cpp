@@ -0,0 +1,585 @@
+/************************************************************
+
+    imagecodec.cpp -
+
+    $Author: ser1zw $
+
+    Copyright (C) 2013 ser1zw
+
+************************************************************/
+#include "imagecodec.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <limits.h>
+#include <string.h>
+#include <stdlib.h>
+#include <vector>
+#ifdef RUBY_OPENCV_USE_LIBJPEG
+#include <setjmp.h>
+#include <jpeglib.h>
+#endif
+
+/*
+ * Header-only probing of encoded images
+ *
+ * The probe functions return 1 if the properties are found, 0 if the data is not
+ * a supported format (or broken), and -1 if more data is needed.
+ */
+unsigned int
+read_be16(const uchar* p)
+{
+  return (p[0] << 8) | p[1];
+}
+
+unsigned int
+read_be32(const uchar* p)
+{
+  return ((unsigned int)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+unsigned int
+read_le16(const uchar* p)
+{
+  return p[0] | (p[1] << 8);
+}
+
+unsigned int
+read_le32(const uchar* p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+int
+probe_jpeg(const uchar* data, size_t size, rb_cvImageInfo* info)
+{
+  size_t pos = 2;
+  while (true) {
+    if (pos >= size)
+      return -1;
+    if (data[pos] != 0xFF)
+      return 0;
+    while (pos < size && data[pos] == 0xFF) // fill bytes
+      pos++;
+    if (pos >= size)
+      return -1;
+    int marker = data[pos++];
+    if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD8)) // markers without length
+      continue;
+    if (marker == 0xD9 || marker == 0xDA) // EOI or SOS before SOF
+      return 0;
+    if (pos + 2 > size)
+      return -1;
+    size_t length = read_be16(data + pos);
+    if (length < 2)
+      return 0;
+    if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+      if (pos + 8 > size)
+	return -1;
+      info->height = read_be16(data + pos + 3);
+      info->width = read_be16(data + pos + 5);
+      info->channels = data[pos + 7];
+      info->format = "jpeg";
+      return 1;
+    }
+    pos += length;
+  }
+}
+
+int
+probe_png(const uchar* data, size_t size, rb_cvImageInfo* info)
+{
+  if (size < 26)
+    return -1;
+  if (memcmp(data + 12, "IHDR", 4) != 0)
+    return 0;
+  info->width = read_be32(data + 16);
+  info->height = read_be32(data + 20);
+  switch (data[25]) { // color type
+  case 0: info->channels = 1; break;
+  case 4: info->channels = 2; break;
+  case 6: info->channels = 4; break;
+  default: info->channels = 3; break; // RGB or palette
+  }
+  info->format = "png";
+  return 1;
+}
+
+int
+probe_bmp(const uchar* data, size_t size, rb_cvImageInfo* info)
+{
+  if (size < 18)
+    return -1;
+  unsigned int header_size = read_le32(data + 14);
+  int bpp;
+  if (header_size == 12) { // OS/2 BITMAPCOREHEADER
+    if (size < 26)
+      return -1;
+    info->width = read_le16(data + 18);
+    info->height = read_le16(data + 20);
+    bpp = read_le16(data + 24);
+  }
+  else {
+    if (size < 30)
+      return -1;
+    info->width = (int)read_le32(data + 18);
+    info->height = abs((int)read_le32(data + 22)); // negative for top-down bitmaps
+    bpp = read_le16(data + 28);
+  }
+  info->channels = (bpp == 32) ? 4 : 3;
+  info->format = "bmp";
+  return 1;
+}
+
+int
+probe_pnm(const uchar* data, size_t size, rb_cvImageInfo* info)
+{
+  int values[2];
+  size_t pos = 2;
+  for (int i = 0; i < 2; i++) {
+    while (true) { // skip whitespaces and comments
+      if (pos >= size)
+	return -1;
+      if (data[pos] == '#') {
+	while (pos < size && data[pos] != '\n')
+	  pos++;
+      }
+      else if (isspace(data[pos]))
+	pos++;
+      else
+	break;
+    }
+    if (!isdigit(data[pos]))
+      return 0;
+    int value = 0;
+    while (pos < size && isdigit(data[pos])) {
+      int digit = data[pos++] - '0';
+      if (value > (INT_MAX - digit) / 10) // corrupt
+	return 0;
+      value = value * 10 + digit;
+    }
+    if (pos >= size)
+      return -1;
+    values[i] = value;
+  }
+  info->width = values[0];
+  info->height = values[1];
+  info->channels = (data[1] == '3' || data[1] == '6') ? 3 : 1;
+  info->format = "pnm";
+  return 1;
+}
+
+int
+probe_tiff(const uchar* data, size_t size, rb_cvImageInfo* info)
+{
+  bool le = (data[0] == 'I');
+  unsigned int (*read16)(const uchar*) = le ? read_le16 : read_be16;
+  unsigned int (*read32)(const uchar*) = le ? read_le32 : read_be32;
+  if (size < 8)
+    return -1;
+  size_t ifd = read32(data + 4);
+  if (ifd + 2 > size)
+    return -1;
+  size_t count = read16(data + ifd);
+  if (ifd + 2 + count * 12 > size)
+    return -1;
+  int width = -1, height = -1, channels = 1;
+  for (size_t i = 0; i < count; i++) {
+    const uchar* entry = data + ifd + 2 + i * 12;
+    unsigned int tag = read16(entry);
+    unsigned int type = read16(entry + 2);
+    int value = (type == 3) ? (int)read16(entry + 8) : (int)read32(entry + 8); // SHORT or LONG
+    if (tag == 256)
+      width = value;
+    else if (tag == 257)
+      height = value;
+    else if (tag == 277)
+      channels = value;
+  }
+  if (width < 0 || height < 0)
+    return 0;
+  info->width = width;
+  info->height = height;
+  info->channels = channels;
+  info->format = "tiff";
+  return 1;
+}
+
+/*
+ * Reads width, height, number of channels and format from the header of an encoded image
+ * (JPEG, PNG, BMP, PNM or TIFF) without decoding the pixels.
+ * Returns 1 if found, 0 if data is not a supported format, -1 if data is truncated.
+ */
+int
+rb_cvProbeImage(const uchar* data, size_t size, rb_cvImageInfo* info)
+{
+  if (size < 4)
+    return -1;
+  if (data[0] == 0xFF && data[1] == 0xD8)
+    return probe_jpeg(data, size, info);
+  if (memcmp(data, "\x89PNG", 4) == 0)
+    return probe_png(data, size, info);
+  if (data[0] == 'B' && data[1] == 'M')
+    return probe_bmp(data, size, info);
+  if (data[0] == 'P' && data[1] >= '1' && data[1] <= '6')
+    return probe_pnm(data, size, info);
+  if (memcmp(data, "II*\0", 4) == 0 || memcmp(data, "MM\0*", 4) == 0)
+    return probe_tiff(data, size, info);
+  return 0;
+}
+
+/*
+ * Same as rb_cvProbeImage() for a file. Reads only the head of the file, as much as needed.
+ * Returns 1 if found, 0 if the file is not a supported format, -1 if the file can not be opened.
+ */
+int
+rb_cvProbeImageFile(const char* filename, rb_cvImageInfo* info)
+{
+  FILE* file = fopen(filename, "rb");
+  if (file == NULL)
+    return -1;
+  std::vector<uchar> buffer;
+  size_t length = 0;
+  int result = -1;
+  for (size_t capacity = 4096; result < 0; capacity *= 4) {
+    buffer.resize(capacity);
+    size_t read = fread(&buffer[length], 1, capacity - length, file);
+    length += read;
+    result = rb_cvProbeImage(&buffer[0], length, info);
+    if (result < 0 && length < capacity) { // reached the end of the file
+      result = 0;
+    }
+  }
+  fclose(file);
+  return result;
+}
+
+/*
+ * Size of the image decoded at 1/reduce scale (same as the DCT scaling of libjpeg)
+ */
+CvSize
+rb_cvReducedSize(CvSize size, int reduce)
+{
+  return cvSize((size.width + reduce - 1) / reduce, (size.height + reduce - 1) / reduce);
+}
+
+#ifdef RUBY_OPENCV_USE_LIBJPEG
+typedef struct {
+  struct jpeg_error_mgr pub;
+  jmp_buf jump;
+} jpeg_error_handler_t;
+
+void
+jpeg_error_exit(j_common_ptr cinfo)
+{
+  longjmp(((jpeg_error_handler_t*)cinfo->err)->jump, 1);
+}
+
+void
+jpeg_output_message(j_common_ptr)
+{
+  // Suppress warnings of libjpeg
+}
+
+/*
+ * Decodes a JPEG image at 1/reduce scale with the DCT scaling of libjpeg, which skips
+ * most of the work of the full decoding. The source is data (size bytes) or file.
+ * Returns NULL if the image is not supported (e.g. CMYK) or broken.
+ */
+CvMat*
+decode_jpeg_reduced(const uchar* data, size_t size, FILE* file, int iscolor, int reduce)
+{
+  struct jpeg_decompress_struct cinfo;
+  jpeg_error_handler_t error;
+  CvMat* volatile mat = NULL;
+
+  cinfo.err = jpeg_std_error(&error.pub);
+  error.pub.error_exit = jpeg_error_exit;
+  error.pub.output_message = jpeg_output_message;
+  if (setjmp(error.jump)) {
+    jpeg_destroy_decompress(&cinfo);
+    if (mat != NULL) {
+      CvMat* ptr = mat;
+      cvReleaseMat(&ptr);
+    }
+    return NULL;
+  }
+  jpeg_create_decompress(&cinfo);
+  if (file != NULL)
+    jpeg_stdio_src(&cinfo, file);
+  else
+    jpeg_mem_src(&cinfo, (unsigned char*)data, size);
+  jpeg_read_header(&cinfo, TRUE);
+  if (cinfo.num_components != 1 && cinfo.num_components != 3) {
+    jpeg_destroy_decompress(&cinfo);
+    return NULL;
+  }
+
+  bool keep_color = (iscolor < 0) || (iscolor & CV_LOAD_IMAGE_ANYCOLOR) != 0;
+  int channels = (keep_color ? cinfo.num_components == 3 : iscolor > 0) ? 3 : 1;
+  cinfo.out_color_space = (channels == 3) ? JCS_RGB : JCS_GRAYSCALE;
+  cinfo.scale_num = 1;
+  cinfo.scale_denom = reduce;
+  jpeg_start_decompress(&cinfo);
+  try {
+    mat = cvCreateMat(cinfo.output_height, cinfo.output_width, CV_8UC(channels));
+  }
+  catch (...) {
+    jpeg_destroy_decompress(&cinfo);
+    throw;
+  }
+  while (cinfo.output_scanline < cinfo.output_height) {
+    JSAMPROW row = mat->data.ptr + mat->step * cinfo.output_scanline;
+    jpeg_read_scanlines(&cinfo, &row, 1);
+    if (channels == 3) { // RGB to BGR
+      for (uchar* p = row; p < row + mat->cols * 3; p += 3) {
+	uchar r = p[0];
+	p[0] = p[2];
+	p[2] = r;
+      }
+    }
+  }
+  jpeg_finish_decompress(&cinfo);
+  jpeg_destroy_decompress(&cinfo);
+  return mat;
+}
+#endif
+
+/*
+ * Shrinks image (CvMat) to 1/reduce scale with CV_INTER_AREA, and releases image.
+ */
+CvMat*
+reduce_decoded_image(CvMat* image, int reduce)
+{
+  CvMat* reduced = NULL;
+  try {
+    CvSize size = rb_cvReducedSize(cvGetSize(image), reduce);
+    reduced = cvCreateMat(size.height, size.width, CV_MAT_TYPE(image->type));
+    cvResize(image, reduced, CV_INTER_AREA);
+  }
+  catch (...) {
+    if (reduced != NULL)
+      cvReleaseMat(&reduced);
+    cvReleaseMat(&image);
+    throw;
+  }
+  cvReleaseMat(&image);
+  return reduced;
+}
+
+/*
+ * Decodes an image from buf (1xN CV_8UC1) at 1/reduce scale (reduce = 1, 2, 4 or 8).
+ * JPEG images are scaled down while decoding when built with libjpeg (--enable-libjpeg);
+ * other images, and JPEG images libjpeg fails to decode (e.g. with a libjpeg of another
+ * version than the headers), are decoded at full size and shrunk with CV_INTER_AREA.
+ * Returns NULL if the image can not be decoded. Does not call Ruby's API.
+ */
+CvMat*
+rb_cvDecodeImageMReduced(const CvMat* buf, int iscolor, int reduce)
+{
+#ifdef RUBY_OPENCV_USE_LIBJPEG
+  if (reduce > 1 && buf->cols > 2 && buf->data.ptr[0] == 0xFF && buf->data.ptr[1] == 0xD8) {
+    CvMat* mat = decode_jpeg_reduced(buf->data.ptr, buf->cols * buf->rows, NULL, iscolor, reduce);
+    if (mat != NULL)
+      return mat;
+  }
+#endif
+  CvMat* mat = cvDecodeImageM(buf, iscolor);
+  if (mat == NULL || reduce <= 1)
+    return mat;
+  return reduce_decoded_image(mat, reduce);
+}
+
+/*
+ * Same as rb_cvDecodeImageMReduced() for a file
+ */
+CvMat*
+rb_cvLoadImageMReduced(const char* filename, int iscolor, int reduce)
+{
+#ifdef RUBY_OPENCV_USE_LIBJPEG
+  if (reduce > 1) {
+    FILE* file = fopen(filename, "rb");
+    if (file != NULL) {
+      CvMat* mat = NULL;
+      if (fgetc(file) == 0xFF && fgetc(file) == 0xD8) {
+	rewind(file);
+	try {
+	  mat = decode_jpeg_reduced(NULL, 0, file, iscolor, reduce);
+	}
+	catch (...) {
+	  fclose(file);
+	  throw;
+	}
+      }
+      fclose(file);
+      if (mat != NULL)
+	return mat;
+    }
+  }
+#endif
+  CvMat* mat = cvLoadImageM(filename, iscolor);
+  if (mat == NULL || reduce <= 1)
+    return mat;
+  return reduce_decoded_image(mat, reduce);
+}
+
+/*
+ * Copies mat into a new IplImage, and releases mat
+ */
+IplImage*
+mat_to_image(CvMat* mat)
+{
+  if (mat == NULL)
+    return NULL;
+  IplImage* image = NULL;
+  try {
+    image = cvCreateImage(cvGetSize(mat), cvIplDepth(mat->type), CV_MAT_CN(mat->type));
+    cvCopy(mat, image);
+  }
+  catch (...) {
+    if (image != NULL)
+      cvReleaseImage(&image);
+    cvReleaseMat(&mat);
+    throw;
+  }
+  cvReleaseMat(&mat);
+  return image;
+}
+
+/*
+ * Same as rb_cvDecodeImageMReduced(), but returns an IplImage
+ */
+IplImage*
+rb_cvDecodeImageReduced(const CvMat* buf, int iscolor, int reduce)
+{
+  if (reduce <= 1)
+    return cvDecodeImage(buf, iscolor);
+  return mat_to_image(rb_cvDecodeImageMReduced(buf, iscolor, reduce));
+}
+
+/*
+ * Same as rb_cvLoadImageMReduced(), but returns an IplImage
+ */
+IplImage*
+rb_cvLoadImageReduced(const char* filename, int iscolor, int reduce)
+{
+  if (reduce <= 1)
+    return cvLoadImage(filename, iscolor);
+  return mat_to_image(rb_cvLoadImageMReduced(filename, iscolor, reduce));
+}
+
+/*
+ * Size of a thumbnail of an image of the given size before cropping.
+ * Images are never enlarged.
+ */
+CvSize
+thumbnail_scaled_size(CvSize size, const rb_cvThumbnailBox& box)
+{
+  double sx = (double)box.width / size.width;
+  double sy = (double)box.height / size.height;
+  double scale = (box.mode == RB_CV_THUMBNAIL_FIT) ? MIN(sx, sy) : MAX(sx, sy);
+  if (scale >= 1.0)
+    return size;
+  return cvSize(MAX(cvRound(size.width * scale), 1), MAX(cvRound(size.height * scale), 1));
+}
+
+/*
+ * Decodes buf (1xN CV_8UC1) once and encodes a thumbnail for each of boxes with
+ * cvEncodeImage(ext, thumbnail, params), storing the 1xN CV_8UC1 results in results[0..count-1].
+ *
+ * JPEG images are decoded at the smallest reduced resolution that still covers the largest
+ * thumbnail, and each thumbnail is resized from the smallest larger one already made.
+ * On error, nothing is left allocated and cv::Exception is thrown. Does not call Ruby's API.
+ */
+void
+rb_cvEncodeThumbnails(const CvMat* buf, const rb_cvThumbnailBox* boxes, int count,
+		      const char* ext, const int* params, CvMat** results)
+{
+  if (count <= 0)
+    return;
+  for (int i = 0; i < count; i++)
+    results[i] = NULL;
+
+  int reduce = 1;
+#ifdef RUBY_OPENCV_USE_LIBJPEG
+  rb_cvImageInfo info;
+  if (rb_cvProbeImage(buf->data.ptr, buf->rows * buf->cols, &info) == 1 && strcmp(info.format, "jpeg") == 0) {
+    CvSize full = cvSize(info.width, info.height);
+    for (reduce = 8; reduce > 1; reduce /= 2) {
+      CvSize reduced = rb_cvReducedSize(full, reduce);
+      bool covered = true;
+      for (int i = 0; i < count && covered; i++) {
+	CvSize size = thumbnail_scaled_size(full, boxes[i]);
+	covered = (reduced.width >= size.width && reduced.height >= size.height);
+      }
+      if (covered)
+	break;
+    }
+  }
+#endif
+
+  CvMat* image = NULL;
+  std::vector<CvMat*> scaled(count, (CvMat*)NULL);
+  try {
+    image = rb_cvDecodeImageMReduced(buf, CV_LOAD_IMAGE_COLOR, reduce);
+    if (image == NULL)
+      CV_Error(CV_StsBadArg, "Could not decode image");
+
+    // Make the thumbnails from the largest to the smallest
+    std::vector<int> order(count);
+    std::vector<CvSize> sizes(count);
+    for (int i = 0; i < count; i++) {
+      order[i] = i;
+      sizes[i] = thumbnail_scaled_size(cvGetSize(image), boxes[i]);
+    }
+    for (int i = 1; i < count; i++) {
+      for (int j = i; j > 0 && (double)sizes[order[j]].width * sizes[order[j]].height >
+	     (double)sizes[order[j - 1]].width * sizes[order[j - 1]].height; j--) {
+	int tmp = order[j];
+	order[j] = order[j - 1];
+	order[j - 1] = tmp;
+      }
+    }
+
+    for (int n = 0; n < count; n++) {
+      const int i = order[n];
+      const CvSize size = sizes[i];
+      CvMat* src = image;
+      for (int m = n - 1; m >= 0; m--) {
+	CvMat* prev = scaled[order[m]];
+	if (prev->cols >= size.width && prev->rows >= size.height) {
+	  src = prev;
+	  break;
+	}
+      }
+      scaled[i] = cvCreateMat(size.height, size.width, CV_MAT_TYPE(image->type));
+      if (src->cols == size.width && src->rows == size.height)
+	cvCopy(src, scaled[i]);
+      else
+	cvResize(src, scaled[i], CV_INTER_AREA);
+
+      CvMat roi;
+      CvMat* thumbnail = scaled[i];
+      if (boxes[i].mode == RB_CV_THUMBNAIL_CROP) {
+	int width = MIN(size.width, boxes[i].width);
+	int height = MIN(size.height, boxes[i].height);
+	thumbnail = cvGetSubRect(scaled[i], &roi, cvRect((size.width - width) / 2, (size.height - height) / 2,
+							 width, height));
+      }
+      results[i] = cvEncodeImage(ext, thumbnail, params);
+    }
+  }
+  catch (...) {
+    for (int i = 0; i < count; i++) {
+      if (results[i] != NULL)
+	cvReleaseMat(&results[i]);
+      if (scaled[i] != NULL)
+	cvReleaseMat(&scaled[i]);
+    }
+    if (image != NULL)
+      cvReleaseMat(&image);
+    throw;
+  }
+  for (int i = 0; i < count; i++)
+    cvReleaseMat(&scaled[i]);
+  cvReleaseMat(&image);
+}
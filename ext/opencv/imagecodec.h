@@ -0,0 +1,59 @@
+/************************************************************
+
+    imagecodec.h -
+
+    $Author: ser1zw $
+
+    Copyright (C) 2013 ser1zw
+
+************************************************************/
+#ifndef RUBY_OPENCV_IMAGECODEC_H
+#define RUBY_OPENCV_IMAGECODEC_H
+
+#include "opencv2/core/core_c.h"
+#include "opencv2/core/core.hpp"
+#include "opencv2/imgproc/imgproc_c.h"
+#include "opencv2/highgui/highgui_c.h"
+
+#if defined(HAVE_JPEGLIB_H) && defined(HAVE_JPEG_MEM_SRC)
+#define RUBY_OPENCV_USE_LIBJPEG
+#endif
+
+/*
+ * Image properties read from the header of an encoded image
+ */
+typedef struct {
+  int width;
+  int height;
+  int channels;
+  const char* format; // "jpeg", "png", "bmp", "pnm" or "tiff"
+} rb_cvImageInfo;
+
+int rb_cvProbeImage(const uchar* data, size_t size, rb_cvImageInfo* info);
+int rb_cvProbeImageFile(const char* filename, rb_cvImageInfo* info);
+
+CvSize rb_cvReducedSize(CvSize size, int reduce);
+CvMat* rb_cvDecodeImageMReduced(const CvMat* buf, int iscolor, int reduce);
+CvMat* rb_cvLoadImageMReduced(const char* filename, int iscolor, int reduce);
+IplImage* rb_cvDecodeImageReduced(const CvMat* buf, int iscolor, int reduce);
+IplImage* rb_cvLoadImageReduced(const char* filename, int iscolor, int reduce);
+
+/*
+ * Target box of a thumbnail
+ */
+enum {
+  RB_CV_THUMBNAIL_FIT = 0, // fit inside the box, keeping the aspect ratio
+  RB_CV_THUMBNAIL_FILL = 1, // cover the box, keeping the aspect ratio
+  RB_CV_THUMBNAIL_CROP = 2 // cover the box, and crop the center to the box size
+};
+
+typedef struct {
+  int width;
+  int height;
+  int mode; // RB_CV_THUMBNAIL_*
+} rb_cvThumbnailBox;
+
+void rb_cvEncodeThumbnails(const CvMat* buf, const rb_cvThumbnailBox* boxes, int count,
+			   const char* ext, const int* params, CvMat** results);
+
+#endif // RUBY_OPENCV_IMAGECODEC_H
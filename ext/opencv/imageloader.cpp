@@ -0,0 +1,480 @@
+/************************************************************
+
+   imageloader.cpp -
+
+   $Author: ser1zw $
+
+   Copyright (C) 2013 ser1zw
+
+************************************************************/
+#include "imageloader.h"
+/*
+ * Document-class: OpenCV::ImageLoader
+ *
+ * Loads many image files in parallel. The files are decoded by a pool of native threads
+ * without the GVL, a bounded number of images ahead of the one being passed to Ruby,
+ * and passed to Ruby in the order of the paths.
+ *
+ * @example
+ *   loader = ImageLoader.new('dataset/', glob: '*.jpg', grayscale: true, threads: 4)
+ *   loader.each { |image, path|
+ *     next if image.is_a?(Exception) # unreadable file
+ *     images << image
+ *     labels << File.basename(path).to_i
+ *   }
+ */
+__NAMESPACE_BEGIN_OPENCV
+__NAMESPACE_BEGIN_IMAGELOADER
+
+VALUE rb_klass;
+ID id_image_class;
+
+VALUE
+rb_class()
+{
+  return rb_klass;
+}
+
+void
+imageloader_free(void *ptr)
+{
+  if (ptr) {
+    sImageLoader* loader = (sImageLoader*)ptr;
+    stop_workers(loader);
+    delete loader;
+  }
+}
+
+size_t
+imageloader_memsize(const void *ptr)
+{
+  const sImageLoader* loader = (const sImageLoader*)ptr;
+  size_t size = sizeof(sImageLoader);
+  for (size_t i = 0; i < loader->paths.size(); i++)
+    size += sizeof(std::string) + loader->paths[i].capacity();
+  return size + loader->slots.capacity() * sizeof(image_loader_slot_t);
+}
+
+const rb_data_type_t data_type = {
+  "OpenCV::ImageLoader",
+  { 0, imageloader_free, imageloader_memsize, },
+  &opencv_data_type, 0, RUBY_TYPED_FREE_IMMEDIATELY | RUBY_TYPED_WB_PROTECTED
+};
+
+VALUE
+rb_allocate(VALUE klass)
+{
+  sImageLoader* loader = new sImageLoader();
+  loader->iscolor = CV_LOAD_IMAGE_COLOR;
+  loader->reduce = 1;
+  loader->ipl = false;
+  loader->threads = 1;
+  loader->queue_size = 2;
+  loader->next_decode = 0;
+  loader->next_yield = 0;
+  loader->stop = false;
+  loader->interrupted = false;
+  loader->running = false;
+  return TypedData_Wrap_Struct(klass, &data_type, loader);
+}
+
+/*
+ * Creates a loader of image files
+ *
+ * @overload new(source, options = nil)
+ *   @param source [Array<String>, String] Paths of the image files, or a directory
+ *   @param options [Hash] Options
+ *   @option options [String] :glob ('*') Pattern of the files in the directory
+ *   @option options [Integer] :iscolor (CV_LOAD_IMAGE_COLOR) Color type of the loaded images (see CvMat.load)
+ *   @option options [Boolean] :grayscale (false) Same as <tt>iscolor: CV_LOAD_IMAGE_GRAYSCALE</tt>
+ *   @option options [Integer] :reduce (1) Reduces the width and height of the loaded images to 1/2, 1/4 or 1/8
+ *     (see CvMat.load)
+ *   @option options [Integer] :threads (number of CPUs) Number of decoder threads
+ *   @option options [Integer] :queue (2 * threads) Maximum number of images decoded ahead
+ *   @option options [Class] :image_class (CvMat) Class of the loaded images (CvMat, IplImage or their subclass)
+ * @return [ImageLoader] Loader
+ */
+VALUE
+rb_initialize(int argc, VALUE *argv, VALUE self)
+{
+  VALUE source, options;
+  rb_scan_args(argc, argv, "11", &source, &options);
+  sImageLoader* loader = IMAGELOADER(self);
+  if (loader->running)
+    rb_raise(rb_eRuntimeError, "can't reinitialize a running loader");
+
+  VALUE glob = Qnil, iscolor = Qnil, grayscale = Qnil, reduce = Qnil;
+  VALUE threads = Qnil, queue_size = Qnil, image_class = Qnil;
+  if (!NIL_P(options)) {
+    Check_Type(options, T_HASH);
+    glob = LOOKUP_HASH(options, "glob");
+    iscolor = LOOKUP_HASH(options, "iscolor");
+    grayscale = LOOKUP_HASH(options, "grayscale");
+    reduce = LOOKUP_HASH(options, "reduce");
+    threads = LOOKUP_HASH(options, "threads");
+    queue_size = LOOKUP_HASH(options, "queue");
+    image_class = LOOKUP_HASH(options, "image_class");
+  }
+
+  VALUE paths = source;
+  if (TYPE(source) == T_STRING) {
+    if (!RTEST(rb_funcall(rb_cFile, rb_intern("directory?"), 1, source)))
+      rb_raise(rb_eArgError, "%s is not a directory", StringValueCStr(source));
+    VALUE pattern = rb_funcall(rb_cFile, rb_intern("join"), 2, source, NIL_P(glob) ? rb_str_new2("*") : glob);
+    VALUE entries = rb_funcall(rb_funcall(rb_cDir, rb_intern("glob"), 1, pattern), rb_intern("sort"), 0);
+    paths = rb_ary_new();
+    for (long i = 0; i < RARRAY_LEN(entries); i++) {
+      VALUE entry = rb_ary_entry(entries, i);
+      if (RTEST(rb_funcall(rb_cFile, rb_intern("file?"), 1, entry)))
+	rb_ary_push(paths, entry);
+    }
+  }
+  Check_Type(paths, T_ARRAY);
+
+  int _iscolor = RTEST(grayscale) ? CV_LOAD_IMAGE_GRAYSCALE : IF_INT(iscolor, CV_LOAD_IMAGE_COLOR);
+  int _reduce = cCvMat::reduce_value(reduce);
+  int _threads = NIL_P(threads) ? rb_cvDefaultThreadCount() : NUM2INT(threads);
+  if (_threads < 1)
+    rb_raise(rb_eArgError, "threads should be positive");
+  int _queue_size = NIL_P(queue_size) ? _threads * 2 : NUM2INT(queue_size);
+  if (_queue_size < 1)
+    rb_raise(rb_eArgError, "queue should be positive");
+  bool ipl = false;
+  if (!NIL_P(image_class)) {
+    if (RTEST(rb_class_inherited_p(image_class, cIplImage::rb_class())))
+      ipl = true;
+    else if (!RTEST(rb_class_inherited_p(image_class, cCvMat::rb_class())))
+      rb_raise(rb_eArgError, "image_class should be CvMat or IplImage");
+  }
+
+  std::vector<std::string> path_list;
+  for (long i = 0; i < RARRAY_LEN(paths); i++) {
+    VALUE path = rb_ary_entry(paths, i);
+    Check_Type(path, T_STRING);
+    path_list.push_back(StringValueCStr(path));
+  }
+  loader->paths.swap(path_list);
+  loader->iscolor = _iscolor;
+  loader->reduce = _reduce;
+  loader->threads = _threads;
+  loader->queue_size = _queue_size;
+  loader->ipl = ipl;
+  rb_ivar_set(self, id_image_class, NIL_P(image_class) ? cCvMat::rb_class() : image_class);
+  return self;
+}
+
+/*
+ * Creates a loader for CvMat.load_images and IplImage.load_images
+ */
+VALUE
+new_loader(VALUE source, VALUE options, VALUE image_class)
+{
+  if (NIL_P(options))
+    options = rb_hash_new();
+  else {
+    Check_Type(options, T_HASH);
+    options = rb_hash_dup(options);
+  }
+  rb_hash_aset(options, ID2SYM(rb_intern("image_class")), image_class);
+  VALUE args[] = { source, options };
+  return rb_class_new_instance(2, args, rb_klass);
+}
+
+/*
+ * Returns the paths of the image files
+ *
+ * @overload paths
+ * @return [Array<String>] Paths
+ */
+VALUE
+rb_paths(VALUE self)
+{
+  sImageLoader* loader = IMAGELOADER(self);
+  VALUE paths = rb_ary_new2(loader->paths.size());
+  for (size_t i = 0; i < loader->paths.size(); i++)
+    rb_ary_push(paths, rb_str_new2(loader->paths[i].c_str()));
+  return paths;
+}
+
+/*
+ * Returns the number of the image files
+ *
+ * @overload size
+ * @return [Integer] Number of the files
+ */
+VALUE
+rb_size(VALUE self)
+{
+  return SIZET2NUM(IMAGELOADER(self)->paths.size());
+}
+
+void
+release_image(void* image, bool ipl)
+{
+  if (image == NULL)
+    return;
+  if (ipl) {
+    IplImage* ptr = (IplImage*)image;
+    cvReleaseImage(&ptr);
+  }
+  else {
+    CvMat* ptr = (CvMat*)image;
+    cvReleaseMat(&ptr);
+  }
+}
+
+/*
+ * Loads an image file. Returns NULL if the file can not be read.
+ * Does not call any Ruby API, so it can be called without the GVL.
+ */
+void*
+decode_image(const char* path, int iscolor, int reduce, bool ipl)
+{
+  if (ipl)
+    return rb_cvLoadImageReduced(path, iscolor, reduce);
+  return rb_cvLoadImageMReduced(path, iscolor, reduce);
+}
+
+void
+decode_worker(sImageLoader* loader)
+{
+  size_t n = loader->paths.size();
+  std::unique_lock<std::mutex> lock(loader->mutex);
+  while (true) {
+    loader->cond.wait(lock, [&] {
+	return loader->stop || loader->next_decode >= n ||
+	  loader->next_decode < loader->next_yield + loader->queue_size;
+      });
+    if (loader->stop || loader->next_decode >= n)
+      break;
+    size_t i = loader->next_decode++;
+    lock.unlock();
+
+    image_loader_slot_t slot;
+    slot.image = NULL;
+    slot.done = true;
+    slot.failed = false;
+    try {
+      slot.image = decode_image(loader->paths[i].c_str(), loader->iscolor, loader->reduce, loader->ipl);
+      slot.failed = (slot.image == NULL);
+    }
+    catch (cv::Exception& e) {
+      slot.failed = true;
+      slot.error = e;
+    }
+    catch (std::bad_alloc&) {
+      slot.failed = true;
+      slot.error = cv::Exception(CV_StsNoMem, "Failed to allocate memory", "ImageLoader#each", __FILE__, __LINE__);
+    }
+
+    lock.lock();
+    loader->slots[i] = slot;
+    loader->cond.notify_all();
+  }
+}
+
+/*
+ * Starts the decoder threads. Returns false if no thread can be created.
+ */
+bool
+start_workers(sImageLoader* loader)
+{
+  image_loader_slot_t empty;
+  empty.image = NULL;
+  empty.done = false;
+  empty.failed = false;
+  loader->slots.assign(loader->paths.size(), empty);
+  loader->next_decode = 0;
+  loader->next_yield = 0;
+  loader->stop = false;
+  loader->interrupted = false;
+  int threads = std::min((size_t)loader->threads, loader->paths.size());
+  for (int i = 0; i < threads; i++) {
+    try {
+      loader->workers.push_back(std::thread(decode_worker, loader));
+    }
+    catch (std::system_error&) {
+      break; // run with the threads created so far
+    }
+  }
+  return !loader->workers.empty() || threads == 0;
+}
+
+/*
+ * Stops and joins the decoder threads, and releases the images not passed to Ruby
+ */
+void
+stop_workers(sImageLoader* loader)
+{
+  {
+    std::lock_guard<std::mutex> lock(loader->mutex);
+    loader->stop = true;
+  }
+  loader->cond.notify_all();
+  for (size_t i = 0; i < loader->workers.size(); i++)
+    loader->workers[i].join();
+  loader->workers.clear();
+  for (size_t i = 0; i < loader->slots.size(); i++)
+    release_image(loader->slots[i].image, loader->ipl);
+  loader->slots.clear();
+}
+
+/*
+ * Waits until the image of the index is decoded, or the waiting thread is interrupted
+ */
+void*
+wait_slot(void* arg)
+{
+  image_loader_each_t* each = (image_loader_each_t*)arg;
+  sImageLoader* loader = each->loader;
+  std::unique_lock<std::mutex> lock(loader->mutex);
+  loader->cond.wait(lock, [&] { return loader->slots[each->index].done || loader->interrupted; });
+  loader->interrupted = false;
+  return NULL;
+}
+
+void
+interrupt_wait(void* arg)
+{
+  sImageLoader* loader = ((image_loader_each_t*)arg)->loader;
+  {
+    std::lock_guard<std::mutex> lock(loader->mutex);
+    loader->interrupted = true;
+  }
+  loader->cond.notify_all();
+}
+
+VALUE
+each_image(VALUE arg)
+{
+  image_loader_each_t* each = (image_loader_each_t*)arg;
+  sImageLoader* loader = each->loader;
+  VALUE image_class = rb_attr_get(each->self, id_image_class);
+  for (size_t i = 0; i < loader->paths.size(); i++) {
+    each->index = i;
+    while (true) {
+#ifdef HAVE_RUBY_THREAD_H
+      rb_thread_call_without_gvl(wait_slot, each, interrupt_wait, each);
+#else
+      wait_slot(each);
+#endif
+      bool done;
+      {
+	std::lock_guard<std::mutex> lock(loader->mutex);
+	done = loader->slots[i].done;
+      }
+      if (done)
+	break;
+      rb_thread_check_ints();
+    }
+
+    image_loader_slot_t slot;
+    {
+      std::lock_guard<std::mutex> lock(loader->mutex);
+      slot = loader->slots[i];
+      loader->slots[i].image = NULL;
+      loader->next_yield = i + 1;
+    }
+    loader->cond.notify_all();
+
+    VALUE image;
+    if (!slot.failed)
+      image = OPENCV_OBJECT(image_class, slot.image);
+    else if (slot.error.code != 0)
+      image = cCvError::exception(slot.error);
+    else
+      image = rb_exc_new2(rb_eStandardError, "file does not exist or invalid format image.");
+    if (NIL_P(each->result))
+      rb_yield_values(2, image, rb_str_new2(loader->paths[i].c_str()));
+    else
+      rb_ary_push(each->result, image);
+  }
+  return each->self;
+}
+
+VALUE
+finish_each(VALUE arg)
+{
+  sImageLoader* loader = ((image_loader_each_t*)arg)->loader;
+  rb_cvCallWithoutGVL([&] { stop_workers(loader); });
+  loader->running = false;
+  return Qnil;
+}
+
+/*
+ * Loads the images, and yields them or collects them into result
+ */
+VALUE
+run_each(VALUE self, VALUE result)
+{
+  sImageLoader* loader = IMAGELOADER(self);
+  if (loader->running)
+    rb_raise(rb_eRuntimeError, "the loader is already running");
+  if (!start_workers(loader)) {
+    loader->slots.clear();
+    rb_raise(rb_eRuntimeError, "failed to create a decoder thread");
+  }
+  loader->running = true;
+  image_loader_each_t each = { self, result, loader, 0 };
+  rb_ensure(each_image, (VALUE)&each, finish_each, (VALUE)&each);
+  return NIL_P(result) ? self : result;
+}
+
+/*
+ * Loads the image files in parallel, and yields the images in the order of the paths.
+ * A file that can not be loaded is yielded as an exception (<tt>StandardError</tt> or <tt>CvError</tt>)
+ * in place of its image.
+ *
+ * @overload each { |image, path| ... }
+ *   @yieldparam image [CvMat, IplImage, StandardError] Loaded image
+ *   @yieldparam path [String] Path of the file
+ * @return [ImageLoader] <tt>self</tt>
+ */
+VALUE
+rb_each(VALUE self)
+{
+  RETURN_ENUMERATOR(self, 0, 0);
+  return run_each(self, Qnil);
+}
+
+/*
+ * Loads the image files in parallel
+ *
+ * @overload images
+ * @return [Array<CvMat, IplImage, StandardError>] Loaded images (or errors) in the order of the paths
+ */
+VALUE
+rb_images(VALUE self)
+{
+  return run_each(self, rb_ary_new2(IMAGELOADER(self)->paths.size()));
+}
+
+void
+init_ruby_class()
+{
+#if 0
+  // For documentation using YARD
+  VALUE opencv = rb_define_module("OpenCV");
+#endif
+
+  if (rb_klass)
+    return;
+  id_image_class = rb_intern("__image_class__");
+  /*
+   * opencv = rb_define_module("OpenCV");
+   *
+   * note: this comment is used by rdoc.
+   */
+  VALUE opencv = rb_module_opencv();
+  rb_klass = rb_define_class_under(opencv, "ImageLoader", rb_cObject);
+  rb_include_module(rb_klass, rb_mEnumerable);
+  rb_define_alloc_func(rb_klass, rb_allocate);
+  rb_define_private_method(rb_klass, "initialize", RUBY_METHOD_FUNC(rb_initialize), -1);
+  rb_define_method(rb_klass, "paths", RUBY_METHOD_FUNC(rb_paths), 0);
+  rb_define_method(rb_klass, "size", RUBY_METHOD_FUNC(rb_size), 0);
+  rb_define_method(rb_klass, "each", RUBY_METHOD_FUNC(rb_each), 0);
+  rb_define_method(rb_klass, "images", RUBY_METHOD_FUNC(rb_images), 0);
+}
+
+__NAMESPACE_END_IMAGELOADER
+__NAMESPACE_END_OPENCV
@@ -0,0 +1,103 @@
+/************************************************************
+
+   imageloader.h -
+
+   $Author: ser1zw $
+
+   Copyright (C) 2013 ser1zw
+
+************************************************************/
+#ifndef RUBY_OPENCV_IMAGELOADER_H
+#define RUBY_OPENCV_IMAGELOADER_H
+
+#include "opencv.h"
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define __NAMESPACE_BEGIN_IMAGELOADER namespace cImageLoader {
+#define __NAMESPACE_END_IMAGELOADER }
+
+__NAMESPACE_BEGIN_OPENCV
+
+/*
+ * A decoded (or failed) image waiting to be passed to Ruby
+ */
+typedef struct {
+  void* image; // CvMat* or IplImage*
+  bool done;
+  bool failed; // true with error, or image == NULL if unreadable
+  cv::Exception error;
+} image_loader_slot_t;
+
+typedef struct {
+  std::vector<std::string> paths;
+  int iscolor;
+  int reduce; // 1, 2, 4 or 8
+  bool ipl; // decode into IplImage instead of CvMat
+  int threads;
+  int queue_size; // maximum number of decoded images not yet passed to Ruby
+
+  // State of the running #each, guarded by mutex
+  std::mutex mutex;
+  std::condition_variable cond;
+  std::vector<image_loader_slot_t> slots;
+  std::vector<std::thread> workers;
+  size_t next_decode;
+  size_t next_yield;
+  bool stop;
+  bool interrupted;
+  bool running;
+} sImageLoader;
+
+typedef struct {
+  VALUE self;
+  VALUE result; // Array to collect the images, or nil to yield them
+  sImageLoader* loader;
+  size_t index;
+} image_loader_each_t;
+
+__NAMESPACE_BEGIN_IMAGELOADER
+
+extern const rb_data_type_t data_type;
+
+VALUE rb_class();
+
+void init_ruby_class();
+
+void imageloader_free(void *ptr);
+size_t imageloader_memsize(const void *ptr);
+VALUE rb_allocate(VALUE klass);
+VALUE rb_initialize(int argc, VALUE *argv, VALUE self);
+VALUE rb_paths(VALUE self);
+VALUE rb_size(VALUE self);
+VALUE rb_each(VALUE self);
+VALUE rb_images(VALUE self);
+
+VALUE new_loader(VALUE source, VALUE options, VALUE image_class);
+void* decode_image(const char* path, int iscolor, int reduce, bool ipl);
+void release_image(void* image, bool ipl);
+void decode_worker(sImageLoader* loader);
+bool start_workers(sImageLoader* loader);
+void stop_workers(sImageLoader* loader);
+void* wait_slot(void* arg);
+void interrupt_wait(void* arg);
+VALUE each_image(VALUE arg);
+VALUE finish_each(VALUE arg);
+VALUE run_each(VALUE self, VALUE result);
+
+__NAMESPACE_END_IMAGELOADER
+
+inline sImageLoader*
+IMAGELOADER(VALUE object)
+{
+  sImageLoader* loader;
+  TypedData_Get_Struct(object, sImageLoader, &cImageLoader::data_type, loader);
+  return loader;
+}
+
+__NAMESPACE_END_OPENCV
+
+#endif // RUBY_OPENCV_IMAGELOADER_H
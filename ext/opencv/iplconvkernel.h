@@ -36,7 +36,7 @@ inline IplConvKernel*
 IPLCONVKERNEL(VALUE object)
 {
   IplConvKernel *ptr;
-  Data_Get_Struct(object, IplConvKernel, ptr);
+  ptr = (IplConvKernel*)OPENCV_DATA_PTR(object);
   return ptr;
 }
 
@@ -56,7 +56,7 @@ IPLCONVKERNEL(VALUE object)
   if (NIL_P(object))
     return NULL;
   else if (rb_obj_is_kind_of(object, cIplConvKernel::rb_class())) {
-    Data_Get_Struct(object, IplConvKernel, ptr);
+    ptr = (IplConvKernel*)OPENCV_DATA_PTR(object);
     return ptr;
   }
   else {
@@ -65,12 +65,13 @@ rb_initialize(int argc, VALUE *argv, VALUE self)
 
 /*
  * call-seq:
- *   IplImage::load(filename[,iscolor = CV_LOAD_IMAGE_COLOR])
+ *   IplImage::load(filename[,iscolor = CV_LOAD_IMAGE_COLOR][, reduce: 1])
  *
  * Load an image from file.
  *  iscolor = CV_LOAD_IMAGE_COLOR, the loaded image is forced to be a 3-channel color image
  *  iscolor = CV_LOAD_IMAGE_GRAYSCALE, the loaded image is forced to be grayscale
  *  iscolor = CV_LOAD_IMAGE_UNCHANGED, the loaded image will be loaded as is.
+ *  reduce = 2, 4 or 8 loads the image at 1/reduce of its width and height (see CvMat.load).
  * Currently the following file format are supported.
  * * Windows bitmaps - BMP,DIB
  * * JPEG files - JPEG,JPG,JPE
@@ -83,6 +84,7 @@ VALUE
 rb_load_image(int argc, VALUE *argv, VALUE self)
 {
   VALUE filename, iscolor;
+  int reduce = cCvMat::extract_reduce(&argc, argv);
   rb_scan_args(argc, argv, "11", &filename, &iscolor);
   Check_Type(filename, T_STRING);
 
@@ -95,8 +97,15 @@ rb_load_image(int argc, VALUE *argv, VALUE self)
     _iscolor = FIX2INT(iscolor);
   }
   
-  IplImage *image;
-  if ((image = cvLoadImage(StringValueCStr(filename), _iscolor)) == NULL) {
+  IplImage *image = NULL;
+  const char* filename_ptr = StringValueCStr(filename);
+  try {
+    rb_cvCallWithoutGVL([&] { image = rb_cvLoadImageReduced(filename_ptr, _iscolor, reduce); });
+  }
+  catch (cv::Exception& e) {
+    raise_cverror(e);
+  }
+  if (image == NULL) {
     rb_raise(rb_eStandardError, "file does not exist or invalid format image.");
   }
   return OPENCV_OBJECT(rb_klass, image);
@@ -104,29 +113,32 @@ rb_load_image(int argc, VALUE *argv, VALUE self)
 
 /*
  * call-seq:
- *   decode_image(buf[, iscolor=CV_LOAD_IMAGE_COLOR]) -> IplImage
+ *   decode_image(buf[, iscolor=CV_LOAD_IMAGE_COLOR][, reduce: 1]) -> IplImage
  *
  * Reads an image from a buffer in memory.
  *
  * Parameters:
- *   buf <CvMat, Array, String> - Input array
+ *   buf <CvMat, Array, String> - Input array (the bytes of a String are decoded in place without being copied)
  *   iscolor <Integer> - Flags specifying the color type of a decoded image (the same flags as CvMat#load)
+ *   reduce <Integer> - Decodes the image at 1/2, 1/4 or 1/8 of its width and height (see CvMat.load)
  */
 VALUE
 rb_decode_image(int argc, VALUE *argv, VALUE self)
 {
   int iscolor, need_release;
-  CvMat* buff = cCvMat::prepare_decoding(argc, argv, &iscolor, &need_release);
+  VALUE locked;
+  CvMat header;
+  int reduce = cCvMat::extract_reduce(&argc, argv);
+  CvMat* buff = cCvMat::prepare_decoding(argc, argv, &header, &iscolor, &need_release, &locked);
   IplImage* img_ptr = NULL;
   try {
-    img_ptr = cvDecodeImage(buff, iscolor);
-    if (need_release) {
-      cvReleaseMat(&buff);
-    }
+    rb_cvCallWithoutGVL([&] { img_ptr = rb_cvDecodeImageReduced(buff, iscolor, reduce); });
   }
   catch (cv::Exception& e) {
+    cCvMat::finish_decoding(&buff, need_release, locked);
     raise_cverror(e);
   }
+  cCvMat::finish_decoding(&buff, need_release, locked);
 
   return OPENCV_OBJECT(rb_klass, img_ptr);
 }
@@ -158,6 +170,7 @@ rb_get_roi(VALUE self)
 VALUE
 rb_set_roi(VALUE self, VALUE roi)
 {
+  check_writable(self);
   VALUE block = rb_block_given_p() ? rb_block_proc() : 0;
   try {
     if (block) {
@@ -183,6 +196,7 @@ rb_set_roi(VALUE self, VALUE roi)
 VALUE
 rb_reset_roi(VALUE self)
 {
+  check_writable(self);
   try {
     cvResetImageROI(IPLIMAGE(self));
   }
@@ -219,6 +233,7 @@ rb_get_coi(VALUE self)
 VALUE
 rb_set_coi(VALUE self, VALUE coi)
 {
+  check_writable(self);
   VALUE block = rb_block_given_p() ? rb_block_proc() : 0;
   try {
     if (block) {
@@ -243,6 +258,7 @@ rb_set_coi(VALUE self, VALUE coi)
 VALUE
 rb_reset_coi(VALUE self)
 {
+  check_writable(self);
   try {
     cvSetImageCOI(IPLIMAGE(self), 0);
   }
@@ -315,8 +331,7 @@ rb_smoothness(int argc, VALUE *argv, VALUE self)
 					 f_highFreqRatio, outLowDensity, outHighDensity);
 
   cvReleaseImage(&pFourierImage);
-  if (p64DepthImage != NULL)
-    cvReleaseImage(&p64DepthImage);
+  rb_cvReleaseImage(&p64DepthImage);
 
   switch(result) {
   case SMOOTH:
@@ -438,9 +453,7 @@ cvShiftDFT(CvArr *src_arr, CvArr *dst_arr )
     cvCopy(tmp, q2, 0);
   }
 
-  if (tmp != NULL) {
-    cvReleaseMat(&tmp);
-  }
+  rb_cvReleaseMat(&tmp);
 }
 
 IplImage*
@@ -56,7 +56,7 @@ inline IplImage*
 IPLIMAGE(VALUE object)
 {
   IplImage *ptr, stub;
-  Data_Get_Struct(object, IplImage, ptr);
+  ptr = (IplImage*)OPENCV_DATA_PTR(object);
   return cvGetImage(ptr, &stub);
 }
 
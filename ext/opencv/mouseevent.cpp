@@ -25,11 +25,13 @@ rb_class()
   return rb_klass;
 }
 
+const rb_data_type_t data_type = OPENCV_STRUCT_TYPE("OpenCV::GUI::MouseEvent", MouseEvent, 0);
+
 VALUE
 rb_allocate(VALUE klass)
 {
   MouseEvent *ptr;
-  return Data_Make_Struct(klass, MouseEvent, 0, 0, ptr);
+  return TypedData_Make_Struct(klass, MouseEvent, &data_type, ptr);
 }
 
 /*
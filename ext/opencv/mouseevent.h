@@ -44,7 +44,7 @@ VALUE new_object(int event, int x, int y, int flag);
 
 inline MouseEvent *MOUSEEVENT(VALUE object) {
   MouseEvent *ptr;
-  Data_Get_Struct(object, MouseEvent, ptr);
+  ptr = (MouseEvent*)OPENCV_DATA_PTR(object);
   return ptr;
 }
 
@@ -45,62 +45,135 @@
 
 __NAMESPACE_BEGIN_OPENCV
 
-
 /*
- * Hashtable for protect from GC
+ * Wraps ptr, whose memory is owned by root, in a new sRootedObject of type
+ * (rooted_object_type or one of its children). An array root is marked as shared,
+ * so that its data is never taken away from the object (see rb_cvTakeImageData).
  */
-st_table *root_table = st_init_numtable();
+VALUE
+wrap_rooted_object(VALUE klass, const rb_data_type_t *type, void *ptr, VALUE root)
+{
+  sRootedObject *rooted;
+  VALUE object = TypedData_Make_Struct(klass, sRootedObject, type, rooted);
+  rooted->ptr = ptr;
+  rooted->root = Qnil;
+  rooted->elem_class = Qnil;
+  RB_OBJ_WRITE(object, &rooted->root, root);
+  if (RB_TYPE_P(root, T_DATA) && RTYPEDDATA_P(root) && RTYPEDDATA_TYPE(root) == &opencv_object_type)
+    rb_cvMarkShared(DATA_PTR(root));
+  return object;
+}
+
+sRootedObject*
+rooted_object(VALUE object)
+{
+  return (sRootedObject*)rb_check_typeddata(object, &rooted_object_type);
+}
 
 /*
- * Mark root object. (protect from GC)
+ * Register root object, which owns the memory of object. (protect from GC)
  */
 void
-mark_root_object(void *ptr)
+register_root_object(VALUE object, VALUE root)
 {
-  VALUE value;
-  if (ptr && st_lookup(root_table, (st_data_t)ptr, (st_data_t*)&value)) {
-    rb_gc_mark(value);
-  }
+  RB_OBJ_WRITE(object, &rooted_object(object)->root, root);
 }
 
 /*
- * Look-up Root root object.
+ * Look-up root object.
  */
 VALUE
-lookup_root_object(void *ptr)
+lookup_root_object(VALUE object)
 {
-  VALUE value = 0;
-  if (ptr)
-    st_lookup(root_table, (st_data_t)ptr, (st_data_t*)&value);
-  return value;
+  return rooted_object(object)->root;
 }
 
 /*
- * Register root object.
+ * Raises FrozenError if object, or a view's root whose data it refers to, is frozen
+ * (e.g. a frame borrowed from CvCapture). Called by the methods that write the data.
+ */
+/*
+ * Raises RuntimeError if object is a borrowed object (BORROWED_OBJECT), whose data is only valid
+ * until its root detaches it. Called by the methods that make views, which could not be detached.
  */
 void
-register_root_object(void *ptr, VALUE root)
+check_viewable(VALUE object)
+{
+  if (RB_TYPE_P(object, T_DATA) && RTYPEDDATA_P(object) && RTYPEDDATA_TYPE(object) == &borrowed_object_type)
+    rb_raise(rb_eRuntimeError, "can not make a view of a borrowed %s; clone it first", rb_obj_classname(object));
+}
+
+void
+check_writable(VALUE object)
+{
+  while (true) {
+    rb_check_frozen(object);
+    if (!RB_TYPE_P(object, T_DATA) || !RTYPEDDATA_P(object) ||
+	!rb_typeddata_inherited_p(RTYPEDDATA_TYPE(object), &rooted_object_type))
+      return;
+    VALUE root = rooted_object(object)->root;
+    if (NIL_P(root))
+      return;
+    object = root;
+  }
+}
+
+void
+mark_rooted_object(void *ptr)
+{
+  sRootedObject *rooted = (sRootedObject*)ptr;
+  rb_gc_mark_movable(rooted->root);
+  rb_gc_mark_movable(rooted->elem_class);
+}
+
+void
+compact_rooted_object(void *ptr)
 {
-  st_insert(root_table, (st_data_t)ptr, (st_data_t)root);
+  sRootedObject *rooted = (sRootedObject*)ptr;
+  rooted->root = rb_gc_location(rooted->root);
+  rooted->elem_class = rb_gc_location(rooted->elem_class);
+}
+
+size_t
+memsize_rooted_object(const void *ptr)
+{
+  return sizeof(sRootedObject);
+}
+
+/*
+ * Free the header of a view (DEPEND_OBJECT), whose data is owned by its root.
+ */
+void
+free_depend_object(void *ptr)
+{
+  free_object(((sRootedObject*)ptr)->ptr);
+  xfree(ptr);
 }
 
 /*
- * Delete mark symbol from hashtable only, not free memory.
+ * Free a borrowed object (BORROWED_OBJECT): the header, and the data it owns once detached
+ * (see rb_cvDetachImageData).
  */
 void
-unregister_object(void *ptr)
+free_borrowed_object(void *ptr)
+{
+  release_object(((sRootedObject*)ptr)->ptr);
+  xfree(ptr);
+}
+
+size_t
+memsize_depend_object(const void *ptr)
 {
-  st_delete(root_table, (st_data_t*)&ptr, 0);
+  return sizeof(sRootedObject) + memsize_cvarr(((const sRootedObject*)ptr)->ptr);
 }
 
 /*
- * Delete mark symbol from hash table, then free memory.
+ * Free memory.
  */
 void
 free_object(void *ptr)
 {
   if (ptr) {
-    unregister_object(ptr);
     try {
       cvFree(&ptr);
     }
@@ -111,14 +184,16 @@ free_object(void *ptr)
 }
 
 /*
- * Release OpenCV specific structure(i.e CvMat, IplImage..) from memory and delete from hashtable.
+ * Release OpenCV specific structure(i.e CvMat, IplImage..) from memory.
+ * The data allocated from the buffer pool goes back to the pool.
  */
 void
 release_object(void *ptr)
 {
   if (ptr) {
-    unregister_object(ptr);
     try {
+      rb_cvForgetShared(ptr);
+      rb_cvReleasePooledData(ptr);
       cvRelease(&ptr);
     }
     catch (cv::Exception& e) {
@@ -128,13 +203,12 @@ release_object(void *ptr)
 }
 
 /*
- * Release IplConvKernel object from memory and delete from hashtable.
+ * Release IplConvKernel object from memory.
  */
 void
 release_iplconvkernel_object(void *ptr)
 {
   if (ptr) {
-    unregister_object(ptr);
     try {
       cvReleaseStructuringElement((IplConvKernel**)(&ptr));
     }
@@ -144,6 +218,108 @@ release_iplconvkernel_object(void *ptr)
   }
 }
 
+/*
+ * Returns the memory size of CvMat, IplImage or CvMatND including its data,
+ * if the data is owned by the header (i.e. not a view of another array).
+ */
+size_t
+memsize_cvarr(const void *ptr)
+{
+  if (!ptr)
+    return 0;
+  if (CV_IS_MAT_HDR(ptr)) {
+    const CvMat* mat = (const CvMat*)ptr;
+    size_t size = sizeof(CvMat);
+    if (mat->refcount && mat->data.ptr) {
+      size_t step = mat->step ? mat->step : (size_t)mat->cols * CV_ELEM_SIZE(mat->type);
+      size += step * mat->rows;
+    }
+    return size;
+  }
+  if (CV_IS_IMAGE_HDR(ptr)) {
+    const IplImage* image = (const IplImage*)ptr;
+    return sizeof(IplImage) + (image->imageDataOrigin ? (size_t)image->imageSize : 0);
+  }
+  if (CV_IS_MATND_HDR(ptr)) {
+    const CvMatND* mat = (const CvMatND*)ptr;
+    size_t size = sizeof(CvMatND);
+    if (mat->refcount && mat->data.ptr && mat->dims > 0)
+      size += (size_t)mat->dim[0].step * mat->dim[0].size;
+    return size;
+  }
+  if (CV_IS_SPARSE_MAT_HDR(ptr))
+    return sizeof(CvSparseMat);
+  return 0;
+}
+
+size_t
+memsize_iplconvkernel(const void *ptr)
+{
+  if (!ptr)
+    return 0;
+  const IplConvKernel* kernel = (const IplConvKernel*)ptr;
+  return sizeof(IplConvKernel) + (kernel->values ? sizeof(int) * kernel->nCols * kernel->nRows : 0);
+}
+
+/*
+ * Common parent of all the data types of Ruby/OpenCV. Accessors such as CVARR() check
+ * objects against it through OPENCV_DATA_PTR, which accepts any of its children.
+ */
+const rb_data_type_t opencv_data_type = {
+  "OpenCV::Data",
+  { 0, 0, 0, },
+  0, 0, 0
+};
+
+/*
+ * Common parent of the data types that wrap an sRootedObject
+ */
+const rb_data_type_t rooted_object_type = {
+  "OpenCV::Rooted",
+  { mark_rooted_object, RUBY_TYPED_DEFAULT_FREE, memsize_rooted_object, compact_rooted_object, },
+  &opencv_data_type, 0, RUBY_TYPED_FREE_IMMEDIATELY | RUBY_TYPED_WB_PROTECTED
+};
+
+/*
+ * Data types of the objects wrapped by OPENCV_OBJECT, IPLCONVKERNEL_OBJECT, GENERIC_OBJECT,
+ * DEPEND_OBJECT and REFER_OBJECT.
+ */
+const rb_data_type_t opencv_object_type = {
+  "OpenCV::CvArr",
+  { 0, release_object, memsize_cvarr, },
+  &opencv_data_type, 0, RUBY_TYPED_FREE_IMMEDIATELY | RUBY_TYPED_WB_PROTECTED
+};
+
+const rb_data_type_t iplconvkernel_object_type = {
+  "OpenCV::IplConvKernel",
+  { 0, release_iplconvkernel_object, memsize_iplconvkernel, },
+  &opencv_data_type, 0, RUBY_TYPED_FREE_IMMEDIATELY | RUBY_TYPED_WB_PROTECTED
+};
+
+const rb_data_type_t generic_object_type = {
+  "OpenCV::Generic",
+  { 0, RUBY_TYPED_DEFAULT_FREE, 0, },
+  &opencv_data_type, 0, RUBY_TYPED_FREE_IMMEDIATELY | RUBY_TYPED_WB_PROTECTED
+};
+
+const rb_data_type_t depend_object_type = {
+  "OpenCV::Depend",
+  { mark_rooted_object, free_depend_object, memsize_depend_object, compact_rooted_object, },
+  &rooted_object_type, 0, RUBY_TYPED_FREE_IMMEDIATELY | RUBY_TYPED_WB_PROTECTED
+};
+
+const rb_data_type_t borrowed_object_type = {
+  "OpenCV::Borrowed",
+  { mark_rooted_object, free_borrowed_object, memsize_rooted_object, compact_rooted_object, },
+  &rooted_object_type, 0, RUBY_TYPED_FREE_IMMEDIATELY | RUBY_TYPED_WB_PROTECTED
+};
+
+const rb_data_type_t refer_object_type = {
+  "OpenCV::Refer",
+  { mark_rooted_object, RUBY_TYPED_DEFAULT_FREE, memsize_rooted_object, compact_rooted_object, },
+  &rooted_object_type, 0, RUBY_TYPED_FREE_IMMEDIATELY | RUBY_TYPED_WB_PROTECTED
+};
+
 VALUE rb_module;
 VALUE rb_opencv_constants;
 
@@ -557,93 +733,174 @@ init_ruby_module()
   REGISTER_HASH(comparison_method, "i3", CV_CONTOURS_MATCH_I3);
 
   /* color convert methods */
-  rb_define_module_function(rb_module, "BGR2BGRA", RUBY_METHOD_FUNC(rb_BGR2BGRA), 1);
-  rb_define_module_function(rb_module, "RGB2RGBA", RUBY_METHOD_FUNC(rb_RGB2RGBA), 1);
-  rb_define_module_function(rb_module, "BGRA2BGR", RUBY_METHOD_FUNC(rb_BGRA2BGR), 1);
-  rb_define_module_function(rb_module, "RGBA2RGB", RUBY_METHOD_FUNC(rb_RGBA2RGB), 1);
-  rb_define_module_function(rb_module, "BGR2RGBA", RUBY_METHOD_FUNC(rb_BGR2RGBA), 1);
-  rb_define_module_function(rb_module, "RGB2BGRA", RUBY_METHOD_FUNC(rb_RGB2BGRA), 1);
-  rb_define_module_function(rb_module, "RGBA2BGR", RUBY_METHOD_FUNC(rb_RGBA2BGR), 1);
-  rb_define_module_function(rb_module, "BGRA2RGB", RUBY_METHOD_FUNC(rb_BGRA2RGB), 1);
-  rb_define_module_function(rb_module, "BGR2RGB", RUBY_METHOD_FUNC(rb_BGR2RGB), 1);
-  rb_define_module_function(rb_module, "RGB2BGR", RUBY_METHOD_FUNC(rb_RGB2BGR), 1);
-  rb_define_module_function(rb_module, "BGRA2RGBA", RUBY_METHOD_FUNC(rb_BGRA2RGBA), 1);
-  rb_define_module_function(rb_module, "RGBA2BGRA", RUBY_METHOD_FUNC(rb_RGBA2BGRA), 1);
-  rb_define_module_function(rb_module, "BGR2GRAY", RUBY_METHOD_FUNC(rb_BGR2GRAY), 1);
-  rb_define_module_function(rb_module, "RGB2GRAY", RUBY_METHOD_FUNC(rb_RGB2GRAY), 1);
-  rb_define_module_function(rb_module, "GRAY2BGR", RUBY_METHOD_FUNC(rb_GRAY2BGR), 1);
-  rb_define_module_function(rb_module, "GRAY2RGB", RUBY_METHOD_FUNC(rb_GRAY2RGB), 1);
-  rb_define_module_function(rb_module, "GRAY2BGRA", RUBY_METHOD_FUNC(rb_GRAY2BGRA), 1);
-  rb_define_module_function(rb_module, "GRAY2RGBA", RUBY_METHOD_FUNC(rb_GRAY2RGBA), 1);
-  rb_define_module_function(rb_module, "BGRA2GRAY", RUBY_METHOD_FUNC(rb_BGRA2GRAY), 1);
-  rb_define_module_function(rb_module, "RGBA2GRAY", RUBY_METHOD_FUNC(rb_RGBA2GRAY), 1);
-  rb_define_module_function(rb_module, "BGR2BGR565", RUBY_METHOD_FUNC(rb_BGR2BGR565), 1);
-  rb_define_module_function(rb_module, "RGB2BGR565", RUBY_METHOD_FUNC(rb_RGB2BGR565), 1);
-  rb_define_module_function(rb_module, "BGR5652BGR", RUBY_METHOD_FUNC(rb_BGR5652BGR), 1);
-  rb_define_module_function(rb_module, "BGR5652RGB", RUBY_METHOD_FUNC(rb_BGR5652RGB), 1);
-  rb_define_module_function(rb_module, "BGRA2BGR565", RUBY_METHOD_FUNC(rb_BGRA2BGR565), 1);
-  rb_define_module_function(rb_module, "RGBA2BGR565", RUBY_METHOD_FUNC(rb_RGBA2BGR565), 1);
-  rb_define_module_function(rb_module, "BGR5652BGRA", RUBY_METHOD_FUNC(rb_BGR5652BGRA), 1);
-  rb_define_module_function(rb_module, "BGR5652RGBA", RUBY_METHOD_FUNC(rb_BGR5652RGBA), 1);
-  rb_define_module_function(rb_module, "GRAY2BGR565", RUBY_METHOD_FUNC(rb_GRAY2BGR565), 1);
-  rb_define_module_function(rb_module, "BGR5652GRAY", RUBY_METHOD_FUNC(rb_BGR5652GRAY), 1);
-  rb_define_module_function(rb_module, "BGR2BGR555", RUBY_METHOD_FUNC(rb_BGR2BGR555), 1);
-  rb_define_module_function(rb_module, "RGB2BGR555", RUBY_METHOD_FUNC(rb_RGB2BGR555), 1);
-  rb_define_module_function(rb_module, "BGR5552BGR", RUBY_METHOD_FUNC(rb_BGR5552BGR), 1);
-  rb_define_module_function(rb_module, "BGR5552RGB", RUBY_METHOD_FUNC(rb_BGR5552RGB), 1);
-  rb_define_module_function(rb_module, "BGRA2BGR555", RUBY_METHOD_FUNC(rb_BGRA2BGR555), 1);
-  rb_define_module_function(rb_module, "RGBA2BGR555", RUBY_METHOD_FUNC(rb_RGBA2BGR555), 1);
-  rb_define_module_function(rb_module, "BGR5552BGRA", RUBY_METHOD_FUNC(rb_BGR5552BGRA), 1);
-  rb_define_module_function(rb_module, "BGR5552RGBA", RUBY_METHOD_FUNC(rb_BGR5552RGBA), 1);
-  rb_define_module_function(rb_module, "GRAY2BGR555", RUBY_METHOD_FUNC(rb_GRAY2BGR555), 1);
-  rb_define_module_function(rb_module, "BGR5552GRAY", RUBY_METHOD_FUNC(rb_BGR5552GRAY), 1);
-  rb_define_module_function(rb_module, "BGR2XYZ", RUBY_METHOD_FUNC(rb_BGR2XYZ), 1);
-  rb_define_module_function(rb_module, "RGB2XYZ", RUBY_METHOD_FUNC(rb_RGB2XYZ), 1);
-  rb_define_module_function(rb_module, "XYZ2BGR", RUBY_METHOD_FUNC(rb_XYZ2BGR), 1);
-  rb_define_module_function(rb_module, "XYZ2RGB", RUBY_METHOD_FUNC(rb_XYZ2RGB), 1);
-  rb_define_module_function(rb_module, "BGR2YCrCb", RUBY_METHOD_FUNC(rb_BGR2YCrCb), 1);
-  rb_define_module_function(rb_module, "RGB2YCrCb", RUBY_METHOD_FUNC(rb_RGB2YCrCb), 1);
-  rb_define_module_function(rb_module, "YCrCb2BGR", RUBY_METHOD_FUNC(rb_YCrCb2BGR), 1);
-  rb_define_module_function(rb_module, "YCrCb2RGB", RUBY_METHOD_FUNC(rb_YCrCb2RGB), 1);
-  rb_define_module_function(rb_module, "BGR2HSV", RUBY_METHOD_FUNC(rb_BGR2HSV), 1);
-  rb_define_module_function(rb_module, "RGB2HSV", RUBY_METHOD_FUNC(rb_RGB2HSV), 1);
-  rb_define_module_function(rb_module, "BGR2Lab", RUBY_METHOD_FUNC(rb_BGR2Lab), 1);
-  rb_define_module_function(rb_module, "RGB2Lab", RUBY_METHOD_FUNC(rb_RGB2Lab), 1);
-  rb_define_module_function(rb_module, "BayerBG2BGR", RUBY_METHOD_FUNC(rb_BayerBG2BGR), 1);
-  rb_define_module_function(rb_module, "BayerGB2BGR", RUBY_METHOD_FUNC(rb_BayerGB2BGR), 1);
-  rb_define_module_function(rb_module, "BayerRG2BGR", RUBY_METHOD_FUNC(rb_BayerRG2BGR), 1);
-  rb_define_module_function(rb_module, "BayerGR2BGR", RUBY_METHOD_FUNC(rb_BayerGR2BGR), 1);
-  rb_define_module_function(rb_module, "BayerBG2RGB", RUBY_METHOD_FUNC(rb_BayerBG2RGB), 1);
-  rb_define_module_function(rb_module, "BayerGB2RGB", RUBY_METHOD_FUNC(rb_BayerGB2RGB), 1);
-  rb_define_module_function(rb_module, "BayerRG2RGB", RUBY_METHOD_FUNC(rb_BayerRG2RGB), 1);
-  rb_define_module_function(rb_module, "BayerGR2RGB", RUBY_METHOD_FUNC(rb_BayerGR2RGB), 1);
-  rb_define_module_function(rb_module, "BGR2Luv", RUBY_METHOD_FUNC(rb_BGR2Luv), 1);
-  rb_define_module_function(rb_module, "RGB2Luv", RUBY_METHOD_FUNC(rb_RGB2Luv), 1);
-  rb_define_module_function(rb_module, "BGR2HLS", RUBY_METHOD_FUNC(rb_BGR2HLS), 1);
-  rb_define_module_function(rb_module, "RGB2HLS", RUBY_METHOD_FUNC(rb_RGB2HLS), 1);
-  rb_define_module_function(rb_module, "HSV2BGR", RUBY_METHOD_FUNC(rb_HSV2BGR), 1);
-  rb_define_module_function(rb_module, "HSV2RGB", RUBY_METHOD_FUNC(rb_HSV2RGB), 1);
-  rb_define_module_function(rb_module, "Lab2BGR", RUBY_METHOD_FUNC(rb_Lab2BGR), 1);
-  rb_define_module_function(rb_module, "Lab2RGB", RUBY_METHOD_FUNC(rb_Lab2RGB), 1);
-  rb_define_module_function(rb_module, "Luv2BGR", RUBY_METHOD_FUNC(rb_Luv2BGR), 1);
-  rb_define_module_function(rb_module, "Luv2RGB", RUBY_METHOD_FUNC(rb_Luv2RGB), 1);
-  rb_define_module_function(rb_module, "HLS2BGR", RUBY_METHOD_FUNC(rb_HLS2BGR), 1);
-  rb_define_module_function(rb_module, "HLS2RGB", RUBY_METHOD_FUNC(rb_HLS2RGB), 1);
+  rb_define_module_function(rb_module, "BGR2BGRA", RUBY_METHOD_FUNC(rb_BGR2BGRA), -1);
+  rb_define_module_function(rb_module, "RGB2RGBA", RUBY_METHOD_FUNC(rb_RGB2RGBA), -1);
+  rb_define_module_function(rb_module, "BGRA2BGR", RUBY_METHOD_FUNC(rb_BGRA2BGR), -1);
+  rb_define_module_function(rb_module, "RGBA2RGB", RUBY_METHOD_FUNC(rb_RGBA2RGB), -1);
+  rb_define_module_function(rb_module, "BGR2RGBA", RUBY_METHOD_FUNC(rb_BGR2RGBA), -1);
+  rb_define_module_function(rb_module, "RGB2BGRA", RUBY_METHOD_FUNC(rb_RGB2BGRA), -1);
+  rb_define_module_function(rb_module, "RGBA2BGR", RUBY_METHOD_FUNC(rb_RGBA2BGR), -1);
+  rb_define_module_function(rb_module, "BGRA2RGB", RUBY_METHOD_FUNC(rb_BGRA2RGB), -1);
+  rb_define_module_function(rb_module, "BGR2RGB", RUBY_METHOD_FUNC(rb_BGR2RGB), -1);
+  rb_define_module_function(rb_module, "RGB2BGR", RUBY_METHOD_FUNC(rb_RGB2BGR), -1);
+  rb_define_module_function(rb_module, "BGRA2RGBA", RUBY_METHOD_FUNC(rb_BGRA2RGBA), -1);
+  rb_define_module_function(rb_module, "RGBA2BGRA", RUBY_METHOD_FUNC(rb_RGBA2BGRA), -1);
+  rb_define_module_function(rb_module, "BGR2GRAY", RUBY_METHOD_FUNC(rb_BGR2GRAY), -1);
+  rb_define_module_function(rb_module, "RGB2GRAY", RUBY_METHOD_FUNC(rb_RGB2GRAY), -1);
+  rb_define_module_function(rb_module, "GRAY2BGR", RUBY_METHOD_FUNC(rb_GRAY2BGR), -1);
+  rb_define_module_function(rb_module, "GRAY2RGB", RUBY_METHOD_FUNC(rb_GRAY2RGB), -1);
+  rb_define_module_function(rb_module, "GRAY2BGRA", RUBY_METHOD_FUNC(rb_GRAY2BGRA), -1);
+  rb_define_module_function(rb_module, "GRAY2RGBA", RUBY_METHOD_FUNC(rb_GRAY2RGBA), -1);
+  rb_define_module_function(rb_module, "BGRA2GRAY", RUBY_METHOD_FUNC(rb_BGRA2GRAY), -1);
+  rb_define_module_function(rb_module, "RGBA2GRAY", RUBY_METHOD_FUNC(rb_RGBA2GRAY), -1);
+  rb_define_module_function(rb_module, "BGR2BGR565", RUBY_METHOD_FUNC(rb_BGR2BGR565), -1);
+  rb_define_module_function(rb_module, "RGB2BGR565", RUBY_METHOD_FUNC(rb_RGB2BGR565), -1);
+  rb_define_module_function(rb_module, "BGR5652BGR", RUBY_METHOD_FUNC(rb_BGR5652BGR), -1);
+  rb_define_module_function(rb_module, "BGR5652RGB", RUBY_METHOD_FUNC(rb_BGR5652RGB), -1);
+  rb_define_module_function(rb_module, "BGRA2BGR565", RUBY_METHOD_FUNC(rb_BGRA2BGR565), -1);
+  rb_define_module_function(rb_module, "RGBA2BGR565", RUBY_METHOD_FUNC(rb_RGBA2BGR565), -1);
+  rb_define_module_function(rb_module, "BGR5652BGRA", RUBY_METHOD_FUNC(rb_BGR5652BGRA), -1);
+  rb_define_module_function(rb_module, "BGR5652RGBA", RUBY_METHOD_FUNC(rb_BGR5652RGBA), -1);
+  rb_define_module_function(rb_module, "GRAY2BGR565", RUBY_METHOD_FUNC(rb_GRAY2BGR565), -1);
+  rb_define_module_function(rb_module, "BGR5652GRAY", RUBY_METHOD_FUNC(rb_BGR5652GRAY), -1);
+  rb_define_module_function(rb_module, "BGR2BGR555", RUBY_METHOD_FUNC(rb_BGR2BGR555), -1);
+  rb_define_module_function(rb_module, "RGB2BGR555", RUBY_METHOD_FUNC(rb_RGB2BGR555), -1);
+  rb_define_module_function(rb_module, "BGR5552BGR", RUBY_METHOD_FUNC(rb_BGR5552BGR), -1);
+  rb_define_module_function(rb_module, "BGR5552RGB", RUBY_METHOD_FUNC(rb_BGR5552RGB), -1);
+  rb_define_module_function(rb_module, "BGRA2BGR555", RUBY_METHOD_FUNC(rb_BGRA2BGR555), -1);
+  rb_define_module_function(rb_module, "RGBA2BGR555", RUBY_METHOD_FUNC(rb_RGBA2BGR555), -1);
+  rb_define_module_function(rb_module, "BGR5552BGRA", RUBY_METHOD_FUNC(rb_BGR5552BGRA), -1);
+  rb_define_module_function(rb_module, "BGR5552RGBA", RUBY_METHOD_FUNC(rb_BGR5552RGBA), -1);
+  rb_define_module_function(rb_module, "GRAY2BGR555", RUBY_METHOD_FUNC(rb_GRAY2BGR555), -1);
+  rb_define_module_function(rb_module, "BGR5552GRAY", RUBY_METHOD_FUNC(rb_BGR5552GRAY), -1);
+  rb_define_module_function(rb_module, "BGR2XYZ", RUBY_METHOD_FUNC(rb_BGR2XYZ), -1);
+  rb_define_module_function(rb_module, "RGB2XYZ", RUBY_METHOD_FUNC(rb_RGB2XYZ), -1);
+  rb_define_module_function(rb_module, "XYZ2BGR", RUBY_METHOD_FUNC(rb_XYZ2BGR), -1);
+  rb_define_module_function(rb_module, "XYZ2RGB", RUBY_METHOD_FUNC(rb_XYZ2RGB), -1);
+  rb_define_module_function(rb_module, "BGR2YCrCb", RUBY_METHOD_FUNC(rb_BGR2YCrCb), -1);
+  rb_define_module_function(rb_module, "RGB2YCrCb", RUBY_METHOD_FUNC(rb_RGB2YCrCb), -1);
+  rb_define_module_function(rb_module, "YCrCb2BGR", RUBY_METHOD_FUNC(rb_YCrCb2BGR), -1);
+  rb_define_module_function(rb_module, "YCrCb2RGB", RUBY_METHOD_FUNC(rb_YCrCb2RGB), -1);
+  rb_define_module_function(rb_module, "BGR2HSV", RUBY_METHOD_FUNC(rb_BGR2HSV), -1);
+  rb_define_module_function(rb_module, "RGB2HSV", RUBY_METHOD_FUNC(rb_RGB2HSV), -1);
+  rb_define_module_function(rb_module, "BGR2Lab", RUBY_METHOD_FUNC(rb_BGR2Lab), -1);
+  rb_define_module_function(rb_module, "RGB2Lab", RUBY_METHOD_FUNC(rb_RGB2Lab), -1);
+  rb_define_module_function(rb_module, "BayerBG2BGR", RUBY_METHOD_FUNC(rb_BayerBG2BGR), -1);
+  rb_define_module_function(rb_module, "BayerGB2BGR", RUBY_METHOD_FUNC(rb_BayerGB2BGR), -1);
+  rb_define_module_function(rb_module, "BayerRG2BGR", RUBY_METHOD_FUNC(rb_BayerRG2BGR), -1);
+  rb_define_module_function(rb_module, "BayerGR2BGR", RUBY_METHOD_FUNC(rb_BayerGR2BGR), -1);
+  rb_define_module_function(rb_module, "BayerBG2RGB", RUBY_METHOD_FUNC(rb_BayerBG2RGB), -1);
+  rb_define_module_function(rb_module, "BayerGB2RGB", RUBY_METHOD_FUNC(rb_BayerGB2RGB), -1);
+  rb_define_module_function(rb_module, "BayerRG2RGB", RUBY_METHOD_FUNC(rb_BayerRG2RGB), -1);
+  rb_define_module_function(rb_module, "BayerGR2RGB", RUBY_METHOD_FUNC(rb_BayerGR2RGB), -1);
+  rb_define_module_function(rb_module, "BGR2Luv", RUBY_METHOD_FUNC(rb_BGR2Luv), -1);
+  rb_define_module_function(rb_module, "RGB2Luv", RUBY_METHOD_FUNC(rb_RGB2Luv), -1);
+  rb_define_module_function(rb_module, "BGR2HLS", RUBY_METHOD_FUNC(rb_BGR2HLS), -1);
+  rb_define_module_function(rb_module, "RGB2HLS", RUBY_METHOD_FUNC(rb_RGB2HLS), -1);
+  rb_define_module_function(rb_module, "HSV2BGR", RUBY_METHOD_FUNC(rb_HSV2BGR), -1);
+  rb_define_module_function(rb_module, "HSV2RGB", RUBY_METHOD_FUNC(rb_HSV2RGB), -1);
+  rb_define_module_function(rb_module, "Lab2BGR", RUBY_METHOD_FUNC(rb_Lab2BGR), -1);
+  rb_define_module_function(rb_module, "Lab2RGB", RUBY_METHOD_FUNC(rb_Lab2RGB), -1);
+  rb_define_module_function(rb_module, "Luv2BGR", RUBY_METHOD_FUNC(rb_Luv2BGR), -1);
+  rb_define_module_function(rb_module, "Luv2RGB", RUBY_METHOD_FUNC(rb_Luv2RGB), -1);
+  rb_define_module_function(rb_module, "HLS2BGR", RUBY_METHOD_FUNC(rb_HLS2BGR), -1);
+  rb_define_module_function(rb_module, "HLS2RGB", RUBY_METHOD_FUNC(rb_HLS2RGB), -1);
 
   rb_define_module_function(rb_module, "build_information", RUBY_METHOD_FUNC(rb_build_information), 0);
+  rb_define_module_function(rb_module, "buffer_pool_limit", RUBY_METHOD_FUNC(rb_buffer_pool_limit), 0);
+  rb_define_module_function(rb_module, "buffer_pool_limit=", RUBY_METHOD_FUNC(rb_set_buffer_pool_limit), 1);
+  rb_define_module_function(rb_module, "buffer_pool_stats", RUBY_METHOD_FUNC(rb_buffer_pool_stats), 0);
+  rb_define_module_function(rb_module, "clear_buffer_pool", RUBY_METHOD_FUNC(rb_clear_buffer_pool), 0);
 }
 
-#define CREATE_CVTCOLOR_FUNC(rb_func_name, c_const_name, src_cn, dest_cn) \
-  VALUE rb_func_name(VALUE klass, VALUE image)				\
+#define CVTCOLOR_FUNCS(F)							\
+  F(BGR2BGRA, 3, 4)							\
+  F(RGB2RGBA, 3, 4)							\
+  F(BGRA2BGR, 4, 3)							\
+  F(RGBA2RGB, 4, 3)							\
+  F(BGR2RGBA, 3, 4)							\
+  F(RGB2BGRA, 3, 4)							\
+  F(RGBA2BGR, 4, 3)							\
+  F(BGRA2RGB, 4, 3)							\
+  F(BGR2RGB, 3, 3)							\
+  F(RGB2BGR, 3, 3)							\
+  F(BGRA2RGBA, 4, 4)							\
+  F(RGBA2BGRA, 4, 4)							\
+  F(BGR2GRAY, 3, 1)							\
+  F(RGB2GRAY, 3, 1)							\
+  F(GRAY2BGR, 1, 3)							\
+  F(GRAY2RGB, 1, 3)							\
+  F(GRAY2BGRA, 1, 4)							\
+  F(GRAY2RGBA, 1, 4)							\
+  F(BGRA2GRAY, 4, 1)							\
+  F(RGBA2GRAY, 4, 1)							\
+  F(BGR2BGR565, 3, 3)							\
+  F(RGB2BGR565, 3, 3)							\
+  F(BGR5652BGR, 3, 3)							\
+  F(BGR5652RGB, 3, 3)							\
+  F(BGRA2BGR565, 4, 3)							\
+  F(RGBA2BGR565, 4, 3)							\
+  F(BGR5652BGRA, 3, 4)							\
+  F(BGR5652RGBA, 3, 4)							\
+  F(GRAY2BGR565, 1, 3)							\
+  F(BGR5652GRAY, 3, 1)							\
+  F(BGR2BGR555, 3, 3)							\
+  F(RGB2BGR555, 3, 3)							\
+  F(BGR5552BGR, 3, 3)							\
+  F(BGR5552RGB, 3, 3)							\
+  F(BGRA2BGR555, 4, 3)							\
+  F(RGBA2BGR555, 4, 3)							\
+  F(BGR5552BGRA, 3, 4)							\
+  F(BGR5552RGBA, 3, 4)							\
+  F(GRAY2BGR555, 1, 3)							\
+  F(BGR5552GRAY, 3, 1)							\
+  F(BGR2XYZ, 3, 3)							\
+  F(RGB2XYZ, 3, 3)							\
+  F(XYZ2BGR, 3, 3)							\
+  F(XYZ2RGB, 3, 3)							\
+  F(BGR2YCrCb, 3, 3)							\
+  F(RGB2YCrCb, 3, 3)							\
+  F(YCrCb2BGR, 3, 3)							\
+  F(YCrCb2RGB, 0, 3)							\
+  F(BGR2HSV, 3, 3)							\
+  F(RGB2HSV, 3, 3)							\
+  F(BGR2Lab, 3, 3)							\
+  F(RGB2Lab, 3, 3)							\
+  F(BayerBG2BGR, 3, 3)							\
+  F(BayerGB2BGR, 3, 3)							\
+  F(BayerRG2BGR, 3, 3)							\
+  F(BayerGR2BGR, 3, 3)							\
+  F(BayerBG2RGB, 3, 3)							\
+  F(BayerGB2RGB, 3, 3)							\
+  F(BayerRG2RGB, 3, 3)							\
+  F(BayerGR2RGB, 3, 3)							\
+  F(BGR2Luv, 3, 3)							\
+  F(RGB2Luv, 3, 3)							\
+  F(BGR2HLS, 3, 3)							\
+  F(RGB2HLS, 3, 3)							\
+  F(HSV2BGR, 3, 3)							\
+  F(HSV2RGB, 3, 3)							\
+  F(Lab2BGR, 3, 3)							\
+  F(Lab2RGB, 3, 3)							\
+  F(Luv2BGR, 3, 3)							\
+  F(Luv2RGB, 3, 3)							\
+  F(HLS2BGR, 3, 3)							\
+  F(HLS2RGB, 3, 3)
+
+#define CREATE_CVTCOLOR_FUNC(name, src_cn, dest_cn)				\
+  VALUE rb_##name(int argc, VALUE *argv, VALUE klass)			\
   {									\
-    VALUE dest = Qnil;							\
+    VALUE image, dest = Qnil;						\
+    VALUE out = cCvMat::extract_out(&argc, argv);			\
+    rb_scan_args(argc, argv, "1", &image);				\
     CvArr* img_ptr = CVARR(image);					\
     try {								\
       int type = cvGetElemType(img_ptr);				\
       if (CV_MAT_CN(type) != src_cn)					\
 	rb_raise(rb_eArgError, "argument 1 should be %d-channel.", src_cn); \
-      dest = cCvMat::new_mat_kind_object(cvGetSize(img_ptr), image, CV_MAT_DEPTH(type), dest_cn); \
-      cvCvtColor(img_ptr, CVARR(dest), c_const_name);			\
+      dest = cCvMat::destination_object(out, cvGetSize(img_ptr), image, CV_MAT_DEPTH(type), dest_cn); \
+      CvArr* dest_ptr = CVARR(dest);					\
+      rb_cvCallWithoutGVL([&] { cvCvtColor(img_ptr, dest_ptr, CV_##name); });  \
     }									\
     catch (cv::Exception& e) {						\
       raise_cverror(e);							\
@@ -651,78 +908,27 @@ init_ruby_module()
     return dest;							\
   }
 
-CREATE_CVTCOLOR_FUNC(rb_BGR2BGRA, CV_BGR2BGRA, 3, 4);
-CREATE_CVTCOLOR_FUNC(rb_RGB2RGBA, CV_RGB2RGBA, 3, 4);
-CREATE_CVTCOLOR_FUNC(rb_BGRA2BGR, CV_BGRA2BGR, 4, 3);
-CREATE_CVTCOLOR_FUNC(rb_RGBA2RGB, CV_RGBA2RGB, 4, 3);
-CREATE_CVTCOLOR_FUNC(rb_BGR2RGBA, CV_BGR2RGBA, 3, 4);
-CREATE_CVTCOLOR_FUNC(rb_RGB2BGRA, CV_RGB2BGRA, 3, 4);
-CREATE_CVTCOLOR_FUNC(rb_RGBA2BGR, CV_RGBA2BGR, 4, 3);
-CREATE_CVTCOLOR_FUNC(rb_BGRA2RGB, CV_BGRA2RGB, 4, 3);
-CREATE_CVTCOLOR_FUNC(rb_BGR2RGB, CV_BGR2RGB, 3, 3);
-CREATE_CVTCOLOR_FUNC(rb_RGB2BGR, CV_RGB2BGR, 3, 3);
-CREATE_CVTCOLOR_FUNC(rb_BGRA2RGBA, CV_BGRA2RGBA, 4, 4);
-CREATE_CVTCOLOR_FUNC(rb_RGBA2BGRA, CV_RGBA2BGRA, 4, 4);
-CREATE_CVTCOLOR_FUNC(rb_BGR2GRAY, CV_BGR2GRAY, 3, 1);
-CREATE_CVTCOLOR_FUNC(rb_RGB2GRAY, CV_RGB2GRAY, 3, 1);
-CREATE_CVTCOLOR_FUNC(rb_GRAY2BGR, CV_GRAY2BGR, 1, 3);
-CREATE_CVTCOLOR_FUNC(rb_GRAY2RGB, CV_GRAY2RGB, 1, 3);
-CREATE_CVTCOLOR_FUNC(rb_GRAY2BGRA, CV_GRAY2BGRA, 1, 4);
-CREATE_CVTCOLOR_FUNC(rb_GRAY2RGBA, CV_GRAY2RGBA, 1, 4);
-CREATE_CVTCOLOR_FUNC(rb_BGRA2GRAY, CV_BGRA2GRAY, 4, 1);
-CREATE_CVTCOLOR_FUNC(rb_RGBA2GRAY, CV_RGBA2GRAY, 4, 1);
-CREATE_CVTCOLOR_FUNC(rb_BGR2BGR565, CV_BGR2BGR565, 3, 3);
-CREATE_CVTCOLOR_FUNC(rb_RGB2BGR565, CV_RGB2BGR565, 3, 3);
-CREATE_CVTCOLOR_FUNC(rb_BGR5652BGR, CV_BGR5652BGR, 3, 3);
-CREATE_CVTCOLOR_FUNC(rb_BGR5652RGB, CV_BGR5652RGB, 3, 3);
-CREATE_CVTCOLOR_FUNC(rb_BGRA2BGR565, CV_BGRA2BGR565, 4, 3);
-CREATE_CVTCOLOR_FUNC(rb_RGBA2BGR565, CV_RGBA2BGR565, 4, 3);
-CREATE_CVTCOLOR_FUNC(rb_BGR5652BGRA, CV_BGR5652BGRA, 3, 4);
-CREATE_CVTCOLOR_FUNC(rb_BGR5652RGBA, CV_BGR5652RGBA, 3, 4);
-CREATE_CVTCOLOR_FUNC(rb_GRAY2BGR565, CV_GRAY2BGR565, 1, 3);
-CREATE_CVTCOLOR_FUNC(rb_BGR5652GRAY, CV_BGR5652GRAY, 3, 1);
-CREATE_CVTCOLOR_FUNC(rb_BGR2BGR555, CV_BGR2BGR555, 3, 3);
-CREATE_CVTCOLOR_FUNC(rb_RGB2BGR555, CV_RGB2BGR555, 3, 3);
-CREATE_CVTCOLOR_FUNC(rb_BGR5552BGR, CV_BGR5552BGR, 3, 3);
-CREATE_CVTCOLOR_FUNC(rb_BGR5552RGB, CV_BGR5552RGB, 3, 3);
-CREATE_CVTCOLOR_FUNC(rb_BGRA2BGR555, CV_BGRA2BGR555, 4, 3);
-CREATE_CVTCOLOR_FUNC(rb_RGBA2BGR555, CV_RGBA2BGR555, 4, 3);
-CREATE_CVTCOLOR_FUNC(rb_BGR5552BGRA, CV_BGR5552BGRA, 3, 4);
-CREATE_CVTCOLOR_FUNC(rb_BGR5552RGBA, CV_BGR5552RGBA, 3, 4);
-CREATE_CVTCOLOR_FUNC(rb_GRAY2BGR555, CV_GRAY2BGR555, 1, 3);
-CREATE_CVTCOLOR_FUNC(rb_BGR5552GRAY, CV_BGR5552GRAY, 3, 1);
-CREATE_CVTCOLOR_FUNC(rb_BGR2XYZ, CV_BGR2XYZ, 3, 3);
-CREATE_CVTCOLOR_FUNC(rb_RGB2XYZ, CV_RGB2XYZ, 3, 3);
-CREATE_CVTCOLOR_FUNC(rb_XYZ2BGR, CV_XYZ2BGR, 3, 3);
-CREATE_CVTCOLOR_FUNC(rb_XYZ2RGB, CV_XYZ2RGB, 3, 3);
-CREATE_CVTCOLOR_FUNC(rb_BGR2YCrCb, CV_BGR2YCrCb, 3, 3);
-CREATE_CVTCOLOR_FUNC(rb_RGB2YCrCb, CV_RGB2YCrCb, 3, 3);
-CREATE_CVTCOLOR_FUNC(rb_YCrCb2BGR, CV_YCrCb2BGR, 3, 3);
-CREATE_CVTCOLOR_FUNC(rb_YCrCb2RGB, CV_YCrCb2RGB, 0, 3);
-CREATE_CVTCOLOR_FUNC(rb_BGR2HSV, CV_BGR2HSV, 3, 3);
-CREATE_CVTCOLOR_FUNC(rb_RGB2HSV, CV_RGB2HSV, 3, 3);
-CREATE_CVTCOLOR_FUNC(rb_BGR2Lab, CV_BGR2Lab, 3, 3);
-CREATE_CVTCOLOR_FUNC(rb_RGB2Lab, CV_RGB2Lab, 3, 3);
-CREATE_CVTCOLOR_FUNC(rb_BayerBG2BGR, CV_BayerBG2BGR, 3, 3);
-CREATE_CVTCOLOR_FUNC(rb_BayerGB2BGR, CV_BayerGB2BGR, 3, 3);
-CREATE_CVTCOLOR_FUNC(rb_BayerRG2BGR, CV_BayerRG2BGR, 3, 3);
-CREATE_CVTCOLOR_FUNC(rb_BayerGR2BGR, CV_BayerGR2BGR, 3, 3);
-CREATE_CVTCOLOR_FUNC(rb_BayerBG2RGB, CV_BayerBG2RGB, 3, 3);
-CREATE_CVTCOLOR_FUNC(rb_BayerGB2RGB, CV_BayerGB2RGB, 3, 3);
-CREATE_CVTCOLOR_FUNC(rb_BayerRG2RGB, CV_BayerRG2RGB, 3, 3);
-CREATE_CVTCOLOR_FUNC(rb_BayerGR2RGB, CV_BayerGR2RGB, 3, 3);
-CREATE_CVTCOLOR_FUNC(rb_BGR2Luv, CV_BGR2Luv, 3, 3);
-CREATE_CVTCOLOR_FUNC(rb_RGB2Luv, CV_RGB2Luv, 3, 3);
-CREATE_CVTCOLOR_FUNC(rb_BGR2HLS, CV_BGR2HLS, 3, 3);
-CREATE_CVTCOLOR_FUNC(rb_RGB2HLS, CV_RGB2HLS, 3, 3);
-CREATE_CVTCOLOR_FUNC(rb_HSV2BGR, CV_HSV2BGR, 3, 3);
-CREATE_CVTCOLOR_FUNC(rb_HSV2RGB, CV_HSV2RGB, 3, 3);
-CREATE_CVTCOLOR_FUNC(rb_Lab2BGR, CV_Lab2BGR, 3, 3);
-CREATE_CVTCOLOR_FUNC(rb_Lab2RGB, CV_Lab2RGB, 3, 3);
-CREATE_CVTCOLOR_FUNC(rb_Luv2BGR, CV_Luv2BGR, 3, 3);
-CREATE_CVTCOLOR_FUNC(rb_Luv2RGB, CV_Luv2RGB, 3, 3);
-CREATE_CVTCOLOR_FUNC(rb_HLS2BGR, CV_HLS2BGR, 3, 3);
-CREATE_CVTCOLOR_FUNC(rb_HLS2RGB, CV_HLS2RGB, 3, 3);
+CVTCOLOR_FUNCS(CREATE_CVTCOLOR_FUNC)
+
+#define CVTCOLOR_INFO(name, src_cn, dest_cn) { #name, CV_##name, src_cn, dest_cn },
+
+const cvtcolor_info_t cvtcolor_infos[] = {
+  CVTCOLOR_FUNCS(CVTCOLOR_INFO)
+  { NULL, 0, 0, 0 }
+};
+
+/*
+ * Returns the color conversion named like the module functions (e.g. "BGR2GRAY"), or NULL
+ */
+const cvtcolor_info_t*
+lookup_cvtcolor(const char* name)
+{
+  for (const cvtcolor_info_t* info = cvtcolor_infos; info->name; info++) {
+    if (strcmp(info->name, name) == 0)
+      return info;
+  }
+  return NULL;
+}
 
 VALUE
 rb_build_information(VALUE klass)
@@ -731,6 +937,76 @@ rb_build_information(VALUE klass)
   return rb_str_new(ptr, strlen(ptr));
 }
 
+/*
+ * Returns the maximum bytes of image data buffers kept by the buffer pool
+ *
+ * @overload buffer_pool_limit
+ * @return [Integer] Limit in bytes (0 means the pool is disabled)
+ */
+VALUE
+rb_buffer_pool_limit(VALUE klass)
+{
+  return SIZET2NUM(rb_cvGetBufferPoolStats().limit);
+}
+
+/*
+ * Enables the buffer pool for the data of CvMat and IplImage, or disables it with 0.
+ *
+ * When enabled, the data buffer of a CvMat or IplImage goes back to the pool when the object
+ * is freed by GC, and is reused by the next CvMat or IplImage of a similar size. Buffers are
+ * grouped into size classes (4 classes per power of two), and buffers smaller than 4KB are
+ * not pooled. Cached buffers beyond the new limit are freed immediately.
+ *
+ * @overload buffer_pool_limit=(bytes)
+ *   @param bytes [Integer] Maximum bytes of buffers to keep in the pool
+ */
+VALUE
+rb_set_buffer_pool_limit(VALUE klass, VALUE bytes)
+{
+  long limit = NUM2LONG(bytes);
+  if (limit < 0)
+    rb_raise(rb_eArgError, "buffer pool limit should be >= 0");
+  rb_cvSetBufferPoolLimit((size_t)limit);
+  return bytes;
+}
+
+/*
+ * Returns the statistics of the buffer pool
+ *
+ * @overload buffer_pool_stats
+ * @return [Hash] <tt>:limit</tt>, <tt>:cached_bytes</tt> and <tt>:cached_buffers</tt> (buffers
+ *   currently kept in the pool), <tt>:hits</tt> and <tt>:misses</tt> (allocations served
+ *   from the pool or not), <tt>:returned</tt> and <tt>:discarded</tt> (freed buffers kept
+ *   in the pool or freed because the pool was full)
+ */
+VALUE
+rb_buffer_pool_stats(VALUE klass)
+{
+  rb_cvBufferPoolStats stats = rb_cvGetBufferPoolStats();
+  VALUE hash = rb_hash_new();
+  rb_hash_aset(hash, ID2SYM(rb_intern("limit")), SIZET2NUM(stats.limit));
+  rb_hash_aset(hash, ID2SYM(rb_intern("cached_bytes")), SIZET2NUM(stats.cached_bytes));
+  rb_hash_aset(hash, ID2SYM(rb_intern("cached_buffers")), SIZET2NUM(stats.cached_buffers));
+  rb_hash_aset(hash, ID2SYM(rb_intern("hits")), SIZET2NUM(stats.hits));
+  rb_hash_aset(hash, ID2SYM(rb_intern("misses")), SIZET2NUM(stats.misses));
+  rb_hash_aset(hash, ID2SYM(rb_intern("returned")), SIZET2NUM(stats.returned));
+  rb_hash_aset(hash, ID2SYM(rb_intern("discarded")), SIZET2NUM(stats.discarded));
+  return hash;
+}
+
+/*
+ * Frees all buffers kept by the buffer pool
+ *
+ * @overload clear_buffer_pool
+ * @return [nil]
+ */
+VALUE
+rb_clear_buffer_pool(VALUE klass)
+{
+  rb_cvClearBufferPool();
+  return Qnil;
+}
+
 
 int
 error_callback(int status, const char *function_name, const char *error_message,
@@ -784,6 +1060,8 @@ extern "C" {
     mOpenCV::cCvHistogram::init_ruby_class();
     mOpenCV::cCvCapture::init_ruby_class();
     mOpenCV::cCvVideoWriter::init_ruby_class();
+    mOpenCV::cCvPipeline::init_ruby_class();
+    mOpenCV::cImageLoader::init_ruby_class();
 
     mOpenCV::cCvLine::init_ruby_class();
     mOpenCV::cCvTwoPoints::init_ruby_class();
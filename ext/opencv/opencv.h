@@ -20,6 +20,9 @@
 #else
 #include <version.h>
 #endif
+#ifdef HAVE_RUBY_MEMORY_VIEW_H
+#include <ruby/memory_view.h>
+#endif
 
 // Workaround for https://bugs.ruby-lang.org/issues/11962
 #undef RB_OBJ_WB_UNPROTECT_FOR
@@ -88,8 +91,39 @@ extern "C" {
 #include "opencv2/nonfree/nonfree.hpp"
 #endif
 
+__NAMESPACE_BEGIN_OPENCV
+// Common parent of all the data types of Ruby/OpenCV, used by the accessors in the headers below
+extern const rb_data_type_t opencv_data_type;
+// Common parent of the data types that wrap an sRootedObject
+extern const rb_data_type_t rooted_object_type;
+
+/*
+ * Wrapper of an OpenCV structure whose memory is owned by another Ruby object (root),
+ * such as a sub-matrix, an element of a sequence or a sequence in a CvMemStorage.
+ * The references are marked and moved by GC through the wrapper.
+ */
+typedef struct {
+  void *ptr;
+  VALUE root;
+  VALUE elem_class; // class of the elements of a sequence
+} sRootedObject;
+
+/*
+ * Returns the OpenCV structure wrapped by object, which is unwrapped from sRootedObject if any
+ */
+inline void*
+OPENCV_DATA_PTR(VALUE object)
+{
+  void *data = rb_check_typeddata(object, &opencv_data_type);
+  if (rb_typeddata_inherited_p(RTYPEDDATA_TYPE(object), &rooted_object_type))
+    return ((sRootedObject*)data)->ptr;
+  return data;
+}
+__NAMESPACE_END_OPENCV
+
 // Ruby/OpenCV headers
 #include "cvutils.h"
+#include "imagecodec.h"
 #include "cverror.h"
 #include "cvpoint.h"
 #include "cvpoint2d32f.h"
@@ -121,6 +155,8 @@ extern "C" {
 #include "cvhistogram.h"
 #include "cvcapture.h"
 #include "cvvideowriter.h"
+#include "cvpipeline.h"
+#include "imageloader.h"
 
 #include "cvline.h"
 #include "cvtwopoints.h"
@@ -193,13 +229,44 @@ extern "C" {
 // OpenCV module
 __NAMESPACE_BEGIN_OPENCV
 
-void mark_root_object(void *ptr);
-VALUE lookup_root_object(void *ptr);
-void register_root_object(void *ptr, VALUE root);
-void unregister_object(void *ptr);
+VALUE wrap_rooted_object(VALUE klass, const rb_data_type_t *type, void *ptr, VALUE root);
+sRootedObject* rooted_object(VALUE object);
+VALUE lookup_root_object(VALUE object);
+void register_root_object(VALUE object, VALUE root);
+void check_viewable(VALUE object);
+void check_writable(VALUE object);
+void mark_rooted_object(void *ptr);
+void compact_rooted_object(void *ptr);
+size_t memsize_rooted_object(const void *ptr);
 void free_object(void *ptr);
 void release_object(void *ptr);
 void release_iplconvkernel_object(void *ptr);
+size_t memsize_cvarr(const void *ptr);
+size_t memsize_iplconvkernel(const void *ptr);
+
+extern const rb_data_type_t opencv_object_type;
+extern const rb_data_type_t iplconvkernel_object_type;
+extern const rb_data_type_t generic_object_type;
+extern const rb_data_type_t depend_object_type;
+extern const rb_data_type_t borrowed_object_type;
+extern const rb_data_type_t refer_object_type;
+
+/*
+ * Size of a plain C structure wrapped by Data_Make_Struct-like allocators (see OPENCV_STRUCT_TYPE)
+ */
+template <typename T>
+size_t
+memsize_struct(const void *ptr)
+{
+  return sizeof(T);
+}
+
+/*
+ * rb_data_type_t initializer for a plain C structure that has no reference to Ruby objects
+ */
+#define OPENCV_STRUCT_TYPE(name, type, free_func)			\
+  { name, { 0, free_func, memsize_struct<type>, }, &opencv_data_type, 0, \
+    RUBY_TYPED_FREE_IMMEDIATELY | RUBY_TYPED_WB_PROTECTED }
 
 VALUE rb_module_opencv();
 void init_ruby_module();
@@ -209,15 +276,14 @@ inline CvArr*
 CVARR(VALUE object)
 {
   CvArr *ptr;
-  Data_Get_Struct(object, CvArr, ptr);
+  ptr = (CvArr*)OPENCV_DATA_PTR(object);
   return ptr;
 }  
 
 inline CvArr*
 CVARR_WITH_CHECK(VALUE object)
 {
-  Check_Type(object, T_DATA);
-  void *ptr = DATA_PTR(object);
+  void *ptr = OPENCV_DATA_PTR(object);
   if (CV_IS_IMAGE(ptr) || CV_IS_MAT(ptr) || CV_IS_SEQ(ptr) ||
       CV_IS_MATND(ptr) || CV_IS_SPARSE_MAT(ptr)) {
     return CVARR(object);
@@ -231,33 +297,37 @@ CVARR_WITH_CHECK(VALUE object)
 inline VALUE
 OPENCV_OBJECT(VALUE klass, void *ptr)
 {
-  return Data_Wrap_Struct(klass, 0, release_object, ptr);
+  return TypedData_Wrap_Struct(klass, &opencv_object_type, ptr);
 }
 
 inline VALUE
 IPLCONVKERNEL_OBJECT(VALUE klass, void *ptr)
 {
-  return Data_Wrap_Struct(klass, 0, release_iplconvkernel_object, ptr);
+  return TypedData_Wrap_Struct(klass, &iplconvkernel_object_type, ptr);
 }
 
 inline VALUE
 GENERIC_OBJECT(VALUE klass, void *ptr)
 {
-  return Data_Wrap_Struct(klass, 0, -1, ptr);
+  return TypedData_Wrap_Struct(klass, &generic_object_type, ptr);
 }
 
 inline VALUE
 DEPEND_OBJECT(VALUE klass, void *ptr, VALUE root)
 {
-  register_root_object(ptr, root);
-  return Data_Wrap_Struct(klass, mark_root_object, free_object, ptr);
+  return wrap_rooted_object(klass, &depend_object_type, ptr, root);
+}
+
+inline VALUE
+BORROWED_OBJECT(VALUE klass, void *ptr, VALUE root)
+{
+  return wrap_rooted_object(klass, &borrowed_object_type, ptr, root);
 }
 
 inline VALUE
 REFER_OBJECT(VALUE klass, void *ptr, VALUE root)
 {
-  register_root_object(ptr, root);
-  return Data_Wrap_Struct(klass, mark_root_object, unregister_object, ptr);
+  return wrap_rooted_object(klass, &refer_object_type, ptr, root);
 }
 
 inline int
@@ -328,80 +398,93 @@ CV2IPL_DEPTH(int depth)
   return 0;
 }
 
-VALUE rb_BGR2BGRA(VALUE klass, VALUE image);
-VALUE rb_RGB2RGBA(VALUE klass, VALUE image);
-VALUE rb_BGRA2BGR(VALUE klass, VALUE image);
-VALUE rb_RGBA2RGB(VALUE klass, VALUE image);
-VALUE rb_BGR2RGBA(VALUE klass, VALUE image);
-VALUE rb_RGB2BGRA(VALUE klass, VALUE image);
-VALUE rb_RGBA2BGR(VALUE klass, VALUE image);
-VALUE rb_BGRA2RGB(VALUE klass, VALUE image);
-VALUE rb_BGR2RGB(VALUE klass, VALUE image);
-VALUE rb_RGB2BGR(VALUE klass, VALUE image);
-VALUE rb_BGRA2RGBA(VALUE klass, VALUE image);
-VALUE rb_RGBA2BGRA(VALUE klass, VALUE image);
-VALUE rb_BGR2GRAY(VALUE klass, VALUE image);
-VALUE rb_RGB2GRAY(VALUE klass, VALUE image);
-VALUE rb_GRAY2BGR(VALUE klass, VALUE image);
-VALUE rb_GRAY2RGB(VALUE klass, VALUE image);
-VALUE rb_GRAY2BGRA(VALUE klass, VALUE image);
-VALUE rb_GRAY2RGBA(VALUE klass, VALUE image);
-VALUE rb_BGRA2GRAY(VALUE klass, VALUE image);
-VALUE rb_RGBA2GRAY(VALUE klass, VALUE image);
-VALUE rb_BGR2BGR565(VALUE klass, VALUE image);
-VALUE rb_RGB2BGR565(VALUE klass, VALUE image);
-VALUE rb_BGR5652BGR(VALUE klass, VALUE image);
-VALUE rb_BGR5652RGB(VALUE klass, VALUE image);
-VALUE rb_BGRA2BGR565(VALUE klass, VALUE image);
-VALUE rb_RGBA2BGR565(VALUE klass, VALUE image);
-VALUE rb_BGR5652BGRA(VALUE klass, VALUE image);
-VALUE rb_BGR5652RGBA(VALUE klass, VALUE image);
-VALUE rb_GRAY2BGR565(VALUE klass, VALUE image);
-VALUE rb_BGR5652GRAY(VALUE klass, VALUE image);
-VALUE rb_BGR2BGR555(VALUE klass, VALUE image);
-VALUE rb_RGB2BGR555(VALUE klass, VALUE image);
-VALUE rb_BGR5552BGR(VALUE klass, VALUE image);
-VALUE rb_BGR5552RGB(VALUE klass, VALUE image);
-VALUE rb_BGRA2BGR555(VALUE klass, VALUE image);
-VALUE rb_RGBA2BGR555(VALUE klass, VALUE image);
-VALUE rb_BGR5552BGRA(VALUE klass, VALUE image);
-VALUE rb_BGR5552RGBA(VALUE klass, VALUE image);
-VALUE rb_GRAY2BGR555(VALUE klass, VALUE image);
-VALUE rb_BGR5552GRAY(VALUE klass, VALUE image);
-VALUE rb_BGR2XYZ(VALUE klass, VALUE image);
-VALUE rb_RGB2XYZ(VALUE klass, VALUE image);
-VALUE rb_XYZ2BGR(VALUE klass, VALUE image);
-VALUE rb_XYZ2RGB(VALUE klass, VALUE image);
-VALUE rb_BGR2YCrCb(VALUE klass, VALUE image);
-VALUE rb_RGB2YCrCb(VALUE klass, VALUE image);
-VALUE rb_YCrCb2BGR(VALUE klass, VALUE image);
-VALUE rb_YCrCb2RGB(VALUE klass, VALUE image);
-VALUE rb_BGR2HSV(VALUE klass, VALUE image);
-VALUE rb_RGB2HSV(VALUE klass, VALUE image);
-VALUE rb_BGR2Lab(VALUE klass, VALUE image);
-VALUE rb_RGB2Lab(VALUE klass, VALUE image);
-VALUE rb_BayerBG2BGR(VALUE klass, VALUE image);
-VALUE rb_BayerGB2BGR(VALUE klass, VALUE image);
-VALUE rb_BayerRG2BGR(VALUE klass, VALUE image);
-VALUE rb_BayerGR2BGR(VALUE klass, VALUE image);
-VALUE rb_BayerBG2RGB(VALUE klass, VALUE image);
-VALUE rb_BayerGB2RGB(VALUE klass, VALUE image);
-VALUE rb_BayerRG2RGB(VALUE klass, VALUE image);
-VALUE rb_BayerGR2RGB(VALUE klass, VALUE image);
-VALUE rb_BGR2Luv(VALUE klass, VALUE image);
-VALUE rb_RGB2Luv(VALUE klass, VALUE image);
-VALUE rb_BGR2HLS(VALUE klass, VALUE image);
-VALUE rb_RGB2HLS(VALUE klass, VALUE image);
-VALUE rb_HSV2BGR(VALUE klass, VALUE image);
-VALUE rb_HSV2RGB(VALUE klass, VALUE image);
-VALUE rb_Lab2BGR(VALUE klass, VALUE image);
-VALUE rb_Lab2RGB(VALUE klass, VALUE image);
-VALUE rb_Luv2BGR(VALUE klass, VALUE image);
-VALUE rb_Luv2RGB(VALUE klass, VALUE image);
-VALUE rb_HLS2BGR(VALUE klass, VALUE image);
-VALUE rb_HLS2RGB(VALUE klass, VALUE image);
+typedef struct {
+  const char* name;
+  int code;
+  int src_cn;
+  int dest_cn;
+} cvtcolor_info_t;
+
+const cvtcolor_info_t* lookup_cvtcolor(const char* name);
+
+VALUE rb_BGR2BGRA(int argc, VALUE *argv, VALUE klass);
+VALUE rb_RGB2RGBA(int argc, VALUE *argv, VALUE klass);
+VALUE rb_BGRA2BGR(int argc, VALUE *argv, VALUE klass);
+VALUE rb_RGBA2RGB(int argc, VALUE *argv, VALUE klass);
+VALUE rb_BGR2RGBA(int argc, VALUE *argv, VALUE klass);
+VALUE rb_RGB2BGRA(int argc, VALUE *argv, VALUE klass);
+VALUE rb_RGBA2BGR(int argc, VALUE *argv, VALUE klass);
+VALUE rb_BGRA2RGB(int argc, VALUE *argv, VALUE klass);
+VALUE rb_BGR2RGB(int argc, VALUE *argv, VALUE klass);
+VALUE rb_RGB2BGR(int argc, VALUE *argv, VALUE klass);
+VALUE rb_BGRA2RGBA(int argc, VALUE *argv, VALUE klass);
+VALUE rb_RGBA2BGRA(int argc, VALUE *argv, VALUE klass);
+VALUE rb_BGR2GRAY(int argc, VALUE *argv, VALUE klass);
+VALUE rb_RGB2GRAY(int argc, VALUE *argv, VALUE klass);
+VALUE rb_GRAY2BGR(int argc, VALUE *argv, VALUE klass);
+VALUE rb_GRAY2RGB(int argc, VALUE *argv, VALUE klass);
+VALUE rb_GRAY2BGRA(int argc, VALUE *argv, VALUE klass);
+VALUE rb_GRAY2RGBA(int argc, VALUE *argv, VALUE klass);
+VALUE rb_BGRA2GRAY(int argc, VALUE *argv, VALUE klass);
+VALUE rb_RGBA2GRAY(int argc, VALUE *argv, VALUE klass);
+VALUE rb_BGR2BGR565(int argc, VALUE *argv, VALUE klass);
+VALUE rb_RGB2BGR565(int argc, VALUE *argv, VALUE klass);
+VALUE rb_BGR5652BGR(int argc, VALUE *argv, VALUE klass);
+VALUE rb_BGR5652RGB(int argc, VALUE *argv, VALUE klass);
+VALUE rb_BGRA2BGR565(int argc, VALUE *argv, VALUE klass);
+VALUE rb_RGBA2BGR565(int argc, VALUE *argv, VALUE klass);
+VALUE rb_BGR5652BGRA(int argc, VALUE *argv, VALUE klass);
+VALUE rb_BGR5652RGBA(int argc, VALUE *argv, VALUE klass);
+VALUE rb_GRAY2BGR565(int argc, VALUE *argv, VALUE klass);
+VALUE rb_BGR5652GRAY(int argc, VALUE *argv, VALUE klass);
+VALUE rb_BGR2BGR555(int argc, VALUE *argv, VALUE klass);
+VALUE rb_RGB2BGR555(int argc, VALUE *argv, VALUE klass);
+VALUE rb_BGR5552BGR(int argc, VALUE *argv, VALUE klass);
+VALUE rb_BGR5552RGB(int argc, VALUE *argv, VALUE klass);
+VALUE rb_BGRA2BGR555(int argc, VALUE *argv, VALUE klass);
+VALUE rb_RGBA2BGR555(int argc, VALUE *argv, VALUE klass);
+VALUE rb_BGR5552BGRA(int argc, VALUE *argv, VALUE klass);
+VALUE rb_BGR5552RGBA(int argc, VALUE *argv, VALUE klass);
+VALUE rb_GRAY2BGR555(int argc, VALUE *argv, VALUE klass);
+VALUE rb_BGR5552GRAY(int argc, VALUE *argv, VALUE klass);
+VALUE rb_BGR2XYZ(int argc, VALUE *argv, VALUE klass);
+VALUE rb_RGB2XYZ(int argc, VALUE *argv, VALUE klass);
+VALUE rb_XYZ2BGR(int argc, VALUE *argv, VALUE klass);
+VALUE rb_XYZ2RGB(int argc, VALUE *argv, VALUE klass);
+VALUE rb_BGR2YCrCb(int argc, VALUE *argv, VALUE klass);
+VALUE rb_RGB2YCrCb(int argc, VALUE *argv, VALUE klass);
+VALUE rb_YCrCb2BGR(int argc, VALUE *argv, VALUE klass);
+VALUE rb_YCrCb2RGB(int argc, VALUE *argv, VALUE klass);
+VALUE rb_BGR2HSV(int argc, VALUE *argv, VALUE klass);
+VALUE rb_RGB2HSV(int argc, VALUE *argv, VALUE klass);
+VALUE rb_BGR2Lab(int argc, VALUE *argv, VALUE klass);
+VALUE rb_RGB2Lab(int argc, VALUE *argv, VALUE klass);
+VALUE rb_BayerBG2BGR(int argc, VALUE *argv, VALUE klass);
+VALUE rb_BayerGB2BGR(int argc, VALUE *argv, VALUE klass);
+VALUE rb_BayerRG2BGR(int argc, VALUE *argv, VALUE klass);
+VALUE rb_BayerGR2BGR(int argc, VALUE *argv, VALUE klass);
+VALUE rb_BayerBG2RGB(int argc, VALUE *argv, VALUE klass);
+VALUE rb_BayerGB2RGB(int argc, VALUE *argv, VALUE klass);
+VALUE rb_BayerRG2RGB(int argc, VALUE *argv, VALUE klass);
+VALUE rb_BayerGR2RGB(int argc, VALUE *argv, VALUE klass);
+VALUE rb_BGR2Luv(int argc, VALUE *argv, VALUE klass);
+VALUE rb_RGB2Luv(int argc, VALUE *argv, VALUE klass);
+VALUE rb_BGR2HLS(int argc, VALUE *argv, VALUE klass);
+VALUE rb_RGB2HLS(int argc, VALUE *argv, VALUE klass);
+VALUE rb_HSV2BGR(int argc, VALUE *argv, VALUE klass);
+VALUE rb_HSV2RGB(int argc, VALUE *argv, VALUE klass);
+VALUE rb_Lab2BGR(int argc, VALUE *argv, VALUE klass);
+VALUE rb_Lab2RGB(int argc, VALUE *argv, VALUE klass);
+VALUE rb_Luv2BGR(int argc, VALUE *argv, VALUE klass);
+VALUE rb_Luv2RGB(int argc, VALUE *argv, VALUE klass);
+VALUE rb_HLS2BGR(int argc, VALUE *argv, VALUE klass);
+VALUE rb_HLS2RGB(int argc, VALUE *argv, VALUE klass);
 
 VALUE rb_build_information(VALUE klass);
+VALUE rb_buffer_pool_limit(VALUE klass);
+VALUE rb_set_buffer_pool_limit(VALUE klass, VALUE bytes);
+VALUE rb_buffer_pool_stats(VALUE klass);
+VALUE rb_clear_buffer_pool(VALUE klass);
 
 __NAMESPACE_END_OPENCV
 
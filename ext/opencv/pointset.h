@@ -40,7 +40,7 @@ POINTSET(VALUE object)
 {
   CvPoint *pointset = (CvPoint*)cvAlloc(CVSEQ(object)->total * sizeof(CvPoint));  
   cvCvtSeqToArray(CVSEQ(object), pointset, CV_WHOLE_SEQ);
-  if (cCvSeq::seqblock_class(CVSEQ(object)) == cCvPoint2D32f::rb_class()) {
+  if (cCvSeq::seqblock_class(object) == cCvPoint2D32f::rb_class()) {
     for(int i =0; i < CVSEQ(object)->total; i++)
       pointset[i] = cvPointFrom32f(((CvPoint2D32f*)pointset)[i]);
   }
@@ -52,7 +52,7 @@ POINTSET2D32f(VALUE object)
 {
   CvPoint2D32f *pointset = (CvPoint2D32f*)cvAlloc(CVSEQ(object)->total * sizeof(CvPoint2D32f));
   cvCvtSeqToArray(CVSEQ(object), pointset, CV_WHOLE_SEQ);
-  if (cCvSeq::seqblock_class(CVSEQ(object)) == cCvPoint::rb_class()) {
+  if (cCvSeq::seqblock_class(object) == cCvPoint::rb_class()) {
     for(int i = 0; i < CVSEQ(object)->total; i++)
       pointset[i] = cvPointTo32f(((CvPoint*)pointset)[i]);
   }
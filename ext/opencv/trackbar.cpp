@@ -25,9 +25,15 @@ VALUE rb_class() {
   return rb_klass;
 }
 
+const rb_data_type_t data_type = {
+  "OpenCV::GUI::Trackbar",
+  { trackbar_mark, trackbar_free, memsize_struct<Trackbar>, },
+  &opencv_data_type, 0, RUBY_TYPED_FREE_IMMEDIATELY
+};
+
 VALUE rb_allocate(VALUE klass) {
   Trackbar *ptr;
-  return Data_Make_Struct(klass, Trackbar, trackbar_mark, trackbar_free, ptr);
+  return TypedData_Make_Struct(klass, Trackbar, &data_type, ptr);
 }
 
 void trackbar_mark(void *ptr) {
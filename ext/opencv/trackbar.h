@@ -50,7 +50,7 @@ __NAMESPACE_END_TRACKBAR
 inline Trackbar*
 TRACKBAR(VALUE object) {
   Trackbar *ptr;
-  Data_Get_Struct(object, Trackbar, ptr);
+  ptr = (Trackbar*)OPENCV_DATA_PTR(object);
   return ptr;
 }
 
@@ -0,0 +1,1602 @@
+/************************************************************
+
+    videoio.cpp -
+
+    $Author: ser1zw $
+
+    Copyright (C) 2013 ser1zw
+
+************************************************************/
+#include "videoio.h"
+#include "imagecodec.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#define rb_cv_fseek _fseeki64
+#else
+#define rb_cv_fseek fseeko
+#endif
+#ifndef S_ISREG
+#define S_ISREG(m) (((m) & S_IFMT) == S_IFREG)
+#endif
+
+/*
+ * Adapters of highgui
+ */
+class HighguiVideoSource : public rb_cvVideoSource {
+public:
+  HighguiVideoSource(CvCapture* capture) : capture(capture) {}
+  ~HighguiVideoSource() { cvReleaseCapture(&capture); }
+  bool grab() { return cvGrabFrame(capture) != 0; }
+  IplImage* retrieve() { return cvRetrieveFrame(capture); }
+  double get(int id) { return cvGetCaptureProperty(capture, id); }
+  bool set(int id, double value) { return cvSetCaptureProperty(capture, id, value) != 0; }
+private:
+  CvCapture* capture;
+};
+
+class HighguiVideoSink : public rb_cvVideoSink {
+public:
+  HighguiVideoSink(CvVideoWriter* writer) : writer(writer) {}
+  ~HighguiVideoSink() { cvReleaseVideoWriter(&writer); }
+  bool write(const IplImage* image) { return cvWriteFrame(writer, image) != 0; }
+private:
+  CvVideoWriter* writer;
+};
+
+rb_cvVideoSource*
+rb_cvCreateHighguiSource(CvCapture* capture)
+{
+  return new HighguiVideoSource(capture);
+}
+
+rb_cvVideoSink*
+rb_cvCreateHighguiSink(CvVideoWriter* writer)
+{
+  return new HighguiVideoSink(writer);
+}
+
+/*
+ * Byte streams
+ */
+unsigned int
+get_le32(const uchar* p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+void
+put_le16(uchar* p, unsigned int value)
+{
+  p[0] = value & 0xFF;
+  p[1] = (value >> 8) & 0xFF;
+}
+
+void
+put_le32(uchar* p, unsigned int value)
+{
+  p[0] = value & 0xFF;
+  p[1] = (value >> 8) & 0xFF;
+  p[2] = (value >> 16) & 0xFF;
+  p[3] = (value >> 24) & 0xFF;
+}
+
+inline bool
+fourcc_is(const uchar* p, const char* fourcc)
+{
+  return memcmp(p, fourcc, 4) == 0;
+}
+
+class FileByteSource : public rb_cvByteSource {
+public:
+  FileByteSource(FILE* file, long long length) : file(file), length(length) {}
+  ~FileByteSource() { fclose(file); }
+  size_t read(void* buffer, size_t size) { return fread(buffer, 1, size, file); }
+  bool seek(long long offset) { return length >= 0 && rb_cv_fseek(file, offset, SEEK_SET) == 0; }
+  long long size() { return length; }
+private:
+  FILE* file;
+  long long length; // -1 for pipes, which are not seekable
+};
+
+rb_cvByteSource*
+rb_cvOpenFileSource(const char* filename)
+{
+  FILE* file = fopen(filename, "rb");
+  if (file == NULL)
+    return NULL;
+  struct stat st;
+  bool regular = (fstat(fileno(file), &st) == 0 && S_ISREG(st.st_mode));
+  return new FileByteSource(file, regular ? (long long)st.st_size : -1);
+}
+
+class MemoryByteSource : public rb_cvByteSource {
+public:
+  MemoryByteSource(const uchar* data, size_t length, bool copy) : data(data), length(length), pos(0) {
+    if (copy) {
+      copied.assign(data, data + length);
+      this->data = copied.empty() ? NULL : &copied[0];
+    }
+  }
+  size_t read(void* buffer, size_t size) {
+    size = std::min(size, length - pos);
+    if (size > 0)
+      memcpy(buffer, data + pos, size);
+    pos += size;
+    return size;
+  }
+  bool seek(long long offset) {
+    if (offset < 0 || offset > (long long)length)
+      return false;
+    pos = (size_t)offset;
+    return true;
+  }
+  long long size() { return length; }
+private:
+  const uchar* data;
+  size_t length;
+  size_t pos;
+  std::vector<uchar> copied;
+};
+
+rb_cvByteSource*
+rb_cvCreateMemorySource(const uchar* data, size_t size, bool copy)
+{
+  return new MemoryByteSource(data, size, copy);
+}
+
+rb_cvByteQueue::rb_cvByteQueue(size_t capacity) : ring(capacity), head(0), count(0), is_finished(false),
+						  is_closed(false), interrupted(false) {}
+
+size_t
+rb_cvByteQueue::push(const uchar* data, size_t size)
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  size_t capacity = ring.size(), done = 0;
+  interrupted = false;
+  while (done < size) {
+    cond.wait(lock, [&] { return count < capacity || is_closed || interrupted; });
+    if (is_closed || interrupted)
+      break;
+    size_t n = std::min(size - done, capacity - count);
+    size_t tail = (head + count) % capacity;
+    size_t first = std::min(n, capacity - tail);
+    memcpy(&ring[tail], data + done, first);
+    memcpy(&ring[0], data + done + first, n - first);
+    count += n;
+    done += n;
+    cond.notify_all();
+  }
+  return done;
+}
+
+size_t
+rb_cvByteQueue::pop(uchar* buffer, size_t size)
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  cond.wait(lock, [&] { return count > 0 || is_finished || is_closed; });
+  size_t capacity = ring.size();
+  size_t n = std::min(size, count);
+  size_t first = std::min(n, capacity - head);
+  memcpy(buffer, &ring[head], first);
+  memcpy(buffer + first, &ring[0], n - first);
+  head = (head + n) % capacity;
+  count -= n;
+  cond.notify_all();
+  return n;
+}
+
+void
+rb_cvByteQueue::finish()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  is_finished = true;
+  cond.notify_all();
+}
+
+void
+rb_cvByteQueue::close()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  is_closed = true;
+  count = 0;
+  cond.notify_all();
+}
+
+void
+rb_cvByteQueue::interrupt()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  interrupted = true;
+  cond.notify_all();
+}
+
+bool
+rb_cvByteQueue::closed()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return is_closed;
+}
+
+class QueueByteSource : public rb_cvByteSource {
+public:
+  QueueByteSource(const std::shared_ptr<rb_cvByteQueue>& queue) : queue(queue) {}
+  ~QueueByteSource() { queue->close(); }
+  size_t read(void* buffer, size_t size) { return queue->pop((uchar*)buffer, size); }
+private:
+  std::shared_ptr<rb_cvByteQueue> queue;
+};
+
+rb_cvByteSource*
+rb_cvCreateQueueSource(const std::shared_ptr<rb_cvByteQueue>& queue)
+{
+  return new QueueByteSource(queue);
+}
+
+/*
+ * Buffered reader over a byte source, which keeps track of the position
+ */
+class ByteReader {
+public:
+  ByteReader(rb_cvByteSource* source) : source(source), begin(0), end(0), offset(0) {}
+  ~ByteReader() { delete source; }
+
+  int getc() {
+    if (begin == end && !fill())
+      return EOF;
+    return buffer[begin++];
+  }
+
+  size_t read(void* dst, size_t size) {
+    uchar* p = (uchar*)dst;
+    size_t done = 0;
+    while (done < size) {
+      if (begin == end) {
+	if (size - done >= sizeof(buffer)) { // large reads bypass the buffer
+	  size_t n = source->read(p + done, size - done);
+	  if (n == 0)
+	    break;
+	  offset += n;
+	  done += n;
+	  continue;
+	}
+	if (!fill())
+	  break;
+      }
+      size_t n = std::min(size - done, end - begin);
+      memcpy(p + done, buffer + begin, n);
+      begin += n;
+      done += n;
+    }
+    return done;
+  }
+
+  // Copies the next bytes without consuming them (size <= sizeof(buffer))
+  size_t peek(uchar* dst, size_t size) {
+    if (end - begin < size) {
+      memmove(buffer, buffer + begin, end - begin);
+      end -= begin;
+      begin = 0;
+      while (end < size) {
+	size_t n = source->read(buffer + end, sizeof(buffer) - end);
+	if (n == 0)
+	  break;
+	offset += n;
+	end += n;
+      }
+    }
+    size = std::min(size, end - begin);
+    memcpy(dst, buffer + begin, size);
+    return size;
+  }
+
+  bool skip(long long size) {
+    if (size <= (long long)(end - begin)) {
+      begin += (size_t)size;
+      return true;
+    }
+    if (seek(position() + size))
+      return true;
+    while (size > 0) {
+      if (begin == end && !fill())
+	return false;
+      size_t n = (size_t)std::min(size, (long long)(end - begin));
+      begin += n;
+      size -= n;
+    }
+    return true;
+  }
+
+  bool seek(long long position) {
+    if (!source->seek(position))
+      return false;
+    begin = end = 0;
+    offset = position;
+    return true;
+  }
+
+  bool seekable() { return source->size() >= 0; }
+  long long position() { return offset - (long long)(end - begin); }
+  long long size() { return source->size(); }
+
+private:
+  bool fill() {
+    begin = 0;
+    end = source->read(buffer, sizeof(buffer));
+    offset += end;
+    return end > 0;
+  }
+
+  rb_cvByteSource* source;
+  uchar buffer[65536];
+  size_t begin;
+  size_t end;
+  long long offset; // of the end of the buffer
+};
+
+/*
+ * Common part of the native readers
+ *
+ * grab() only reads the data of a frame, and retrieve() decodes it on demand
+ * into an image reused over the frames.
+ */
+class RawVideoSource : public rb_cvVideoSource {
+public:
+  RawVideoSource(ByteReader* reader) : reader(reader), frame(NULL), width(0), height(0), fps(25),
+				       frame_count(0), fourcc(0), pos(0), data_start(0),
+				       grabbed(false), decoded(false) {}
+
+  virtual ~RawVideoSource() {
+    if (frame)
+      cvReleaseImage(&frame);
+    delete reader;
+  }
+
+  bool grab() {
+    grabbed = read_frame();
+    decoded = false;
+    if (grabbed)
+      pos++;
+    return grabbed;
+  }
+
+  IplImage* retrieve() {
+    if (!grabbed)
+      return NULL;
+    if (!decoded) {
+      decode();
+      decoded = true;
+    }
+    return frame;
+  }
+
+  double get(int id) {
+    switch (id) {
+    case CV_CAP_PROP_POS_FRAMES:
+      return pos;
+    case CV_CAP_PROP_POS_MSEC:
+      return pos * 1000.0 / fps;
+    case CV_CAP_PROP_POS_AVI_RATIO:
+      return (frame_count > 0) ? (double)pos / frame_count : 0;
+    case CV_CAP_PROP_FRAME_WIDTH:
+      return width;
+    case CV_CAP_PROP_FRAME_HEIGHT:
+      return height;
+    case CV_CAP_PROP_FPS:
+      return fps;
+    case CV_CAP_PROP_FOURCC:
+      return fourcc;
+    case CV_CAP_PROP_FRAME_COUNT:
+      return frame_count;
+    case CV_CAP_PROP_CONVERT_RGB:
+      return 1;
+    }
+    return 0;
+  }
+
+  bool set(int id, double value) {
+    long target;
+    switch (id) {
+    case CV_CAP_PROP_POS_FRAMES:
+      target = cvRound(value);
+      break;
+    case CV_CAP_PROP_POS_MSEC:
+      target = cvRound(value * fps / 1000.0);
+      break;
+    case CV_CAP_PROP_POS_AVI_RATIO:
+      if (frame_count <= 0)
+	return false;
+      target = cvRound(value * frame_count);
+      break;
+    default:
+      return false;
+    }
+    if (target < 0)
+      target = 0;
+    if (frame_count > 0 && target > frame_count)
+      target = frame_count;
+    grabbed = false;
+    return seek_frame(target);
+  }
+
+protected:
+  // Reads the data of the next frame, false at the end of the stream
+  virtual bool read_frame() = 0;
+  // Decodes the data of the last frame into frame
+  virtual void decode() = 0;
+
+  // Moves before the frame at index, and sets pos. Reads forward (from the start
+  // if needed), which subclasses override with direct seeks.
+  virtual bool seek_frame(long index) {
+    if (index < pos) {
+      if (!reader->seek(data_start))
+	return false;
+      pos = 0;
+    }
+    while (pos < index && read_frame())
+      pos++;
+    return true;
+  }
+
+  void decode_jpeg() {
+    if (data.empty()) { // repeats the previous frame
+      if (frame == NULL)
+	CV_Error(CV_StsParseError, "Empty first frame");
+      return;
+    }
+    CvMat buf = cvMat(1, (int)data.size(), CV_8UC1, &data[0]);
+    IplImage* image = rb_cvDecodeImageReduced(&buf, CV_LOAD_IMAGE_COLOR, 1);
+    if (image == NULL)
+      CV_Error(CV_StsParseError, "Could not decode a JPEG frame");
+    if (frame)
+      cvReleaseImage(&frame);
+    frame = image;
+  }
+
+  ByteReader* reader;
+  IplImage* frame;
+  int width;
+  int height;
+  double fps;
+  long frame_count; // 0 if unknown
+  int fourcc;
+  long pos;
+  long long data_start;
+  bool grabbed;
+  bool decoded;
+  std::vector<uchar> data;
+
+  // Bounds of the sizes read from the files, so that a corrupted header can not allocate more
+  static const size_t MAX_FRAME_SIZE = 256 << 20;
+  static const long MAX_FRAME_DIMENSION = 1 << 15;
+};
+
+/*
+ * YUV4MPEG2 reader
+ */
+class Y4MVideoSource : public RawVideoSource {
+public:
+  Y4MVideoSource(ByteReader* reader) : RawVideoSource(reader), full_range(false),
+				       y_plane(NULL), cb_plane(NULL), cr_plane(NULL), ycc(NULL) {
+    std::string header;
+    if (!read_line(&header) || header.compare(0, 10, "YUV4MPEG2 ") != 0)
+      CV_Error(CV_StsParseError, "Invalid YUV4MPEG2 header");
+    std::string chroma = "420jpeg";
+    size_t p = 10;
+    while (p < header.size()) {
+      size_t q = header.find(' ', p);
+      if (q == std::string::npos)
+	q = header.size();
+      std::string token = header.substr(p, q - p);
+      p = q + 1;
+      if (token.empty())
+	continue;
+      const char* value = token.c_str() + 1;
+      switch (token[0]) {
+      case 'W':
+	width = parse_dimension(value);
+	break;
+      case 'H':
+	height = parse_dimension(value);
+	break;
+      case 'F': {
+	int num = 0, den = 0;
+	if (sscanf(value, "%d:%d", &num, &den) == 2 && num > 0 && den > 0)
+	  fps = (double)num / den;
+	break;
+      }
+      case 'C':
+	chroma = value;
+	break;
+      case 'X':
+	if (token == "XCOLORRANGE=FULL")
+	  full_range = true;
+	break;
+      }
+    }
+    if (width <= 0 || height <= 0)
+      CV_Error(CV_StsParseError, "Invalid frame size in the YUV4MPEG2 header");
+
+    // 8-bit only: the high bit depth colorspaces (420p10, 422p12, 444p16, mono16, ...) are rejected
+    if (chroma == "420jpeg" || chroma == "420paldv" || chroma == "420mpeg2" || chroma == "420") {
+      chroma_size = cvSize((width + 1) / 2, (height + 1) / 2);
+      fourcc = CV_FOURCC('I', '4', '2', '0');
+    }
+    else if (chroma == "422") {
+      chroma_size = cvSize((width + 1) / 2, height);
+      fourcc = CV_FOURCC('Y', '4', '2', 'B');
+    }
+    else if (chroma == "444") {
+      chroma_size = cvSize(width, height);
+      fourcc = CV_FOURCC('4', '4', '4', 'P');
+    }
+    else if (chroma == "mono") {
+      chroma_size = cvSize(0, 0);
+      fourcc = CV_FOURCC('Y', '8', '0', '0');
+    }
+    else
+      CV_Error(CV_StsUnsupportedFormat, "Unsupported chroma subsampling in the YUV4MPEG2 header");
+
+    frame_size = (size_t)width * height + 2 * (size_t)chroma_size.width * chroma_size.height;
+    if (frame_size > MAX_FRAME_SIZE)
+      CV_Error(CV_StsOutOfRange, "Too large frame size in the YUV4MPEG2 header");
+    data.resize(frame_size);
+    data_start = reader->position();
+    if (reader->size() > 0)
+      frame_count = (long)((reader->size() - data_start) / (long long)(6 + frame_size));
+  }
+
+  ~Y4MVideoSource() {
+    if (y_plane)
+      cvReleaseImage(&y_plane);
+    if (cb_plane)
+      cvReleaseImage(&cb_plane);
+    if (cr_plane)
+      cvReleaseImage(&cr_plane);
+    if (ycc)
+      cvReleaseImage(&ycc);
+  }
+
+protected:
+  bool read_frame() {
+    std::string line;
+    if (!read_line(&line))
+      return false;
+    if (line.compare(0, 5, "FRAME") != 0)
+      CV_Error(CV_StsParseError, "Invalid YUV4MPEG2 frame header");
+    return reader->read(&data[0], frame_size) == frame_size;
+  }
+
+  void decode() {
+    CvSize size = cvSize(width, height);
+    if (frame == NULL) {
+      frame = cvCreateImage(size, IPL_DEPTH_8U, 3);
+      y_plane = cvCreateImage(size, IPL_DEPTH_8U, 1);
+    }
+    CvMat y = cvMat(height, width, CV_8UC1, &data[0]);
+    if (full_range)
+      cvCopy(&y, y_plane);
+    else
+      cvConvertScale(&y, y_plane, 255.0 / 219, -16 * 255.0 / 219);
+    if (chroma_size.width == 0) {
+      cvCvtColor(y_plane, frame, CV_GRAY2BGR);
+      return;
+    }
+
+    if (ycc == NULL) {
+      cb_plane = cvCreateImage(size, IPL_DEPTH_8U, 1);
+      cr_plane = cvCreateImage(size, IPL_DEPTH_8U, 1);
+      ycc = cvCreateImage(size, IPL_DEPTH_8U, 3);
+    }
+    size_t chroma_bytes = (size_t)chroma_size.width * chroma_size.height;
+    uchar* cb = &data[(size_t)width * height];
+    CvMat u = cvMat(chroma_size.height, chroma_size.width, CV_8UC1, cb);
+    CvMat v = cvMat(chroma_size.height, chroma_size.width, CV_8UC1, cb + chroma_bytes);
+    upsample(&u, cb_plane);
+    upsample(&v, cr_plane);
+    cvMerge(y_plane, cr_plane, cb_plane, NULL, ycc);
+    cvCvtColor(ycc, frame, CV_YCrCb2BGR);
+  }
+
+  // Frames are at fixed offsets unless the frame headers have parameters
+  bool seek_frame(long index) {
+    long long offset = data_start + index * (long long)(6 + frame_size);
+    if (reader->seek(offset)) {
+      char head[6];
+      if (index == frame_count ||
+	  (reader->read(head, 6) == 6 && memcmp(head, "FRAME\n", 6) == 0 && reader->seek(offset))) {
+	pos = index;
+	return true;
+      }
+      if (!reader->seek(data_start)) // frame headers with parameters
+	return false;
+      pos = 0;
+    }
+    return RawVideoSource::seek_frame(index);
+  }
+
+private:
+  // Returns the value of a W or H parameter, or 0 if it is invalid or too large
+  static int parse_dimension(const char* value) {
+    char* end;
+    long n = strtol(value, &end, 10);
+    return (end != value && *end == '\0' && n > 0 && n <= MAX_FRAME_DIMENSION) ? (int)n : 0;
+  }
+
+  bool read_line(std::string* line) {
+    int c;
+    while ((c = reader->getc()) != EOF && c != '\n') {
+      if (line->size() >= 1024)
+	CV_Error(CV_StsParseError, "Too long YUV4MPEG2 header");
+      line->push_back((char)c);
+    }
+    return c != EOF || !line->empty();
+  }
+
+  void upsample(const CvMat* src, IplImage* dst) {
+    if (src->cols == dst->width && src->rows == dst->height)
+      cvCopy(src, dst);
+    else
+      cvResize(src, dst, CV_INTER_LINEAR);
+    if (!full_range)
+      cvConvertScale(dst, dst, 255.0 / 224, 128 - 128 * 255.0 / 224);
+  }
+
+  bool full_range;
+  CvSize chroma_size;
+  size_t frame_size;
+  IplImage* y_plane;
+  IplImage* cb_plane;
+  IplImage* cr_plane;
+  IplImage* ycc;
+};
+
+/*
+ * Motion JPEG in AVI reader
+ *
+ * Reads the movi list sequentially, so non-seekable streams work. Seekable files
+ * are also indexed from idx1 for direct seeks.
+ */
+class AviMjpegVideoSource : public RawVideoSource {
+public:
+  AviMjpegVideoSource(ByteReader* reader) : RawVideoSource(reader), video_stream(-1),
+					    stream_count(0), compression(0), movi_end(-1) {
+    uchar head[12];
+    if (reader->read(head, 12) != 12 || !fourcc_is(head, "RIFF") || !fourcc_is(head + 8, "AVI "))
+      CV_Error(CV_StsParseError, "Invalid AVI header");
+    while (data_start == 0) {
+      if (reader->read(head, 8) != 8)
+	CV_Error(CV_StsParseError, "No movi list in the AVI file");
+      unsigned int size = get_le32(head + 4);
+      if (fourcc_is(head, "LIST")) {
+	if (reader->read(head + 8, 4) != 4 || (size < 4 && !fourcc_is(head + 8, "movi")))
+	  CV_Error(CV_StsParseError, "Invalid AVI list");
+	if (fourcc_is(head + 8, "hdrl"))
+	  parse_list(size - 4, 0);
+	else if (fourcc_is(head + 8, "movi")) {
+	  data_start = reader->position();
+	  if (size > 4 && reader->size() >= data_start + size - 4)
+	    movi_end = data_start + size - 4;
+	}
+	else
+	  reader->skip(size - 4 + (size & 1));
+      }
+      else if (!reader->skip(size + (size & 1)))
+	CV_Error(CV_StsParseError, "No movi list in the AVI file");
+    }
+    if (video_stream < 0)
+      CV_Error(CV_StsParseError, "No video stream in the AVI file");
+    if (compression != CV_FOURCC('M', 'J', 'P', 'G') && compression != CV_FOURCC('m', 'j', 'p', 'g') &&
+	compression != CV_FOURCC('J', 'P', 'E', 'G') && compression != CV_FOURCC('j', 'p', 'e', 'g'))
+      CV_Error(CV_StsUnsupportedFormat, "Only Motion JPEG is supported in AVI files");
+    fourcc = CV_FOURCC('M', 'J', 'P', 'G');
+    if (movi_end > 0)
+      read_index();
+  }
+
+protected:
+  bool read_frame() {
+    uchar head[12];
+    while (reader->read(head, 8) == 8) {
+      unsigned int size = get_le32(head + 4);
+      if (fourcc_is(head, "LIST") || fourcc_is(head, "RIFF")) {
+	if (reader->read(head + 8, 4) != 4)
+	  return false;
+	if (fourcc_is(head + 8, "movi") || fourcc_is(head + 8, "rec ") || fourcc_is(head + 8, "AVIX"))
+	  continue; // frames are inside
+	if (!reader->skip(size - 4 + (size & 1)))
+	  return false;
+      }
+      else if (head[0] == stream_id[0] && head[1] == stream_id[1] && head[2] == 'd' &&
+	       (head[3] == 'c' || head[3] == 'b')) {
+	if (size > MAX_FRAME_SIZE)
+	  CV_Error(CV_StsOutOfRange, "Too large frame in the AVI file");
+	data.resize(size);
+	if (size > 0 && reader->read(&data[0], size) != size)
+	  return false;
+	reader->skip(size & 1);
+	return true;
+      }
+      else if (!reader->skip(size + (size & 1)))
+	return false;
+    }
+    return false;
+  }
+
+  void decode() {
+    decode_jpeg();
+  }
+
+  bool seek_frame(long index) {
+    if (index < (long)offsets.size() && reader->seek(offsets[index])) {
+      pos = index;
+      return true;
+    }
+    if (index == (long)offsets.size() && index > 0 && reader->seek(movi_end)) {
+      pos = index;
+      return true;
+    }
+    return RawVideoSource::seek_frame(index);
+  }
+
+private:
+  // Walks the chunks of hdrl for the first video stream
+  void parse_list(long long size, int depth) {
+    uchar head[56];
+    int stream = -1;
+    long long end = reader->position() + size;
+    while (reader->position() + 8 <= end) {
+      if (reader->read(head, 8) != 8)
+	CV_Error(CV_StsParseError, "Truncated AVI header");
+      unsigned int chunk_size = get_le32(head + 4);
+      long long next = reader->position() + chunk_size + (chunk_size & 1);
+      if (fourcc_is(head, "LIST") && depth == 0) {
+	if (reader->read(head, 4) != 4)
+	  CV_Error(CV_StsParseError, "Truncated AVI header");
+	if (fourcc_is(head, "strl")) {
+	  stream_count++;
+	  parse_list(chunk_size - 4, 1);
+	}
+      }
+      else if (fourcc_is(head, "avih") && chunk_size >= 40) {
+	reader->read(head, 40);
+	unsigned int usec = get_le32(head);
+	if (usec > 0)
+	  fps = 1e6 / usec;
+	frame_count = get_le32(head + 16);
+	width = get_le32(head + 32);
+	height = get_le32(head + 36);
+      }
+      else if (fourcc_is(head, "strh") && chunk_size >= 36) {
+	reader->read(head, 36);
+	if (fourcc_is(head, "vids") && video_stream < 0) {
+	  stream = video_stream = stream_count - 1;
+	  stream_id[0] = '0' + video_stream / 10;
+	  stream_id[1] = '0' + video_stream % 10;
+	  unsigned int scale = get_le32(head + 20), rate = get_le32(head + 24);
+	  if (scale > 0 && rate > 0)
+	    fps = (double)rate / scale;
+	  if (get_le32(head + 32) > 0)
+	    frame_count = get_le32(head + 32);
+	}
+      }
+      else if (fourcc_is(head, "strf") && chunk_size >= 20 && stream >= 0 && stream == video_stream) {
+	reader->read(head, 20);
+	width = get_le32(head + 4);
+	height = abs((int)get_le32(head + 8)); // negative for top-down
+	compression = get_le32(head + 16);
+      }
+      long long rest = next - reader->position();
+      if (rest > 0 && !reader->skip(rest))
+	CV_Error(CV_StsParseError, "Truncated AVI header");
+    }
+  }
+
+  // Reads the offsets of the video frames from idx1, which are either from the
+  // 'movi' fourcc or from the start of the file
+  void read_index() {
+    uchar head[16];
+    bool found = false;
+    if (reader->seek(movi_end)) {
+      while (reader->read(head, 8) == 8) {
+	unsigned int size = get_le32(head + 4);
+	if (fourcc_is(head, "idx1")) {
+	  found = true;
+	  for (unsigned int i = 0; i + 16 <= size && reader->read(head, 16) == 16; i += 16) {
+	    if (head[0] == stream_id[0] && head[1] == stream_id[1] && head[2] == 'd')
+	      offsets.push_back(get_le32(head + 8));
+	  }
+	  break;
+	}
+	if (!reader->skip(size + (size & 1)))
+	  break;
+      }
+    }
+    if (found && !offsets.empty()) {
+      long long base = -1;
+      long long candidates[2] = { data_start - 4, 0 };
+      for (int i = 0; i < 2 && base < 0; ++i) {
+	if (reader->seek(candidates[i] + offsets[0]) && reader->read(head, 2) == 2 &&
+	    head[0] == stream_id[0] && head[1] == stream_id[1])
+	  base = candidates[i];
+      }
+      if (base < 0)
+	offsets.clear();
+      for (size_t i = 0; i < offsets.size(); ++i)
+	offsets[i] += base;
+      if (!offsets.empty())
+	frame_count = (long)offsets.size();
+    }
+    if (!reader->seek(data_start))
+      CV_Error(CV_StsError, "Could not seek in the AVI file");
+  }
+
+  int video_stream;
+  int stream_count;
+  char stream_id[2];
+  unsigned int compression;
+  long long movi_end; // -1 if unknown
+  std::vector<long long> offsets; // of the chunk headers of the frames
+};
+
+/*
+ * Concatenated JPEG images (e.g. a multipart HTTP stream without the headers)
+ *
+ * The JPEG markers are parsed to find the end of each image. The frame rate is
+ * not stored in the stream, and the offsets of the frames are recorded while reading.
+ */
+class MjpegVideoSource : public RawVideoSource {
+public:
+  MjpegVideoSource(ByteReader* reader, double rate) : RawVideoSource(reader), pending(false) {
+    if (rate > 0)
+      fps = rate;
+    fourcc = CV_FOURCC('M', 'J', 'P', 'G');
+    if (!read_frame())
+      CV_Error(CV_StsParseError, "No JPEG image in the stream");
+    rb_cvImageInfo info;
+    if (rb_cvProbeImage(&data[0], data.size(), &info) != 1)
+      CV_Error(CV_StsParseError, "Invalid JPEG image in the stream");
+    width = info.width;
+    height = info.height;
+    pending = true;
+  }
+
+protected:
+  bool read_frame() {
+    if (pending) { // the first frame read at open
+      pending = false;
+      return true;
+    }
+    int prev = EOF, c;
+    while ((c = reader->getc()) != EOF) {
+      if (prev == 0xFF && c == 0xD8)
+	break;
+      prev = c;
+    }
+    if (c == EOF)
+      return false;
+    long long start = reader->position() - 2;
+    data.clear();
+    data.push_back(0xFF);
+    data.push_back(0xD8);
+
+    int marker = EOF;
+    while (true) {
+      if (marker == EOF) {
+	if (reader->getc() != 0xFF)
+	  return corrupt();
+	while ((marker = reader->getc()) == 0xFF) // fill bytes
+	  ;
+	if (marker == EOF)
+	  return false;
+      }
+      data.push_back(0xFF);
+      data.push_back((uchar)marker);
+      if (marker == 0xD9) // EOI
+	break;
+      int m = marker;
+      marker = EOF;
+      if (m == 0x01 || (m >= 0xD0 && m <= 0xD7)) // no length
+	continue;
+      uchar len[2];
+      if (reader->read(len, 2) != 2)
+	return false;
+      size_t length = (len[0] << 8) | len[1];
+      if (length < 2)
+	return corrupt();
+      size_t offset = data.size();
+      data.resize(offset + length);
+      memcpy(&data[offset], len, 2);
+      if (reader->read(&data[offset + 2], length - 2) != length - 2)
+	return false;
+      if (data.size() > MAX_FRAME_SIZE)
+	CV_Error(CV_StsOutOfRange, "Too large JPEG image in the stream");
+      if (m != 0xDA) // SOS is followed by the entropy-coded data
+	continue;
+      while (marker == EOF) {
+	if ((c = reader->getc()) == EOF)
+	  return false;
+	if (c != 0xFF)
+	  data.push_back((uchar)c);
+	else {
+	  while ((c = reader->getc()) == 0xFF)
+	    ;
+	  if (c == EOF)
+	    return false;
+	  if (c == 0x00 || (c >= 0xD0 && c <= 0xD7)) { // stuffed byte or restart marker
+	    data.push_back(0xFF);
+	    data.push_back((uchar)c);
+	  }
+	  else
+	    marker = c;
+	}
+	if (data.size() > MAX_FRAME_SIZE) // a stream without EOI must not fill the memory
+	  CV_Error(CV_StsOutOfRange, "Too large JPEG image in the stream");
+      }
+    }
+    if ((size_t)pos == offsets.size())
+      offsets.push_back(start);
+    return true;
+  }
+
+  void decode() {
+    decode_jpeg();
+  }
+
+  bool seek_frame(long index) {
+    pending = false;
+    if (index < (long)offsets.size() && reader->seek(offsets[index])) {
+      pos = index;
+      return true;
+    }
+    if (!offsets.empty() && index > pos && reader->seek(offsets.back())) {
+      pos = (long)offsets.size() - 1;
+      return RawVideoSource::seek_frame(index);
+    }
+    return RawVideoSource::seek_frame(index);
+  }
+
+private:
+  bool corrupt() {
+    CV_Error(CV_StsParseError, "Invalid JPEG data in the stream");
+    return false;
+  }
+
+  bool pending;
+  std::vector<long long> offsets; // of the frames read so far
+};
+
+int
+rb_cvSniffVideoFormat(const uchar* head, size_t size)
+{
+  if (size >= 10 && memcmp(head, "YUV4MPEG2 ", 10) == 0)
+    return RB_CV_VIDEO_Y4M;
+  if (size >= 12 && fourcc_is(head, "RIFF") && fourcc_is(head + 8, "AVI "))
+    return RB_CV_VIDEO_AVI_MJPEG;
+  if (size >= 3 && head[0] == 0xFF && head[1] == 0xD8 && head[2] == 0xFF)
+    return RB_CV_VIDEO_MJPEG;
+  return RB_CV_VIDEO_UNKNOWN;
+}
+
+/*
+ * Format of a file from its first bytes. Pipes are not read (they could not be read again),
+ * and their format is guessed from the file name.
+ */
+int
+rb_cvSniffVideoFile(const char* filename)
+{
+  struct stat st;
+  if (stat(filename, &st) == 0 && !S_ISREG(st.st_mode))
+    return rb_cvVideoFormatFromFilename(filename);
+  FILE* file = fopen(filename, "rb");
+  if (file == NULL)
+    return RB_CV_VIDEO_UNKNOWN;
+  uchar head[12];
+  size_t size = fread(head, 1, sizeof(head), file);
+  fclose(file);
+  return rb_cvSniffVideoFormat(head, size);
+}
+
+int
+rb_cvVideoFormatFromFilename(const char* filename)
+{
+  const char* dot = strrchr(filename, '.');
+  if (dot == NULL)
+    return RB_CV_VIDEO_UNKNOWN;
+  std::string ext(dot + 1);
+  for (size_t i = 0; i < ext.size(); ++i)
+    ext[i] = tolower(ext[i]);
+  if (ext == "y4m")
+    return RB_CV_VIDEO_Y4M;
+  if (ext == "avi")
+    return RB_CV_VIDEO_AVI_MJPEG;
+  if (ext == "mjpeg" || ext == "mjpg")
+    return RB_CV_VIDEO_MJPEG;
+  return RB_CV_VIDEO_UNKNOWN;
+}
+
+/*
+ * Creates a native reader of the format of the stream. The stream is owned by the
+ * reader, and deleted on errors. fps is the frame rate of raw MJPEG.
+ */
+rb_cvVideoSource*
+rb_cvCreateRawVideoSource(rb_cvByteSource* stream, double fps)
+{
+  ByteReader* reader = new ByteReader(stream);
+  uchar head[12];
+  switch (rb_cvSniffVideoFormat(head, reader->peek(head, sizeof(head)))) {
+  case RB_CV_VIDEO_Y4M:
+    return new Y4MVideoSource(reader);
+  case RB_CV_VIDEO_AVI_MJPEG:
+    return new AviMjpegVideoSource(reader);
+  case RB_CV_VIDEO_MJPEG:
+    return new MjpegVideoSource(reader, fps);
+  }
+  delete reader;
+  CV_Error(CV_StsUnsupportedFormat, "Unknown video format");
+  return NULL;
+}
+
+/*
+ * Image sequence reader
+ *
+ * Worker threads decode the frames ahead into a ring of slots, frame i into
+ * slots[i % slots.size()], and grab() takes them in order. A seek only resets
+ * the positions, and the images decoded for the old positions are discarded.
+ */
+class ImageSequenceSource : public rb_cvVideoSource {
+public:
+  ImageSequenceSource(const std::vector<std::string>& paths, double fps, int threads, int ahead)
+    : paths(paths), fps(fps), width(0), height(0), slots(ahead), current(NULL), pos(0), next_job(0),
+      generation(0), grabbed(false), stopping(false) {
+    rb_cvImageInfo info;
+    if (!paths.empty() && rb_cvProbeImageFile(paths[0].c_str(), &info) > 0) {
+      width = info.width;
+      height = info.height;
+    }
+    workers.reserve(threads); // push_back can not throw with a running thread
+    try {
+      for (int i = 0; i < threads; i++)
+	workers.push_back(std::thread(&ImageSequenceSource::work, this));
+    }
+    catch (std::system_error&) {
+      // The destructor does not run for a partially constructed object
+      stop_workers();
+      CV_Error(CV_StsError, "Could not create the decoder threads");
+    }
+  }
+
+  ~ImageSequenceSource() {
+    stop_workers();
+    for (size_t i = 0; i < slots.size(); i++) {
+      if (slots[i].image)
+	cvReleaseImage(&slots[i].image);
+    }
+    if (current)
+      cvReleaseImage(&current);
+  }
+
+  bool grab() {
+    std::unique_lock<std::mutex> lock(mutex);
+    grabbed = false;
+    if (pos >= (long)paths.size())
+      return false;
+    long index = pos;
+    Slot& slot = slots[index % slots.size()];
+    cond.wait(lock, [&] { return slot.index == index && slot.done; });
+    if (current)
+      cvReleaseImage(&current);
+    current = slot.image;
+    slot.image = NULL;
+    slot.index = -1;
+    pos++;
+    cond.notify_all();
+    if (current == NULL) { // the next grab() goes on with the next file
+      std::string message = "Could not load " + paths[index];
+      CV_Error(CV_StsError, message.c_str());
+    }
+    if (width == 0) {
+      width = current->width;
+      height = current->height;
+    }
+    grabbed = true;
+    return true;
+  }
+
+  IplImage* retrieve() {
+    return grabbed ? current : NULL;
+  }
+
+  bool threaded() {
+    return true;
+  }
+
+  double get(int id) {
+    std::lock_guard<std::mutex> lock(mutex);
+    switch (id) {
+    case CV_CAP_PROP_POS_FRAMES:
+      return pos;
+    case CV_CAP_PROP_POS_MSEC:
+      return pos * 1000.0 / fps;
+    case CV_CAP_PROP_POS_AVI_RATIO:
+      return paths.empty() ? 0 : (double)pos / paths.size();
+    case CV_CAP_PROP_FRAME_WIDTH:
+      return width;
+    case CV_CAP_PROP_FRAME_HEIGHT:
+      return height;
+    case CV_CAP_PROP_FPS:
+      return fps;
+    case CV_CAP_PROP_FRAME_COUNT:
+      return paths.size();
+    case CV_CAP_PROP_CONVERT_RGB:
+      return 1;
+    }
+    return 0;
+  }
+
+  bool set(int id, double value) {
+    long target;
+    switch (id) {
+    case CV_CAP_PROP_POS_FRAMES:
+      target = cvRound(value);
+      break;
+    case CV_CAP_PROP_POS_MSEC:
+      target = cvRound(value * fps / 1000.0);
+      break;
+    case CV_CAP_PROP_POS_AVI_RATIO:
+      target = cvRound(value * paths.size());
+      break;
+    default:
+      return false;
+    }
+    target = std::max(0L, std::min(target, (long)paths.size()));
+    std::lock_guard<std::mutex> lock(mutex);
+    generation++;
+    for (size_t i = 0; i < slots.size(); i++) {
+      if (slots[i].image)
+	cvReleaseImage(&slots[i].image);
+      slots[i].index = -1;
+      slots[i].done = false;
+    }
+    pos = next_job = target;
+    grabbed = false;
+    cond.notify_all();
+    return true;
+  }
+
+private:
+  struct Slot {
+    Slot() : index(-1), image(NULL), done(false) {}
+    long index;
+    IplImage* image; // NULL if the file could not be loaded
+    bool done;
+  };
+
+  void stop_workers() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+      cond.notify_all();
+    }
+    for (size_t i = 0; i < workers.size(); i++)
+      workers[i].join();
+    workers.clear();
+  }
+
+  void work() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+      cond.wait(lock, [&] {
+	  return stopping || (next_job < (long)paths.size() && next_job < pos + (long)slots.size());
+	});
+      if (stopping)
+	return;
+      long index = next_job++;
+      unsigned long job_generation = generation;
+      Slot& slot = slots[index % slots.size()];
+      slot.index = index;
+      slot.done = false;
+      lock.unlock();
+      IplImage* image = NULL;
+      try {
+	image = rb_cvLoadImageReduced(paths[index].c_str(), CV_LOAD_IMAGE_COLOR, 1);
+      }
+      catch (cv::Exception&) {
+	image = NULL;
+      }
+      lock.lock();
+      if (job_generation != generation) { // seeked while decoding
+	if (image)
+	  cvReleaseImage(&image);
+	continue;
+      }
+      slot.image = image;
+      slot.done = true;
+      cond.notify_all();
+    }
+  }
+
+  std::vector<std::string> paths;
+  double fps;
+  int width;
+  int height;
+  std::vector<Slot> slots;
+  IplImage* current;
+  long pos; // index of the next frame to grab
+  long next_job; // index of the next frame to decode
+  unsigned long generation; // incremented by seeks
+  bool grabbed;
+  bool stopping;
+  std::mutex mutex;
+  std::condition_variable cond;
+  std::vector<std::thread> workers;
+};
+
+rb_cvVideoSource*
+rb_cvCreateImageSequenceSource(const std::vector<std::string>& paths, double fps, int threads, int ahead)
+{
+  return new ImageSequenceSource(paths, (fps > 0) ? fps : 25, threads, std::max(ahead, 1));
+}
+
+/*
+ * Expands a printf-style pattern with one integer conversion (e.g. "frame%04d.jpg") into the
+ * existing files from the first index in 0..1000 to the last consecutive one. Returns false
+ * if pattern is not such a pattern.
+ */
+bool
+rb_cvExpandSequencePattern(const char* pattern, std::vector<std::string>* paths)
+{
+  std::string prefix, suffix;
+  int width = 0;
+  bool zero = false, found = false;
+  for (const char* p = pattern; *p; p++) {
+    std::string& part = found ? suffix : prefix;
+    if (*p != '%') {
+      part += *p;
+      continue;
+    }
+    p++;
+    if (*p == '%') {
+      part += '%';
+      continue;
+    }
+    if (found)
+      return false;
+    if (*p == '0') {
+      zero = true;
+      p++;
+    }
+    for (; isdigit((uchar)*p); p++)
+      width = width * 10 + (*p - '0');
+    if (*p != 'd' && *p != 'i' && *p != 'u')
+      return false;
+    found = true;
+  }
+  if (!found)
+    return false;
+
+  paths->clear();
+  struct stat st;
+  char number[32];
+  for (long i = 0; ; i++) {
+    snprintf(number, sizeof(number), zero ? "%0*ld" : "%*ld", width, i);
+    std::string path = prefix + number + suffix;
+    if (stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode))
+      paths->push_back(path);
+    else if (!paths->empty() || i >= 1000)
+      break;
+  }
+  return true;
+}
+
+/*
+ * Common part of the native writers
+ */
+class RawVideoSink : public rb_cvVideoSink {
+public:
+  RawVideoSink(FILE* file, CvSize size, bool is_color, int quality)
+    : file(file), size(size), is_color(is_color), quality(quality), written(0), converted(NULL) {
+    struct stat st;
+    seekable = (fstat(fileno(file), &st) == 0 && S_ISREG(st.st_mode));
+  }
+
+  virtual ~RawVideoSink() {
+    if (converted)
+      cvReleaseImage(&converted);
+    fclose(file);
+  }
+
+protected:
+  // Checks the frame, and converts it to the channels of the video
+  const IplImage* prepare(const IplImage* image) {
+    if (image->depth != IPL_DEPTH_8U)
+      CV_Error(CV_BadDepth, "Only 8-bit images can be written");
+    if (image->width != size.width || image->height != size.height)
+      CV_Error(CV_StsUnmatchedSizes, "The frame size differs from the video");
+    int channels = is_color ? 3 : 1;
+    if (image->nChannels == channels)
+      return image;
+    if (converted == NULL)
+      converted = cvCreateImage(size, IPL_DEPTH_8U, channels);
+    switch (image->nChannels) {
+    case 1:
+      cvCvtColor(image, converted, CV_GRAY2BGR);
+      break;
+    case 3:
+      cvCvtColor(image, converted, CV_BGR2GRAY);
+      break;
+    case 4:
+      cvCvtColor(image, converted, is_color ? CV_BGRA2BGR : CV_BGRA2GRAY);
+      break;
+    default:
+      CV_Error(CV_BadNumChannels, "Unsupported number of channels");
+    }
+    return converted;
+  }
+
+  CvMat* encode_jpeg(const IplImage* image) {
+    int params[] = { CV_IMWRITE_JPEG_QUALITY, quality, 0 };
+    return cvEncodeImage(".jpg", image, params);
+  }
+
+  // Writes the data, or throws (except in destructors)
+  bool put(const void* data, size_t size, bool raise = true) {
+    if (fwrite(data, 1, size, file) != size) {
+      if (raise)
+	CV_Error(CV_StsError, "Could not write the video file");
+      return false;
+    }
+    written += size;
+    return true;
+  }
+
+  FILE* file;
+  bool seekable;
+  CvSize size;
+  bool is_color;
+  int quality;
+  long long written;
+  IplImage* converted;
+};
+
+/*
+ * Converts a frame rate to a fraction
+ */
+void
+frame_rate_fraction(double fps, unsigned int* num, unsigned int* den)
+{
+  static const unsigned int dens[] = { 1, 1001 };
+  for (int i = 0; i < 2; ++i) {
+    *den = dens[i];
+    *num = cvRound(fps * *den);
+    if (fabs((double)*num / *den - fps) < 1e-4)
+      return;
+  }
+  *den = 1000;
+  *num = cvRound(fps * 1000);
+}
+
+/*
+ * YUV4MPEG2 writer, with full range 4:2:0 (or mono) frames
+ */
+class Y4MVideoSink : public RawVideoSink {
+public:
+  Y4MVideoSink(FILE* file, double fps, CvSize size, bool is_color)
+    : RawVideoSink(file, size, is_color, 0), ycc(NULL), y(NULL), cb(NULL), cr(NULL),
+      cb_half(NULL), cr_half(NULL) {
+    unsigned int num, den;
+    frame_rate_fraction(fps, &num, &den);
+    char header[128];
+    int n = snprintf(header, sizeof(header), "YUV4MPEG2 W%d H%d F%u:%u Ip A1:1 %s XCOLORRANGE=FULL\n",
+		     size.width, size.height, num, den, is_color ? "C420jpeg" : "Cmono");
+    put(header, n);
+  }
+
+  ~Y4MVideoSink() {
+    IplImage** images[] = { &ycc, &y, &cb, &cr, &cb_half, &cr_half };
+    for (int i = 0; i < 6; ++i) {
+      if (*images[i])
+	cvReleaseImage(images[i]);
+    }
+  }
+
+  bool write(const IplImage* image) {
+    const IplImage* src = prepare(image);
+    put("FRAME\n", 6);
+    if (!is_color) {
+      put_plane(src);
+      return true;
+    }
+    if (ycc == NULL) {
+      CvSize half = cvSize((size.width + 1) / 2, (size.height + 1) / 2);
+      ycc = cvCreateImage(size, IPL_DEPTH_8U, 3);
+      y = cvCreateImage(size, IPL_DEPTH_8U, 1);
+      cb = cvCreateImage(size, IPL_DEPTH_8U, 1);
+      cr = cvCreateImage(size, IPL_DEPTH_8U, 1);
+      cb_half = cvCreateImage(half, IPL_DEPTH_8U, 1);
+      cr_half = cvCreateImage(half, IPL_DEPTH_8U, 1);
+    }
+    cvCvtColor(src, ycc, CV_BGR2YCrCb);
+    cvSplit(ycc, y, cr, cb, NULL);
+    cvResize(cb, cb_half, CV_INTER_AREA);
+    cvResize(cr, cr_half, CV_INTER_AREA);
+    put_plane(y);
+    put_plane(cb_half);
+    put_plane(cr_half);
+    return true;
+  }
+
+private:
+  void put_plane(const IplImage* plane) {
+    for (int i = 0; i < plane->height; ++i)
+      put(plane->imageData + i * plane->widthStep, plane->width * plane->nChannels);
+  }
+
+  IplImage* ycc;
+  IplImage* y;
+  IplImage* cb;
+  IplImage* cr;
+  IplImage* cb_half;
+  IplImage* cr_half;
+};
+
+/*
+ * Motion JPEG in AVI writer
+ *
+ * Only the index (8 bytes per frame) is kept in memory. The sizes in the headers are
+ * filled in at the end if the file is seekable, and left 0 in pipes.
+ */
+class AviMjpegVideoSink : public RawVideoSink {
+public:
+  AviMjpegVideoSink(FILE* file, double fps, CvSize size, bool is_color, int quality)
+    : RawVideoSink(file, size, is_color, quality), max_chunk(0) {
+    frame_rate_fraction(fps, &rate, &scale);
+    uchar header[HEADER_SIZE];
+    make_header(header, 0);
+    put(header, HEADER_SIZE);
+  }
+
+  ~AviMjpegVideoSink() {
+    std::vector<uchar> idx(8 + 16 * index.size());
+    memcpy(&idx[0], "idx1", 4);
+    put_le32(&idx[4], (unsigned int)(16 * index.size()));
+    for (size_t i = 0; i < index.size(); ++i) {
+      uchar* entry = &idx[8 + 16 * i];
+      memcpy(entry, "00dc", 4);
+      put_le32(entry + 4, 0x10); // AVIIF_KEYFRAME
+      put_le32(entry + 8, index[i].first);
+      put_le32(entry + 12, index[i].second);
+    }
+    long long movi_size = written - (HEADER_SIZE - 4);
+    if (put(&idx[0], idx.size(), false) && seekable && rb_cv_fseek(file, 0, SEEK_SET) == 0) {
+      uchar header[HEADER_SIZE];
+      make_header(header, movi_size);
+      put(header, HEADER_SIZE, false);
+    }
+  }
+
+  bool write(const IplImage* image) {
+    CvMat* buf = encode_jpeg(prepare(image));
+    size_t size = buf->rows * buf->cols;
+    if (written + 8 + size > 0xFFFFFFF0LL - 16 * (index.size() + 1)) {
+      cvReleaseMat(&buf);
+      CV_Error(CV_StsOutOfRange, "AVI files larger than 4GB are not supported");
+    }
+    index.push_back(std::make_pair((unsigned int)(written - (HEADER_SIZE - 4)), (unsigned int)size));
+    uchar head[8];
+    memcpy(head, "00dc", 4);
+    put_le32(head + 4, (unsigned int)size);
+    uchar pad = 0;
+    bool ok = put(head, 8, false) && put(buf->data.ptr, size, false) && (size % 2 == 0 || put(&pad, 1, false));
+    cvReleaseMat(&buf);
+    if (!ok)
+      CV_Error(CV_StsError, "Could not write the video file");
+    max_chunk = std::max(max_chunk, (unsigned int)size);
+    return true;
+  }
+
+private:
+  // RIFF header, hdrl list and the header of the movi list
+  void make_header(uchar* h, long long movi_size) {
+    unsigned int frames = (unsigned int)index.size();
+    memset(h, 0, HEADER_SIZE);
+    memcpy(h, "RIFF", 4);
+    put_le32(h + 4, movi_size > 0 ? (unsigned int)(HEADER_SIZE - 8 + movi_size - 4 + 8 + 16 * frames) : 0);
+    memcpy(h + 8, "AVI LIST", 8);
+    put_le32(h + 16, 192);
+    memcpy(h + 20, "hdrlavih", 8);
+    put_le32(h + 28, 56);
+    put_le32(h + 32, cvRound(1e6 * scale / rate)); // dwMicroSecPerFrame
+    put_le32(h + 44, 0x10); // AVIF_HASINDEX
+    put_le32(h + 48, frames);
+    put_le32(h + 56, 1); // streams
+    put_le32(h + 60, max_chunk);
+    put_le32(h + 64, size.width);
+    put_le32(h + 68, size.height);
+    memcpy(h + 88, "LIST", 4);
+    put_le32(h + 92, 116);
+    memcpy(h + 96, "strlstrh", 8);
+    put_le32(h + 104, 56);
+    memcpy(h + 108, "vidsMJPG", 8);
+    put_le32(h + 128, scale);
+    put_le32(h + 132, rate);
+    put_le32(h + 140, frames);
+    put_le32(h + 144, max_chunk);
+    put_le32(h + 148, 0xFFFFFFFF); // dwQuality
+    put_le16(h + 160, size.width);
+    put_le16(h + 162, size.height);
+    memcpy(h + 164, "strf", 4);
+    put_le32(h + 168, 40);
+    put_le32(h + 172, 40); // biSize
+    put_le32(h + 176, size.width);
+    put_le32(h + 180, size.height);
+    put_le16(h + 184, 1); // biPlanes
+    put_le16(h + 186, is_color ? 24 : 8);
+    memcpy(h + 188, "MJPG", 4);
+    put_le32(h + 192, size.width * size.height * (is_color ? 3 : 1));
+    memcpy(h + 212, "LIST", 4);
+    put_le32(h + 216, (unsigned int)movi_size);
+    memcpy(h + 220, "movi", 4);
+  }
+
+  static const int HEADER_SIZE = 224;
+  unsigned int rate;
+  unsigned int scale;
+  unsigned int max_chunk;
+  std::vector<std::pair<unsigned int, unsigned int> > index; // offsets from 'movi' and sizes
+};
+
+/*
+ * Concatenated JPEG images writer
+ */
+class MjpegVideoSink : public RawVideoSink {
+public:
+  MjpegVideoSink(FILE* file, CvSize size, bool is_color, int quality)
+    : RawVideoSink(file, size, is_color, quality) {}
+
+  bool write(const IplImage* image) {
+    CvMat* buf = encode_jpeg(prepare(image));
+    bool ok = put(buf->data.ptr, buf->rows * buf->cols, false);
+    cvReleaseMat(&buf);
+    if (!ok)
+      CV_Error(CV_StsError, "Could not write the video file");
+    return true;
+  }
+};
+
+/*
+ * Creates a native writer. Returns NULL if the file can not be opened.
+ * quality is the JPEG quality (0-100) of the MJPEG formats.
+ */
+rb_cvVideoSink*
+rb_cvCreateRawVideoSink(const char* filename, int format, double fps, CvSize size,
+			bool is_color, int quality)
+{
+  if (format != RB_CV_VIDEO_Y4M && format != RB_CV_VIDEO_AVI_MJPEG && format != RB_CV_VIDEO_MJPEG)
+    CV_Error(CV_StsUnsupportedFormat, "Unknown video format");
+  if (size.width <= 0 || size.height <= 0)
+    CV_Error(CV_StsBadSize, "Invalid frame size");
+  if (fps <= 0)
+    CV_Error(CV_StsOutOfRange, "Invalid frame rate");
+  FILE* file = fopen(filename, "wb");
+  if (file == NULL)
+    return NULL;
+  switch (format) {
+  case RB_CV_VIDEO_Y4M:
+    return new Y4MVideoSink(file, fps, size, is_color);
+  case RB_CV_VIDEO_AVI_MJPEG:
+    return new AviMjpegVideoSink(file, fps, size, is_color, quality);
+  default:
+    return new MjpegVideoSink(file, size, is_color, quality);
+  }
+}
@@ -0,0 +1,116 @@
+/************************************************************
+
+    videoio.h -
+
+    $Author: ser1zw $
+
+    Copyright (C) 2013 ser1zw
+
+************************************************************/
+#ifndef RUBY_OPENCV_VIDEOIO_H
+#define RUBY_OPENCV_VIDEOIO_H
+
+#include "opencv2/core/core_c.h"
+#include "opencv2/core/core.hpp"
+#include "opencv2/imgproc/imgproc_c.h"
+#include "opencv2/highgui/highgui_c.h"
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*
+ * Source of video frames behind CvCapture: a CvCapture of highgui, or a native reader
+ * of the raw video formats below. The methods follow cvGrabFrame(), cvRetrieveFrame(),
+ * cvGetCaptureProperty() and cvSetCaptureProperty(), and throw cv::Exception on errors.
+ */
+class rb_cvVideoSource {
+public:
+  virtual ~rb_cvVideoSource() {}
+  virtual bool grab() = 0;
+  virtual IplImage* retrieve() = 0; // the last grabbed frame, owned by the source
+  virtual double get(int id) = 0;
+  virtual bool set(int id, double value) = 0;
+  virtual bool threaded() { return false; } // true if deleting the source waits for its threads
+
+  IplImage* query() { return grab() ? retrieve() : NULL; }
+};
+
+/*
+ * Destination of video frames behind CvVideoWriter (see rb_cvVideoSource)
+ * Deleting the sink finishes the file.
+ */
+class rb_cvVideoSink {
+public:
+  virtual ~rb_cvVideoSink() {}
+  virtual bool write(const IplImage* image) = 0;
+};
+
+/*
+ * Byte stream read by the native readers
+ */
+class rb_cvByteSource {
+public:
+  virtual ~rb_cvByteSource() {}
+  virtual size_t read(void* buffer, size_t size) = 0; // may wait for data, 0 only at the end of the stream
+  virtual bool seek(long long offset) { return false; } // from the start, false if not seekable
+  virtual long long size() { return -1; } // -1 if unknown
+};
+
+/*
+ * Bounded byte queue from a producer (e.g. a Ruby thread reading an IO) to a native reader.
+ * Both sides wait without the GVL: push() while the queue is full, and pop() while it is empty.
+ */
+class rb_cvByteQueue {
+public:
+  rb_cvByteQueue(size_t capacity);
+  size_t push(const uchar* data, size_t size); // returns less than size if closed or interrupted
+  size_t pop(uchar* buffer, size_t size); // 0 at the end of the stream
+  void finish(); // no more data will be pushed
+  void close(); // the reader is gone, and the data is discarded
+  void interrupt(); // makes a waiting push() return
+  bool closed();
+private:
+  std::mutex mutex;
+  std::condition_variable cond;
+  std::vector<uchar> ring;
+  size_t head;
+  size_t count;
+  bool is_finished;
+  bool is_closed;
+  bool interrupted;
+};
+
+rb_cvByteSource* rb_cvCreateQueueSource(const std::shared_ptr<rb_cvByteQueue>& queue);
+rb_cvByteSource* rb_cvCreateMemorySource(const uchar* data, size_t size, bool copy); // else data must outlive the source
+
+rb_cvVideoSource* rb_cvCreateHighguiSource(CvCapture* capture);
+rb_cvVideoSink* rb_cvCreateHighguiSink(CvVideoWriter* writer);
+
+/*
+ * Raw video formats read and written natively (with cvDecodeImageM() and cvEncodeImage() for JPEG)
+ */
+enum {
+  RB_CV_VIDEO_UNKNOWN = 0,
+  RB_CV_VIDEO_Y4M = 1, // YUV4MPEG2
+  RB_CV_VIDEO_AVI_MJPEG = 2, // Motion JPEG in AVI
+  RB_CV_VIDEO_MJPEG = 3 // concatenated JPEG images
+};
+
+int rb_cvSniffVideoFormat(const uchar* head, size_t size);
+int rb_cvSniffVideoFile(const char* filename);
+int rb_cvVideoFormatFromFilename(const char* filename);
+rb_cvByteSource* rb_cvOpenFileSource(const char* filename);
+rb_cvVideoSource* rb_cvCreateRawVideoSource(rb_cvByteSource* stream, double fps);
+rb_cvVideoSink* rb_cvCreateRawVideoSink(const char* filename, int format, double fps, CvSize size,
+					bool is_color, int quality);
+
+/*
+ * Sequence of image files read as a video, decoded ahead by threads into ahead frames
+ */
+rb_cvVideoSource* rb_cvCreateImageSequenceSource(const std::vector<std::string>& paths, double fps,
+						 int threads, int ahead);
+bool rb_cvExpandSequencePattern(const char* pattern, std::vector<std::string>* paths);
+
+#endif // RUBY_OPENCV_VIDEOIO_H
@@ -32,11 +32,17 @@ rb_class()
   return rb_klass;
 }
 
+const rb_data_type_t data_type = {
+  "OpenCV::GUI::Window",
+  { window_mark, window_free, memsize_struct<Window>, },
+  &opencv_data_type, 0, RUBY_TYPED_FREE_IMMEDIATELY
+};
+
 VALUE
 rb_allocate(VALUE klass)
 {
   Window *ptr;
-  return Data_Make_Struct(klass, Window, window_mark, window_free, ptr);
+  return TypedData_Make_Struct(klass, Window, &data_type, ptr);
 }
 
 void
@@ -49,7 +49,7 @@ VALUE rb_set_mouse_callback(int argc, VALUE* argv, VALUE self);
 inline Window*
 WINDOW(VALUE object) {
   Window *ptr;
-  Data_Get_Struct(object, Window, ptr);
+  ptr = (Window*)OPENCV_DATA_PTR(object);
   return ptr;
 }
 
@@ -2,6 +2,7 @@
 # -*- mode: ruby; coding: utf-8 -*-
 require 'test/unit'
 require 'opencv'
+require 'stringio'
 require File.expand_path(File.dirname(__FILE__)) + '/helper'
 
 include OpenCV
@@ -56,6 +57,20 @@ class TestCvCapture < OpenCVTestCase
     assert_raise(IOError) do
       cap1.query
     end
+
+    # Closing waits for the calls of the other threads, which then fail cleanly
+    cap2 = CvCapture.open(AVI_SAMPLE)
+    reader = Thread.new {
+      begin
+        loop { cap2.query; cap2.width }
+      rescue IOError
+        :closed
+      end
+    }
+    sleep 0.05
+    cap2.close
+    assert_equal(:closed, reader.value)
+    assert_raise(IOError) { cap2.fps }
   end
 
   def test_grab
@@ -73,6 +88,541 @@ class TestCvCapture < OpenCVTestCase
     assert_equal(IplImage, img.class)
   end
 
+  def test_retrieve_into
+    cap1 = CvCapture.open(AVI_SAMPLE)
+    cap2 = CvCapture.open(AVI_SAMPLE)
+    img = cap1.query
+    frame = IplImage.new(img.width, img.height, img.depth, img.channel)
+    assert_equal(frame, cap2.query(into: frame))
+    assert_equal(img.to_binary, frame.to_binary)
+
+    cap1.grab
+    cap2.grab
+    assert_equal(frame, cap2.retrieve(into: frame))
+    assert_equal(cap1.retrieve.to_binary, frame.to_binary)
+
+    assert_raise(ArgumentError) {
+      cap2.query(into: IplImage.new(img.width + 1, img.height, img.depth, img.channel))
+    }
+    assert_raise(TypeError) {
+      cap2.query(into: DUMMY_OBJ)
+    }
+    assert_raise(ArgumentError) {
+      cap2.query(into: frame, borrow: true)
+    }
+  end
+
+  def test_query_borrow
+    cap1 = CvCapture.open(AVI_SAMPLE)
+    cap2 = CvCapture.open(AVI_SAMPLE)
+    img = cap2.query(borrow: true)
+    assert_equal(IplImage, img.class)
+    assert(img.frozen?)
+    assert_equal(cap1.query.to_binary, img.to_binary)
+
+    # The frame belongs to the capture: it can not be written, nor viewed beyond the next frame
+    assert_raise(FrozenError) { img.set_data([0] * (img.width * img.height * img.channel)) }
+    assert_raise(FrozenError) { img[0, 0] = CvScalar.new(0) }
+    assert_raise(FrozenError) { img.fill!(CvScalar.new(0)) }
+    assert_raise(FrozenError) { img.set_roi(CvRect.new(0, 0, 1, 1)) }
+    assert_raise(FrozenError) { img.smooth(CV_GAUSSIAN, 3, out: img) }
+    assert_raise(FrozenError) { cap1.query(into: img) }
+    assert_raise(FrozenError) { cap1.retrieve(into: img) }
+    assert_raise(FrozenError) { cap1.query(into: img.clone.freeze) }
+    [-> { img.sub_rect(0, 0, 2, 2) }, -> { img.get_rows(0) }, -> { img.get_cols(0) },
+     -> { img.to_CvMat }, -> { img.reshape(1) }, -> { img.each_row { } }].each { |view|
+      assert_raise(RuntimeError) { view.call }
+    }
+    copy = img.clone
+    view = copy.sub_rect(0, 0, 2, 2)
+    expected = view.to_binary
+    cap2.grab
+    assert_equal(expected, view.to_binary)
+    assert_equal([1, 1], [img.width, img.height])
+
+    # Detached by the next frame
+    cap2.query
+    assert_equal([1, 1], [img.width, img.height])
+    2.times { cap1.grab } # cap1 and cap2 are both at the third frame
+
+    cap1.grab
+    cap2.grab
+    img = cap2.retrieve(borrow: true)
+    assert_equal(cap1.retrieve.to_binary, img.to_binary)
+    cap2.close
+    assert_equal([1, 1], [img.width, img.height])
+    assert_equal("\0" * img.channel, img.to_binary)
+  end
+
+  def test_prefetch
+    frames = []
+    cap1 = CvCapture.open(AVI_SAMPLE)
+    10.times { frames << cap1.query.to_binary }
+
+    cap2 = CvCapture.open(AVI_SAMPLE)
+    assert_equal(cap2, cap2.prefetch(4))
+    assert(cap2.prefetch?)
+    frames.each { |expected|
+      img = cap2.query
+      assert_equal(IplImage, img.class)
+      assert_equal(expected, img.to_binary)
+    }
+    assert(cap2.grab)
+    assert_equal(IplImage, cap2.retrieve.class)
+
+    stats = cap2.prefetch_stats
+    assert_equal(4, stats[:capacity])
+    assert_equal(11, stats[:delivered])
+    assert(stats[:decoded] >= 11)
+    assert(stats[:depth] <= 4)
+    assert_equal(0, stats[:dropped])
+    assert(stats[:decode_time].is_a? Float)
+
+    # Setting the position discards the queued frames
+    cap2.frames = 0
+    assert_equal(frames[0], cap2.query.to_binary)
+
+    count = 1
+    count += 1 while cap2.query
+    assert(count > frames.size)
+    assert_nil(cap2.query)
+
+    assert(cap2.stop_prefetch)
+    assert_false(cap2.prefetch?)
+    assert_nil(cap2.prefetch_stats)
+    assert_false(cap2.stop_prefetch)
+
+    cap3 = CvCapture.open(AVI_SAMPLE).prefetch(2, drop: true)
+    assert_equal(IplImage, cap3.query.class)
+    cap3.close
+    assert_raise(IOError) {
+      cap3.query
+    }
+
+    assert_raise(ArgumentError) {
+      CvCapture.open(AVI_SAMPLE).prefetch(0)
+    }
+
+    # query(into:) copies the frames and reuses the images of the ring
+    cap4 = CvCapture.open(AVI_SAMPLE).prefetch(2)
+    frame = cap4.query
+    3.times { |i|
+      assert_same(frame, cap4.query(into: frame))
+      assert_equal(frames[i + 1], frame.to_binary)
+    }
+    cap4.close
+
+    # A prefetching capture left to GC is released without waiting for its thread in GC
+    5.times { CvCapture.open(AVI_SAMPLE).prefetch(4).query }
+    GC.start
+  end
+
+  def test_live
+    cap1 = CvCapture.open(AVI_SAMPLE)
+    frames = []
+    while (frame = cap1.query)
+      frames << frame.to_binary
+    end
+    assert_nil(cap1.timestamp)
+    assert_nil(cap1.skipped_frames)
+
+    # A caller slower than the source gets the newest frames and skips the others.
+    # The caller waits for the decoder to be two frames ahead, so one frame is always skipped.
+    cap2 = CvCapture.open(AVI_SAMPLE)
+    assert_equal(cap2, cap2.live)
+    assert(cap2.prefetch?)
+    assert_nil(cap2.timestamp)
+    taken = 0
+    skipped = 0
+    timestamps = []
+    loop {
+      ahead = cap2.frames.to_i + 2
+      Thread.pass until cap2.prefetch_stats[:decoded] >= [ahead, frames.size].min
+      frame = cap2.query
+      break unless frame
+      taken += 1
+      skipped += cap2.skipped_frames
+      assert(cap2.skipped_frames > 0) if ahead <= frames.size
+      timestamps << cap2.timestamp
+      assert_equal(frames[cap2.frames.to_i - 1], frame.to_binary)
+    }
+    assert_equal(frames.size, taken + skipped)
+    assert(skipped >= frames.size / 2 - 1)
+    assert_equal(timestamps.sort, timestamps)
+    assert(timestamps.last <= Time.now)
+
+    stats = cap2.prefetch_stats
+    assert_equal(1, stats[:capacity])
+    assert_equal(skipped, stats[:dropped])
+
+    # The rate paces the grabs like a device; without drop, nothing is skipped
+    rate = 200
+    start = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+    cap3 = CvCapture.open(AVI_SAMPLE).prefetch(1, rate: rate)
+    count = 0
+    while cap3.query
+      count += 1
+      assert_equal(0, cap3.skipped_frames)
+    end
+    assert_equal(frames.size, count)
+    assert(Process.clock_gettime(Process::CLOCK_MONOTONIC) - start >= (frames.size - 1).to_f / rate)
+
+    assert_raise(ArgumentError) {
+      cap3.live(rate: 0)
+    }
+    assert_raise(ArgumentError) {
+      cap3.prefetch(2, rate: -1)
+    }
+  end
+
+  def test_each_frame
+    cap1 = CvCapture.open(AVI_SAMPLE)
+    frames = []
+    10.times { frames << [cap1.query.to_binary, cap1.millisecond] }
+
+    cap2 = CvCapture.open(AVI_SAMPLE)
+    results = []
+    assert_equal(cap2, cap2.each_frame(step: 3, max: 3) { |frame, msec|
+      assert_equal(IplImage, frame.class)
+      results << [frame.to_binary, msec]
+    })
+    assert_equal([frames[0], frames[3], frames[6]], results)
+
+    cap3 = CvCapture.open(AVI_SAMPLE)
+    msecs = cap3.each_frame(every_ms: 200, max: 3).map { |frame, msec| msec }
+    assert_equal(3, msecs.size)
+    msecs.each_cons(2) { |a, b| assert(b - a >= 200 - (frames[1][1] - frames[0][1])) }
+
+    cap4 = CvCapture.open(AVI_SAMPLE).prefetch(2)
+    cap4.query
+    results = cap4.each_frame(step: 4, max: 3).map { |frame, msec| [frame.to_binary, msec] }
+    assert_equal([frames[1], frames[5], frames[9]], results)
+
+    assert_raise(ArgumentError) {
+      cap1.each_frame(step: 0) {}
+    }
+    assert_raise(ArgumentError) {
+      cap1.each_frame(every_ms: -1) {}
+    }
+    assert_raise(ArgumentError) {
+      cap1.each_frame(max: -1) {}
+    }
+  end
+
+  def test_skip
+    cap1 = CvCapture.open(AVI_SAMPLE)
+    frames = []
+    6.times { frames << cap1.query.to_binary }
+
+    cap2 = CvCapture.open(AVI_SAMPLE)
+    assert_equal(5, cap2.skip(5))
+    assert_equal(frames[5], cap2.query.to_binary)
+
+    cap3 = CvCapture.open(AVI_SAMPLE).prefetch(2)
+    assert_equal(0, cap3.skip(0))
+    assert_equal(5, cap3.skip(5))
+    assert_equal(frames[5], cap3.query.to_binary)
+
+    count = cap2.frame_count.to_i
+    assert(cap2.skip(count + 10) < count + 10)
+    assert_nil(cap2.query)
+
+    assert_raise(ArgumentError) {
+      cap2.skip(-1)
+    }
+  end
+
+  def test_index
+    filename = 'index_test.cvindex'
+    File.delete filename if File.exists? filename
+
+    cap1 = CvCapture.open(AVI_SAMPLE)
+    frames = []
+    cap1.frame_count.to_i.times { frames << [cap1.query.to_binary, cap1.millisecond] }
+
+    cap2 = CvCapture.open(AVI_SAMPLE)
+    assert_false(cap2.indexed?)
+    assert_nil(cap2.keyframes)
+    cap2.query
+    assert_equal(frames.size, cap2.build_index(filename))
+    assert(cap2.indexed?)
+    assert(File.exists? filename)
+    assert_equal(frames.size, cap2.frame_count)
+    assert(cap2.keyframes.is_a? Array)
+
+    # The position is kept
+    assert_equal(1, cap2.frames)
+    assert_equal(frames[1][0], cap2.query.to_binary)
+
+    [7, 3, frames.size - 1, 0].each { |i|
+      cap2.frames = i
+      assert_equal(i, cap2.frames)
+      assert_equal(frames[i][0], cap2.query.to_binary)
+    }
+    cap2.millisecond = frames[5][1]
+    assert_equal(frames[5][0], cap2.query.to_binary)
+
+    cap3 = CvCapture.open(AVI_SAMPLE)
+    assert(cap3.load_index(filename))
+    assert_equal(cap2.keyframes, cap3.keyframes)
+    cap3.frames = 4
+    assert_equal(frames[4][0], cap3.query.to_binary)
+
+    assert_false(CvCapture.open(AVI_SAMPLE).load_index('not_exist.cvindex'))
+
+    # A corrupted index is stale: it is rebuilt instead of being trusted
+    source = File.read(filename)
+    [source.sub(/frames \d+/, 'frames 999999999999'), source.sub(/keyframes \d+/, 'keyframes 999999999999'),
+     source[0, source.size / 2], source.sub(/keyframes \d+\n/, "keyframes 1\n#{frames.size}\n")].each { |corrupted|
+      File.write(filename, corrupted)
+      assert_false(CvCapture.open(AVI_SAMPLE).load_index(filename))
+      cap4 = CvCapture.open(AVI_SAMPLE, index: filename)
+      assert(cap4.indexed?)
+      assert_equal(frames.size, cap4.frame_count)
+    }
+    assert(CvCapture.open(AVI_SAMPLE).load_index(filename))
+
+    # An index which can not be saved is kept in memory with a warning
+    cap5 = CvCapture.open(AVI_SAMPLE)
+    stderr = $stderr
+    begin
+      $stderr = StringIO.new
+      assert_equal(frames.size, cap5.build_index('not_exist_dir/index.cvindex'))
+      assert_match(/could not write the index/, $stderr.string)
+    ensure
+      $stderr = stderr
+    end
+    assert(cap5.indexed?)
+    assert(CvCapture.open(AVI_SAMPLE, index: filename).indexed?)
+    assert_raise(TypeError) {
+      CvCapture.open(AVI_SAMPLE).load_index(DUMMY_OBJ)
+    }
+  ensure
+    File.delete filename if File.exists? filename
+  end
+
+  def test_open_native
+    filename = 'capture_native_test.y4m'
+    img = IplImage.load(FILENAME_LENA256x256)
+    CvVideoWriter.new(filename, nil, 10, img.size) { |vw|
+      10.times { |i| vw.write img.sub(CvScalar.new(i * 20, i * 20, i * 20)) }
+    }
+
+    cap = CvCapture.open(filename)
+    assert_equal(10, cap.frame_count)
+    assert_equal(10, cap.fps)
+    frames = []
+    while (frame = cap.query)
+      frames << frame.to_binary
+    end
+    assert_equal(10, frames.size)
+    [7, 2, 9, 0].each { |i|
+      cap.frames = i
+      assert_equal(i, cap.frames)
+      assert_equal(frames[i], cap.query.to_binary)
+    }
+    cap.millisecond = 500
+    assert_equal(frames[5], cap.query.to_binary)
+    cap.avi_ratio = 0.3
+    assert_equal(frames[3], cap.query.to_binary)
+    cap.close
+
+    # Read from a pipe
+    r, w = IO.pipe
+    writer = Thread.new { w.write File.binread(filename); w.close }
+    cap = CvCapture.open("/dev/fd/#{r.fileno}", native: true)
+    count = 0
+    count += 1 while cap.grab
+    assert_equal(10, count)
+    writer.join
+    cap.close
+    r.close
+
+    File.binwrite(filename, "YUV4MPEG2 W0 H0\n")
+    assert_raise(CvStsParseError) {
+      CvCapture.open(filename)
+    }
+    File.binwrite(filename, "YUV4MPEG2 W99999999999 H2\n")
+    assert_raise(CvStsParseError) {
+      CvCapture.open(filename)
+    }
+    File.binwrite(filename, "YUV4MPEG2 W30000 H30000\n")
+    assert_raise(CvStsOutOfRange) {
+      CvCapture.open(filename)
+    }
+    ['420p10', '422p12', '444p16', 'mono16'].each { |chroma|
+      File.binwrite(filename, "YUV4MPEG2 W2 H2 C#{chroma}\n")
+      assert_raise(CvStsUnsupportedFormat) {
+        CvCapture.open(filename)
+      }
+    }
+  ensure
+    File.delete filename if File.exists? filename
+  end
+
+  def test_open_native_avi_corrupted
+    filename = 'capture_native_test.avi'
+    img = IplImage.load(FILENAME_LENA256x256)
+    CvVideoWriter.new(filename, 'MJPG', 10, img.size, native: true) { |vw|
+      2.times { vw.write img }
+    }
+    # A frame chunk claiming 2GB is rejected instead of being allocated
+    data = File.binread(filename)
+    chunk = data.index('00dc', data.index('movi'))
+    data[chunk + 4, 4] = [0x7fffffff].pack('V')
+    File.binwrite(filename, data)
+    cap = CvCapture.open(filename, native: true)
+    assert_raise(CvStsOutOfRange) {
+      cap.query
+    }
+  ensure
+    File.delete filename if File.exists? filename
+  end
+
+  def test_open_stream
+    filename = 'capture_stream_test.mjpeg'
+    img = IplImage.load(FILENAME_LENA256x256)
+    CvVideoWriter.new(filename, nil, 10, img.size) { |vw|
+      10.times { |i| vw.write img.sub(CvScalar.new(i * 20, i * 20, i * 20)) }
+    }
+    data = File.binread(filename)
+    frames = []
+    cap = CvCapture.open(filename)
+    while (frame = cap.query)
+      frames << frame.to_binary
+    end
+    assert_equal(10, frames.size)
+
+    # Data arriving in small pieces through a pipe, with a small buffer
+    r, w = IO.pipe
+    writer = Thread.new {
+      data.bytes.each_slice(1000) { |bytes| w.write bytes.pack('C*') }
+      w.close
+    }
+    cap = CvCapture.open(r, buffer: 4096, fps: 10)
+    assert_equal(10, cap.fps)
+    assert_equal(256, cap.width)
+    frames.each { |f|
+      assert_equal(f, cap.query.to_binary)
+    }
+    assert_nil(cap.query)
+    writer.join
+    cap.close
+    r.close
+
+    # An interrupt stops waiting for the header, and a failed open stops the reader thread
+    r, w = IO.pipe
+    threads = Thread.list.size
+    opener = Thread.new { CvCapture.open(r) }
+    Thread.pass until opener.stop?
+    assert_not_nil(opener.kill.join(10))
+    w.write('not a video!')
+    assert_raise(CvStsUnsupportedFormat) {
+      CvCapture.open(r)
+    }
+    Thread.pass until Thread.list.size == threads
+    w.close
+    r.close
+
+    cap = CvCapture.open(StringIO.new(data))
+    count = 0
+    count += 1 while cap.grab
+    assert_equal(10, count)
+
+    # A string can be seeked
+    cap = CvCapture.decode(data)
+    cap.frames = 6
+    assert_equal(frames[6], cap.query.to_binary)
+    cap.frames = 1
+    assert_equal(frames[1], cap.query.to_binary)
+
+    assert_raise(CvStsUnsupportedFormat) {
+      CvCapture.open(StringIO.new('not a video'))
+    }
+    assert_raise(CvStsUnsupportedFormat) {
+      CvCapture.decode('not a video')
+    }
+    assert_raise(TypeError) {
+      CvCapture.decode(DUMMY_OBJ)
+    }
+    assert_raise(ArgumentError) {
+      CvCapture.open(StringIO.new(data), buffer: 0)
+    }
+  ensure
+    File.delete filename if File.exists? filename
+  end
+
+  def test_open_sequence
+    dir = 'capture_sequence_test'
+    Dir.mkdir dir
+    img = IplImage.load(FILENAME_LENA256x256)
+    filenames = (1..12).map { |i|
+      filename = format('%s/frame%03d.png', dir, i)
+      img.sub(CvScalar.new(i * 15, i * 15, i * 15)).save_image(filename)
+      filename
+    }
+    frames = filenames.map { |filename| IplImage.load(filename).to_binary }
+
+    ["#{dir}/frame%03d.png", "#{dir}/frame*.png", filenames].each { |source|
+      [{}, { threads: 1, queue: 1 }, { threads: 4, queue: 3 }].each { |options|
+        cap = CvCapture.open(source, options)
+        assert_equal(12, cap.frame_count)
+        assert_equal(256, cap.width)
+        assert_equal(256, cap.height)
+        frames.each { |f|
+          assert_equal(f, cap.query.to_binary)
+        }
+        assert_nil(cap.query)
+
+        cap.frames = 7
+        assert_equal(frames[7], cap.query.to_binary)
+        cap.frames = 2
+        assert_equal(frames[2], cap.query.to_binary)
+        assert_equal(frames[3], cap.query.to_binary)
+        cap.close
+      }
+    }
+
+    cap = CvCapture.open("#{dir}/frame%03d.png", fps: 10)
+    assert_equal(10, cap.fps)
+    cap.millisecond = 500
+    assert_equal(frames[5], cap.query.to_binary)
+    cap.close
+
+    # A pattern or glob which matches no files is opened as a video file (e.g. a URL)
+    assert_raise(StandardError) {
+      CvCapture.open("#{dir}/none%03d.png")
+    }
+    assert_raise(ArgumentError) {
+      CvCapture.open("#{dir}/none%03d.png", sequence: true)
+    }
+    assert_raise(StandardError) {
+      CvCapture.open("#{dir}/frame*.png", sequence: false)
+    }
+    assert_raise(ArgumentError) {
+      CvCapture.open("#{dir}/frame%03d.png", threads: 0)
+    }
+    assert_raise(ArgumentError) {
+      CvCapture.open("#{dir}/frame%03d.png", queue: 0)
+    }
+    assert_raise(TypeError) {
+      CvCapture.open([DUMMY_OBJ])
+    }
+
+    # A broken file fails only its frame
+    File.binwrite(filenames[1], 'broken')
+    cap = CvCapture.open("#{dir}/frame%03d.png")
+    assert(cap.grab)
+    assert_raise(CvStsError) {
+      cap.grab
+    }
+    assert_equal(frames[2], cap.query.to_binary)
+    cap.close
+  ensure
+    filenames.each { |f| File.delete f if File.exists? f } if filenames
+    Dir.rmdir dir if File.exists? dir
+  end
+
   def test_millisecond
     @cap.millisecond = 10
     assert(@cap.millisecond.is_a? Numeric)
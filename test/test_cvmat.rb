@@ -1,6 +1,11 @@
 #!/usr/bin/env ruby
 # -*- mode: ruby; coding: utf-8 -*-
 require 'test/unit'
+require 'stringio'
+begin
+  require 'fiddle'
+rescue LoadError
+end
 require 'opencv'
 require File.expand_path(File.dirname(__FILE__)) + '/helper'
 
@@ -152,6 +157,36 @@ class TestCvMat < OpenCVTestCase
     # }
   end
 
+  def test_encode_binary
+    mat = CvMat.load(FILENAME_CAT)
+
+    jpg = mat.encode_binary('.jpg')
+    assert_equal(Encoding::ASCII_8BIT, jpg.encoding)
+    assert_equal('JFIF', jpg[6, 4])
+    assert_equal(mat.encode('.jpg').pack('c*'), jpg)
+
+    png = mat.encode_binary('.png', CV_IMWRITE_PNG_COMPRESSION => 9)
+    assert_equal('PNG', png[1, 3])
+
+    buf = 'head'.force_encoding('ASCII-8BIT')
+    assert_equal(buf.object_id, mat.encode_binary('.jpg', nil, buf).object_id)
+    assert_equal('head' + jpg, buf)
+
+    io = StringIO.new(''.force_encoding('ASCII-8BIT'))
+    assert_equal(io, mat.encode_binary('.jpg', nil, io))
+    assert_equal(jpg, io.string)
+
+    assert_raise(TypeError) {
+      mat.encode_binary(DUMMY_OBJ)
+    }
+    assert_raise(TypeError) {
+      mat.encode_binary('.jpg', DUMMY_OBJ)
+    }
+    assert_raise(TypeError) {
+      mat.encode_binary('.jpg', nil, DUMMY_OBJ)
+    }
+  end
+
   def test_decode
     data = nil
     open(FILENAME_CAT, 'rb') { |f|
@@ -202,6 +237,121 @@ class TestCvMat < OpenCVTestCase
     # snap mat1, mat2, mat3
   end
 
+  def test_load_reduced
+    data = open(FILENAME_CAT, 'rb') { |f| f.read }
+    full = CvMat.load(FILENAME_CAT)
+    [2, 4, 8].each { |reduce|
+      width = (375 + reduce - 1) / reduce
+      height = (500 + reduce - 1) / reduce
+      [CvMat.load(FILENAME_CAT, reduce: reduce), CvMat.decode(data, reduce: reduce),
+       IplImage.load(FILENAME_CAT, CV_LOAD_IMAGE_COLOR, reduce: reduce)].each { |mat|
+        assert_equal(width, mat.cols)
+        assert_equal(height, mat.rows)
+        assert_equal(3, mat.channel)
+        # Close to the resized full-size image
+        expected = full.resize(CvSize.new(width, height), CV_INTER_AREA)
+        assert((expected - mat).abs.avg.to_a[0, 3].all? { |v| v < 8 })
+      }
+      mat = CvMat.load(FILENAME_CAT, CV_LOAD_IMAGE_GRAYSCALE, reduce: reduce)
+      assert_equal([width, height, 1], [mat.cols, mat.rows, mat.channel])
+    }
+    assert_equal(IplImage, IplImage.decode(data, reduce: 2).class)
+    assert_equal(full.to_binary, CvMat.load(FILENAME_CAT, reduce: 1).to_binary)
+
+    assert_raise(ArgumentError) {
+      CvMat.load(FILENAME_CAT, reduce: 3)
+    }
+    assert_raise(ArgumentError) {
+      CvMat.decode(data, reduce: 16)
+    }
+  end
+
+  def test_probe
+    info = CvMat.probe(FILENAME_CAT)
+    assert_equal({ width: 375, height: 500, channels: 3, format: :jpeg }, info)
+
+    data = open(FILENAME_CAT, 'rb') { |f| f.read }
+    assert_equal(info, CvMat.probe_buffer(data))
+    assert_equal(info, CvMat.probe_buffer(data.unpack('c*')))
+
+    png = CvMat.load(FILENAME_LENA32x32, CV_LOAD_IMAGE_GRAYSCALE).encode_image('.png')
+    assert_equal({ width: 32, height: 32, channels: 1, format: :png }, CvMat.probe_buffer(png))
+    bmp = CvMat.load(FILENAME_LENA32x32).encode_image('.bmp')
+    assert_equal({ width: 32, height: 32, channels: 3, format: :bmp }, CvMat.probe_buffer(bmp))
+
+    assert_nil(CvMat.probe(__FILE__))
+    assert_nil(CvMat.probe_buffer('foobar'))
+    assert_equal({ width: 2147483647, height: 1, channels: 1, format: :pnm }, CvMat.probe_buffer("P5 2147483647 1 255\n"))
+    assert_nil(CvMat.probe_buffer("P5 2147483648 1 255\n"))
+    assert_nil(CvMat.probe_buffer("P6 32 99999999999999999999 255\n"))
+    assert_raise(SystemCallError) {
+      CvMat.probe('file/does/not/exist')
+    }
+    assert_raise(TypeError) {
+      CvMat.probe(DUMMY_OBJ)
+    }
+  end
+
+  def test_thumbnails
+    data = open(FILENAME_CAT, 'rb') { |f| f.read }
+    thumbnails = CvMat.thumbnails(data, [[40, 40], [160, 120, :fill], { width: 50, height: 50, mode: :crop },
+                                         CvSize.new(1000, 1000)])
+    assert_equal(4, thumbnails.size)
+    thumbnails.each { |thumbnail|
+      assert_equal(String, thumbnail.class)
+      assert_equal(Encoding::ASCII_8BIT, thumbnail.encoding)
+    }
+    sizes = thumbnails.map { |thumbnail|
+      mat = CvMat.decode(thumbnail)
+      [mat.cols, mat.rows]
+    }
+    assert_equal([[30, 40], [160, 213], [50, 50], [375, 500]], sizes)
+
+    # Compare with decode -> resize
+    expected = CvMat.load(FILENAME_CAT).resize(CvSize.new(30, 40), CV_INTER_AREA)
+    actual = CvMat.decode(thumbnails[0])
+    assert((expected - actual).abs.avg.to_a[0, 3].all? { |v| v < 12 })
+
+    pngs = CvMat.thumbnails(data.unpack('c*'), [[100, 100]], ext: '.png', mode: :crop,
+                            params: { CV_IMWRITE_PNG_COMPRESSION => 9 })
+    assert_equal({ width: 100, height: 100, channels: 3, format: :png }, CvMat.probe_buffer(pngs[0]))
+    assert_equal([], CvMat.thumbnails(data, []))
+
+    assert_raise(TypeError) {
+      CvMat.thumbnails(data, DUMMY_OBJ)
+    }
+    assert_raise(TypeError) {
+      CvMat.thumbnails(DUMMY_OBJ, [[10, 10]])
+    }
+    assert_raise(ArgumentError) {
+      CvMat.thumbnails(data, [[10, 0]])
+    }
+    assert_raise(ArgumentError) {
+      CvMat.thumbnails(data, [[10, 10, :stretch]])
+    }
+    assert_raise(ArgumentError) {
+      CvMat.thumbnails(data, [[10]])
+    }
+    assert_raise(ArgumentError) {
+      CvMat.thumbnails(data, [[10, 10]], ext: ".png\0")
+    }
+    ext = '.png'.dup
+    CvMat.thumbnails(data, [[10, 10]], ext: ext)
+    assert_false(ext.frozen?)
+    assert_equal('.png!', ext << '!')
+    assert_raise(CvStsBadArg) {
+      CvMat.thumbnails('foobar', [[10, 10]])
+    }
+    assert_raise(TypeError) {
+      CvMat.thumbnails(DUMMY_OBJ, [[10, 10]], params: { CV_IMWRITE_JPEG_QUALITY => 80 })
+    }
+    assert_raise(TypeError) {
+      CvMat.thumbnails(data, [[10, 10]], params: { CV_IMWRITE_JPEG_QUALITY => DUMMY_OBJ })
+    }
+    # The buffer is not left locked by the errors
+    data << ''
+  end
+
   def test_GOOD_FEATURES_TO_TRACK_OPTION
     assert_equal(0xff, CvMat::GOOD_FEATURES_TO_TRACK_OPTION[:max])
     assert_nil(CvMat::GOOD_FEATURES_TO_TRACK_OPTION[:mask])
@@ -294,6 +444,61 @@ class TestCvMat < OpenCVTestCase
     assert_equal(1, m.channel)
   end
 
+  def test_to_binary
+    m = create_cvmat(3, 4, :cv8u, 2) { |j, i, c| CvScalar.new(c, c + 100) }
+    bin = m.to_binary
+    assert_equal(Encoding::ASCII_8BIT, bin.encoding)
+    assert(bin.frozen?)
+    assert_equal(3 * 4 * 2, bin.bytesize)
+    assert_equal((0...12).map { |c| [c, c + 100] }.flatten, bin.unpack('C*'))
+    assert(m.continuous?)
+
+    sub = m.sub_rect(1, 1, 2, 2)
+    assert_false(sub.continuous?)
+    assert_equal([5, 105, 6, 106, 9, 109, 10, 110], sub.to_binary.unpack('C*'))
+
+    m = create_cvmat(2, 3, :cv32f, 1) { |j, i, c| CvScalar.new(c * 0.5) }
+    assert_equal([0, 0.5, 1.0, 1.5, 2.0, 2.5], m.to_binary.unpack('f*'))
+  end
+
+  def test_memory_view
+    return unless defined?(Fiddle::MemoryView)
+
+    m = create_cvmat(3, 4, :cv16s, 2) { |j, i, c| CvScalar.new(c, -c) }
+    view = Fiddle::MemoryView.new(m)
+    begin
+      assert_equal(3, view.ndim)
+      assert_equal([3, 4, 2], view.shape)
+      assert_equal([4 * 2 * 2, 2 * 2, 2], view.strides)
+      assert_equal('s', view.format)
+      assert_equal(2, view.item_size)
+      assert_equal(3 * 4 * 2 * 2, view.byte_size)
+      assert(view.readonly?)
+      assert_equal(m.to_binary, view.to_s)
+      assert_equal(6, view[1, 2, 0])
+      assert_equal(-6, view[1, 2, 1])
+    ensure
+      view.release
+    end
+
+    m = create_cvmat(2, 3, :cv64f, 1) { |j, i, c| CvScalar.new(c * 0.25) }
+    view = Fiddle::MemoryView.new(m)
+    begin
+      assert_equal([2, 3, 1], view.shape)
+      assert_equal([3 * 8, 8, 8], view.strides)
+      assert_equal('d', view.format)
+      assert_equal(1.25, view[1, 2, 0])
+    ensure
+      view.release
+    end
+
+    # A strided view such as sub_rect is exported only to consumers that accept strides
+    sub = create_cvmat(4, 4, :cv8u, 1).sub_rect(1, 1, 2, 2)
+    assert_raise(ArgumentError) {
+      Fiddle::MemoryView.new(sub)
+    }
+  end
+
   def test_clone
     m1 = create_cvmat(10, 20)
     m2 = m1.clone
@@ -692,6 +897,84 @@ class TestCvMat < OpenCVTestCase
     }
   end
 
+  def test_to_a
+    m = create_cvmat(2, 3, :cv8u, 3) { |j, i, c| CvScalar.new(c, c * 10, 255) }
+    assert_equal([0, 0, 255, 1, 10, 255, 2, 20, 255, 3, 30, 255, 4, 40, 255, 5, 50, 255], m.to_a)
+    assert_equal([0, 10, 20, 30, 40, 50], m.to_a(1))
+    assert_equal([3, 30, 255, 4, 40, 255, 5, 50, 255], m.row_to_a(1))
+    assert_equal([3, 4, 5], m.row_to_a(1, 0))
+    assert_equal([1, 10, 255, 2, 20, 255, 4, 40, 255, 5, 50, 255], m.pixels(CvRect.new(1, 0, 2, 2)))
+    assert_equal([255, 255], m.pixels(CvRect.new(2, 0, 1, 2), 2))
+    assert_equal(m.pixels(CvRect.new(1, 0, 2, 2)), m.sub_rect(1, 0, 2, 2).to_a)
+
+    m = create_cvmat(2, 2, :cv32f, 1) { |j, i, c| CvScalar.new(c * 0.5 - 1) }
+    a = m.to_a
+    assert_equal([Float] * 4, a.map(&:class))
+    assert_in_delta([-1.0, -0.5, 0.0, 0.5], a, 1.0e-5)
+
+    m = create_cvmat(1, 2, :cv32s, 1) { |j, i, c| CvScalar.new(c - 2**30) }
+    assert_equal([-2**30, 1 - 2**30], m.to_a)
+
+    assert_raise(ArgumentError) {
+      m.to_a(1)
+    }
+    assert_raise(ArgumentError) {
+      m.row_to_a(1)
+    }
+    assert_raise(ArgumentError) {
+      m.pixels(CvRect.new(1, 0, 2, 1))
+    }
+    assert_raise(TypeError) {
+      m.pixels(DUMMY_OBJ)
+    }
+  end
+
+  def test_memsize
+    require 'objspace'
+    m = CvMat.new(100, 200, :cv8u, 3)
+    assert(ObjectSpace.memsize_of(m) >= 100 * 200 * 3)
+    assert(ObjectSpace.memsize_of(m.sub_rect(0, 0, 10, 10)) < 100 * 200 * 3)
+    assert(ObjectSpace.memsize_of(IplImage.new(200, 100, :cv16u, 1)) >= 100 * 200 * 2)
+  end
+
+  def test_gather_scatter
+    m = create_cvmat(3, 4, :cv8u, 2) { |j, i, c| CvScalar.new(c * 10, 200 - c) }
+    v = m.gather([1, 0, 3, 2, 0, 1])
+    assert_equal([3, 1, :cv8u, 2], [v.rows, v.cols, v.depth, v.channel])
+    assert_equal([10, 199, 110, 189, 40, 196], v.to_a)
+    assert_equal(v.to_a, m.gather(CvMat.new(3, 2, :cv32s, 1).set_data([1, 0, 3, 2, 0, 1])).to_a)
+    assert_equal([10, 199], m.gather([0.6, 0.4]).to_a)
+
+    v = m.gather(CvMat.new(2, 1, :cv32f, 2).set_data([0.5, 0.0, 1.0, 0.5]), true)
+    assert_equal([2, 1, :cv32f, 2], [v.rows, v.cols, v.depth, v.channel])
+    assert_in_delta([5.0, 199.5, 30.0, 197.0], v.to_a, 1.0e-5)
+    assert_in_delta([110.0, 189.0], m.gather([3, 2], true).to_a, 1.0e-5)
+
+    assert_equal(m, m.scatter!([1, 0, 3, 2], [1, 2, 3, 4]))
+    assert_equal([1, 2, 3, 4], m.gather([1, 0, 3, 2]).to_a)
+    m.scatter!([0, 0], CvMat.new(1, 1, :cv8u, 2).set_data([5, 6]))
+    assert_equal([5, 6], m.gather([0, 0]).to_a)
+
+    assert_raise(ArgumentError) {
+      m.gather([4, 0])
+    }
+    assert_raise(ArgumentError) {
+      m.gather([3.5, 0], true)
+    }
+    assert_raise(ArgumentError) {
+      m.gather([1, 2, 3])
+    }
+    assert_raise(TypeError) {
+      m.gather(CvMat.new(1, 2, :cv8u, 1))
+    }
+    assert_raise(ArgumentError) {
+      m.scatter!([0, 0, 1, 1], CvMat.new(1, 1, :cv8u, 2))
+    }
+    assert_raise(TypeError) {
+      m.scatter!([0, 0], CvMat.new(1, 1, :cv32f, 2))
+    }
+  end
+
   def test_set_data
     [CV_8U, CV_8S, CV_16U, CV_16S, CV_32S].each { |depth|
       a = [10, 20, 30, 40, 50, 60]
@@ -725,6 +1008,47 @@ class TestCvMat < OpenCVTestCase
         m.set_data(a)
       }
     }
+
+    # Packed binary data
+    a = [0.5, 1.5, 2.5, 3.5, 4.5, 5.5]
+    m = CvMat.new(2, 3, CV_32F, 1)
+    m.set_data(a.pack('f*'))
+    (m.rows * m.cols).times { |i|
+      assert_in_delta(a[i], m[i][0], 1.0e-5)
+    }
+
+    m = create_cvmat(4, 4, :cv16u, 1) { |j, i, c| CvScalar.new(0) }
+    sub = m.sub_rect(1, 1, 2, 2)
+    sub.set_data([1, 2, 3, 4].pack('S*'))
+    assert_equal([0, 0, 0, 0, 0, 1, 2, 0, 0, 3, 4, 0, 0, 0, 0, 0], m.to_binary.unpack('S*'))
+
+    assert_raise(ArgumentError) {
+      CvMat.new(2, 3, CV_8U, 1).set_data("\x00" * 5)
+    }
+    assert_raise(TypeError) {
+      CvMat.new(2, 3, CV_8U, 1).set_data(DUMMY_OBJ)
+    }
+  end
+
+  def test_from_binary
+    m = CvMat.from_binary([1, 2, 3, 4, 5, 6].pack('s*'), 2, 3, CV_16S, 1)
+    assert_equal(CvMat, m.class)
+    assert_equal(2, m.rows)
+    assert_equal(3, m.cols)
+    assert_equal(:cv16s, m.depth)
+    assert_equal(1, m.channel)
+    assert_equal([1, 2, 3, 4, 5, 6], m.to_binary.unpack('s*'))
+
+    m = CvMat.from_binary((1..12).to_a.pack('C*'), 2, 2)
+    assert_equal(3, m.channel)
+    assert_cvscalar_equal(CvScalar.new(10, 11, 12, 0), m[1, 1])
+
+    img = IplImage.from_binary((1..12).to_a.pack('C*'), 2, 2, :cv8u, 3)
+    assert_equal(IplImage, img.class)
+
+    assert_raise(ArgumentError) {
+      CvMat.from_binary("\x00" * 5, 2, 3, CV_8U, 1)
+    }
   end
 
   def test_fill
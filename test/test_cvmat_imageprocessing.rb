@@ -416,6 +416,92 @@ class TestCvMat_imageprocessing < OpenCVTestCase
     #      ['nn', mat3], ['area', mat4], ['cubic', mat5] , ['lanczos4', mat6])
   end
 
+  def test_resize_in_threads
+    mat0 = CvMat.load(FILENAME_LENA256x256, CV_LOAD_IMAGE_ANYCOLOR | CV_LOAD_IMAGE_ANYDEPTH)
+    size = CvSize.new(384, 384)
+    expected = mat0.resize(size, CV_INTER_CUBIC).smooth(CV_GAUSSIAN, 5).to_binary
+    results = 4.times.map {
+      Thread.new { mat0.resize(size, CV_INTER_CUBIC).smooth(CV_GAUSSIAN, 5).to_binary }
+    }.map(&:value)
+    results.each { |r|
+      assert_equal(expected, r)
+    }
+
+    assert_raise_kind_of(CvError) {
+      Thread.new { mat0.filter2d(CvMat.new(1, 1, :cv8u, 3)) }.value
+    }
+  end
+
+  def test_out_destination
+    mat0 = CvMat.load(FILENAME_LENA256x256, CV_LOAD_IMAGE_ANYCOLOR | CV_LOAD_IMAGE_ANYDEPTH)
+    size = CvSize.new(128, 128)
+    dest = CvMat.new(128, 128, mat0.depth, mat0.channel)
+    assert_same(dest, mat0.resize(size, CV_INTER_AREA, out: dest))
+    assert_equal(mat0.resize(size, CV_INTER_AREA).to_binary, dest.to_binary)
+
+    dest = CvMat.new(mat0.rows, mat0.cols, mat0.depth, mat0.channel)
+    assert_same(dest, mat0.smooth(CV_GAUSSIAN, 5, out: dest))
+    assert_equal(mat0.smooth(CV_GAUSSIAN, 5).to_binary, dest.to_binary)
+    assert_same(dest, mat0.smooth_median(3, out: dest))
+    assert_equal(mat0.smooth_median(3).to_binary, dest.to_binary)
+
+    gray = CvMat.new(mat0.rows, mat0.cols, :cv8u, 1)
+    assert_same(gray, mat0.BGR2GRAY(out: gray))
+    assert_equal(mat0.BGR2GRAY.to_binary, gray.to_binary)
+    assert_same(gray, OpenCV.BGR2GRAY(mat0, out: gray))
+
+    binary = CvMat.new(mat0.rows, mat0.cols, :cv8u, 1)
+    assert_same(binary, gray.threshold(128, 255, :binary, out: binary))
+    assert_equal(gray.threshold(128, 255, :binary).to_binary, binary.to_binary)
+    result, thresh = gray.threshold(0, 255, :binary, true, out: binary)
+    assert_same(binary, result)
+    assert(thresh > 0)
+
+    edges = CvMat.new(mat0.rows, mat0.cols, :cv16s, 1)
+    assert_same(edges, gray.sobel(1, 0, out: edges))
+    assert_same(binary, gray.canny(50, 200, out: binary))
+    assert_same(binary, gray.equalize_hist(out: binary))
+    half = CvMat.new(mat0.rows / 2, mat0.cols / 2, :cv8u, 1)
+    assert_same(half, gray.pyr_down(out: half))
+
+    kernel = CvMat.new(3, 3, :cv32f, 1).set_data([0, 0, 0, 0, 1, 0, 0, 0, 0])
+    assert_same(dest, mat0.filter2d(kernel, out: dest))
+    assert_equal(mat0.to_binary, dest.to_binary)
+
+    map_matrix = CvMat.rotation_matrix2D(CvPoint2D32f.new(128, 128), 90, 1)
+    assert_same(dest, mat0.warp_affine(map_matrix, out: dest))
+    assert_equal(mat0.warp_affine(map_matrix).to_binary, dest.to_binary)
+
+    # Mismatched destinations are rejected before processing
+    assert_raise(ArgumentError) {
+      mat0.resize(size, out: CvMat.new(64, 64, mat0.depth, mat0.channel))
+    }
+    assert_raise(ArgumentError) {
+      mat0.smooth(CV_GAUSSIAN, 5, out: CvMat.new(mat0.rows, mat0.cols, :cv32f, mat0.channel))
+    }
+    assert_raise(ArgumentError) {
+      mat0.BGR2GRAY(out: CvMat.new(mat0.rows, mat0.cols, :cv8u, 3))
+    }
+    assert_raise(ArgumentError) {
+      mat0.smooth_blur(out: mat0)
+    }
+    # Overlapping views of the same matrix are rejected, disjoint ones are accepted
+    wide = CvMat.new(10, 20, :cv8u, 1)
+    left = wide.sub_rect(0, 0, 10, 10)
+    assert_raise(ArgumentError) {
+      left.smooth_blur(out: wide.sub_rect(5, 0, 10, 10))
+    }
+    assert_raise(ArgumentError) {
+      wide.sub_rect(0, 1, 10, 9).smooth_blur(out: wide.sub_rect(1, 0, 10, 9))
+    }
+    top = wide.sub_rect(0, 0, 20, 5)
+    bottom = wide.sub_rect(0, 5, 20, 5)
+    assert_same(bottom, top.smooth_blur(out: bottom))
+    assert_raise(TypeError) {
+      mat0.smooth_blur(out: DUMMY_OBJ)
+    }
+  end
+
   def test_warp_affine
     mat0 = CvMat.load(FILENAME_LENA256x256, CV_LOAD_IMAGE_ANYCOLOR | CV_LOAD_IMAGE_ANYDEPTH)
     map_matrix = CvMat.new(2, 3, :cv32f, 1)
@@ -0,0 +1,206 @@
+#!/usr/bin/env ruby
+# -*- mode: ruby; coding: utf-8 -*-
+require 'test/unit'
+require 'opencv'
+require File.expand_path(File.dirname(__FILE__)) + '/helper'
+
+include OpenCV
+
+# Tests for OpenCV::CvPipeline
+class TestCvPipeline < OpenCVTestCase
+  FILENAME_LENA256x256 = File.expand_path(File.dirname(__FILE__)) + '/samples/lena-256x256.jpg'
+
+  def setup
+    @mat0 = CvMat.load(FILENAME_LENA256x256, CV_LOAD_IMAGE_COLOR)
+  end
+
+  def test_initialize
+    pipeline = CvPipeline.new
+    assert_equal(CvPipeline, pipeline.class)
+    assert_equal(0, pipeline.size)
+    assert_equal([], pipeline.operations)
+
+    pipeline = CvPipeline.new { |p|
+      p.cvt_color(:BGR2GRAY).pyr_down
+    }
+    assert_equal(2, pipeline.size)
+    assert_equal([[:cvt_color, :BGR2GRAY], [:pyr_down]], pipeline.operations)
+  end
+
+  def test_run
+    size = CvSize.new(128, 128)
+    pipeline = CvPipeline.new.cvt_color(:BGR2GRAY).resize(size, CV_INTER_AREA).
+      smooth(CV_GAUSSIAN, 5).threshold(128, 255, CV_THRESH_BINARY)
+    expected = @mat0.BGR2GRAY.resize(size, CV_INTER_AREA).smooth(CV_GAUSSIAN, 5).
+      threshold(128, 255, CV_THRESH_BINARY)
+
+    2.times {
+      result = pipeline.run(@mat0)
+      assert_equal(CvMat, result.class)
+      assert_equal(expected.to_binary, result.to_binary)
+    }
+    assert_equal(expected.to_binary, pipeline.call(@mat0).to_binary)
+
+    # Other input sizes
+    mat1 = @mat0.resize(CvSize.new(64, 32))
+    assert_equal(mat1.BGR2GRAY.resize(size, CV_INTER_AREA).smooth(CV_GAUSSIAN, 5).
+                 threshold(128, 255, CV_THRESH_BINARY).to_binary, pipeline.run(mat1).to_binary)
+
+    # Depth changing operations
+    gray = @mat0.BGR2GRAY
+    pipeline = CvPipeline.new.smooth(:blur, 3, 3).sobel(1, 0)
+    assert_equal(gray.smooth(:blur, 3, 3).sobel(1, 0).to_binary, pipeline.run(gray).to_binary)
+    assert_equal(:cv16s, pipeline.run(gray).depth)
+
+    kernel = CvMat.new(3, 3, :cv32f, 1).set_data([0, -1, 0, -1, 5, -1, 0, -1, 0])
+    map_matrix = CvMat.rotation_matrix2D(CvPoint2D32f.new(128, 128), 30, 1)
+    element = IplConvKernel.new(3, 3, 1, 1, :rect)
+    pipeline = CvPipeline.new.filter2d(kernel).warp_affine(map_matrix).pyr_down.pyr_up.
+      erode(element).dilate.morphology(CV_MOP_GRADIENT, element).equalize_hist
+    expected = gray.filter2d(kernel).warp_affine(map_matrix).pyr_down.pyr_up.
+      erode(element).dilate.morphology(CV_MOP_GRADIENT, element).equalize_hist
+    assert_equal(expected.to_binary, pipeline.run(gray).to_binary)
+
+    # IplImage input gives IplImage output
+    image = IplImage.load(FILENAME_LENA256x256, CV_LOAD_IMAGE_GRAYSCALE)
+    result = CvPipeline.new.canny(50, 200).run(image)
+    assert_equal(IplImage, result.class)
+    assert_equal(image.canny(50, 200).to_binary, result.to_binary)
+
+    # Empty pipeline copies the input
+    result = CvPipeline.new.run(@mat0)
+    assert_equal(@mat0.to_binary, result.to_binary)
+
+    assert_raise(TypeError) {
+      CvPipeline.new.run(DUMMY_OBJ)
+    }
+  end
+
+  def test_run_out
+    pipeline = CvPipeline.new.cvt_color(:BGR2GRAY).pyr_down
+    dest = CvMat.new(128, 128, :cv8u, 1)
+    assert_same(dest, pipeline.run(@mat0, out: dest))
+    assert_equal(@mat0.BGR2GRAY.pyr_down.to_binary, dest.to_binary)
+
+    assert_raise(ArgumentError) {
+      pipeline.run(@mat0, out: CvMat.new(256, 256, :cv8u, 1))
+    }
+    assert_raise(ArgumentError) {
+      pipeline.run(@mat0, out: CvMat.new(128, 128, :cv8u, 3))
+    }
+  end
+
+  def test_run_error
+    # Errors of the input are raised before processing
+    assert_raise(ArgumentError) {
+      CvPipeline.new.cvt_color(:BGR2GRAY).run(@mat0.BGR2GRAY)
+    }
+    assert_raise(ArgumentError) {
+      CvPipeline.new.sobel(1, 0).run(CvMat.new(16, 16, :cv16u, 1))
+    }
+    assert_raise(NotImplementedError) {
+      CvPipeline.new.smooth(:blur_no_scale).run(CvMat.new(16, 16, :cv16u, 1))
+    }
+  end
+
+  def test_batch
+    size = CvSize.new(64, 64)
+    images = [@mat0, @mat0.resize(CvSize.new(128, 100)), @mat0.BGR2GRAY, @mat0.flip(:x)]
+    pipeline = CvPipeline.new.cvt_color(:BGR2GRAY).resize(size, CV_INTER_AREA).smooth(CV_GAUSSIAN, 3)
+
+    [1, 3, 8].each { |threads|
+      results = pipeline.batch(images, threads: threads)
+      assert_equal(images.size, results.size)
+      [0, 1, 3].each { |i|
+        expected = images[i].BGR2GRAY.resize(size, CV_INTER_AREA).smooth(CV_GAUSSIAN, 3)
+        assert_equal(expected.to_binary, results[i].to_binary)
+      }
+      # Errors are returned per image
+      assert_equal(ArgumentError, results[2].class)
+    }
+    assert_equal(4, pipeline.batch(images).size)
+    assert_equal([], pipeline.batch([]))
+
+    results = CvMat.batch(images, threads: 2) { |p|
+      p.cvt_color(:BGR2GRAY).resize(size, CV_INTER_AREA).smooth(CV_GAUSSIAN, 3)
+    }
+    assert_equal(pipeline.batch(images).map(&:class), results.map(&:class))
+    assert_equal(pipeline.run(images[1]).to_binary, results[1].to_binary)
+
+    results = CvMat.batch([@mat0, DUMMY_OBJ], pipeline: CvPipeline.new.pyr_down)
+    assert_equal(@mat0.pyr_down.to_binary, results[0].to_binary)
+    assert_equal(TypeError, results[1].class)
+
+    assert_raise(ArgumentError) {
+      pipeline.batch(images, threads: 0)
+    }
+    assert_raise(TypeError) {
+      pipeline.batch(DUMMY_OBJ)
+    }
+    assert_raise(TypeError) {
+      CvMat.batch(images, pipeline: DUMMY_OBJ)
+    }
+    assert_raise(ArgumentError) {
+      CvMat.batch(images, pipeline: pipeline) { |p| p.pyr_down }
+    }
+  end
+
+  def test_batch_encode
+    pipeline = CvPipeline.new.resize(CvSize.new(64, 48), CV_INTER_AREA)
+    params = { CV_IMWRITE_JPEG_QUALITY => 80 }
+    results = pipeline.batch([@mat0, @mat0.BGR2GRAY, DUMMY_OBJ], threads: 2, encode: '.jpg', params: params)
+    assert_equal(3, results.size)
+    [@mat0, @mat0.BGR2GRAY].each_with_index { |mat, i|
+      assert_equal(Encoding::ASCII_8BIT, results[i].encoding)
+      assert_equal(pipeline.run(mat).encode_binary('.jpg', params), results[i])
+    }
+    assert_equal(TypeError, results[2].class)
+
+    results = CvMat.batch([@mat0], encode: '.png') { |p| p.pyr_down }
+    assert_equal(@mat0.pyr_down.encode_binary('.png'), results[0])
+
+    assert_raise(TypeError) {
+      pipeline.batch([@mat0], encode: DUMMY_OBJ)
+    }
+  end
+
+  def test_batch_interrupt
+    pipeline = CvPipeline.new.smooth(CV_GAUSSIAN, 15).smooth(CV_GAUSSIAN, 15)
+    images = [@mat0] * 1000
+    queue = Queue.new
+    thread = Thread.new {
+      queue << :started
+      pipeline.batch(images, threads: 1)
+    }
+    queue.pop
+    thread.raise(Interrupt)
+    result = begin
+               thread.value
+             rescue Interrupt
+               :interrupted
+             end
+    # The batch stops between images (unless it has already finished), and can be run again
+    assert(result == :interrupted || result.size == images.size)
+    assert_equal(pipeline.run(@mat0).to_binary, pipeline.batch([@mat0])[0].to_binary)
+  end
+
+  def test_record_error
+    pipeline = CvPipeline.new
+    assert_raise(ArgumentError) {
+      pipeline.cvt_color(:FOO2BAR)
+    }
+    assert_raise(TypeError) {
+      pipeline.cvt_color(DUMMY_OBJ)
+    }
+    assert_raise(ArgumentError) {
+      pipeline.threshold(128, 255, :foobar)
+    }
+    assert_raise(TypeError) {
+      pipeline.filter2d(DUMMY_OBJ)
+    }
+    assert_raise(TypeError) {
+      pipeline.erode(DUMMY_OBJ)
+    }
+    assert_equal(0, pipeline.size)
+  end
+end
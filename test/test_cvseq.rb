@@ -73,6 +73,27 @@ class TestCvSeq < OpenCVTestCase
     assert_equal(30, seq2[2])
   end
 
+  def test_aref_keeps_sequence
+    seq = CvSeq.new(CV_SEQ_ELTYPE_POINT).push(CvPoint.new(10, 20), CvPoint.new(30, 40))
+    pt1 = seq[1]
+    pt2 = seq[1]
+    seq = nil
+    pt1 = nil
+    GC.start
+    assert_equal(30, pt2.x)
+    assert_equal(40, pt2.y)
+  end
+
+  def test_root_survives_compaction
+    seq = CvSeq.new(CvPoint).push(CvPoint.new(10, 20)).freeze
+    pt = seq[0]
+    seq = nil
+    GC.start
+    GC.compact if GC.respond_to?(:compact)
+    assert_equal(10, pt.x)
+    assert_equal(20, pt.y)
+  end
+
   def test_push
     seq1 = CvSeq.new(CV_SEQ_ELTYPE_POINT).push(CvPoint.new(10, 20), CvPoint.new(30, 40))
     
@@ -50,9 +50,133 @@ class TestCvVideoWriter < OpenCVTestCase
     }
   end
 
+  def test_async
+    img = IplImage.load(FILENAME_LENA256x256)
+    vw = CvVideoWriter.new(OUTPUT_FILENAME, 'MJPG', 15, CvSize.new(256, 256))
+    assert_false(vw.async?)
+    assert_nil(vw.async_stats)
+    assert_equal(vw, vw.async(2))
+    assert(vw.async?)
+    10.times { vw.write img }
+    owned = img.clone
+    vw.write(owned, own: true)
+    assert_equal([1, 1], [owned.width, owned.height])
+
+    # The data of an image with a view is copied, so the view stays valid
+    shared = img.clone
+    view = shared.sub_rect(0, 0, 16, 16)
+    vw.write(shared, own: true)
+    assert_equal([256, 256], [shared.width, shared.height])
+    assert_equal(img.sub_rect(0, 0, 16, 16).to_binary, view.to_binary)
+    assert_equal(vw, vw.flush)
+    stats = vw.async_stats
+    assert_equal(0, stats[:depth])
+    assert_equal(2, stats[:capacity])
+    assert_equal(12, stats[:written])
+    assert_equal(0, stats[:dropped])
+    vw.close
+    assert_false(vw.async?)
+    assert_equal(12, CvCapture.open(OUTPUT_FILENAME).frame_count.to_i)
+
+    CvVideoWriter.new(OUTPUT_FILENAME, 'MJPG', 15, CvSize.new(256, 256)) { |vw|
+      vw.async(1, drop: true)
+      10.times { vw.write img }
+      vw.flush
+      stats = vw.async_stats
+      assert_equal(10, stats[:written] + stats[:dropped])
+    }
+
+    assert_raise(ArgumentError) {
+      CvVideoWriter.new(OUTPUT_FILENAME, 'MJPG', 15, CvSize.new(256, 256)).async(0)
+    }
+    assert_raise(TypeError) {
+      CvVideoWriter.new(OUTPUT_FILENAME, 'MJPG', 15, CvSize.new(256, 256)) { |vw|
+        vw.async.write DUMMY_OBJ
+      }
+    }
+  end
+
+  def test_async_gc
+    filename = 'async_gc_test.avi'
+    img = IplImage.load(FILENAME_LENA256x256)
+    # Writers dropped with queued frames are released without encoding them in GC
+    3.times {
+      vw = CvVideoWriter.new(filename, 'MJPG', 15, CvSize.new(256, 256))
+      vw.async(4)
+      4.times { vw.write img }
+    }
+    GC.start
+    assert(true)
+  ensure
+    File.delete filename if File.exists? filename
+  end
+
+  def test_native
+    img = IplImage.load(FILENAME_LENA256x256)
+    %w(y4m mjpeg avi).each { |ext|
+      filename = "videowriter_result_native.#{ext}"
+      begin
+        CvVideoWriter.new(filename, 'MJPG', 30000.0 / 1001, CvSize.new(256, 256), native: true, quality: 90) { |vw|
+          5.times { vw.write img }
+        }
+        cap = CvCapture.open(filename, native: true)
+        assert_equal(256, cap.width)
+        assert_equal(256, cap.height)
+        assert_in_delta(ext == 'mjpeg' ? 25 : 29.97, cap.fps, 0.01)
+        frames = 0
+        while (frame = cap.query)
+          assert_equal([256, 256], [frame.width, frame.height])
+          frames += 1
+        end
+        assert_equal(5, frames)
+        cap.close
+      ensure
+        File.delete filename if File.exists? filename
+      end
+    }
+
+    filename = 'videowriter_result_native.y4m'
+    CvVideoWriter.new(filename, nil, 25, CvSize.new(256, 256), false) { |vw| vw.write img }
+    assert_match(/\AYUV4MPEG2 W256 H256 F25:1 .*Cmono/, File.binread(filename, 64))
+    File.delete filename
+
+    CvVideoWriter.new(OUTPUT_FILENAME, nil, 25, CvSize.new(256, 256), format: :mjpeg) { |vw| vw.write img }
+    assert_equal("\xFF\xD8".b, File.binread(OUTPUT_FILENAME, 2))
+
+    assert_raise(ArgumentError) {
+      CvVideoWriter.new(OUTPUT_FILENAME, 'MJPG', 15, CvSize.new(256, 256), format: :mkv)
+    }
+    assert_raise(ArgumentError) {
+      CvVideoWriter.new(OUTPUT_FILENAME, 'MJPG', 15, CvSize.new(256, 256), quality: 101)
+    }
+    assert_raise(CvStsUnmatchedSizes) {
+      CvVideoWriter.new(filename, nil, 25, CvSize.new(320, 240)) { |vw| vw.write img }
+    }
+  ensure
+    File.delete filename if filename and File.exists? filename
+  end
+
   def test_close
     vw = CvVideoWriter.new(OUTPUT_FILENAME, 'MJPG', 15, CvSize.new(320, 240))
     vw.close
+    assert_raise(IOError) {
+      vw.write(IplImage.new(320, 240, :cv8u, 3))
+    }
+
+    # A write racing with close is not queued after the encoder thread has stopped
+    img = IplImage.load(FILENAME_LENA256x256)
+    vw = CvVideoWriter.new(OUTPUT_FILENAME, 'MJPG', 15, CvSize.new(256, 256)).async(2)
+    writer = Thread.new {
+      begin
+        loop { vw.write(img) }
+      rescue IOError
+        :closed
+      end
+    }
+    sleep 0.05
+    vw.close
+    assert_equal(:closed, writer.value)
+    assert_false(vw.async?)
   end
 end
 
@@ -0,0 +1,110 @@
+#!/usr/bin/env ruby
+# -*- mode: ruby; coding: utf-8 -*-
+require 'test/unit'
+require 'opencv'
+require File.expand_path(File.dirname(__FILE__)) + '/helper'
+
+include OpenCV
+
+# Tests for OpenCV::ImageLoader
+class TestImageLoader < OpenCVTestCase
+  SAMPLES_DIR = File.expand_path(File.dirname(__FILE__)) + '/samples'
+  FILENAMES = %w(lena-256x256.jpg lena-32x32.jpg baboon200.jpg fruits.jpg cat.jpg).map { |f|
+    File.join(SAMPLES_DIR, f)
+  }
+
+  def test_initialize
+    loader = ImageLoader.new(FILENAMES)
+    assert_equal(FILENAMES, loader.paths)
+    assert_equal(FILENAMES.size, loader.size)
+
+    loader = ImageLoader.new(SAMPLES_DIR, glob: 'blank*.jpg')
+    assert_equal(Dir.glob(File.join(SAMPLES_DIR, 'blank*.jpg')).sort, loader.paths)
+
+    assert_raise(ArgumentError) {
+      ImageLoader.new(FILENAMES[0])
+    }
+    assert_raise(TypeError) {
+      ImageLoader.new([DUMMY_OBJ])
+    }
+    assert_raise(ArgumentError) {
+      ImageLoader.new(FILENAMES, reduce: 3)
+    }
+    assert_raise(ArgumentError) {
+      ImageLoader.new(FILENAMES, threads: 0)
+    }
+    assert_raise(ArgumentError) {
+      ImageLoader.new(FILENAMES, queue: 0)
+    }
+    assert_raise(ArgumentError) {
+      ImageLoader.new(FILENAMES, image_class: String)
+    }
+  end
+
+  def test_each
+    [[1, 1], [2, 1], [4, 8]].each { |threads, queue|
+      paths = []
+      ImageLoader.new(FILENAMES, threads: threads, queue: queue).each { |image, path|
+        assert_equal(CvMat, image.class)
+        assert_equal(CvMat.load(path).to_binary, image.to_binary)
+        paths << path
+      }
+      assert_equal(FILENAMES, paths)
+    }
+
+    loader = ImageLoader.new(FILENAMES, grayscale: true, image_class: IplImage)
+    loader.each { |image, path|
+      assert_equal(IplImage, image.class)
+      assert_equal(IplImage.load(path, CV_LOAD_IMAGE_GRAYSCALE).to_binary, image.to_binary)
+    }
+
+    # Stopping in the middle
+    count = 0
+    loader = ImageLoader.new(FILENAMES * 4, threads: 2, queue: 2)
+    loader.each { |image, path|
+      count += 1
+      break if count == 3
+    }
+    assert_equal(3, count)
+    assert_equal(FILENAMES.size * 4, loader.each.to_a.size)
+
+    # Unreadable files are passed as errors
+    results = ImageLoader.new([FILENAMES[0], 'not_exist.jpg', FILENAMES[1]]).images
+    assert_equal(3, results.size)
+    assert_equal(CvMat, results[0].class)
+    assert_equal(StandardError, results[1].class)
+    assert_equal(CvMat, results[2].class)
+  end
+
+  def test_reduce
+    image = CvMat.load(FILENAMES[0])
+    [2, 4, 8].each { |reduce|
+      reduced = ImageLoader.new([FILENAMES[0]], reduce: reduce).images[0]
+      assert_equal((image.width + reduce - 1) / reduce, reduced.width)
+      assert_equal((image.height + reduce - 1) / reduce, reduced.height)
+    }
+  end
+
+  def test_load_images
+    images = CvMat.load_images(FILENAMES, threads: 2)
+    assert_equal(FILENAMES.size, images.size)
+    FILENAMES.zip(images).each { |path, image|
+      assert_equal(CvMat.load(path).to_binary, image.to_binary)
+    }
+
+    paths = []
+    IplImage.load_images(FILENAMES, grayscale: true) { |image, path|
+      assert_equal(IplImage, image.class)
+      assert_equal(1, image.channel)
+      paths << path
+    }
+    assert_equal(FILENAMES, paths)
+
+    # Subclasses get their own class, as CvMat.load
+    mat_class = Class.new(CvMat)
+    ipl_class = Class.new(IplImage)
+    assert_equal([mat_class], mat_class.load_images(FILENAMES[0, 1]).map(&:class))
+    assert_equal([ipl_class], ipl_class.load_images(FILENAMES[0, 1]).map(&:class))
+    assert_equal(mat_class.load(FILENAMES[0]).class, mat_class.load_images(FILENAMES[0, 1])[0].class)
+  end
+end
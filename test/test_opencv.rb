@@ -355,6 +355,45 @@ class TestOpenCV < OpenCVTestCase
     assert_equal(String, s.class)
     assert(s =~ /^\s+General configuration for OpenCV #{CV_VERSION}/)
   end
+
+  def test_buffer_pool
+    assert_equal(0, OpenCV.buffer_pool_limit)
+    OpenCV.buffer_pool_limit = 1024 * 1024
+    assert_equal(1024 * 1024, OpenCV.buffer_pool_limit)
+
+    # CvMat#morphology(:gradient) releases its temporary matrix explicitly
+    mat = CvMat.new(100, 100, :cv8u, 3).set_data([1] * 30000)
+    dest = mat.clone
+    before = OpenCV.buffer_pool_stats
+    3.times { mat.morphology(:gradient, nil, 1, out: dest) }
+    stats = OpenCV.buffer_pool_stats
+    assert_equal(1024 * 1024, stats[:limit])
+    assert_equal(before[:misses] + 1, stats[:misses])
+    assert_equal(before[:hits] + 2, stats[:hits])
+    assert_equal(before[:returned] + 3, stats[:returned])
+    assert_equal(1, stats[:cached_buffers])
+    assert(stats[:cached_bytes] <= 1024 * 1024)
+
+    # A buffer which was not allocated from the pool is not taken by it
+    OpenCV.clear_buffer_pool
+    before = OpenCV.buffer_pool_stats
+    mat.encode_image('.png')
+    assert_equal(before[:returned], OpenCV.buffer_pool_stats[:returned])
+
+    m = CvMat.new(100, 100, :cv8u, 3).set_data([1] * 30000)
+    assert_equal([1] * 30000, m.to_a)
+
+    OpenCV.clear_buffer_pool
+    stats = OpenCV.buffer_pool_stats
+    assert_equal(0, stats[:cached_bytes])
+    assert_equal(0, stats[:cached_buffers])
+
+    assert_raise(ArgumentError) {
+      OpenCV.buffer_pool_limit = -1
+    }
+  ensure
+    OpenCV.buffer_pool_limit = 0
+  end
 end
 
 